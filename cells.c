@@ -0,0 +1,208 @@
+/*
+ *	cells.c --
+ *		Identify storm cells in a volume. See sigmet_raw (1).
+ *	--
+ *
+ *	Usage: cells [-3] [-n min_gates] [-a num_az] data_type threshold sweep_index|all
+ *		raw_product_file
+ *
+ *	Finds connected regions of gates with data_type values at or above threshold, after
+ *	resampling sweeps to num_az azimuth cells, default 720. Cells are found in each sweep, or
+ *	with -3, across sweeps, which should then be in order of elevation. Cells with fewer than
+ *	min_gates gates, default 1, are ignored. Prints one line per cell with first and last
+ *	sweep, gate count, area in square kilometers, volume in cubic kilometers, centroid in
+ *	kilometers east, north, and above the radar, maximum value, and the azimuth in degrees and
+ *	range in kilometers of the maximum.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <libgen.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define DEG_PER_RAD ((double)57.29577951308232087648)
+#define DFLT_NUM_AZ 720
+#define CELL_FMT "%2u %2u %8u %10.3f %10.3f %8.2f %8.2f %6.2f %7.1f %6.1f %7.2f\n"
+
+int main(int argc, char *argv[])
+{
+    /* If set, use $APP_NAME in error messages instead of argv[0]. */
+    char *cmd = getenv("APP_NAME") ? getenv("APP_NAME") : basename(argv[0]);
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    struct SigmetRaw_CellsCfg cfg = { .min_gates = 1, .three_d = 0 };
+    unsigned num_az = DFLT_NUM_AZ;
+    int a = 1;
+    while (a < argc && argv[a][0] == '-') {
+	if (strcmp(argv[a], "-3") == 0) {
+	    cfg.three_d = 1;
+	    a++;
+	} else if (strcmp(argv[a], "-n") == 0 && a + 1 < argc) {
+	    if (sscanf(argv[a + 1], "%u", &cfg.min_gates) != 1) {
+		fprintf(stderr, "%s: expected integer for minimum gate count, got %s\n",
+			cmd, argv[a + 1]);
+		exit(EXIT_FAILURE);
+	    }
+	    a += 2;
+	} else if (strcmp(argv[a], "-a") == 0 && a + 1 < argc) {
+	    if (sscanf(argv[a + 1], "%u", &num_az) != 1
+		    || num_az == 0 || num_az > SIGMETRAW_AZGRID_MAX_AZ) {
+		fprintf(stderr, "%s: expected azimuth count 1 to %d, got %s\n",
+			cmd, SIGMETRAW_AZGRID_MAX_AZ, argv[a + 1]);
+		exit(EXIT_FAILURE);
+	    }
+	    a += 2;
+	} else {
+	    break;
+	}
+    }
+    if (argc - a != 4) {
+	fprintf(stderr, "Usage: %s [-3] [-n min_gates] [-a num_az] data_type threshold "
+		"sweep_index|all raw_product_file\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    char * abbrv = argv[a];
+    char * thresh_s = argv[a + 1];
+    char * s_s = argv[a + 2];
+    char * path = argv[a + 3];
+    const struct Sigmet_DataType * type = Sigmet_DataTypeGet(abbrv);
+    if (type == NULL) {
+	fprintf(stderr, "%s: %s is not a Sigmet data type.\n", cmd, abbrv);
+	exit(EXIT_FAILURE);
+    }
+    if (sscanf(thresh_s, "%f", &cfg.thresh) != 1) {
+	fprintf(stderr, "%s: expected number for threshold, got %s\n", cmd, thresh_s);
+	exit(EXIT_FAILURE);
+    }
+    int s = -1;				/* -1 => all */
+    if (strcmp(s_s, "all") != 0 && sscanf(s_s, "%d", &s) != 1) {
+	fprintf(stderr, "%s: expected integer or \"all\" for sweep index, got %s\n", cmd, s_s);
+	exit(EXIT_FAILURE);
+    }
+
+    /* Read volume */
+    FILE * vol_fl = fopen(path, "r");
+    if (vol_fl == NULL) {
+	fprintf(stderr, "%s: could not open file. %s\n", cmd, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    struct Sigmet_VolHdr vol_hdr;
+    memset(&vol_hdr, 0, sizeof vol_hdr);
+    if ( !Sigmet_VolReadVHdr(vol_fl, &vol_hdr, &err_msg) ) {
+	fclose(vol_fl);
+	fprintf(stderr, "%s: could not read volume headers from %s. %s\n", cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    int num_swps = Sigmet_VolNumSwps(&vol_hdr);
+    if (s < -1 || s >= num_swps) {
+	fprintf(stderr, "%s: sweep index %d out of range. Volume has %d sweeps.\n",
+		cmd, s, num_swps);
+	exit(EXIT_FAILURE);
+    }
+    int num_rays = Sigmet_VolNumRays(&vol_hdr);
+    int num_types = Sigmet_VolNumTypes(&vol_hdr);
+    int y = Sigmet_VolTypeIdx(type, &vol_hdr);
+    if (y == -1) {
+	fprintf(stderr, "%s: %s data type is not in volume at %s.\n", cmd, abbrv, path);
+	exit(EXIT_FAILURE);
+    }
+    struct Sigmet_SwpHdr * swp_hdrs = calloc(num_swps, sizeof *swp_hdrs);
+    struct Sigmet_Ray (*rays)[num_rays][num_types] = calloc(num_swps, sizeof *rays);
+    if (swp_hdrs == NULL || rays == NULL) {
+	fprintf(stderr, "%s could not allocate memory for array of  %d by %d ray structures "
+		"from raw product file %s\n", cmd, num_swps, num_rays, path);
+	exit(EXIT_FAILURE);
+    }
+    size_t dat_buf_sz = Sigmet_VolIDatSz(&vol_hdr, &err_msg);
+    if (dat_buf_sz == 0) {
+	fprintf(stderr, "%s: could not determine size of input data buffer. %s\n", cmd, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    void * dat_buf = malloc(dat_buf_sz);
+    if (dat_buf == NULL) {
+	fprintf(stderr, "%s: could not allocate memory for %zu bytes of data.\n", cmd, dat_buf_sz);
+	exit(EXIT_FAILURE);
+    }
+    int rd = Sigmet_VolReadDat(vol_fl, &vol_hdr, num_swps, num_rays, num_types, swp_hdrs,
+	    rays, dat_buf_sz, dat_buf, &err_msg);
+    fclose(vol_fl);
+    if (rd == 0) {
+	fprintf(stderr, "%s: volume at %s has no data. %s\n", cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+
+    /* Geometry. Raw product gives ranges in centimeters. */
+    const struct Sigmet_TaskRngInfo * rng_info = &vol_hdr.ingst_hdr.task_cfg.task_rng_info;
+    cfg.rng0 = rng_info->rng_1st_bin * 0.01f;
+    cfg.drng = rng_info->step_out * 0.01f;
+    cfg.beam_width = Sigmet_Bin4Rad(vol_hdr.ingst_hdr.task_cfg.task_misc_info.vert_beam_width);
+    int num_bins = Sigmet_VolNumBins(&vol_hdr);
+
+    /* Resample the sweeps to a stack of regular azimuth grids */
+    int s0 = (s == -1) ? 0 : s, s1 = (s == -1) ? num_swps : s + 1;
+    unsigned n_swps = s1 - s0;
+    size_t swp_sz = (size_t)num_az * num_bins;
+    float * grid = malloc(n_swps * swp_sz * sizeof *grid);
+    double * tilts = malloc(n_swps * sizeof *tilts);
+    struct Sigmet_RayHdr * ray_hdrs = calloc(num_rays, sizeof *ray_hdrs);
+    const float ** dat = calloc(num_rays, sizeof *dat);
+    float * vals = calloc((size_t)num_rays * num_bins, sizeof *vals);
+    if (grid == NULL || tilts == NULL || ray_hdrs == NULL || dat == NULL || vals == NULL) {
+	fprintf(stderr, "%s: could not allocate memory for %u sweeps.\n", cmd, n_swps);
+	exit(EXIT_FAILURE);
+    }
+    struct SigmetRaw_AzGrid * az_grid = SigmetRaw_AzGridInit(num_az, SigmetRawAzGridNearest,
+	    &err_msg);
+    if (az_grid == NULL) {
+	fprintf(stderr, "%s: could not create resampler. %s\n", cmd, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    for (int ss = s0; ss < s1; ss++) {
+	float * v = vals;
+	for (int r = 0; r < num_rays; r++) {
+	    struct Sigmet_Ray * ray = &rays[ss][r][y];
+	    int nb = ray->ray_hdr.num_bins;
+	    ray_hdrs[r] = ray->ray_hdr;
+	    dat[r] = NULL;
+	    if (ray->dat == NULL || nb <= 0 || nb > num_bins) {
+		continue;
+	    }
+	    Sigmet_DataTypeStorToVal(vol_hdr.types[y], nb, v, ray->dat, &vol_hdr);
+	    dat[r] = v;
+	    v += nb;
+	}
+	if ( !SigmetRaw_AzGridResample(az_grid, num_rays, ray_hdrs, dat, num_bins,
+		    grid + (ss - s0) * swp_sz, &err_msg) ) {
+	    fprintf(stderr, "%s: could not resample sweep %d. %s\n", cmd, ss, err_msg.str);
+	    exit(EXIT_FAILURE);
+	}
+	tilts[ss - s0] = swp_hdrs[ss].angl;
+    }
+    SigmetRaw_AzGridFree(az_grid);
+
+    /* Find and print cells */
+    struct SigmetRaw_Cells * cells = SigmetRaw_CellsInit(&err_msg);
+    if (cells == NULL || !SigmetRaw_CellsFind(cells, &cfg, n_swps, num_az, num_bins, tilts,
+		grid, NULL, &err_msg) ) {
+	fprintf(stderr, "%s: could not find cells. %s\n", cmd, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    unsigned num_cells;
+    const struct SigmetRaw_Cell * c = SigmetRaw_CellsGet(cells, &num_cells);
+    for (unsigned n = 0; n < num_cells; n++, c++) {
+	printf(CELL_FMT, c->swp0 + s0, c->swp1 + s0, c->num_gates, c->area * 1.0e-6,
+		c->vol * 1.0e-9, c->x * 1.0e-3, c->y * 1.0e-3, c->z * 1.0e-3, c->max,
+		(c->max_az + 0.5) * 360.0 / num_az,
+		(cfg.rng0 + (c->max_bin + 0.5) * cfg.drng) * 1.0e-3);
+    }
+    SigmetRaw_CellsFree(cells);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,293 @@
+/*
+ *	clutter.c --
+ *		Build a clutter map from clear air volumes. See sigmet_raw (1).
+ *	--
+ *
+ *	Usage: clutter [-a num_az] [-f frequency] [-n min_obs] [-t num_threads] data_type threshold
+ *		map_file raw_product_file ...
+ *
+ *	Counts how often data_type values exceed threshold at each sweep angle, azimuth cell, and
+ *	range bin in the raw product files, and writes a map flagging gates that exceed it in at
+ *	least fraction frequency, default 0.5, of at least min_obs rays, default 1, to map_file.
+ *	There are num_az azimuth cells, default 720. Volumes are read on num_threads threads,
+ *	default one per processor, each with its own counts, which are added at the end. Volumes
+ *	with range geometry different from the first volume are skipped. Apply the map with
+ *	"data -c map_file ...". See sigmet_raw_clutter.c.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <pthread.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define DFLT_NUM_AZ 720
+#define DFLT_FREQ 0.5f
+
+/* Work shared by the threads. Threads take volumes from paths in order. */
+struct work {
+    const struct Sigmet_DataType * type;
+    char ** paths;
+    unsigned num_paths;
+    unsigned next;			/* Index of next path to read */
+    unsigned num_bins;			/* Geometry of first volume */
+    float rng0, drng;
+    const char * cmd;
+    pthread_mutex_t mtx;
+};
+
+/* Arguments and result for one thread */
+struct worker {
+    struct work * work;
+    struct SigmetRaw_ClutterAcc * acc;
+    unsigned num_vols;			/* Volumes accumulated */
+};
+
+static int vol_acc(struct work *, const char *, struct SigmetRaw_ClutterAcc *,
+	struct Sigmet_ErrMsg *);
+
+static void * worker_run(void * arg)
+{
+    struct worker * wkr = arg;
+    struct work * work = wkr->work;
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    while (1) {
+	pthread_mutex_lock(&work->mtx);
+	unsigned p = work->next;
+	work->next += (p < work->num_paths) ? 1 : 0;
+	pthread_mutex_unlock(&work->mtx);
+	if (p == work->num_paths) {
+	    break;
+	}
+	if (vol_acc(work, work->paths[p], wkr->acc, &err_msg)) {
+	    wkr->num_vols++;
+	} else {
+	    fprintf(stderr, "%s: skipping %s. %s\n", work->cmd, work->paths[p], err_msg.str);
+	}
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    /* If set, use $APP_NAME in error messages instead of argv[0]. */
+    char *cmd = getenv("APP_NAME") ? getenv("APP_NAME") : basename(argv[0]);
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    unsigned num_az = DFLT_NUM_AZ;
+    float freq = DFLT_FREQ;
+    unsigned min_obs = 1;
+    unsigned num_threads = 0;
+    int a = 1;
+    while (a + 1 < argc && argv[a][0] == '-') {
+	char * opt = argv[a], * val = argv[a + 1];
+	if (strcmp(opt, "-a") == 0) {
+	    if (sscanf(val, "%u", &num_az) != 1
+		    || num_az == 0 || num_az > SIGMETRAW_AZGRID_MAX_AZ) {
+		fprintf(stderr, "%s: expected azimuth count 1 to %d, got %s\n",
+			cmd, SIGMETRAW_AZGRID_MAX_AZ, val);
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(opt, "-f") == 0) {
+	    if (sscanf(val, "%f", &freq) != 1 || !(freq > 0.0f && freq <= 1.0f)) {
+		fprintf(stderr, "%s: expected frequency greater than 0 and at most 1, got %s\n",
+			cmd, val);
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(opt, "-n") == 0) {
+	    if (sscanf(val, "%u", &min_obs) != 1) {
+		fprintf(stderr, "%s: expected integer for minimum observation count, got %s\n",
+			cmd, val);
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(opt, "-t") == 0) {
+	    if (sscanf(val, "%u", &num_threads) != 1) {
+		fprintf(stderr, "%s: expected integer for thread count, got %s\n", cmd, val);
+		exit(EXIT_FAILURE);
+	    }
+	} else {
+	    break;
+	}
+	a += 2;
+    }
+    if (argc - a < 4) {
+	fprintf(stderr, "Usage: %s [-a num_az] [-f frequency] [-n min_obs] [-t num_threads] "
+		"data_type threshold map_file raw_product_file ...\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    char * abbrv = argv[a];
+    char * thresh_s = argv[a + 1];
+    char * map_path = argv[a + 2];
+    struct work work = {
+	.paths = argv + a + 3, .num_paths = argc - a - 3, .next = 0, .cmd = cmd
+    };
+    if ((work.type = Sigmet_DataTypeGet(abbrv)) == NULL) {
+	fprintf(stderr, "%s: %s is not a Sigmet data type.\n", cmd, abbrv);
+	exit(EXIT_FAILURE);
+    }
+    float thresh;
+    if (sscanf(thresh_s, "%f", &thresh) != 1) {
+	fprintf(stderr, "%s: expected number for threshold, got %s\n", cmd, thresh_s);
+	exit(EXIT_FAILURE);
+    }
+
+    /* Map geometry comes from the first volume. */
+    FILE * vol_fl = fopen(work.paths[0], "r");
+    if (vol_fl == NULL) {
+	fprintf(stderr, "%s: could not open %s. %s\n", cmd, work.paths[0], strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    struct Sigmet_VolHdr vol_hdr;
+    memset(&vol_hdr, 0, sizeof vol_hdr);
+    if ( !Sigmet_VolReadVHdr(vol_fl, &vol_hdr, &err_msg) ) {
+	fprintf(stderr, "%s: could not read volume headers from %s. %s\n",
+		cmd, work.paths[0], err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    fclose(vol_fl);
+    const struct Sigmet_TaskRngInfo * rng_info = &vol_hdr.ingst_hdr.task_cfg.task_rng_info;
+    work.rng0 = rng_info->rng_1st_bin * 0.01f;
+    work.drng = rng_info->step_out * 0.01f;
+    int num_bins = Sigmet_VolNumBins(&vol_hdr);
+    if (num_bins <= 0) {
+	fprintf(stderr, "%s: %s corrupt, claims %d bins per ray.\n", cmd, work.paths[0], num_bins);
+	exit(EXIT_FAILURE);
+    }
+    work.num_bins = num_bins;
+
+    /* Accumulate on num_threads threads */
+    num_threads = SigmetRaw_NumThreads(num_threads);
+    num_threads = (num_threads < work.num_paths) ? num_threads : work.num_paths;
+    struct worker * wkrs = calloc(num_threads, sizeof *wkrs);
+    if (wkrs == NULL) {
+	fprintf(stderr, "%s: could not allocate memory for %u threads.\n", cmd, num_threads);
+	exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&work.mtx, NULL);
+    for (unsigned t = 0; t < num_threads; t++) {
+	wkrs[t].work = &work;
+	wkrs[t].acc = SigmetRaw_ClutterAccInit(num_az, work.num_bins, work.rng0, work.drng,
+		thresh, &err_msg);
+	if (wkrs[t].acc == NULL) {
+	    fprintf(stderr, "%s: could not create clutter counts. %s\n", cmd, err_msg.str);
+	    exit(EXIT_FAILURE);
+	}
+    }
+    SigmetRaw_ThreadsRun(num_threads, worker_run, wkrs, sizeof *wkrs);
+    unsigned num_vols = wkrs[0].num_vols;
+    for (unsigned t = 1; t < num_threads; t++) {
+	num_vols += wkrs[t].num_vols;
+	if ( !SigmetRaw_ClutterAccMerge(wkrs[0].acc, wkrs[t].acc, &err_msg) ) {
+	    fprintf(stderr, "%s: could not combine clutter counts. %s\n", cmd, err_msg.str);
+	    exit(EXIT_FAILURE);
+	}
+	SigmetRaw_ClutterAccFree(wkrs[t].acc);
+    }
+    if (num_vols == 0) {
+	fprintf(stderr, "%s: no volumes to build clutter map from.\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    if ( !SigmetRaw_ClutterMapWrite(wkrs[0].acc, freq, min_obs, map_path, &err_msg) ) {
+	fprintf(stderr, "%s: could not write clutter map. %s\n", cmd, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    SigmetRaw_ClutterAccFree(wkrs[0].acc);
+    exit(EXIT_SUCCESS);
+}
+
+/* Add all sweeps of work->type in raw product file at path to acc. Return 1/0 on
+ * success/failure. */
+static int vol_acc(struct work * work, const char * path, struct SigmetRaw_ClutterAcc * acc,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct Sigmet_VolHdr vol_hdr;
+    FILE * vol_fl = fopen(path, "r");
+    if (vol_fl == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "Could not open file. %s", strerror(errno));
+	return 0;
+    }
+    memset(&vol_hdr, 0, sizeof vol_hdr);
+    if ( !Sigmet_VolReadVHdr(vol_fl, &vol_hdr, err_msg_p) ) {
+	fclose(vol_fl);
+	return 0;
+    }
+    const struct Sigmet_TaskRngInfo * rng_info = &vol_hdr.ingst_hdr.task_cfg.task_rng_info;
+    if (rng_info->rng_1st_bin * 0.01f != work->rng0 || rng_info->step_out * 0.01f != work->drng
+	    || Sigmet_VolNumBins(&vol_hdr) != work->num_bins) {
+	Sigmet_ErrMsg_Print(err_msg_p, "Range geometry differs from first volume.");
+	fclose(vol_fl);
+	return 0;
+    }
+    int y = Sigmet_VolTypeIdx(work->type, &vol_hdr);
+    size_t dat_buf_sz = Sigmet_VolIDatSz(&vol_hdr, err_msg_p);
+    if (y == -1 || dat_buf_sz == 0) {
+	if (y == -1) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s data type is not in volume.",
+		    Sigmet_DataTypeAbbrv(work->type));
+	}
+	fclose(vol_fl);
+	return 0;
+    }
+    int status = 0;
+    int num_swps = Sigmet_VolNumSwps(&vol_hdr);
+    int num_rays = Sigmet_VolNumRays(&vol_hdr);
+    int num_types = Sigmet_VolNumTypes(&vol_hdr);
+    struct Sigmet_Ray (*rays)[num_rays][num_types] = calloc(num_swps, sizeof *rays);
+    struct Sigmet_SwpHdr * swp_hdrs = calloc(num_swps, sizeof *swp_hdrs);
+    void * dat_buf = malloc(dat_buf_sz);
+    struct Sigmet_RayHdr * ray_hdrs = calloc(num_rays, sizeof *ray_hdrs);
+    const float ** dat = calloc(num_rays, sizeof *dat);
+    float * vals = calloc((size_t)num_rays * work->num_bins, sizeof *vals);
+    if (rays == NULL || swp_hdrs == NULL || dat_buf == NULL || ray_hdrs == NULL || dat == NULL
+	    || vals == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "Could not allocate memory for volume.");
+	goto done;
+    }
+    int rd = Sigmet_VolReadDat(vol_fl, &vol_hdr, num_swps, num_rays, num_types, swp_hdrs,
+	    rays, dat_buf_sz, dat_buf, err_msg_p);
+    if (rd == 0) {
+	goto done;
+    }
+
+    /* Truncated volumes have fewer sweeps than the header claims. Sweeps after rd are empty. */
+    for (int s = 0; s < rd; s++) {
+	float * v = vals;
+	for (int r = 0; r < num_rays; r++) {
+	    struct Sigmet_Ray * ray = &rays[s][r][y];
+	    int nb = ray->ray_hdr.num_bins;
+	    ray_hdrs[r] = ray->ray_hdr;
+	    dat[r] = NULL;
+	    if (ray->dat == NULL || nb <= 0) {
+		continue;
+	    }
+	    /* SigmetRaw_ClutterAccSwp ignores bins beyond the map, so do not convert them. */
+	    nb = (nb < (int)work->num_bins) ? nb : (int)work->num_bins;
+	    Sigmet_DataTypeStorToVal(vol_hdr.types[y], nb, v, ray->dat, &vol_hdr);
+	    dat[r] = v;
+	    v += nb;
+	}
+	if ( !SigmetRaw_ClutterAccSwp(acc, swp_hdrs[s].angl, num_rays, ray_hdrs, dat, err_msg_p) ) {
+	    goto done;
+	}
+    }
+    status = 1;
+
+done:
+    fclose(vol_fl);
+    free(rays);
+    free(swp_hdrs);
+    free(dat_buf);
+    free(ray_hdrs);
+    free(dat);
+    free(vals);
+    return status;
+}
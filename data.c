@@ -22,33 +22,125 @@
 #include "sigmet.h"
 #include "sigmet_raw.h"
 
-static void data_fm_fl(const char *, const struct Sigmet_DataType *, int, _Bool, const char *);
-static void skt_to_txt(const char *, const struct Sigmet_DataType *, int, const char *);
-static void skt_to_bin(const char *, const struct Sigmet_DataType *, int, const char *);
+/* Output formats */
+enum Data_OutFmt {
+    DataTxt,				/* Text */
+    DataBin,				/* Native binary floats */
+    DataBits				/* Native binary valid gate bitmaps, see sigmet_raw_bits.c */
+};
+
+#define DEG_PER_RAD ((double)57.29577951308232087648)
+
+/* Azimuth cells in beam blockage tables. See sigmet_raw_geom.c */
+#define GEOM_NUM_AZ 720
+
+/* Gates to set to NAN while converting a sweep. See ray_vals. */
+struct Data_Mask {
+    const struct SigmetRaw_ClutterMap * clut;	/* Clutter map, or NULL */
+    int c_s;					/* Sweep in clut, or -1 */
+    const struct SigmetRaw_Geom * geom;		/* Beam geometry tables, or NULL */
+    int g_s;					/* Sweep in geom, or -1 */
+    unsigned max_blk;				/* Largest beam blockage to keep, 0 to 255 */
+};
+
+/* Print format for expression values, which do not have a data type */
+#define EXPR_PRINT_FMT "%g "
+
+static void data_fm_fl(const char *, const struct Sigmet_DataType *, struct SigmetRaw_Expr *, int,
+	const struct SigmetRaw_PyrSel *, const struct SigmetRaw_ClutterMap *, const char *, float,
+	enum Data_OutFmt, const char *);
+static void data_fm_shm(const char *, const char *, const struct Sigmet_DataType *, int,
+	const struct SigmetRaw_PyrSel *, enum Data_OutFmt, const char *);
+static void pyr_print(float *, unsigned, unsigned, const struct SigmetRaw_PyrSel *,
+	enum Data_OutFmt, const char *, const char *);
+static int ray_vals(const struct Sigmet_VolHdr *, unsigned num_rays, unsigned num_types,
+	struct Sigmet_Ray (*)[num_rays][num_types], int, int, int, struct SigmetRaw_Expr *,
+	const int *, float *, const struct Data_Mask *, int, float *);
+static void skt_to_txt(const char *, const struct Sigmet_DataType *, const char *, int,
+	const struct SigmetRaw_PyrSel *, const char *);
+static void skt_to_bin(const char *, enum SigmetRaw_SubCmdN, const struct Sigmet_DataType *,
+	const char *, int, const struct SigmetRaw_PyrSel *, const char *);
 
 int main(int argc, char *argv[])
 {
     /* If set, use $APP_NAME in error messages instead of argv[0]. */
     char *cmd = getenv("APP_NAME") ? getenv("APP_NAME") : basename(argv[0]);
     char * abbrv = NULL;		/* Data type abbreviation, e.g. "DB_DBZ" */
+    char * expr_src = NULL;		/* Expression, e.g. "where(DB_RHOHV > 0.9, DB_DBZ, NAN)" */
     char * s_s = NULL;			/* Sweep index */
     char * path = NULL;			/* Volume file or socket */
-    _Bool txt = true;			/* true => print data as text. false => send native binary. */
-    if (argc == 4) {
-	abbrv = argv[1];
-	s_s = argv[2];
-	path = argv[3];
-    } else if (argc == 5 && strcmp(argv[1], "-b") == 0) {
-	abbrv = argv[2];
-	s_s = argv[3];
-	path = argv[4];
-	txt = false;
-    } else {
-	fprintf(stderr, "Usage: %s [-b] data_type sweep_index raw_product_file|socket\n", cmd);
-	exit(EXIT_FAILURE);
+    char * clut_path = NULL;		/* Clutter map, see sigmet_raw_clutter.c */
+    char * dem_path = NULL;		/* Elevation model for beam blockage, see sigmet_raw_geom.c */
+    float max_blk = 1.0f;		/* Largest fraction of beam blocked to keep */
+    enum Data_OutFmt out_fmt = DataTxt;
+    struct SigmetRaw_PyrSel pyr = { .lvl = 0, .mode = SigmetRawPyrMean };
+    int a = 1;
+    if (a < argc && (strcmp(argv[a], "-b") == 0 || strcmp(argv[a], "-m") == 0)) {
+	out_fmt = (argv[a][1] == 'b') ? DataBin : DataBits;
+	a++;
+    }
+    if (a + 1 < argc && (strcmp(argv[a], "-p") == 0 || strcmp(argv[a], "-P") == 0)) {
+	/* Pyramid level, cells from mean (-p) or maximum (-P) */
+	pyr.mode = (argv[a][1] == 'p') ? SigmetRawPyrMean : SigmetRawPyrMax;
+	if (sscanf(argv[a + 1], "%d", &pyr.lvl) != 1
+		|| pyr.lvl < 0 || pyr.lvl > SIGMETRAW_PYR_MAX_LVL) {
+	    fprintf(stderr, "%s: expected pyramid level 0 to %d, got %s\n",
+		    cmd, SIGMETRAW_PYR_MAX_LVL, argv[a + 1]);
+	    exit(EXIT_FAILURE);
+	}
+	if (out_fmt == DataBits) {
+	    fprintf(stderr, "%s: valid gate bitmaps are only available at full resolution.\n",
+		    cmd);
+	    exit(EXIT_FAILURE);
+	}
+	a += 2;
+    }
+    if (a + 1 < argc && strcmp(argv[a], "-c") == 0) {
+	clut_path = argv[a + 1];
+	a += 2;
     }
-    const struct Sigmet_DataType * type = Sigmet_DataTypeGet(abbrv);
-    if (type == NULL) {
+    if (a + 2 < argc && strcmp(argv[a], "-k") == 0) {
+	/* Mask gates whose beam is more than max_blk blocked by terrain in dem_path */
+	dem_path = argv[a + 1];
+	if (sscanf(argv[a + 2], "%f", &max_blk) != 1 || !(max_blk >= 0.0f && max_blk <= 1.0f)) {
+	    fprintf(stderr, "%s: expected blockage fraction 0 to 1, got %s\n", cmd, argv[a + 2]);
+	    exit(EXIT_FAILURE);
+	}
+	a += 3;
+    }
+    if (a < argc && strcmp(argv[a], "-e") == 0) {
+	a++;
+	if (a < argc) {
+	    expr_src = argv[a];
+	}
+    }
+    if (argc - a == 3) {
+	abbrv = argv[a];
+	s_s = argv[a + 1];
+	path = argv[a + 2];
+    } else {
+	fprintf(stderr, "Usage: %s [-b|-m] [-p|-P level] [-c clutter_map] "
+		"[-k dem_file max_blockage] data_type|-e expression sweep_index "
+		"raw_product_file|socket\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    const struct Sigmet_DataType * type = NULL;
+    struct SigmetRaw_Expr * expr = NULL;
+    if (expr_src != NULL) {
+	/* Expression output has the dimensions of the first data type in the expression. */
+	struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+	if (strlen(expr_src) >= SIGMETRAW_EXPR_LEN) {
+	    fprintf(stderr, "%s: expression too long. Limit is %d characters.\n",
+		    cmd, SIGMETRAW_EXPR_LEN - 1);
+	    exit(EXIT_FAILURE);
+	}
+	expr = SigmetRaw_ExprCompile(expr_src, &err_msg);
+	if (expr == NULL) {
+	    fprintf(stderr, "%s: could not compile expression %s. %s\n", cmd, expr_src, err_msg.str);
+	    exit(EXIT_FAILURE);
+	}
+	type = SigmetRaw_ExprType(expr, 0);
+    } else if ((type = Sigmet_DataTypeGet(abbrv)) == NULL) {
 	fprintf(stderr, "%s: %s is not a Sigmet data type.\n", cmd, abbrv);
 	exit(EXIT_FAILURE);
     }
@@ -63,15 +155,45 @@ int main(int argc, char *argv[])
 		cmd, abbrv, s_s, path, strerror(errno));
 	exit(EXIT_FAILURE);
     }
-    if (S_ISREG(st_buf.st_mode) || S_ISFIFO(st_buf.st_mode)) {
+    struct SigmetRaw_ClutterMap * clut = NULL;
+    if (clut_path != NULL) {
+	/* Clutter maps are applied while converting raw product files. */
+	struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+	if ( !S_ISREG(st_buf.st_mode) && !S_ISFIFO(st_buf.st_mode) ) {
+	    fprintf(stderr, "%s: clutter map needs a raw product file.\n", cmd);
+	    exit(EXIT_FAILURE);
+	}
+	if ((clut = SigmetRaw_ClutterMapOpen(clut_path, &err_msg)) == NULL) {
+	    fprintf(stderr, "%s: could not open clutter map. %s\n", cmd, err_msg.str);
+	    exit(EXIT_FAILURE);
+	}
+    }
+    if (dem_path != NULL && !S_ISREG(st_buf.st_mode) && !S_ISFIFO(st_buf.st_mode)) {
+	/* Blockage tables are applied while converting raw product files. */
+	fprintf(stderr, "%s: beam blockage mask needs a raw product file.\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    if (S_ISREG(st_buf.st_mode) && expr == NULL && clut == NULL && dem_path == NULL
+	    && getenv("SIGMETRAW_SHM") != NULL) {
+	/* Share decoded volume with other processes through volume store at $SIGMETRAW_SHM, or
+	 * the default store if it is empty. */
+	data_fm_shm(getenv("SIGMETRAW_SHM"), path, type, s, &pyr, out_fmt, cmd);
+    } else if (S_ISREG(st_buf.st_mode) || S_ISFIFO(st_buf.st_mode)) {
 	/* path must specify a Sigmet raw product file */
-	data_fm_fl(path, type, s, txt, cmd);
+	data_fm_fl(path, type, expr, s, &pyr, clut, dem_path, max_blk, out_fmt, cmd);
     } else if (S_ISSOCK(st_buf.st_mode)) {
 	/* path must be sigmet_raw daemon socket. */
-	if (txt) {
-	    skt_to_txt(path, type, s, cmd);
-	} else {
-	    skt_to_bin(path, type, s, cmd);
+	switch (out_fmt) {
+	    case DataTxt:
+		skt_to_txt(path, type, expr_src, s, &pyr, cmd);
+		break;
+	    case DataBin:
+		skt_to_bin(path, expr_src ? SigmetRawExpr : SigmetRawData, type, expr_src, s, &pyr,
+			cmd);
+		break;
+	    case DataBits:
+		skt_to_bin(path, SigmetRawValidBits, type, expr_src, s, &pyr, cmd);
+		break;
 	}
 
     } else {
@@ -81,9 +203,16 @@ int main(int argc, char *argv[])
 }
 
 /* Obtain data for data type type, sweep s from Sigmet raw product file at path, print, and exit.
- * If txt is true, print data as text, otherwise print native binary. cmd is for error messages. */
-static void data_fm_fl(const char * path, const struct Sigmet_DataType * type, int s, _Bool txt,
-	const char * cmd)
+ * If expr is not NULL, evaluate it instead, and type should be its first data type. If pyr_p
+ * selects a level above 0, print that pyramid level instead of the full resolution sweep.
+ * If clut is not NULL, set gates it flags as clutter to NAN. If dem_path is not NULL, set
+ * gates whose beam terrain in elevation model dem_path blocks by more than fraction max_blk to
+ * NAN, using blockage tables from the geometry cache at $SIGMETRAW_GEOM. out_fmt selects text,
+ * native binary, or valid gate bitmaps. cmd is for error messages. */
+static void data_fm_fl(const char * path, const struct Sigmet_DataType * type,
+	struct SigmetRaw_Expr * expr, int s, const struct SigmetRaw_PyrSel * pyr_p,
+	const struct SigmetRaw_ClutterMap * clut, const char * dem_path, float max_blk,
+	enum Data_OutFmt out_fmt, const char * cmd)
 {
     struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
     FILE *vol_fl = fopen(path, "r");
@@ -138,14 +267,55 @@ static void data_fm_fl(const char * path, const struct Sigmet_DataType * type, i
 	fprintf(stderr, "%s: could not allocate memory for %zu bytes of data.\n", cmd, dat_buf_sz);
 	exit(EXIT_FAILURE);
     }
+    struct Sigmet_SwpHdr * swp_hdrs = calloc(num_swps, sizeof *swp_hdrs);
+    if (swp_hdrs == NULL) {
+	fprintf(stderr, "%s: could not allocate memory for %d sweep headers.\n", cmd, num_swps);
+	exit(EXIT_FAILURE);
+    }
     /* Read volume data headers and data values. */
-    int rd = Sigmet_VolReadDat(vol_fl, &vol_hdr, num_swps, num_rays, num_types, NULL,
+    int rd = Sigmet_VolReadDat(vol_fl, &vol_hdr, num_swps, num_rays, num_types, swp_hdrs,
 	    rays, dat_buf_sz, dat_buf, &err_msg);
     fclose(vol_fl);
     if (rd == 0) {
 	fprintf(stderr, "%s: volume at %s has no data. %s\n", cmd, path, err_msg.str);
 	exit(EXIT_FAILURE);
     }
+    /* Clutter map sweep for this sweep, or -1 if none. Map range geometry must match volume. */
+    struct Data_Mask mask = { .clut = clut, .c_s = -1, .geom = NULL, .g_s = -1, .max_blk = 255 };
+    if (clut != NULL) {
+	const struct Sigmet_TaskRngInfo * rng_info = &vol_hdr.ingst_hdr.task_cfg.task_rng_info;
+	float c_rng0, c_drng;
+	unsigned c_num_bins = SigmetRaw_ClutterMapRng(clut, &c_rng0, &c_drng);
+	if (c_rng0 != rng_info->rng_1st_bin * 0.01f || c_drng != rng_info->step_out * 0.01f
+		|| c_num_bins != (unsigned)num_bins) {
+	    fprintf(stderr, "%s: clutter map range geometry does not match %s.\n", cmd, path);
+	    exit(EXIT_FAILURE);
+	}
+	mask.c_s = SigmetRaw_ClutterMapSwp(clut, swp_hdrs[s].angl);
+	if (mask.c_s == -1) {
+	    fprintf(stderr, "%s: warning: clutter map has no sweep at %.1f degrees. "
+		    "Data are not masked.\n", cmd, swp_hdrs[s].angl * DEG_PER_RAD);
+	}
+    }
+    /* Beam blockage for the scan strategy, from the geometry cache if possible */
+    if (dem_path != NULL) {
+	struct SigmetRaw_GeomKey key;
+	if ( !SigmetRaw_GeomKeyFmVol(&vol_hdr, swp_hdrs, rd, GEOM_NUM_AZ, &key, &err_msg) ) {
+	    fprintf(stderr, "%s: could not get scan geometry for %s. %s\n", cmd, path, err_msg.str);
+	    exit(EXIT_FAILURE);
+	}
+	mask.geom = SigmetRaw_GeomGet(getenv("SIGMETRAW_GEOM"), &key, dem_path, 0, &err_msg);
+	if (mask.geom == NULL) {
+	    fprintf(stderr, "%s: could not get beam geometry tables. %s\n", cmd, err_msg.str);
+	    exit(EXIT_FAILURE);
+	}
+	mask.g_s = SigmetRaw_GeomSwp(mask.geom, swp_hdrs[s].angl);
+	if (mask.g_s == -1) {
+	    fprintf(stderr, "%s: warning: no blockage table for sweep at %.1f degrees. "
+		    "Data are not masked.\n", cmd, swp_hdrs[s].angl * DEG_PER_RAD);
+	}
+	mask.max_blk = (unsigned)lroundf(max_blk * 255.0f);
+    }
     /* Allocate ray with maximum bin count from ray headers, not volume headers. */
     int num_bins_max = 0;
     for (int r = 0; r < num_rays; r++) {
@@ -164,9 +334,49 @@ static void data_fm_fl(const char * path, const struct Sigmet_DataType * type, i
 		cmd, num_rays, num_bins_max);
 	exit(EXIT_FAILURE);
     }
-    if (txt) {
+    /* Expression inputs - type indeces in volume and a ray of values for each data type */
+    unsigned num_expr_types = (expr != NULL) ? SigmetRaw_ExprNumTypes(expr) : 0;
+    int ys[SIGMET_NUM_DATA_TYPES];
+    float * expr_dat = NULL;
+    if (expr != NULL) {
+	for (unsigned e = 0; e < num_expr_types; e++) {
+	    const struct Sigmet_DataType * e_type = SigmetRaw_ExprType(expr, e);
+	    if ((ys[e] = Sigmet_VolTypeIdx(e_type, &vol_hdr)) == -1) {
+		fprintf(stderr, "%s: %s data type is not in volume at %s.\n",
+			cmd, Sigmet_DataTypeAbbrv(e_type), path);
+		exit(EXIT_FAILURE);
+	    }
+	}
+	expr_dat = calloc((size_t)num_expr_types * num_bins_max, sizeof *expr_dat);
+	if (expr_dat == NULL) {
+	    fprintf(stderr, "%s: could not allocate memory for %u x %d expression inputs.\n",
+		    cmd, num_expr_types, num_bins_max);
+	    exit(EXIT_FAILURE);
+	}
+    }
+    if (pyr_p->lvl > 0) {
+	/* Level 0 of the pyramid is the sweep on a regular grid. */
+	float * grid = malloc((size_t)num_rays * num_bins_max * sizeof *grid);
+	if (grid == NULL) {
+	    fprintf(stderr, "%s: could not allocate memory for %d x %d sweep.\n",
+		    cmd, num_rays, num_bins_max);
+	    exit(EXIT_FAILURE);
+	}
+	for (int r = 0; r < num_rays; r++) {
+	    float * g = grid + (size_t)r * num_bins_max;
+	    int nb = ray_vals(&vol_hdr, num_rays, num_types, rays, s, r, y, expr, ys, expr_dat,
+		    &mask, num_bins_max, g);
+	    for (int b = (nb > 0) ? nb : 0; b < num_bins_max; b++) {
+		g[b] = NAN;
+	    }
+	}
+	pyr_print(grid, num_rays, num_bins_max, pyr_p, out_fmt,
+		(expr != NULL) ? EXPR_PRINT_FMT : Sigmet_DataType_PrintFmt(type), cmd);
+	exit(EXIT_SUCCESS);
+    }
+    if (out_fmt == DataTxt) {
 	/* Text output */
-	const char * fmt = Sigmet_DataType_PrintFmt(type);
+	const char * fmt = (expr != NULL) ? EXPR_PRINT_FMT : Sigmet_DataType_PrintFmt(type);
 	if (fmt == NULL) {
 	    fprintf(stderr, "%s: could not obtain print format for data type %s "
 		    "in raw product file %s.\n", cmd, Sigmet_DataTypeAbbrv(type), path);
@@ -176,23 +386,35 @@ static void data_fm_fl(const char * path, const struct Sigmet_DataType * type, i
 	    for (int b = 0; b < num_bins_max; b++) {
 		dat[b] = NAN;
 	    }
-	    void * idat = rays[s][r][y].dat;
-	    if (idat != NULL) {
-		int nb = rays[s][r][y].ray_hdr.num_bins;
-		Sigmet_DataTypeStorToVal(type, nb, dat, idat, &vol_hdr);
-	    }
+	    ray_vals(&vol_hdr, num_rays, num_types, rays, s, r, y, expr, ys, expr_dat,
+		    &mask, num_bins_max, dat);
 	    for (int b = 0; b < num_bins_max; b++) {
 		printf(fmt, dat[b]);
 	    }
 	    printf("\n");
 	}
+    } else if (out_fmt == DataBits) {
+	/* Valid gate bitmaps, SigmetRaw_BitsNumWds(num_bins) words per non-empty ray */
+	uint32_t * bits = calloc(SigmetRaw_BitsNumWds(num_bins_max), sizeof *bits);
+	if (bits == NULL) {
+	    fprintf(stderr, "%s: could not allocate memory for bitmap of %d bins.\n",
+		    cmd, num_bins_max);
+	    exit(EXIT_FAILURE);
+	}
+	for (int r = 0; r < num_rays; r++) {
+	    int nb = ray_vals(&vol_hdr, num_rays, num_types, rays, s, r, y, expr, ys, expr_dat,
+		    &mask, num_bins_max, dat);
+	    if (nb >= 0) {
+		SigmetRaw_BitsValid(nb, dat, bits);
+		fwrite(bits, sizeof *bits, SigmetRaw_BitsNumWds(nb), stdout);
+	    }
+	}
     } else {
 	/* Assume native binary output */
 	for (int r = 0; r < num_rays; r++) {
-	    void * idat = rays[s][r][y].dat;
-	    if (idat != NULL) {
-		int nb = rays[s][r][y].ray_hdr.num_bins;
-		Sigmet_DataTypeStorToVal(type, nb, dat, idat, &vol_hdr);
+	    int nb = ray_vals(&vol_hdr, num_rays, num_types, rays, s, r, y, expr, ys, expr_dat,
+		    &mask, num_bins_max, dat);
+	    if (nb >= 0) {
 		fwrite(dat, sizeof *dat, nb, stdout);
 	    }
 	}
@@ -200,215 +422,303 @@ static void data_fm_fl(const char * path, const struct Sigmet_DataType * type, i
     exit(EXIT_SUCCESS);
 }
 
-/* Obtain ray headers and sweep data for data type type, sweep s, from sigmet_raw daemon monitoring
- * socket at path. Ray headers provide data dimensions. Print the sweep data to standard output as text.
- * cmd is for error messages. */
-static void skt_to_txt(const char * path, const struct Sigmet_DataType * type, int s, const char * cmd)
+/* Set gates in dat, which has num_bins values for the ray with header ray_hdr, that mask_p
+ * selects to NAN. */
+static void mask_apply(const struct Data_Mask * mask_p, const struct Sigmet_RayHdr * ray_hdr,
+	int num_bins, float * dat)
+{
+    if (mask_p->clut != NULL) {
+	SigmetRaw_ClutterMapApply(mask_p->clut, mask_p->c_s, ray_hdr, num_bins, dat);
+    }
+    if (mask_p->geom != NULL && mask_p->g_s != -1) {
+	const uint8_t * blk = SigmetRaw_GeomBlk(mask_p->geom, mask_p->g_s, ray_hdr->az0,
+		ray_hdr->az1);
+	int n = (int)SigmetRaw_GeomGetKey(mask_p->geom)->num_bins;
+	n = (num_bins < n) ? num_bins : n;
+	for (int b = 0; b < n; b++) {
+	    if (blk[b] > mask_p->max_blk) {
+		dat[b] = NAN;
+	    }
+	}
+    }
+}
+
+/* Put values for sweep s, ray r into dat. If expr is NULL, values come from data type with index
+ * y in volume. Otherwise, values come from evaluating expr with its data types at indeces ys,
+ * using expr_dat, which must have space for num_bins_max values for each expression data type.
+ * Then set gates that mask_p selects to NAN. Return bin count, or -1 if ray is empty. */
+static int ray_vals(const struct Sigmet_VolHdr * vol_hdr_p, unsigned num_rays, unsigned num_types,
+	struct Sigmet_Ray (*rays)[num_rays][num_types], int s, int r, int y,
+	struct SigmetRaw_Expr * expr, const int * ys, float * expr_dat,
+	const struct Data_Mask * mask_p, int num_bins_max, float * dat)
+{
+    void * idat = rays[s][r][y].dat;
+    if (idat == NULL) {
+	return -1;
+    }
+    int nb = rays[s][r][y].ray_hdr.num_bins;
+    if (expr == NULL) {
+	Sigmet_DataTypeStorToVal(vol_hdr_p->types[y], nb, dat, idat, vol_hdr_p);
+	mask_apply(mask_p, &rays[s][r][y].ray_hdr, nb, dat);
+	return nb;
+    }
+    unsigned num_expr_types = SigmetRaw_ExprNumTypes(expr);
+    const float * vals[SIGMET_NUM_DATA_TYPES];
+    for (unsigned e = 0; e < num_expr_types; e++) {
+	float * e_dat = expr_dat + (size_t)e * num_bins_max;
+	struct Sigmet_Ray * e_ray = &rays[s][r][ys[e]];
+	int e_nb = (e_ray->dat != NULL) ? e_ray->ray_hdr.num_bins : 0;
+	e_nb = (e_nb < nb) ? e_nb : nb;
+	if (e_nb > 0) {
+	    Sigmet_DataTypeStorToVal(vol_hdr_p->types[ys[e]], e_nb, e_dat, e_ray->dat, vol_hdr_p);
+	}
+	for (int b = e_nb; b < nb; b++) {
+	    e_dat[b] = NAN;
+	}
+	vals[e] = e_dat;
+    }
+    SigmetRaw_ExprEval(expr, nb, vals, dat);
+    mask_apply(mask_p, &rays[s][r][y].ray_hdr, nb, dat);
+    return nb;
+}
+
+/* Obtain data for data type type, sweep s from Sigmet raw product file at path by way of shared
+ * memory volume store dir, print, and exit. pyr_p and out_fmt are as for data_fm_fl. cmd is for
+ * error messages. */
+static void data_fm_shm(const char * dir, const char * path, const struct Sigmet_DataType * type,
+	int s, const struct SigmetRaw_PyrSel * pyr_p, enum Data_OutFmt out_fmt, const char * cmd)
 {
     struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
-    errno = 0;
-    const char * abbrv = Sigmet_DataTypeAbbrv(type);
-    /* Obtain ray headers - needed for bin counts. Note: binary output skips empty rays. Text output prints
-     * them as num_bins*"NAN". */
-    int rh_skt_fd = SigmetRaw_DmnConnect(path, &err_msg);
-    if (rh_skt_fd == -1) {
-	fprintf(stderr, "%s failed to connect to sigmet_raw daemon at %s. %s\n",
+    struct SigmetRaw_ShmVol * vol = SigmetRaw_ShmAttach(dir, path, 0, &err_msg);
+    if (vol == NULL) {
+	fprintf(stderr, "%s: could not get volume %s from volume store. %s\n",
 		cmd, path, err_msg.str);
 	exit(EXIT_FAILURE);
     }
-    int rh_pipe[2];			/* Ray headers will appear here. */
-    if (pipe(rh_pipe) == -1) {
-	fprintf(stderr, "%s could not create pipe to read ray headers from daemon at socket %s."
-		" %s.\n", cmd, path, strerror(errno));
+    const struct Sigmet_VolHdr * vol_hdr_p = SigmetRaw_ShmVolHdr(vol);
+    int num_swps = SigmetRaw_ShmNumSwps(vol);
+    if (s < 0 || s >= num_swps) {
+	fprintf(stderr, "%s: sweep index %d out of range. Volume has %d sweeps.\n",
+		cmd, s, num_swps);
 	exit(EXIT_FAILURE);
     }
-    FILE *rh_fl = fdopen(rh_pipe[0], "r");
-    if (rh_fl == NULL) {
-	fprintf(stderr, "%s could not configure pipe to read ray headers from daemon "
-		"at socket %s. %s.\n", cmd, path, strerror(errno));
+    unsigned num_rays = SigmetRaw_ShmNumRays(vol);
+    int y = Sigmet_VolTypeIdx(type, vol_hdr_p);
+    if (y == -1) {
+	fprintf(stderr, "%s: %s data type is not in volume at %s.\n",
+		cmd, Sigmet_DataTypeAbbrv(type), path);
 	exit(EXIT_FAILURE);
     }
-    int rh_err_pipe[2];			/* Ray header transfer error channel */
-    if (pipe(rh_err_pipe) == -1) {
-	fprintf(stderr, "%s could not create pipe to read ray header error information from "
-		"daemon at socket %s. %s.\n", cmd, path, strerror(errno));
-	exit(EXIT_FAILURE);
+    int num_bins_max = 0;
+    for (unsigned r = 0; r < num_rays; r++) {
+	const struct Sigmet_RayHdr * ray_hdr = SigmetRaw_ShmRayHdr(vol, s, r, y);
+	if (SigmetRaw_ShmRay(vol, s, r, y) != NULL && ray_hdr->num_bins > num_bins_max) {
+	    num_bins_max = ray_hdr->num_bins;
+	}
     }
-    /* Send request message for ray headers */
-    struct SigmetRaw_Rqst rh_rqst = SigmetRaw_Rqst_Init();
-    SigmetRaw_Rqst_Set_SubCmd(&rh_rqst, SigmetRawRayHeaders);
-    SigmetRaw_Rqst_Set_Swp(&rh_rqst, s);
-    SigmetRaw_Rqst_Set_DataType(&rh_rqst, abbrv);
-    SigmetRaw_Rqst_Set_ShFD(&rh_rqst, rh_pipe[1]);
-    SigmetRaw_Rqst_Set_ErrFD(&rh_rqst, rh_err_pipe[1]);
-    if ( !SigmetRaw_Rqst_Send(rh_skt_fd, &rh_rqst, &err_msg) ) {
-	fprintf(stderr, "%s failed to request ray headers from daemon at socket %s. %s.\n",
-		cmd, path, err_msg.str);
+    if (num_bins_max == 0) {
+	fprintf(stderr, "%s: raw product file %s has no data.\n", cmd, path);
 	exit(EXIT_FAILURE);
     }
-    /* Get daemon response, which should provide status, ray count, type count, and type index. */
-    enum SigmetRaw_Status rh_stat = SigmetRawError;
-    unsigned num_swps = -1;		/* Not used in this subcommand. Daemon sends it anyway. */
-    unsigned num_rays = -1;
-    char tz[SIGMET_TZ_STRLEN] = {'\0'};
-    struct msghdr rh_rps = {
-	.msg_iov = (struct iovec [4]){
-	    [0] = { .iov_base = &rh_stat,   .iov_len = sizeof rh_stat },
-	    [1] = { .iov_base = &num_swps,  .iov_len = sizeof num_swps },
-	    [2] = { .iov_base = &num_rays,  .iov_len = sizeof num_rays },
-	    [3] = { .iov_base = tz,         .iov_len = SIGMET_TZ_STRLEN }
-	},
-	.msg_iovlen = 4
-    };
-    if (recvmsg(rh_skt_fd, &rh_rps, 0) == -1) {
-	fprintf(stderr, "%s: when requesting ray headers could not get response from daemon "
-		"at %s. %s.\n", cmd, path, strerror(errno));
+    const char * fmt = Sigmet_DataType_PrintFmt(type);
+    uint32_t * bits = calloc(SigmetRaw_BitsNumWds(num_bins_max), sizeof *bits);
+    if (fmt == NULL || bits == NULL) {
+	fprintf(stderr, "%s: could not set up output for data type %s.\n",
+		cmd, Sigmet_DataTypeAbbrv(type));
 	exit(EXIT_FAILURE);
     }
-    close(rh_pipe[1]);		/* Daemon writes to pipe. This process reads from pipe. */
-    close(rh_err_pipe[1]);
-    close(rh_skt_fd);		/* Done with socket */
-    if (rh_stat != SigmetRawOkay) {
-	fprintf(stderr, "%s failed for %s. ", cmd, path);
-	FILE * err = fdopen(rh_err_pipe[0], "r");
-	if (err == NULL) {
-	    fprintf(stderr, "%s when requesting ray headers could not configure pipe to read "
-		    "error information from daemon at socket %s. %s.\n",
-		    cmd, path, strerror(errno));
+    if (pyr_p->lvl > 0) {
+	float * grid = malloc((size_t)num_rays * num_bins_max * sizeof *grid);
+	if (grid == NULL) {
+	    fprintf(stderr, "%s: could not allocate memory for %u x %d sweep.\n",
+		    cmd, num_rays, num_bins_max);
 	    exit(EXIT_FAILURE);
 	}
-	/* Copy error information from error channel to stderr. */
-	for (int c = fgetc(err); c != EOF; c = fgetc(err)) {
-	    fputc(c, stderr);
+	for (unsigned r = 0; r < num_rays; r++) {
+	    const float * dat = SigmetRaw_ShmRay(vol, s, r, y);
+	    int nb = (dat != NULL) ? SigmetRaw_ShmRayHdr(vol, s, r, y)->num_bins : 0;
+	    float * g = grid + (size_t)r * num_bins_max;
+	    for (int b = 0; b < num_bins_max; b++) {
+		g[b] = (b < nb) ? dat[b] : NAN;
+	    }
+	}
+	SigmetRaw_ShmDetach(vol);
+	pyr_print(grid, num_rays, num_bins_max, pyr_p, out_fmt, fmt, cmd);
+	exit(EXIT_SUCCESS);
+    }
+    for (unsigned r = 0; r < num_rays; r++) {
+	const float * dat = SigmetRaw_ShmRay(vol, s, r, y);
+	int nb = (dat != NULL) ? SigmetRaw_ShmRayHdr(vol, s, r, y)->num_bins : -1;
+	switch (out_fmt) {
+	    case DataTxt:
+		for (int b = 0; b < num_bins_max; b++) {
+		    printf(fmt, (b < nb) ? dat[b] : NAN);
+		}
+		printf("\n");
+		break;
+	    case DataBin:
+		if (nb >= 0) {
+		    fwrite(dat, sizeof *dat, nb, stdout);
+		}
+		break;
+	    case DataBits:
+		if (nb >= 0) {
+		    SigmetRaw_BitsValid(nb, dat, bits);
+		    fwrite(bits, sizeof *bits, SigmetRaw_BitsNumWds(nb), stdout);
+		}
+		break;
 	}
-	fputc('\n', stderr);
-	exit(EXIT_FAILURE);
-    }
-    close(rh_err_pipe[0]);
-    if (num_rays == 0) {
-	fprintf(stderr, "%s: got impossible ray count (%d) from daemon at socket %s.\n",
-		cmd, num_rays, path);
-	exit(EXIT_FAILURE);
-    }
-    /* Allocate ray headers and read from daemon via pipe. */
-    struct SigmetRaw_RayHdr * wray_hdrs = NULL;
-    wray_hdrs = calloc(num_rays, sizeof *wray_hdrs);
-    if (wray_hdrs == NULL) {
-	fprintf(stderr, "%s could not allocate memory for %d rays headers from daemon at socket %s\n",
-		cmd, num_rays, path);
-	exit(EXIT_FAILURE);
-    }
-    if (fread(wray_hdrs, sizeof wray_hdrs[0], num_rays, rh_fl) != (size_t)num_rays) {
-	fprintf(stderr, "%s: could not read ray headers from daemon at socket %s\n.", cmd, path);
-	exit(EXIT_FAILURE);
     }
-    fclose(rh_fl);
-    /* Allocate data array with space for all of the data bins in sweep. */
-    size_t num_bins_tot = 0;
-    for (int r = 0; r < num_rays; r++) {
-	num_bins_tot += wray_hdrs[r].ray_hdr.num_bins;
+    SigmetRaw_ShmDetach(vol);
+    exit(EXIT_SUCCESS);
+}
+
+/* Print pyramid level pyr_p->lvl of the num_rays by num_bins sweep at grid, which this function
+ * may overwrite, as text with print format fmt or native binary as selected by out_fmt. */
+static void pyr_print(float * grid, unsigned num_rays, unsigned num_bins,
+	const struct SigmetRaw_PyrSel * pyr_p, enum Data_OutFmt out_fmt, const char * fmt,
+	const char * cmd)
+{
+    size_t n = (size_t)SigmetRaw_PyrHalf(num_rays) * SigmetRaw_PyrHalf(num_bins);
+    float * lvl = malloc(n * sizeof *lvl);
+    float * wt = NULL, * wt1 = NULL;
+    if (pyr_p->mode == SigmetRawPyrMean) {
+	wt = malloc(n * sizeof *wt);
+	wt1 = malloc(n * sizeof *wt1);
+    }
+    if (lvl == NULL || (pyr_p->mode == SigmetRawPyrMean && (wt == NULL || wt1 == NULL))) {
+	fprintf(stderr, "%s: could not allocate memory for pyramid level.\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    /* Alternate between grid and lvl, and between the weight buffers. */
+    const float * src_wt = NULL;
+    for (int l = 0; l < pyr_p->lvl; l++) {
+	SigmetRaw_PyrDecimate(num_rays, num_bins, grid, src_wt, pyr_p->mode, lvl, wt);
+	float * t = grid;
+	grid = lvl;
+	lvl = t;
+	src_wt = wt;
+	t = wt1;
+	wt1 = wt;
+	wt = t;
+	num_rays = SigmetRaw_PyrHalf(num_rays);
+	num_bins = SigmetRaw_PyrHalf(num_bins);
+    }
+    if (out_fmt == DataTxt) {
+	if (fmt == NULL) {
+	    fprintf(stderr, "%s: could not obtain print format.\n", cmd);
+	    exit(EXIT_FAILURE);
+	}
+	for (unsigned r = 0; r < num_rays; r++) {
+	    for (unsigned b = 0; b < num_bins; b++) {
+		printf(fmt, grid[(size_t)r * num_bins + b]);
+	    }
+	    printf("\n");
+	}
+    } else {
+	fwrite(grid, sizeof *grid, (size_t)num_rays * num_bins, stdout);
     }
-    float * dat = calloc(num_bins_tot, sizeof(float));
-    if (dat == NULL) {
-	fprintf(stderr, "%s %s %d: could not allocate memory for array of %zu data values "
-		"from daemon at socket %s.", cmd, abbrv, s, num_bins_tot, path);
+}
+
+/* Obtain ray headers and sweep data for data type type, sweep s, from sigmet_raw daemon monitoring
+ * socket at path. Ray headers provide data dimensions. Print the sweep data to standard output as text.
+ * If expr_src is not NULL, request values of the expression instead, in which case type should be
+ * the first data type in the expression. If pyr_p selects a level above 0, request and print that
+ * pyramid level. cmd is for error messages. */
+static void skt_to_txt(const char * path, const struct Sigmet_DataType * type, const char * expr_src,
+	int s, const struct SigmetRaw_PyrSel * pyr_p, const char * cmd)
+{
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    errno = 0;
+    const char * abbrv = Sigmet_DataTypeAbbrv(type);
+    const char * fmt = (expr_src != NULL) ? EXPR_PRINT_FMT : Sigmet_DataType_PrintFmt(type);
+    if (fmt == NULL) {
+	fprintf(stderr, "%s: could not obtain print format for data type %s in daemon at socket %s.\n",
+		cmd, abbrv, path);
 	exit(EXIT_FAILURE);
     }
-    for (size_t b = 0; b < num_bins_tot; b++) {
-	dat[b] = NAN;
-    }
-    /* Obtain data from pipe shared with daemon */
-    int dat_skt_fd = SigmetRaw_DmnConnect(path, &err_msg);
-    if (dat_skt_fd == -1) {
+    int vsn = SigmetRaw_DmnProto(path, &err_msg);
+    if (vsn == 0) {
 	fprintf(stderr, "%s failed to connect to sigmet_raw daemon at %s. %s\n",
 		cmd, path, err_msg.str);
 	exit(EXIT_FAILURE);
     }
-    int dat_pipe[2];
-    if (pipe(dat_pipe) == -1) {
-	fprintf(stderr, "%s could not create pipe to daemon at socket %s. %s.\n",
-		cmd, path, strerror(errno));
-	exit(EXIT_FAILURE);
-    }
-    FILE * dat_fl = fdopen(dat_pipe[0], "r");
-    if (dat_fl == NULL) {
-	fprintf(stderr, "%s could not configure pipe to read from daemon at socket %s. %s.\n",
-		cmd, path, strerror(errno));
-	exit(EXIT_FAILURE);
-    }
-    /* Error channel for data. Daemon will write error messages to it. */
-    int dat_err_fd[2];
-    if (pipe(dat_err_fd) == -1) {
-	fprintf(stderr, "%s could not create pipe to read error information from daemon at "
-		"socket %s. %s.\n", cmd, path, strerror(errno));
-	exit(EXIT_FAILURE);
-    }
-    /* Send request message for data */
-    struct SigmetRaw_Rqst dat_rqst = SigmetRaw_Rqst_Init();
-    SigmetRaw_Rqst_Set_SubCmd(&dat_rqst, SigmetRawData);
-    SigmetRaw_Rqst_Set_DataType(&dat_rqst, abbrv);
-    SigmetRaw_Rqst_Set_Swp(&dat_rqst, s);
-    SigmetRaw_Rqst_Set_ShFD(&dat_rqst, dat_pipe[1]);
-    SigmetRaw_Rqst_Set_ErrFD(&dat_rqst, dat_err_fd[1]);
-    if ( !SigmetRaw_Rqst_Send(dat_skt_fd, &dat_rqst, &err_msg) ) {
-	fprintf(stderr, "%s failed to request ray headers from daemon at socket %s. %s.\n",
-		cmd, path, err_msg.str);
-	exit(EXIT_FAILURE);
-    }
-    /* Get daemon response. */
-    enum SigmetRaw_Status dat_stat = SigmetRawError;
-    struct msghdr dat_rps = {
-	.msg_iov = (struct iovec [1]){
-	    [0] = { .iov_base = &dat_stat, .iov_len = sizeof dat_stat }
-	},
-	.msg_iovlen = 1
-    };
-    if (recvmsg(dat_skt_fd, &dat_rps, 0) == -1) {
-	fprintf(stderr, "%s: could not get response from daemon at %s. %s.\n",
-		cmd, path, strerror(errno));
+    if (vsn == 1 && (expr_src != NULL || pyr_p->lvl > 0)) {
+	fprintf(stderr, "%s: daemon at %s does not support expressions or pyramid levels.\n",
+		cmd, path);
 	exit(EXIT_FAILURE);
     }
-    close(dat_pipe[1]);		/* Daemon writes to pipe. This process only reads from it. */
-    close(dat_err_fd[1]);
-    close(dat_skt_fd);		/* Done with socket. */
-    /* Check status for data read request */
-    if (dat_stat != SigmetRawOkay) {
-	fprintf(stderr, "%s failed for daemon at socket %s. ", cmd, path);
-	/* Request failed. Copy error information from error channel to stderr. */
-	FILE * err = fdopen(dat_err_fd[0], "r");
-	if (err == NULL) {
-	    fprintf(stderr, "%s could not configure pipe to read error information from daemon "
-		    "at socket %s. %s.\n", cmd, path, strerror(errno));
+    /* Ray headers are needed for bin counts. Note: binary output skips empty rays. Text output
+     * prints them as num_bins*"NAN". */
+    const struct SigmetRaw_RayHdr * wray_hdrs;
+    unsigned num_rays;
+    float * dat;
+    size_t num_bins_tot;
+    if (vsn == 1) {
+	/* Daemon only speaks protocol version 1, one request per connection. */
+	struct SigmetRaw_RayHdr * wray_hdrs1;
+	if ( !SigmetRaw_Dmn_SwpDat1(path, abbrv, s, &wray_hdrs1, &num_rays, &dat, &num_bins_tot,
+		    &err_msg) ) {
+	    fprintf(stderr, "%s failed for daemon at socket %s. %s\n", cmd, path, err_msg.str);
 	    exit(EXIT_FAILURE);
 	}
-	for (int c = fgetc(err); c != EOF; c = fgetc(err)) {
-	    fputc(c, stderr);
+	wray_hdrs = wray_hdrs1;
+    } else {
+	int skt_fd = SigmetRaw_DmnConnect(path, &err_msg);
+	if (skt_fd == -1) {
+	    fprintf(stderr, "%s failed to connect to sigmet_raw daemon at %s. %s\n",
+		    cmd, path, err_msg.str);
+	    exit(EXIT_FAILURE);
 	}
-	fputc('\n', stderr);
-	exit(EXIT_FAILURE);
-    }
-    close(dat_err_fd[0]);
-    /* Read the sweep data */
-    if (fread(dat, sizeof *dat, num_bins_tot, dat_fl) != num_bins_tot) {
-	fprintf(stderr, "%s: could not read %s data for sweep %d from sigmet_raw daemon "
-		"at socket %s.\n", cmd, abbrv, s, path);
-	exit(EXIT_FAILURE);
+	struct SigmetRaw_Rqst dat_rqst = SigmetRaw_Rqst_Init();
+	SigmetRaw_Rqst_Set_SubCmd(&dat_rqst, (expr_src != NULL) ? SigmetRawExpr : SigmetRawData);
+	SigmetRaw_Rqst_Set_DataType(&dat_rqst, abbrv);
+	SigmetRaw_Rqst_Set_Swp(&dat_rqst, s);
+	if (expr_src != NULL) {
+	    SigmetRaw_Rqst_Set_Expr(&dat_rqst, expr_src);
+	}
+	if (pyr_p->lvl > 0) {
+	    /* Pyramid levels are regular grids, so they do not need ray headers. */
+	    SigmetRaw_Rqst_Set_Pyr(&dat_rqst, pyr_p->lvl, pyr_p->mode);
+	    unsigned num_bins;
+	    if ( !SigmetRaw_Dmn_PyrDat(skt_fd, &dat_rqst, &num_rays, &num_bins, &dat,
+			&err_msg) ) {
+		fprintf(stderr, "%s failed for daemon at socket %s. %s\n",
+			cmd, path, err_msg.str);
+		exit(EXIT_FAILURE);
+	    }
+	    close(skt_fd);
+	    for (unsigned r = 0; r < num_rays; r++) {
+		for (unsigned b = 0; b < num_bins; b++) {
+		    printf(fmt, *dat++);
+		}
+		printf("\n");
+	    }
+	    exit(EXIT_SUCCESS);
+	}
+	/* Ray headers come from a cache checked against the volume generation in the data
+	 * response. Clients that keep the cache, e.g. multi, only ask for them again when the
+	 * daemon's volume changes. */
+	struct SigmetRaw_RhCache * rh_cache = SigmetRaw_RhCacheInit(1, &err_msg);
+	if (rh_cache == NULL) {
+	    fprintf(stderr, "%s: %s\n", cmd, err_msg.str);
+	    exit(EXIT_FAILURE);
+	}
+	if ( !SigmetRaw_Dmn_SwpDat(skt_fd, &dat_rqst, rh_cache, &wray_hdrs, &num_rays,
+		    &dat, &num_bins_tot, &err_msg) ) {
+	    fprintf(stderr, "%s failed for daemon at socket %s. %s\n", cmd, path, err_msg.str);
+	    exit(EXIT_FAILURE);
+	}
+	close(skt_fd);			/* Done with socket. */
     }
-    fclose(dat_fl);
     /* Write the data */
     int num_bins_max = 0;		/* Use bin count for sweep, not volume. */
-    for (int r = 0; r < num_rays; r++) {
+    for (unsigned r = 0; r < num_rays; r++) {
 	if (wray_hdrs[r].ray_hdr.num_bins > num_bins_max) {
 	    num_bins_max = wray_hdrs[r].ray_hdr.num_bins;
 	}
     }
-    const char * fmt = Sigmet_DataType_PrintFmt(type);
-    if (fmt == NULL) {
-	fprintf(stderr, "%s: could not obtain print format for data type %s in daemon at socket %s.\n",
-		cmd, abbrv, path);
-	exit(EXIT_FAILURE);
-    }
-    for (int r = 0; r < num_rays; r++) {
+    for (unsigned r = 0; r < num_rays; r++) {
 	int b = 0;
 	for ( ; b < wray_hdrs[r].ray_hdr.num_bins; b++) {
 	    printf(fmt, *dat++);
@@ -423,8 +733,13 @@ static void skt_to_txt(const char * path, const struct Sigmet_DataType * type, i
 }
 
 /* Request sigmet_raw daemon at path send sweep data for data type type, sweep s to standard output
-   of this process in native binary. */
-static void skt_to_bin(const char * path, const struct Sigmet_DataType * type, int s, const char * cmd)
+   of this process in native binary. sub_cmd should be SigmetRawData for float values,
+   SigmetRawExpr for values of expression expr_src, or SigmetRawValidBits for valid gate bitmaps
+   of data type type or, if expr_src is not NULL, of expr_src. pyr_p selects a pyramid level for
+   float values. */
+static void skt_to_bin(const char * path, enum SigmetRaw_SubCmdN sub_cmd,
+	const struct Sigmet_DataType * type, const char * expr_src, int s,
+	const struct SigmetRaw_PyrSel * pyr_p, const char * cmd)
 {
     struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
     errno = 0;
@@ -435,22 +750,44 @@ static void skt_to_bin(const char * path, const struct Sigmet_DataType * type, i
 		cmd, path, err_msg.str);
 	exit(EXIT_FAILURE);
     }
-    /* Error channel. */
-    int err_pipe[2];
+    struct SigmetRaw_Rqst rqst = SigmetRaw_Rqst_Init();
+    SigmetRaw_Rqst_Set_SubCmd(&rqst, sub_cmd);
+    SigmetRaw_Rqst_Set_DataType(&rqst, abbrv);
+    SigmetRaw_Rqst_Set_Swp(&rqst, s);
+    SigmetRaw_Rqst_Set_ShFD(&rqst, STDOUT_FILENO);
+    if (expr_src != NULL || pyr_p->lvl > 0) {
+	/* Expression and pyramid level only travel in protocol version 2 requests. The daemon
+	 * streams data to standard output of this process, then responds. */
+	if (expr_src != NULL) {
+	    SigmetRaw_Rqst_Set_Expr(&rqst, expr_src);
+	}
+	SigmetRaw_Rqst_Set_Pyr(&rqst, pyr_p->lvl, pyr_p->mode);
+	if ( !SigmetRaw_Rqst2_Send(skt_fd, &rqst, &err_msg) ) {
+	    fprintf(stderr, "%s failed to request data from daemon at socket %s. %s.\n",
+		    cmd, path, err_msg.str);
+	    exit(EXIT_FAILURE);
+	}
+	struct SigmetRaw_Rps2Hdr rps;
+	void * buf;
+	size_t buf_sz;
+	int status = SigmetRaw_Rps2_Recv(skt_fd, &rps, &buf, &buf_sz, &err_msg);
+	free(buf);
+	if ( !status ) {
+	    fprintf(stderr, "%s failed for daemon at socket %s. %s\n", cmd, path, err_msg.str);
+	    exit(EXIT_FAILURE);
+	}
+	exit(EXIT_SUCCESS);
+    }
+    /* Plain requests use protocol version 1, which every daemon understands. */
+    int err_pipe[2];			/* Error channel. */
     if (pipe(err_pipe) == -1) {
 	fprintf(stderr, "%s could not create pipe to read error information from daemon at "
 		"socket %s. %s.\n", cmd, path, strerror(errno));
 	exit(EXIT_FAILURE);
     }
-    /* Send request message */
-    struct SigmetRaw_Rqst rqst = SigmetRaw_Rqst_Init();
-    SigmetRaw_Rqst_Set_SubCmd(&rqst, SigmetRawData);
-    SigmetRaw_Rqst_Set_DataType(&rqst, abbrv);
-    SigmetRaw_Rqst_Set_Swp(&rqst, s);
-    SigmetRaw_Rqst_Set_ShFD(&rqst, STDOUT_FILENO);
     SigmetRaw_Rqst_Set_ErrFD(&rqst, err_pipe[1]);
     if ( !SigmetRaw_Rqst_Send(skt_fd, &rqst, &err_msg) ) {
-	fprintf(stderr, "%s failed to request ray headers from daemon at socket %s. %s.\n",
+	fprintf(stderr, "%s failed to request data from daemon at socket %s. %s.\n",
 		cmd, path, err_msg.str);
 	exit(EXIT_FAILURE);
     }
@@ -0,0 +1,183 @@
+/*
+ *	geom.c --
+ *		Print beam height or beam blockage for a sweep. See sigmet_raw (1).
+ *	--
+ *
+ *	Usage: geom [-k] [-a num_az] [-t num_threads] dem_file sweep_index|all raw_product_file
+ *
+ *	Prints beam height above sea level in meters, or with -k, fraction of the beam blocked by
+ *	terrain in elevation model dem_file, an ESRI ASCII grid, for each gate of the sweep, one
+ *	line per ray, one value per bin, lined up with "data data_type sweep_index ..." output.
+ *	With "all", prints tables for all sweeps read, one after another. Sweeps without tables,
+ *	e.g. past the first SIGMETRAW_GEOM_MAX_SWPS, print NAN.
+ *
+ *	Tables for the site and scan strategy of the volume come from the geometry cache at
+ *	$SIGMETRAW_GEOM, or a default directory if it is not set. If they are not cached, they are
+ *	computed on num_threads threads, default one per processor, and added to the cache, so
+ *	later volumes with the same scan strategy skip the computation. Blockage tables have
+ *	num_az azimuth cells, default 720. See sigmet_raw_geom.c.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <libgen.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define DFLT_NUM_AZ 720
+#define DEG_PER_RAD ((double)57.29577951308232087648)
+
+int main(int argc, char *argv[])
+{
+    /* If set, use $APP_NAME in error messages instead of argv[0]. */
+    char *cmd = getenv("APP_NAME") ? getenv("APP_NAME") : basename(argv[0]);
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    _Bool blk = 0;
+    unsigned num_az = DFLT_NUM_AZ;
+    unsigned num_threads = 0;
+    int a = 1;
+    while (a < argc && argv[a][0] == '-') {
+	if (strcmp(argv[a], "-k") == 0) {
+	    blk = 1;
+	    a++;
+	} else if (strcmp(argv[a], "-a") == 0 && a + 1 < argc) {
+	    if (sscanf(argv[a + 1], "%u", &num_az) != 1
+		    || num_az == 0 || num_az > SIGMETRAW_AZGRID_MAX_AZ) {
+		fprintf(stderr, "%s: expected azimuth count 1 to %d, got %s\n",
+			cmd, SIGMETRAW_AZGRID_MAX_AZ, argv[a + 1]);
+		exit(EXIT_FAILURE);
+	    }
+	    a += 2;
+	} else if (strcmp(argv[a], "-t") == 0 && a + 1 < argc) {
+	    if (sscanf(argv[a + 1], "%u", &num_threads) != 1) {
+		fprintf(stderr, "%s: expected integer for thread count, got %s\n",
+			cmd, argv[a + 1]);
+		exit(EXIT_FAILURE);
+	    }
+	    a += 2;
+	} else {
+	    break;
+	}
+    }
+    if (argc - a != 3) {
+	fprintf(stderr, "Usage: %s [-k] [-a num_az] [-t num_threads] dem_file sweep_index|all "
+		"raw_product_file\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    char * dem_path = argv[a];
+    char * s_s = argv[a + 1];
+    char * path = argv[a + 2];
+    int s = -1;				/* -1 => all */
+    if (strcmp(s_s, "all") != 0 && sscanf(s_s, "%d", &s) != 1) {
+	fprintf(stderr, "%s: expected integer or \"all\" for sweep index, got %s\n", cmd, s_s);
+	exit(EXIT_FAILURE);
+    }
+
+    /* Read volume. Ray headers come from the first data type. */
+    FILE * vol_fl = fopen(path, "r");
+    if (vol_fl == NULL) {
+	fprintf(stderr, "%s: could not open file. %s\n", cmd, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    struct Sigmet_VolHdr vol_hdr;
+    memset(&vol_hdr, 0, sizeof vol_hdr);
+    if ( !Sigmet_VolReadVHdr(vol_fl, &vol_hdr, &err_msg) ) {
+	fclose(vol_fl);
+	fprintf(stderr, "%s: could not read volume headers from %s. %s\n", cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    int num_swps = Sigmet_VolNumSwps(&vol_hdr);
+    if (s < -1 || s >= num_swps) {
+	fprintf(stderr, "%s: sweep index %d out of range. Volume has %d sweeps.\n",
+		cmd, s, num_swps);
+	exit(EXIT_FAILURE);
+    }
+    int num_rays = Sigmet_VolNumRays(&vol_hdr);
+    int num_types = Sigmet_VolNumTypes(&vol_hdr);
+    struct Sigmet_SwpHdr * swp_hdrs = calloc(num_swps, sizeof *swp_hdrs);
+    struct Sigmet_Ray (*rays)[num_rays][num_types] = calloc(num_swps, sizeof *rays);
+    if (swp_hdrs == NULL || rays == NULL) {
+	fprintf(stderr, "%s could not allocate memory for array of  %d by %d ray structures "
+		"from raw product file %s\n", cmd, num_swps, num_rays, path);
+	exit(EXIT_FAILURE);
+    }
+    size_t dat_buf_sz = Sigmet_VolIDatSz(&vol_hdr, &err_msg);
+    if (dat_buf_sz == 0) {
+	fprintf(stderr, "%s: could not determine size of input data buffer. %s\n", cmd, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    void * dat_buf = malloc(dat_buf_sz);
+    if (dat_buf == NULL) {
+	fprintf(stderr, "%s: could not allocate memory for %zu bytes of data.\n", cmd, dat_buf_sz);
+	exit(EXIT_FAILURE);
+    }
+    int rd = Sigmet_VolReadDat(vol_fl, &vol_hdr, num_swps, num_rays, num_types, swp_hdrs,
+	    rays, dat_buf_sz, dat_buf, &err_msg);
+    fclose(vol_fl);
+    if (rd == 0) {
+	fprintf(stderr, "%s: volume at %s has no data. %s\n", cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+
+    /* Tables for the scan strategy, from the cache if possible */
+    struct SigmetRaw_GeomKey key;
+    if ( !SigmetRaw_GeomKeyFmVol(&vol_hdr, swp_hdrs, rd, num_az, &key, &err_msg) ) {
+	fprintf(stderr, "%s: could not get scan geometry for %s. %s\n", cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    struct SigmetRaw_Geom * geom = SigmetRaw_GeomGet(getenv("SIGMETRAW_GEOM"), &key, dem_path,
+	    num_threads, &err_msg);
+    if (geom == NULL) {
+	fprintf(stderr, "%s: could not get beam geometry tables. %s\n", cmd, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+
+    /* Print. As in data output, each line has the maximum bin count in the sweep's ray headers,
+     * with NAN past the end of a ray or the tables. */
+    if (s >= rd) {
+	fprintf(stderr, "%s: sweep %d not in %s. Volume has data for %d sweeps.\n",
+		cmd, s, path, rd);
+	exit(EXIT_FAILURE);
+    }
+    int s0 = (s == -1) ? 0 : s, s1 = (s == -1) ? rd : s + 1;
+    for (int ss = s0; ss < s1; ss++) {
+	int g_s = SigmetRaw_GeomSwp(geom, swp_hdrs[ss].angl);
+	if (g_s == -1) {
+	    fprintf(stderr, "%s: warning: no tables for sweep %d at %.1f degrees.\n",
+		    cmd, ss, swp_hdrs[ss].angl * DEG_PER_RAD);
+	}
+	const float * ht = (g_s != -1) ? SigmetRaw_GeomHt(geom, g_s) : NULL;
+	int num_bins_max = 0;
+	for (int r = 0; r < num_rays; r++) {
+	    int nb = rays[ss][r][0].ray_hdr.num_bins;
+	    num_bins_max = (nb > num_bins_max) ? nb : num_bins_max;
+	}
+	for (int r = 0; r < num_rays; r++) {
+	    const struct Sigmet_Ray * ray = &rays[ss][r][0];
+	    int nb = (ray->dat != NULL && g_s != -1) ? ray->ray_hdr.num_bins : 0;
+	    nb = (nb < (int)key.num_bins) ? nb : (int)key.num_bins;
+	    const uint8_t * b_blk = (blk && nb > 0)
+		? SigmetRaw_GeomBlk(geom, g_s, ray->ray_hdr.az0, ray->ray_hdr.az1) : NULL;
+	    for (int b = 0; b < num_bins_max; b++) {
+		if (b >= nb) {
+		    printf("%g ", NAN);
+		} else if (blk) {
+		    printf("%.3f ", b_blk[b] / 255.0);
+		} else {
+		    printf("%.1f ", ht[b]);
+		}
+	    }
+	    printf("\n");
+	}
+    }
+    SigmetRaw_GeomFree(geom);
+    exit(EXIT_SUCCESS);
+}
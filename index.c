@@ -0,0 +1,192 @@
+/*
+ *	index.c --
+ *		Build sidecar indexes for raw product files, and use them to select files and sweeps
+ *		that might satisfy a predicate. See sigmet_raw (1) and sigmet_raw_index.c.
+ *	--
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <libgen.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+static int idx_build(const char *, const char *);
+static void idx_select(const char *, const char *, float, float, const char *);
+
+int main(int argc, char *argv[])
+{
+    /* If set, use $APP_NAME in error messages instead of argv[0]. */
+    char *cmd = getenv("APP_NAME") ? getenv("APP_NAME") : basename(argv[0]);
+    if (argc >= 6 && strcmp(argv[1], "-q") == 0) {
+	/* Select: index -q data_type threshold max_range_km raw_product_file ... */
+	char * abbrv = argv[2];
+	if (Sigmet_DataTypeGet(abbrv) == NULL) {
+	    fprintf(stderr, "%s: %s is not a Sigmet data type.\n", cmd, abbrv);
+	    exit(EXIT_FAILURE);
+	}
+	float thresh, max_rng;
+	if (sscanf(argv[3], "%f", &thresh) != 1) {
+	    fprintf(stderr, "%s: expected float value for threshold, got %s\n", cmd, argv[3]);
+	    exit(EXIT_FAILURE);
+	}
+	if (sscanf(argv[4], "%f", &max_rng) != 1) {
+	    fprintf(stderr, "%s: expected float value for maximum range, got %s\n", cmd, argv[4]);
+	    exit(EXIT_FAILURE);
+	}
+	for (int a = 5; a < argc; a++) {
+	    idx_select(argv[a], abbrv, thresh, max_rng * 1000.0f, cmd);
+	}
+	exit(EXIT_SUCCESS);
+    } else if (argc >= 2 && argv[1][0] != '-') {
+	/* Build: index raw_product_file ... */
+	int status = EXIT_SUCCESS;
+	for (int a = 1; a < argc; a++) {
+	    if ( !idx_build(argv[a], cmd) ) {
+		status = EXIT_FAILURE;
+	    }
+	}
+	exit(status);
+    }
+    fprintf(stderr, "Usage: %s raw_product_file ...\n"
+	    "       %s -q data_type threshold max_range_km raw_product_file ...\n", cmd, cmd);
+    exit(EXIT_FAILURE);
+}
+
+/* Read raw product file at path and write its index to path.idx. cmd is for error messages.
+ * Return 1/0 on success/failure. */
+static int idx_build(const char * path, const char * cmd)
+{
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    struct stat st_buf;
+    if (stat(path, &st_buf) == -1) {
+	fprintf(stderr, "%s: could not get information about %s. %s\n", cmd, path, strerror(errno));
+	return 0;
+    }
+    char idx_path[PATH_MAX];
+    if ( !SigmetRaw_IdxPath(idx_path, sizeof idx_path, path) ) {
+	fprintf(stderr, "%s: index path for %s is too long.\n", cmd, path);
+	return 0;
+    }
+    FILE *vol_fl = fopen(path, "r");
+    if (vol_fl == NULL) {
+	fprintf(stderr, "%s: could not open raw product file %s. %s\n", cmd, path, strerror(errno));
+	return 0;
+    }
+    struct Sigmet_VolHdr vol_hdr = {0};
+    if ( !Sigmet_VolReadVHdr(vol_fl, &vol_hdr, &err_msg) ) {
+	fclose(vol_fl);
+	fprintf(stderr, "%s: could not read volume headers from %s. %s\n", cmd, path, err_msg.str);
+	return 0;
+    }
+    unsigned num_swps = Sigmet_VolNumSwps(&vol_hdr);
+    unsigned num_rays = Sigmet_VolNumRays(&vol_hdr);
+    unsigned num_types = Sigmet_VolNumTypes(&vol_hdr);
+    struct Sigmet_Ray (*rays)[num_rays][num_types] = calloc(num_swps, sizeof *rays);
+    if (rays == NULL) {
+	fclose(vol_fl);
+	fprintf(stderr, "%s could not allocate memory for array of  %d by %d ray structures "
+		"from raw product file %s\n", cmd, num_swps, num_rays, path);
+	return 0;
+    }
+    size_t dat_buf_sz = Sigmet_VolIDatSz(&vol_hdr, &err_msg);
+    void * dat_buf = (dat_buf_sz > 0) ? malloc(dat_buf_sz) : NULL;
+    if (dat_buf == NULL) {
+	fclose(vol_fl);
+	fprintf(stderr, "%s: could not allocate input data buffer for %s. %s\n",
+		cmd, path, err_msg.str);
+	free(rays);
+	return 0;
+    }
+    int rd = Sigmet_VolReadDat(vol_fl, &vol_hdr, num_swps, num_rays, num_types, NULL,
+	    rays, dat_buf_sz, dat_buf, &err_msg);
+    fclose(vol_fl);
+    int status = 0;
+    struct SigmetRaw_Idx idx;
+    if (rd == 0) {
+	fprintf(stderr, "%s: volume at %s has no data. %s\n", cmd, path, err_msg.str);
+    } else if ( !SigmetRaw_IdxBuild(&idx, &vol_hdr, num_swps, num_rays, num_types, rays, &err_msg) ) {
+	fprintf(stderr, "%s: could not build index for %s. %s\n", cmd, path, err_msg.str);
+    } else {
+	FILE * idx_fl = fopen(idx_path, "w");
+	if (idx_fl == NULL) {
+	    fprintf(stderr, "%s: could not open %s. %s\n", cmd, idx_path, strerror(errno));
+	} else if ( !SigmetRaw_IdxWrite(idx_fl, &idx, &st_buf, &err_msg) ) {
+	    fprintf(stderr, "%s: could not write %s. %s\n", cmd, idx_path, err_msg.str);
+	    fclose(idx_fl);
+	} else if (fclose(idx_fl) == EOF) {
+	    fprintf(stderr, "%s: could not close %s. %s\n", cmd, idx_path, strerror(errno));
+	} else {
+	    status = 1;
+	}
+	SigmetRaw_IdxFree(&idx);
+    }
+    free(dat_buf);
+    free(rays);
+    return status;
+}
+
+/* If raw product file at path might have a value of data type abbrv greater than thresh within
+ * max_rng meters, print path followed by indeces of sweeps that might have such values. If
+ * path has no usable index, print path followed by "all", since every sweep must be decoded to
+ * know. Print nothing if the index shows that no sweep qualifies. cmd is for error messages. */
+static void idx_select(const char * path, const char * abbrv, float thresh, float max_rng,
+	const char * cmd)
+{
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    struct stat st_buf;
+    if (stat(path, &st_buf) == -1) {
+	fprintf(stderr, "%s: could not get information about %s. %s\n", cmd, path, strerror(errno));
+	return;
+    }
+    char idx_path[PATH_MAX];
+    FILE * idx_fl = NULL;
+    struct SigmetRaw_Idx idx;
+    if ( !SigmetRaw_IdxPath(idx_path, sizeof idx_path, path)
+	    || (idx_fl = fopen(idx_path, "r")) == NULL ) {
+	printf("%s all\n", path);
+	return;
+    }
+    /* Volume headers, to check index dimensions. Reading them does not decode any sweeps. */
+    FILE * vol_fl = fopen(path, "r");
+    struct Sigmet_VolHdr vol_hdr = {0};
+    if (vol_fl == NULL || !Sigmet_VolReadVHdr(vol_fl, &vol_hdr, &err_msg) ) {
+	if (vol_fl != NULL) {
+	    fclose(vol_fl);
+	}
+	fclose(idx_fl);
+	printf("%s all\n", path);
+	return;
+    }
+    fclose(vol_fl);
+    int rd = SigmetRaw_IdxRead(idx_fl, &idx, &st_buf, &vol_hdr, &err_msg);
+    fclose(idx_fl);
+    if ( !rd ) {
+	printf("%s all\n", path);
+	return;
+    }
+    int y = SigmetRaw_IdxTypeIdx(&idx, abbrv);
+    _Bool hit = 0;
+    for (unsigned s = 0; y != -1 && s < idx.num_swps; s++) {
+	if ( SigmetRaw_IdxSwpMayExceed(&idx, s, y, thresh, max_rng) ) {
+	    if ( !hit ) {
+		printf("%s", path);
+		hit = 1;
+	    }
+	    printf(" %u", s);
+	}
+    }
+    if (hit) {
+	printf("\n");
+    }
+    SigmetRaw_IdxFree(&idx);
+}
@@ -0,0 +1,674 @@
+/*
+ *	multi.c --
+ *		Run many sigmet_raw commands in one process. See sigmet_raw (1).
+ *	--
+ *
+ *	Usage: multi [control_socket]
+ *
+ *	Reads commands, one per line, from standard input, or from connections to control_socket if
+ *	given. Commands have the same arguments as the corresponding subcommands:
+ *
+ *	    data [-b|-m] data_type sweep_index raw_product_file|socket
+ *	    ray_headers sweep_index|all [data_type] raw_product_file
+ *	    records -h|sweep_index raw_product_file|socket
+ *
+ *	Each command produces one frame on standard output, or on the connection:
+ *
+ *	    ok length\n	followed by length bytes of command output, or
+ *	    error length\n	followed by length bytes of error message.
+ *
+ *	Decoded volumes are cached between commands, keyed by path, size, and modification time, so
+ *	a script that asks for several sweeps or data types of the same volume reads and decodes it
+ *	once. Daemon connections are also kept open between commands, and use protocol version 2.
+ *	Text output from a daemon needs ray headers, which are cached until the daemon reports a new
+ *	volume generation, so repeated requests for the same sweeps skip the ray header request.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define DEG_PER_RAD ((double)57.29577951308232087648)
+#define RAY_HDR_FMT "%2d %4d    time    %04d/%02d/%02d %02d:%02d:%06.3lf    az    %7.1f %7.1f" \
+    "    tilt %6.1f %6.1f    num_bins    %4d \n"
+
+#define MAX_ARGS 8			/* Maximum words in a command */
+#define NUM_VOLS 4			/* Decoded volumes to keep */
+#define NUM_SKTS 4			/* Daemon connections to keep */
+#define NUM_RH 64			/* Sweeps of daemon ray headers to keep */
+
+/* Decoded volume */
+struct vol {
+    char path[PATH_MAX];
+    dev_t dev;
+    ino_t ino;
+    off_t sz;
+    struct timespec mtim;
+    unsigned long used;			/* Value of use counter at last use */
+    struct Sigmet_VolHdr vol_hdr;
+    unsigned num_swps, num_rays, num_types;
+    struct Sigmet_SwpHdr * swp_hdrs;
+    struct Sigmet_Ray * rays;		/* [num_swps][num_rays][num_types] */
+    void * dat_buf;
+};
+
+/* Daemon connection */
+struct skt {
+    char path[PATH_MAX];
+    int fd;
+    unsigned long used;
+};
+
+static struct vol vols[NUM_VOLS];
+static struct skt skts[NUM_SKTS];
+static unsigned long use_count;
+static struct SigmetRaw_RhCache * rh_cache;
+
+static void serve(FILE *, FILE *);
+static int run(int, char **, FILE *, struct Sigmet_ErrMsg *);
+static struct vol * vol_get(const char *, const struct stat *, struct Sigmet_ErrMsg *);
+static void vol_clear(struct vol *);
+static int skt_get(const char *, struct Sigmet_ErrMsg *);
+static void skt_drop(int);
+static int data_fm_vol(struct vol *, const struct Sigmet_DataType *, int, char, FILE *,
+	struct Sigmet_ErrMsg *);
+static int ray_hdrs_fm_vol(struct vol *, const struct Sigmet_DataType *, unsigned, FILE *,
+	struct Sigmet_ErrMsg *);
+static int fm_skt(const char *, struct SigmetRaw_Rqst *, FILE *, struct Sigmet_ErrMsg *);
+static int txt_fm_skt(const char *, const struct Sigmet_DataType *, int, FILE *,
+	struct Sigmet_ErrMsg *);
+
+int main(int argc, char *argv[])
+{
+    /* If set, use $APP_NAME in error messages instead of argv[0]. */
+    char *cmd = getenv("APP_NAME") ? getenv("APP_NAME") : basename(argv[0]);
+    for (struct skt * skt = skts; skt < skts + NUM_SKTS; skt++) {
+	skt->fd = -1;
+    }
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    if ((rh_cache = SigmetRaw_RhCacheInit(NUM_RH, &err_msg)) == NULL) {
+	fprintf(stderr, "%s: %s\n", cmd, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    if (argc == 1) {
+	serve(stdin, stdout);
+	exit(EXIT_SUCCESS);
+    }
+    if (argc != 2) {
+	fprintf(stderr, "Usage: %s [control_socket]\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    char * ctl_path = argv[1];
+    signal(SIGPIPE, SIG_IGN);
+    int ctl_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un sa_un = { .sun_family = AF_UNIX };
+    if (snprintf(sa_un.sun_path, sizeof sa_un.sun_path, "%s", ctl_path)
+	    >= (int)sizeof sa_un.sun_path) {
+	fprintf(stderr, "%s: path %s too big for unix socket address.\n", cmd, ctl_path);
+	exit(EXIT_FAILURE);
+    }
+    if (ctl_fd == -1 || bind(ctl_fd, (struct sockaddr *)&sa_un, sizeof sa_un) == -1
+	    || listen(ctl_fd, SOMAXCONN) == -1) {
+	fprintf(stderr, "%s: could not create control socket %s. %s\n",
+		cmd, ctl_path, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    for (;;) {
+	int cl_fd = accept(ctl_fd, NULL, NULL);
+	if (cl_fd == -1) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    fprintf(stderr, "%s: could not accept connection at %s. %s\n",
+		    cmd, ctl_path, strerror(errno));
+	    exit(EXIT_FAILURE);
+	}
+	FILE * in = fdopen(cl_fd, "r");
+	FILE * out = fdopen(dup(cl_fd), "w");
+	if (in == NULL || out == NULL) {
+	    fprintf(stderr, "%s: could not configure connection at %s. %s\n",
+		    cmd, ctl_path, strerror(errno));
+	    exit(EXIT_FAILURE);
+	}
+	serve(in, out);
+	fclose(in);
+	fclose(out);
+    }
+}
+
+/* Run commands from in, writing frames to out, until end of input. */
+static void serve(FILE * in, FILE * out)
+{
+    char ln[LINE_MAX];
+    while (fgets(ln, sizeof ln, in) != NULL) {
+	char * argv[MAX_ARGS + 1];
+	int argc = 0;
+	for (char * c = strtok(ln, " \t\n"); c != NULL; c = strtok(NULL, " \t\n")) {
+	    if (argc == MAX_ARGS) {
+		argc++;
+		break;
+	    }
+	    argv[argc++] = c;
+	}
+	if (argc == 0) {
+	    continue;
+	}
+	char * buf = NULL;
+	size_t buf_sz = 0;
+	FILE * cmd_out = open_memstream(&buf, &buf_sz);
+	char err_str[SIGMET_ERR_LEN] = "";
+	struct Sigmet_ErrMsg err_msg = { .str = err_str, .sz = SIGMET_ERR_LEN };
+	struct Sigmet_ErrMsg * err_msg_p = &err_msg;
+	int status;
+	if (cmd_out == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "could not allocate output buffer. %s", strerror(errno));
+	    status = 0;
+	} else if (argc > MAX_ARGS) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "too many words in command %s", argv[0]);
+	    status = 0;
+	} else {
+	    status = run(argc, argv, cmd_out, err_msg_p);
+	}
+	if (cmd_out != NULL) {
+	    fclose(cmd_out);
+	}
+	if (status) {
+	    fprintf(out, "ok %zu\n", buf_sz);
+	    fwrite(buf, 1, buf_sz, out);
+	} else {
+	    fprintf(out, "error %zu\n%s", strlen(err_str), err_str);
+	}
+	free(buf);
+	if (fflush(out) == EOF) {
+	    return;
+	}
+    }
+}
+
+/* Run command in argv, writing output to out. Return 1/0 on success/failure. */
+static int run(int argc, char ** argv, FILE * out, struct Sigmet_ErrMsg * err_msg_p)
+{
+    const char * sub_cmd = argv[0];
+    const char * path = argv[argc - 1];
+    struct stat st_buf = {0};
+    if (argc > 1 && stat(path, &st_buf) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not get information about %s. %s",
+		sub_cmd, path, strerror(errno));
+	return 0;
+    }
+    if (strcmp(sub_cmd, "data") == 0) {
+	char fmt = 't';
+	int a = 1;
+	if (a < argc && (strcmp(argv[a], "-b") == 0 || strcmp(argv[a], "-m") == 0)) {
+	    fmt = argv[a++][1];
+	}
+	int s;
+	const struct Sigmet_DataType * type;
+	if (argc - a != 3) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "Usage: data [-b|-m] data_type sweep_index "
+		    "raw_product_file|socket");
+	    return 0;
+	}
+	if ((type = Sigmet_DataTypeGet(argv[a])) == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "data: %s is not a Sigmet data type.", argv[a]);
+	    return 0;
+	}
+	if (sscanf(argv[a + 1], "%d", &s) != 1) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "data: expected integer for sweep index, got %s",
+		    argv[a + 1]);
+	    return 0;
+	}
+	if (S_ISSOCK(st_buf.st_mode)) {
+	    if (fmt == 't') {
+		return txt_fm_skt(path, type, s, out, err_msg_p);
+	    }
+	    struct SigmetRaw_Rqst rqst = SigmetRaw_Rqst_Init();
+	    SigmetRaw_Rqst_Set_SubCmd(&rqst, (fmt == 'b') ? SigmetRawData : SigmetRawValidBits);
+	    SigmetRaw_Rqst_Set_DataType(&rqst, argv[a]);
+	    SigmetRaw_Rqst_Set_Swp(&rqst, s);
+	    return fm_skt(path, &rqst, out, err_msg_p);
+	}
+	struct vol * vol = vol_get(path, &st_buf, err_msg_p);
+	return vol != NULL && data_fm_vol(vol, type, s, fmt, out, err_msg_p);
+    } else if (strcmp(sub_cmd, "ray_headers") == 0) {
+	unsigned i_swp;
+	const struct Sigmet_DataType * type = NULL;
+	if ( !(argc == 3 || argc == 4) ) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "Usage: ray_headers sweep_index|all [data_type] "
+		    "raw_product_file");
+	    return 0;
+	}
+	if (strcmp(argv[1], "all") == 0) {
+	    i_swp = UINT_MAX;
+	} else if (sscanf(argv[1], "%u", &i_swp) != 1) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "ray_headers: expected integer or \"all\" for sweep "
+		    "index, got %s", argv[1]);
+	    return 0;
+	}
+	if (argc == 4 && (type = Sigmet_DataTypeGet(argv[2])) == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "ray_headers: %s is not a Sigmet data type.", argv[2]);
+	    return 0;
+	}
+	if (S_ISSOCK(st_buf.st_mode)) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "ray_headers: use the ray_headers subcommand for "
+		    "daemon socket %s.", path);
+	    return 0;
+	}
+	struct vol * vol = vol_get(path, &st_buf, err_msg_p);
+	return vol != NULL && ray_hdrs_fm_vol(vol, type, i_swp, out, err_msg_p);
+    } else if (strcmp(sub_cmd, "records") == 0) {
+	int s;
+	if (argc != 3) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "Usage: records -h|sweep_index raw_product_file|socket");
+	    return 0;
+	}
+	if (strcmp(argv[1], "-h") == 0) {
+	    s = SIGMETRAW_RECS_HDR;
+	} else if (sscanf(argv[1], "%d", &s) != 1 || s < 0) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "records: expected non-negative integer or -h for "
+		    "sweep index, got %s", argv[1]);
+	    return 0;
+	}
+	if (S_ISSOCK(st_buf.st_mode)) {
+	    struct SigmetRaw_Rqst rqst = SigmetRaw_Rqst_Init();
+	    SigmetRaw_Rqst_Set_SubCmd(&rqst, SigmetRawRecords);
+	    SigmetRaw_Rqst_Set_Swp(&rqst, s);
+	    return fm_skt(path, &rqst, out, err_msg_p);
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "records: could not open %s. %s", path, strerror(errno));
+	    return 0;
+	}
+	off_t off;
+	size_t len;
+	char * buf = NULL;
+	int status = SigmetRaw_RecRange(fd, s, &off, &len, err_msg_p);
+	if (status && (buf = malloc(len)) == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "records: could not allocate %zu bytes.", len);
+	    status = 0;
+	}
+	if (status && pread(fd, buf, len, off) != (ssize_t)len) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "records: could not read %s.", path);
+	    status = 0;
+	}
+	if (status) {
+	    fwrite(buf, 1, len, out);
+	}
+	free(buf);
+	close(fd);
+	return status;
+    }
+    Sigmet_ErrMsg_Print(err_msg_p, "unknown command %s", sub_cmd);
+    return 0;
+}
+
+/* Return decoded volume for raw product file at path, with status st_p, reading it if it is not
+ * in the cache or has changed. Return NULL on failure. */
+static struct vol * vol_get(const char * path, const struct stat * st_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct vol * vol, * lru = vols;
+    for (vol = vols; vol < vols + NUM_VOLS; vol++) {
+	if (vol->rays != NULL && strcmp(vol->path, path) == 0 && vol->dev == st_p->st_dev
+		&& vol->ino == st_p->st_ino && vol->sz == st_p->st_size
+		&& vol->mtim.tv_sec == st_p->st_mtim.tv_sec
+		&& vol->mtim.tv_nsec == st_p->st_mtim.tv_nsec) {
+	    vol->used = ++use_count;
+	    return vol;
+	}
+	if (vol->used < lru->used) {
+	    lru = vol;
+	}
+    }
+    /* Load into a new entry, so the least recently used one survives if loading fails. */
+    struct vol new_vol = {0};
+    vol = &new_vol;
+    FILE * vol_fl = fopen(path, "r");
+    if (vol_fl == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "could not open raw product file %s. %s",
+		path, strerror(errno));
+	return NULL;
+    }
+    char vh_err[SIGMET_ERR_LEN];
+    struct Sigmet_ErrMsg vh_err_msg = { .str = vh_err, .sz = SIGMET_ERR_LEN };
+    if ( !Sigmet_VolReadVHdr(vol_fl, &vol->vol_hdr, &vh_err_msg) ) {
+	fclose(vol_fl);
+	Sigmet_ErrMsg_Print(err_msg_p, "could not read volume headers from %s. %s", path, vh_err);
+	return NULL;
+    }
+    vol->num_swps = Sigmet_VolNumSwps(&vol->vol_hdr);
+    vol->num_rays = Sigmet_VolNumRays(&vol->vol_hdr);
+    vol->num_types = Sigmet_VolNumTypes(&vol->vol_hdr);
+    size_t dat_buf_sz = Sigmet_VolIDatSz(&vol->vol_hdr, &vh_err_msg);
+    vol->swp_hdrs = calloc(vol->num_swps, sizeof *vol->swp_hdrs);
+    vol->rays = calloc((size_t)vol->num_swps * vol->num_rays * vol->num_types, sizeof *vol->rays);
+    vol->dat_buf = (dat_buf_sz > 0) ? malloc(dat_buf_sz) : NULL;
+    if (vol->swp_hdrs == NULL || vol->rays == NULL || vol->dat_buf == NULL) {
+	fclose(vol_fl);
+	vol_clear(vol);
+	Sigmet_ErrMsg_Print(err_msg_p, "could not allocate memory for volume %s.", path);
+	return NULL;
+    }
+    unsigned num_rays = vol->num_rays, num_types = vol->num_types;
+    int rd = Sigmet_VolReadDat(vol_fl, &vol->vol_hdr, vol->num_swps, num_rays, num_types,
+	    vol->swp_hdrs, (struct Sigmet_Ray (*)[num_rays][num_types])vol->rays,
+	    dat_buf_sz, vol->dat_buf, &vh_err_msg);
+    fclose(vol_fl);
+    if (rd == 0) {
+	vol_clear(vol);
+	Sigmet_ErrMsg_Print(err_msg_p, "raw product file %s has no data. %s", path, vh_err);
+	return NULL;
+    }
+    snprintf(vol->path, sizeof vol->path, "%s", path);
+    vol->dev = st_p->st_dev;
+    vol->ino = st_p->st_ino;
+    vol->sz = st_p->st_size;
+    vol->mtim = st_p->st_mtim;
+    vol->used = ++use_count;
+    vol_clear(lru);
+    *lru = new_vol;
+    return lru;
+}
+
+static void vol_clear(struct vol * vol)
+{
+    free(vol->swp_hdrs);
+    free(vol->rays);
+    free(vol->dat_buf);
+    memset(vol, 0, sizeof *vol);
+}
+
+/* Print data for data type type, sweep s of vol to out, as text if fmt is 't', floats if 'b',
+ * or valid gate bitmaps if 'm'. Output matches the data subcommand. */
+static int data_fm_vol(struct vol * vol, const struct Sigmet_DataType * type, int s, char fmt,
+	FILE * out, struct Sigmet_ErrMsg * err_msg_p)
+{
+    unsigned num_rays = vol->num_rays, num_types = vol->num_types;
+    struct Sigmet_Ray (*rays)[num_rays][num_types] = (void *)vol->rays;
+    if (s < 0 || (unsigned)s >= vol->num_swps) {
+	Sigmet_ErrMsg_Print(err_msg_p, "data: sweep index %d out of range. Volume has %u sweeps.",
+		s, vol->num_swps);
+	return 0;
+    }
+    int y = Sigmet_VolTypeIdx(type, &vol->vol_hdr);
+    if (y == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "data: %s data type is not in volume at %s.",
+		Sigmet_DataTypeAbbrv(type), vol->path);
+	return 0;
+    }
+    int num_bins_max = 0;
+    for (unsigned r = 0; r < num_rays; r++) {
+	if (rays[s][r][y].ray_hdr.num_bins > num_bins_max) {
+	    num_bins_max = rays[s][r][y].ray_hdr.num_bins;
+	}
+    }
+    if (num_bins_max == 0) {
+	Sigmet_ErrMsg_Print(err_msg_p, "data: raw product file %s has no data.", vol->path);
+	return 0;
+    }
+    const char * prt_fmt = Sigmet_DataType_PrintFmt(type);
+    float * dat = calloc(num_bins_max, sizeof *dat);
+    uint32_t * bits = calloc(SigmetRaw_BitsNumWds(num_bins_max), sizeof *bits);
+    if (dat == NULL || bits == NULL || prt_fmt == NULL) {
+	free(dat);
+	free(bits);
+	Sigmet_ErrMsg_Print(err_msg_p, "data: could not set up output for %d bins.", num_bins_max);
+	return 0;
+    }
+    for (unsigned r = 0; r < num_rays; r++) {
+	struct Sigmet_Ray * ray = &rays[s][r][y];
+	int nb = (ray->dat != NULL) ? ray->ray_hdr.num_bins : -1;
+	if (nb >= 0) {
+	    Sigmet_DataTypeStorToVal(type, nb, dat, ray->dat, &vol->vol_hdr);
+	}
+	switch (fmt) {
+	    case 't':
+		for (int b = 0; b < num_bins_max; b++) {
+		    fprintf(out, prt_fmt, (b < nb) ? dat[b] : NAN);
+		}
+		fprintf(out, "\n");
+		break;
+	    case 'b':
+		if (nb >= 0) {
+		    fwrite(dat, sizeof *dat, nb, out);
+		}
+		break;
+	    case 'm':
+		if (nb >= 0) {
+		    SigmetRaw_BitsValid(nb, dat, bits);
+		    fwrite(bits, sizeof *bits, SigmetRaw_BitsNumWds(nb), out);
+		}
+		break;
+	}
+    }
+    free(dat);
+    free(bits);
+    return 1;
+}
+
+/* Print ray headers for sweep i_swp, or all sweeps if i_swp is UINT_MAX, of vol to out. If type
+ * is NULL, use first data type. Output matches the ray_headers subcommand. */
+static int ray_hdrs_fm_vol(struct vol * vol, const struct Sigmet_DataType * type, unsigned i_swp,
+	FILE * out, struct Sigmet_ErrMsg * err_msg_p)
+{
+    unsigned num_rays = vol->num_rays, num_types = vol->num_types;
+    struct Sigmet_Ray (*rays)[num_rays][num_types] = (void *)vol->rays;
+    const struct Sigmet_VolHdr * vol_hdr_p = &vol->vol_hdr;
+    if ( !SigmetRaw_GetAllSwps(i_swp) && i_swp >= vol->num_swps) {
+	Sigmet_ErrMsg_Print(err_msg_p, "ray_headers: sweep index %u out of range. Volume %s has "
+		"%u sweeps.", i_swp, vol->path, vol->num_swps);
+	return 0;
+    }
+    _Bool hav_xhdr = Sigmet_VolXHdr(vol_hdr_p);
+    unsigned y = hav_xhdr;
+    if (type != NULL) {
+	int y_ = Sigmet_VolTypeIdx(type, vol_hdr_p);
+	if (y_ == -1) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "ray_headers: %s data type is not in volume at %s.",
+		    Sigmet_DataTypeAbbrv(type), vol->path);
+	    return 0;
+	}
+	y = y_;
+    }
+    if ( !Sigmet_VolTZSet(vol_hdr_p, err_msg_p) ) {
+	return 0;
+    }
+    unsigned s0 = SigmetRaw_GetAllSwps(i_swp) ? 0             : i_swp;
+    unsigned s1 = SigmetRaw_GetAllSwps(i_swp) ? vol->num_swps : i_swp + 1;
+    const struct Sigmet_DataType * xhdr = Sigmet_DataTypeGet("DB_XHDR");
+    int y_hxdr = Sigmet_VolTypeIdx(xhdr, vol_hdr_p);
+    for (unsigned s = s0; s < s1; s++) {
+	double swp_tm = Sigmet_DTime(&vol->swp_hdrs[s].tm);
+	for (unsigned r = 0; r < num_rays; r++) {
+	    struct Sigmet_RayHdr ray_hdr = rays[s][r][y].ray_hdr;
+	    float ray_tm = NAN;
+	    if (hav_xhdr) {
+		Sigmet_DataTypeStorToVal(xhdr, 1, &ray_tm, rays[s][r][y_hxdr].dat, vol_hdr_p);
+	    } else {
+		ray_tm = ray_hdr.tm;
+	    }
+	    int yr, mon, day, hr, min;
+	    float sec;
+	    if ( !Sigmet_BkTime(swp_tm + ray_tm, &yr, &mon, &day, &hr, &min, &sec) ) {
+		yr = mon = day = hr = min = sec = 0;
+	    }
+	    fprintf(out, RAY_HDR_FMT, s, r, yr, mon, day, hr, min, sec,
+		    ray_hdr.az0 * DEG_PER_RAD, ray_hdr.az1 * DEG_PER_RAD,
+		    ray_hdr.tilt0 * DEG_PER_RAD, ray_hdr.tilt1 * DEG_PER_RAD,
+		    ray_hdr.num_bins);
+	}
+    }
+    return 1;
+}
+
+/* Return open connection to daemon at socket path, connecting if necessary, or -1. Requests
+ * share the connection, which needs protocol version 2. */
+static int skt_get(const char * path, struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct skt * skt, * lru = skts;
+    for (skt = skts; skt < skts + NUM_SKTS; skt++) {
+	if (skt->fd != -1 && strcmp(skt->path, path) == 0) {
+	    skt->used = ++use_count;
+	    return skt->fd;
+	}
+	if (skt->used < lru->used) {
+	    lru = skt;
+	}
+    }
+    int vsn = SigmetRaw_DmnProto(path, err_msg_p);
+    if (vsn == 0) {
+	return -1;
+    } else if (vsn != 2) {
+	Sigmet_ErrMsg_Print(err_msg_p, "daemon at %s does not support protocol version 2.", path);
+	return -1;
+    }
+    skt = lru;
+    if (skt->fd != -1) {
+	close(skt->fd);
+    }
+    if ((skt->fd = SigmetRaw_DmnConnect(path, err_msg_p)) == -1) {
+	return -1;
+    }
+    snprintf(skt->path, sizeof skt->path, "%s", path);
+    skt->used = ++use_count;
+    return skt->fd;
+}
+
+/* Forget connection fd, e.g. after the daemon closed it. */
+static void skt_drop(int fd)
+{
+    for (struct skt * skt = skts; skt < skts + NUM_SKTS; skt++) {
+	if (skt->fd == fd) {
+	    close(skt->fd);
+	    skt->fd = -1;
+	    skt->used = 0;
+	}
+    }
+}
+
+/* Send request at rqst_p to daemon at socket path with protocol version 2. The daemon streams
+ * output into a pipe, which is copied to out. */
+static int fm_skt(const char * path, struct SigmetRaw_Rqst * rqst_p, FILE * out,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    int skt_fd = skt_get(path, err_msg_p);
+    if (skt_fd == -1) {
+	return 0;
+    }
+    int p[2];
+    if (pipe(p) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "could not create pipe for daemon at %s. %s",
+		path, strerror(errno));
+	return 0;
+    }
+    SigmetRaw_Rqst_Set_ShFD(rqst_p, p[1]);
+    if ( !SigmetRaw_Rqst2_Send(skt_fd, rqst_p, err_msg_p) ) {
+	skt_drop(skt_fd);
+	close(p[0]);
+	close(p[1]);
+	return 0;
+    }
+    close(p[1]);			/* Daemon has its own copy. */
+    char buf[BUFSIZ];
+    ssize_t n;
+    while ((n = read(p[0], buf, sizeof buf)) > 0 || (n == -1 && errno == EINTR)) {
+	if (n > 0) {
+	    fwrite(buf, 1, n, out);
+	}
+    }
+    close(p[0]);
+    struct SigmetRaw_Rps2Hdr rps = {0};
+    void * dat;
+    size_t dat_sz;
+    int status = SigmetRaw_Rps2_Recv(skt_fd, &rps, &dat, &dat_sz, err_msg_p);
+    if (dat != NULL) {
+	fwrite(dat, 1, dat_sz, out);
+	free(dat);
+    }
+    if ( !status && rps.err_len == 0 ) {
+	skt_drop(skt_fd);		/* Transfer failed, reconnect next time */
+    }
+    return status;
+}
+
+/* Print data for data type type, sweep s from daemon at socket path to out as text. Ray headers,
+ * which give bin counts, come from rh_cache unless the daemon volume has changed. */
+static int txt_fm_skt(const char * path, const struct Sigmet_DataType * type, int s, FILE * out,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    const struct SigmetRaw_RayHdr * wray_hdrs;
+    struct SigmetRaw_RayHdr * wray_hdrs1 = NULL;	/* From a version 1 daemon */
+    unsigned num_rays;
+    float * dat;
+    size_t num_bins_tot;
+    int vsn = SigmetRaw_DmnProto(path, err_msg_p);
+    if (vsn == 0) {
+	return 0;
+    } else if (vsn == 1) {
+	if ( !SigmetRaw_Dmn_SwpDat1(path, Sigmet_DataTypeAbbrv(type), s, &wray_hdrs1,
+		    &num_rays, &dat, &num_bins_tot, err_msg_p) ) {
+	    return 0;
+	}
+	wray_hdrs = wray_hdrs1;
+    } else {
+	int skt_fd = skt_get(path, err_msg_p);
+	if (skt_fd == -1) {
+	    return 0;
+	}
+	struct SigmetRaw_Rqst rqst = SigmetRaw_Rqst_Init();
+	SigmetRaw_Rqst_Set_SubCmd(&rqst, SigmetRawData);
+	SigmetRaw_Rqst_Set_DataType(&rqst, Sigmet_DataTypeAbbrv(type));
+	SigmetRaw_Rqst_Set_Swp(&rqst, s);
+	if ( !SigmetRaw_Dmn_SwpDat(skt_fd, &rqst, rh_cache, &wray_hdrs, &num_rays, &dat,
+		    &num_bins_tot, err_msg_p) ) {
+	    skt_drop(skt_fd);		/* Connection state unknown, reconnect next time */
+	    return 0;
+	}
+    }
+    const char * prt_fmt = Sigmet_DataType_PrintFmt(type);
+    if (prt_fmt == NULL) {
+	free(wray_hdrs1);
+	free(dat);
+	Sigmet_ErrMsg_Print(err_msg_p, "data: could not obtain print format for data type %s.",
+		Sigmet_DataTypeAbbrv(type));
+	return 0;
+    }
+    int num_bins_max = 0;
+    for (unsigned r = 0; r < num_rays; r++) {
+	if (wray_hdrs[r].ray_hdr.num_bins > num_bins_max) {
+	    num_bins_max = wray_hdrs[r].ray_hdr.num_bins;
+	}
+    }
+    const float * d = dat;
+    for (unsigned r = 0; r < num_rays; r++) {
+	int b = 0;
+	for ( ; b < wray_hdrs[r].ray_hdr.num_bins; b++) {
+	    fprintf(out, prt_fmt, *d++);
+	}
+	for ( ; b < num_bins_max; b++) {
+	    fprintf(out, prt_fmt, NAN);
+	}
+	fprintf(out, "\n");
+    }
+    free(wray_hdrs1);
+    free(dat);
+    return 1;
+}
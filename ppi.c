@@ -0,0 +1,223 @@
+/*
+ *	ppi.c --
+ *		Render sweeps from a volume as PPI images. See sigmet_raw (1).
+ *	--
+ *
+ *	Usage: ppi [-s size] [-r range] [-l start:step:count] [-t threads] data_type sweep_index|all
+ *		raw_product_file output_prefix
+ *
+ *	Writes a size by size pixel palette PNG image, default 1024, for each sweep to
+ *	output_prefix_sweep_index.png, or to standard output if output_prefix is "-" and there is one
+ *	sweep. Images extend range meters from the radar, default the end of the last bin. Colors
+ *	come from the color scale definition in the product configuration unless -l gives count
+ *	levels of width step from start.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <math.h>
+#include <libgen.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define DFLT_SZ 1024
+
+int main(int argc, char *argv[])
+{
+    /* If set, use $APP_NAME in error messages instead of argv[0]. */
+    char *cmd = getenv("APP_NAME") ? getenv("APP_NAME") : basename(argv[0]);
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    unsigned sz = DFLT_SZ;
+    float rng_max = NAN;
+    unsigned num_threads = 0;
+    struct SigmetRaw_PpiLevels lvls;
+    _Bool have_lvls = 0;
+    int a = 1;
+    while (a + 1 < argc && argv[a][0] == '-') {
+	char * opt = argv[a], * val = argv[a + 1];
+	float start, step;
+	unsigned count;
+	if (strcmp(opt, "-s") == 0) {
+	    if (sscanf(val, "%u", &sz) != 1) {
+		fprintf(stderr, "%s: expected integer for image size, got %s\n", cmd, val);
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(opt, "-r") == 0) {
+	    if (sscanf(val, "%f", &rng_max) != 1 || !(rng_max > 0.0f)) {
+		fprintf(stderr, "%s: expected positive number for range, got %s\n", cmd, val);
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(opt, "-l") == 0) {
+	    if (sscanf(val, "%f:%f:%u", &start, &step, &count) != 3
+		    || !(step > 0.0f) || count == 0 || count > SIGMETRAW_PPI_MAX_COLORS) {
+		fprintf(stderr, "%s: expected start:step:count for levels, with positive step "
+			"and 1 to %d levels, got %s\n", cmd, SIGMETRAW_PPI_MAX_COLORS, val);
+		exit(EXIT_FAILURE);
+	    }
+	    SigmetRaw_PpiLevelsFixed(start, step, count, &lvls);
+	    have_lvls = 1;
+	} else if (strcmp(opt, "-t") == 0) {
+	    if (sscanf(val, "%u", &num_threads) != 1) {
+		fprintf(stderr, "%s: expected integer for thread count, got %s\n", cmd, val);
+		exit(EXIT_FAILURE);
+	    }
+	} else {
+	    break;
+	}
+	a += 2;
+    }
+    if (argc - a != 4) {
+	fprintf(stderr, "Usage: %s [-s size] [-r range] [-l start:step:count] [-t threads] "
+		"data_type sweep_index|all raw_product_file output_prefix\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    char * abbrv = argv[a];
+    char * s_s = argv[a + 1];
+    char * path = argv[a + 2];
+    char * prefix = argv[a + 3];
+    const struct Sigmet_DataType * type = Sigmet_DataTypeGet(abbrv);
+    if (type == NULL) {
+	fprintf(stderr, "%s: %s is not a Sigmet data type.\n", cmd, abbrv);
+	exit(EXIT_FAILURE);
+    }
+    int s = -1;				/* -1 => all */
+    if (strcmp(s_s, "all") != 0 && sscanf(s_s, "%d", &s) != 1) {
+	fprintf(stderr, "%s: expected integer or \"all\" for sweep index, got %s\n", cmd, s_s);
+	exit(EXIT_FAILURE);
+    }
+
+    /* Read volume */
+    FILE * vol_fl = fopen(path, "r");
+    if (vol_fl == NULL) {
+	fprintf(stderr, "%s: could not open file. %s\n", cmd, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    struct Sigmet_VolHdr vol_hdr;
+    memset(&vol_hdr, 0, sizeof vol_hdr);
+    if ( !Sigmet_VolReadVHdr(vol_fl, &vol_hdr, &err_msg) ) {
+	fclose(vol_fl);
+	fprintf(stderr, "%s: could not read volume headers from %s. %s\n", cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    int num_swps = Sigmet_VolNumSwps(&vol_hdr);
+    if (s < -1 || s >= num_swps) {
+	fprintf(stderr, "%s: sweep index %d out of range. Volume has %d sweeps.\n",
+		cmd, s, num_swps);
+	exit(EXIT_FAILURE);
+    }
+    if (s == -1 && num_swps > 1 && strcmp(prefix, "-") == 0) {
+	fprintf(stderr, "%s: can only send one sweep to standard output.\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    int num_rays = Sigmet_VolNumRays(&vol_hdr);
+    int num_types = Sigmet_VolNumTypes(&vol_hdr);
+    int y = Sigmet_VolTypeIdx(type, &vol_hdr);
+    if (y == -1) {
+	fprintf(stderr, "%s: %s data type is not in volume at %s.\n", cmd, abbrv, path);
+	exit(EXIT_FAILURE);
+    }
+    struct Sigmet_Ray (*rays)[num_rays][num_types] = calloc(num_swps, sizeof *rays);
+    if (rays == NULL) {
+	fprintf(stderr, "%s could not allocate memory for array of  %d by %d ray structures "
+		"from raw product file %s\n", cmd, num_swps, num_rays, path);
+	exit(EXIT_FAILURE);
+    }
+    size_t dat_buf_sz = Sigmet_VolIDatSz(&vol_hdr, &err_msg);
+    if (dat_buf_sz == 0) {
+	fprintf(stderr, "%s: could not determine size of input data buffer. %s\n", cmd, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    void * dat_buf = malloc(dat_buf_sz);
+    if (dat_buf == NULL) {
+	fprintf(stderr, "%s: could not allocate memory for %zu bytes of data.\n", cmd, dat_buf_sz);
+	exit(EXIT_FAILURE);
+    }
+    int rd = Sigmet_VolReadDat(vol_fl, &vol_hdr, num_swps, num_rays, num_types, NULL,
+	    rays, dat_buf_sz, dat_buf, &err_msg);
+    fclose(vol_fl);
+    if (rd == 0) {
+	fprintf(stderr, "%s: volume at %s has no data. %s\n", cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+
+    /* Range geometry. Raw product gives ranges in centimeters. */
+    const struct Sigmet_TaskRngInfo * rng_info = &vol_hdr.ingst_hdr.task_cfg.task_rng_info;
+    float rng0 = rng_info->rng_1st_bin * 0.01f;
+    float drng = rng_info->step_out * 0.01f;
+    int num_bins = Sigmet_VolNumBins(&vol_hdr);
+    if (isnan(rng_max)) {
+	rng_max = rng0 + num_bins * drng;
+    }
+    if ( !have_lvls && !SigmetRaw_PpiLevelsFmCsd(&vol_hdr.prod_hdr.prod_cfg.color_scale_def,
+		&lvls, &err_msg) ) {
+	fprintf(stderr, "%s: could not get color levels from %s, use -l. %s\n",
+		cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    struct SigmetRaw_Ppi * ppi = SigmetRaw_PpiInit(sz, num_threads, &err_msg);
+    if (ppi == NULL) {
+	fprintf(stderr, "%s: could not create renderer. %s\n", cmd, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+
+    /* Render each sweep. Ray values are converted from storage values one sweep at a time. */
+    struct Sigmet_RayHdr * ray_hdrs = calloc(num_rays, sizeof *ray_hdrs);
+    const float ** dat = calloc(num_rays, sizeof *dat);
+    float * vals = calloc((size_t)num_rays * num_bins, sizeof *vals);
+    if (ray_hdrs == NULL || dat == NULL || vals == NULL) {
+	fprintf(stderr, "%s: could not allocate memory for %d rays.\n", cmd, num_rays);
+	exit(EXIT_FAILURE);
+    }
+    int s0 = (s == -1) ? 0 : s, s1 = (s == -1) ? num_swps : s + 1;
+    for (int ss = s0; ss < s1; ss++) {
+	float * v = vals;
+	for (int r = 0; r < num_rays; r++) {
+	    struct Sigmet_Ray * ray = &rays[ss][r][y];
+	    int nb = ray->ray_hdr.num_bins;
+	    ray_hdrs[r] = ray->ray_hdr;
+	    dat[r] = NULL;
+	    if (ray->dat == NULL || nb <= 0 || nb > num_bins) {
+		continue;
+	    }
+	    Sigmet_DataTypeStorToVal(vol_hdr.types[y], nb, v, ray->dat, &vol_hdr);
+	    dat[r] = v;
+	    v += nb;
+	}
+	void * png;
+	size_t png_sz;
+	if ( !SigmetRaw_PpiRender(ppi, &lvls, rng0, drng, rng_max, num_rays, ray_hdrs, dat,
+		    &png, &png_sz, &err_msg) ) {
+	    fprintf(stderr, "%s: could not render sweep %d. %s\n", cmd, ss, err_msg.str);
+	    exit(EXIT_FAILURE);
+	}
+	FILE * out = stdout;
+	char out_path[PATH_MAX];
+	if (strcmp(prefix, "-") != 0) {
+	    if (snprintf(out_path, sizeof out_path, "%s_%d.png", prefix, ss)
+		    >= (int)sizeof out_path) {
+		fprintf(stderr, "%s: output path for %s too long.\n", cmd, prefix);
+		exit(EXIT_FAILURE);
+	    }
+	    if ((out = fopen(out_path, "w")) == NULL) {
+		fprintf(stderr, "%s: could not open %s. %s\n", cmd, out_path, strerror(errno));
+		exit(EXIT_FAILURE);
+	    }
+	}
+	if (fwrite(png, 1, png_sz, out) != png_sz || (out != stdout && fclose(out) == EOF)) {
+	    fprintf(stderr, "%s: could not write image for sweep %d. %s\n",
+		    cmd, ss, strerror(errno));
+	    exit(EXIT_FAILURE);
+	}
+	free(png);
+    }
+    SigmetRaw_PpiFree(ppi);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,117 @@
+/*
+ *	records.c --
+ *		Copy raw records for a sweep, or the header records, from a Sigmet raw product file to
+ *		standard output. See sigmet_raw (1).
+ *	--
+ *
+ *	Output is unconverted IRIS records, suitable for another decoder. Records are copied with
+ *	sendfile or splice, so they do not pass through this process, or through the daemon.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+static void recs_fm_fl(const char *, int, const char *);
+static void recs_fm_skt(const char *, int, const char *);
+
+int main(int argc, char *argv[])
+{
+    /* If set, use $APP_NAME in error messages instead of argv[0]. */
+    char *cmd = getenv("APP_NAME") ? getenv("APP_NAME") : basename(argv[0]);
+    if (argc != 3) {
+	fprintf(stderr, "Usage: %s -h|sweep_index raw_product_file|socket\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    char * s_s = argv[1];
+    char * path = argv[2];
+    int s;
+    if (strcmp(s_s, "-h") == 0) {
+	s = SIGMETRAW_RECS_HDR;
+    } else if (sscanf(s_s, "%d", &s) != 1 || s < 0) {
+	fprintf(stderr, "%s: expected non-negative integer or -h for sweep index, got %s\n",
+		cmd, s_s);
+	exit(EXIT_FAILURE);
+    }
+    struct stat st_buf;
+    if (stat(path, &st_buf) == -1) {
+	fprintf(stderr, "%s: could not get information about %s. %s\n",
+		cmd, path, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    if (S_ISREG(st_buf.st_mode)) {
+	recs_fm_fl(path, s, cmd);
+    } else if (S_ISSOCK(st_buf.st_mode)) {
+	recs_fm_skt(path, s, cmd);
+    } else {
+	fprintf(stderr, "%s: %s must be a regular file or socket.\n", cmd, path);
+	exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+/* Copy records for sweep s from raw product file at path to standard output. cmd is for error
+ * messages. */
+static void recs_fm_fl(const char * path, int s, const char * cmd)
+{
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+	fprintf(stderr, "%s: could not open %s. %s\n", cmd, path, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    off_t off;
+    size_t len;
+    if ( !SigmetRaw_RecRange(fd, s, &off, &len, &err_msg)
+	    || !SigmetRaw_RecSend(STDOUT_FILENO, fd, off, len, &err_msg) ) {
+	fprintf(stderr, "%s: could not copy records from %s. %s\n", cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    close(fd);
+}
+
+/* Ask daemon at socket path to copy records for sweep s of its volume to standard output. cmd is
+ * for error messages. */
+static void recs_fm_skt(const char * path, int s, const char * cmd)
+{
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    int skt_fd = SigmetRaw_DmnConnect(path, &err_msg);
+    if (skt_fd == -1) {
+	fprintf(stderr, "%s failed to connect to sigmet_raw daemon at %s. %s\n",
+		cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    struct SigmetRaw_Rqst rqst = SigmetRaw_Rqst_Init();
+    SigmetRaw_Rqst_Set_SubCmd(&rqst, SigmetRawRecords);
+    SigmetRaw_Rqst_Set_Swp(&rqst, s);
+    SigmetRaw_Rqst_Set_ShFD(&rqst, STDOUT_FILENO);
+    if ( !SigmetRaw_Rqst2_Send(skt_fd, &rqst, &err_msg) ) {
+	fprintf(stderr, "%s failed to request records from daemon at socket %s. %s.\n",
+		cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    /* Errors come back inline in the response. */
+    struct SigmetRaw_Rps2Hdr rps;
+    void * dat;
+    size_t dat_sz;
+    int status = SigmetRaw_Rps2_Recv(skt_fd, &rps, &dat, &dat_sz, &err_msg);
+    free(dat);
+    if ( !status ) {
+	fprintf(stderr, "%s failed for daemon at socket %s. %s\n", cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    /* Daemon has copied the records to standard output of this process. */
+    close(skt_fd);
+}
@@ -20,24 +20,48 @@
 /* Daemon subcommand specifiers */
 enum SigmetRaw_SubCmdN {
     SigmetRawExit, SigmetRawVolumeHeaders, SigmetRawSwpHeaders, SigmetRawRayHeaders,
-    SigmetRawData, SigmetRawCorx
+    SigmetRawData, SigmetRawCorx, SigmetRawValidBits, SigmetRawExpr, SigmetRawSubscribe,
+    SigmetRawRecords
 };
 
 /* Daemon status codes */
 enum SigmetRaw_Status { SigmetRawError, SigmetRawOkay };
 
-/* Order of parameters in client-to-daemon requests */
+/* Order of parameters in client-to-daemon requests. The version 1 request layout is fixed, so
+ * daemons built for it keep working. Newer request members travel only in version 2 requests.
+ * See struct SigmetRaw_Rqst2Hdr. */
 #define SIGMETRAW_RQST_IOVLEN 3
 enum { SigmetRawRqstSubCmd, SigmetRawRqstDataType, SigmetRawRqstSwpIdx };
 
+/* Maximum length of expression text in a request, including nul. See sigmet_raw_expr.c */
+#define SIGMETRAW_EXPR_LEN 256
+
 /* Order of shared file descriptors in client-to-daemon requests */
 enum {SigmetRawErrFD, SigmetRawHdrDataFD};
 
+/* Sweep pyramid level selection. Level l has ray and bin counts halved l times. See
+ * sigmet_raw_pyr.c */
+#define SIGMETRAW_PYR_MAX_LVL 6
+enum SigmetRaw_PyrMode { SigmetRawPyrMean, SigmetRawPyrMax };
+struct SigmetRaw_PyrSel {
+    int32_t lvl;			/* 0 => full resolution */
+    int32_t mode;			/* enum SigmetRaw_PyrMode */
+};
+
 /* Client to daemon requests. */
 struct SigmetRaw_Rqst {
     enum SigmetRaw_SubCmdN sub_cmd_n;	/* Subcommand. Always used. */
     char abbrv[SIGMET_DATA_TYPE_LEN];	/* Data type abbreviation. Sometimes used. */
     int s;				/* Sweep index. Sometimes used. */
+    char expr[SIGMETRAW_EXPR_LEN];	/* Expression for SigmetRawExpr or SigmetRawValidBits.
+					 * Sometimes used. Version 2 only. */
+    struct timespec deadline;		/* CLOCK_MONOTONIC time after which the client no longer
+					 * wants the result. tv_sec == 0 => no deadline.
+					 * Version 2 only. */
+    struct SigmetRaw_PyrSel pyr;	/* Pyramid level for SigmetRawData or SigmetRawExpr. Data
+					 * at a level above 0 come as a regular grid of
+					 * num_rays by num_swp_bins values from the response.
+					 * Version 2 only. */
     int hd_fd;				/* Shared file descriptor for headers or data. */
     int err_fd;				/* Error message channel */
 };
@@ -46,9 +70,14 @@ struct SigmetRaw_Rqst SigmetRaw_Rqst_Init(void);
 void SigmetRaw_Rqst_Set_SubCmd(struct SigmetRaw_Rqst *, enum SigmetRaw_SubCmdN);
 void SigmetRaw_Rqst_Set_DataType(struct SigmetRaw_Rqst *, const char *);
 void SigmetRaw_Rqst_Set_Swp(struct SigmetRaw_Rqst *, unsigned);
+int SigmetRaw_Rqst_Set_Expr(struct SigmetRaw_Rqst *, const char *);
+int SigmetRaw_Rqst_Set_Timeout(struct SigmetRaw_Rqst *, double);
+int SigmetRaw_Rqst_Set_Pyr(struct SigmetRaw_Rqst *, unsigned, enum SigmetRaw_PyrMode);
 void SigmetRaw_Rqst_Set_ShFD(struct SigmetRaw_Rqst *, int);
 void SigmetRaw_Rqst_Set_ErrFD(struct SigmetRaw_Rqst *, int);
 int SigmetRaw_Rqst_Send(int, struct SigmetRaw_Rqst *, struct Sigmet_ErrMsg *);
+_Bool SigmetRaw_Rqst_Expired(const struct SigmetRaw_Rqst *);
+_Bool SigmetRaw_Rqst_Orphaned(const struct SigmetRaw_Rqst *);
 
 /* Daemons call sendmsg to respond to client subcommand requests. Clients call recvmsg to receive
  * the reponse. The msghdr.msg_iov array provides command status and metadata the client might
@@ -59,18 +88,501 @@ int SigmetRaw_Rqst_Send(int, struct SigmetRaw_Rqst *, struct Sigmet_ErrMsg *);
 enum { SigmetRawRpsStatus, SigmetRawRpsNumSwps, SigmetRawRpsNumRays, SigmetRawRpsNumSwpBins,
     SigmetRawRpsSwpTm, SigmetRawRpsTZ, SigmetRawRpsErr };
 
+/* Protocol version 2, with length framed requests, errors and small results inline in the
+ * response, and descriptors only for streamed output. See sigmet_raw_proto2.c */
+#define SIGMETRAW_PROTO2_MAGIC 0x32525253u	/* "SRR2" little endian */
+#define SIGMETRAW_INLINE_MAX (1 << 20)		/* Largest inline result */
+struct SigmetRaw_Rqst2Hdr {
+    uint32_t magic;			/* SIGMETRAW_PROTO2_MAGIC */
+    uint32_t len;			/* Bytes after this header */
+    int32_t sub_cmd_n;			/* enum SigmetRaw_SubCmdN */
+    int32_t s;				/* Sweep index */
+    struct timespec deadline;		/* See struct SigmetRaw_Rqst */
+    struct SigmetRaw_PyrSel pyr;	/* See struct SigmetRaw_Rqst */
+    uint16_t abbrv_len;			/* Data type abbreviation bytes, no nul */
+    uint16_t expr_len;			/* Expression bytes, no nul */
+    uint8_t stream;			/* If true, request carries shared descriptor */
+};
+struct SigmetRaw_Rps2Hdr {
+    uint32_t magic;			/* SIGMETRAW_PROTO2_MAGIC, so clients can recognize a
+					 * version 2 daemon. See SigmetRaw_DmnProto. */
+    int32_t status;			/* enum SigmetRaw_Status */
+    int32_t num_swps, num_rays, num_swp_bins;
+    double swp_tm;
+    char tz[SIGMET_TZ_STRLEN];
+    uint64_t gen;			/* Volume generation. Changes whenever the daemon's volume
+					 * changes. 0 => unknown, do not cache results. */
+    uint32_t err_len;			/* Error message bytes after this header, no nul */
+    uint32_t dat_len;			/* Inline result bytes after error message */
+};
+int SigmetRaw_Rqst2_Send(int, const struct SigmetRaw_Rqst *, struct Sigmet_ErrMsg *);
+int SigmetRaw_Rps2_Recv(int, struct SigmetRaw_Rps2Hdr *, void **, size_t *, struct Sigmet_ErrMsg *);
+int SigmetRaw_Rqst2_Recv(int, struct SigmetRaw_Rqst *, struct Sigmet_ErrMsg *);
+int SigmetRaw_Rps2_Send(int, struct SigmetRaw_Rps2Hdr *, const char *, const void *, size_t,
+	struct Sigmet_ErrMsg *);
+
 /* Sigmet raw header appended with extended header time, if available */
 struct SigmetRaw_RayHdr {
     struct Sigmet_RayHdr ray_hdr;
     double tm;				/* Sweep time + (ray_hdr time OR extended header time) or NAN */
 };
 
+/* Client cache of ray headers, keyed by daemon, volume generation, data type, and sweep. Not
+ * thread safe. See sigmet_raw_rhcache.c */
+struct SigmetRaw_RhCache;
+struct SigmetRaw_RhCache * SigmetRaw_RhCacheInit(unsigned, struct Sigmet_ErrMsg *);
+void SigmetRaw_RhCacheFree(struct SigmetRaw_RhCache *);
+const struct SigmetRaw_RayHdr * SigmetRaw_RhCacheGet(struct SigmetRaw_RhCache *, int, uint64_t *,
+	const char *, int, unsigned *, struct Sigmet_ErrMsg *);
+
+/* Serialized volume header, sent by the daemon for SigmetRawVolumeHeaders. Pointer free, so it
+ * can be cached or mapped across processes. See sigmet_raw_vhdr.c */
+#define SIGMETRAW_VHDR_VSN 1
+struct SigmetRaw_VolHdrSerHdr {
+    char magic[4];			/* "SRVH" */
+    uint16_t vsn;			/* SIGMETRAW_VHDR_VSN */
+    uint16_t num_types;			/* Data type abbreviations at end of buffer */
+    uint32_t sz;			/* Bytes in serialized header, including this */
+    uint32_t prod_hdr_sz;		/* sizeof(struct Sigmet_ProdHdr) of writer */
+    uint32_t ingst_hdr_sz;		/* sizeof(struct Sigmet_IngstHdr) of writer */
+};
+size_t SigmetRaw_VolHdrSerSz(const struct Sigmet_VolHdr *);
+size_t SigmetRaw_VolHdrSer(const struct Sigmet_VolHdr *, void *, size_t);
+int SigmetRaw_VolHdrSerChk(const void *, size_t, struct SigmetRaw_VolHdrSerHdr *,
+	struct Sigmet_ErrMsg *);
+int SigmetRaw_VolHdrDeser(const void *, size_t, struct Sigmet_VolHdr *, struct Sigmet_ErrMsg *);
+
+/* Valid gate bitmaps. See sigmet_raw_bits.c */
+#define SIGMETRAW_BITS_PER_WD 32
+static inline size_t SigmetRaw_BitsNumWds(size_t num_bins)
+{
+    return (num_bins + SIGMETRAW_BITS_PER_WD - 1) / SIGMETRAW_BITS_PER_WD;
+}
+void SigmetRaw_BitsValid(size_t, const float *, uint32_t *);
+void SigmetRaw_BitsGt(size_t, const float *, float, uint32_t *);
+size_t SigmetRaw_BitsCount(size_t, const uint32_t *);
+void SigmetRaw_BitsAnd(size_t, uint32_t * restrict, const uint32_t * restrict);
+void SigmetRaw_BitsOr(size_t, uint32_t * restrict, const uint32_t * restrict);
+long SigmetRaw_BitsNext(size_t, const uint32_t *, size_t);
+
+/* Bitmaps for one data type in a sweep. Rays are ragged, so ray r has num_bins[r] bits starting
+ * at word wd_off[r]. wd_off[num_rays] is the total word count. */
+struct SigmetRaw_SwpBits {
+    unsigned num_rays;
+    int * num_bins;
+    size_t * wd_off;
+    uint32_t * wds;
+};
+int SigmetRaw_SwpBitsAlloc(struct SigmetRaw_SwpBits *, unsigned, const int *, struct Sigmet_ErrMsg *);
+void SigmetRaw_SwpBitsFree(struct SigmetRaw_SwpBits *);
+static inline uint32_t * SigmetRaw_SwpBitsRay(const struct SigmetRaw_SwpBits * swp_bits_p, unsigned r)
+{
+    return swp_bits_p->wds + swp_bits_p->wd_off[r];
+}
+size_t SigmetRaw_SwpBitsCount(const struct SigmetRaw_SwpBits *);
+void SigmetRaw_SwpBitsAnd(struct SigmetRaw_SwpBits *, const struct SigmetRaw_SwpBits *);
+void SigmetRaw_SwpBitsOr(struct SigmetRaw_SwpBits *, const struct SigmetRaw_SwpBits *);
+
+/* Sidecar index with zone maps. See sigmet_raw_index.c */
+#define SIGMETRAW_IDX_RAY_BLK 32
+#define SIGMETRAW_IDX_BIN_BLK 64
+struct SigmetRaw_Zone {
+    float min, max;			/* Range of valid values. If count is 0, min > max. */
+    uint32_t count;			/* Number of valid (not NAN) bins */
+};
+struct SigmetRaw_Idx {
+    unsigned num_swps, num_types;
+    unsigned num_ray_blks, num_bin_blks;
+    float rng0, drng;			/* Range to first bin, bin step, meters */
+    char abbrvs[SIGMET_NUM_DATA_TYPES][SIGMET_DATA_TYPE_LEN + 1];
+    struct SigmetRaw_Zone * swp_zones;	/* [num_swps][num_types] */
+    struct SigmetRaw_Zone * blk_zones;	/* [num_swps][num_types][num_ray_blks][num_bin_blks] */
+};
+static inline struct SigmetRaw_Zone * SigmetRaw_IdxSwpZone(const struct SigmetRaw_Idx * idx_p,
+	unsigned s, unsigned y)
+{
+    return idx_p->swp_zones + (size_t)s * idx_p->num_types + y;
+}
+static inline struct SigmetRaw_Zone * SigmetRaw_IdxBlkZone(const struct SigmetRaw_Idx * idx_p,
+	unsigned s, unsigned y, unsigned rb, unsigned bb)
+{
+    return idx_p->blk_zones
+	+ (((size_t)s * idx_p->num_types + y) * idx_p->num_ray_blks + rb) * idx_p->num_bin_blks + bb;
+}
+struct stat;
+int SigmetRaw_IdxPath(char *, size_t, const char *);
+int SigmetRaw_IdxBuild(struct SigmetRaw_Idx *, const struct Sigmet_VolHdr *,
+	unsigned num_swps, unsigned num_rays, unsigned num_types,
+	struct Sigmet_Ray (*)[num_rays][num_types], struct Sigmet_ErrMsg *);
+int SigmetRaw_IdxWrite(FILE *, const struct SigmetRaw_Idx *, const struct stat *,
+	struct Sigmet_ErrMsg *);
+int SigmetRaw_IdxRead(FILE *, struct SigmetRaw_Idx *, const struct stat *,
+	const struct Sigmet_VolHdr *, struct Sigmet_ErrMsg *);
+void SigmetRaw_IdxFree(struct SigmetRaw_Idx *);
+int SigmetRaw_IdxTypeIdx(const struct SigmetRaw_Idx *, const char *);
+_Bool SigmetRaw_IdxSwpMayExceed(const struct SigmetRaw_Idx *, unsigned, int, float, float);
+
+/* Derived field expressions. See sigmet_raw_expr.c */
+struct SigmetRaw_Expr;
+struct SigmetRaw_Expr * SigmetRaw_ExprCompile(const char *, struct Sigmet_ErrMsg *);
+void SigmetRaw_ExprFree(struct SigmetRaw_Expr *);
+unsigned SigmetRaw_ExprNumTypes(const struct SigmetRaw_Expr *);
+const struct Sigmet_DataType * SigmetRaw_ExprType(const struct SigmetRaw_Expr *, unsigned);
+void SigmetRaw_ExprEval(struct SigmetRaw_Expr *, int, const float * const *, float *);
+
+/* Volume built incrementally from a raw product record feed. See sigmet_raw_live.c */
+#define SIGMETRAW_REC_LEN 6144		/* Bytes per record in raw product file */
+struct SigmetRaw_Live;
+struct SigmetRaw_Live * SigmetRaw_LiveInit(int, struct Sigmet_ErrMsg *);
+void SigmetRaw_LiveFree(struct SigmetRaw_Live *);
+int SigmetRaw_LiveFeed(struct SigmetRaw_Live *, int, struct Sigmet_ErrMsg *);
+const struct Sigmet_VolHdr * SigmetRaw_LiveVolHdr(const struct SigmetRaw_Live *);
+unsigned SigmetRaw_LiveNumSwps(struct SigmetRaw_Live *);
+unsigned SigmetRaw_LiveNumSwpsDone(struct SigmetRaw_Live *);
+const struct Sigmet_SwpHdr * SigmetRaw_LiveSwpHdr(struct SigmetRaw_Live *, unsigned);
+unsigned SigmetRaw_LiveNumRays(struct SigmetRaw_Live *, unsigned);
+const struct Sigmet_Ray * SigmetRaw_LiveRay(struct SigmetRaw_Live *, unsigned, unsigned, unsigned);
+
+/* Raw record passthrough. For a SigmetRawRecords request, the daemon copies the raw records for
+ * sweep s, or the header records if s is SIGMETRAW_RECS_HDR, to the shared descriptor.
+ * See sigmet_raw_recs.c and records.c */
+#define SIGMETRAW_RECS_HDR -1
+int SigmetRaw_RecRange(int, int, off_t *, size_t *, struct Sigmet_ErrMsg *);
+int SigmetRaw_RecSend(int, int, off_t, size_t, struct Sigmet_ErrMsg *);
+
+/* Ray subscription streams. After a SigmetRawSubscribe request, the daemon writes frames to the
+ * shared descriptor as rays of the requested data type and sweep (or all sweeps) arrive. Each
+ * frame is a SigmetRaw_SubFrame, followed, for SigmetRawSubRay, by wray_hdr.ray_hdr.num_bins
+ * floats. See subscribe.c */
+enum SigmetRaw_SubKind {
+    SigmetRawSubRay,			/* New ray */
+    SigmetRawSubSwpDone,		/* Sweep s is complete */
+    SigmetRawSubVolDone,		/* Volume is complete */
+    SigmetRawSubLost			/* Subscriber fell behind, rays were dropped */
+};
+struct SigmetRaw_SubFrame {
+    enum SigmetRaw_SubKind kind;
+    char abbrv[SIGMET_DATA_TYPE_LEN];
+    int s, r;
+    struct SigmetRaw_RayHdr wray_hdr;
+};
+
+/* Broadcast ring buffer that fans frames out to subscribers. See sigmet_raw_ring.c */
+struct SigmetRaw_Ring;
+size_t SigmetRaw_RingSz(size_t);
+struct SigmetRaw_Ring * SigmetRaw_RingInit(void *, size_t);
+uint64_t SigmetRaw_RingHead(struct SigmetRaw_Ring *);
+int SigmetRaw_RingWrite(struct SigmetRaw_Ring *, unsigned, const void * [], const size_t []);
+long SigmetRaw_RingRead(struct SigmetRaw_Ring *, uint64_t *, void *, size_t, uint64_t *);
+
+/* Request coalescing. Concurrent identical requests share one computation. See sigmet_raw_flight.c */
+struct SigmetRaw_Flights;
+struct SigmetRaw_Flight;
+struct SigmetRaw_Flights * SigmetRaw_FlightsInit(struct Sigmet_ErrMsg *);
+void SigmetRaw_FlightsFree(struct SigmetRaw_Flights *);
+struct SigmetRaw_Flight * SigmetRaw_FlightJoin(struct SigmetRaw_Flights *,
+	const struct SigmetRaw_Rqst *, _Bool *);
+void SigmetRaw_FlightDone(struct SigmetRaw_Flights *, struct SigmetRaw_Flight *,
+	enum SigmetRaw_Status, void *, size_t, const char *);
+void SigmetRaw_FlightWait(struct SigmetRaw_Flights *, struct SigmetRaw_Flight *,
+	enum SigmetRaw_Status *, const void **, size_t *, const char **);
+void SigmetRaw_FlightRelease(struct SigmetRaw_Flights *, struct SigmetRaw_Flight *);
+
+/* Cache warm-up policy. See sigmet_raw_warm.c */
+struct SigmetRaw_Warm;
+typedef int (SigmetRaw_WarmFn)(const struct Sigmet_DataType *, unsigned, void *);
+struct SigmetRaw_Warm * SigmetRaw_WarmInit(unsigned, struct Sigmet_ErrMsg *);
+void SigmetRaw_WarmFree(struct SigmetRaw_Warm *);
+int SigmetRaw_WarmAdd(struct SigmetRaw_Warm *, const char *, unsigned, struct Sigmet_ErrMsg *);
+void SigmetRaw_WarmRecord(struct SigmetRaw_Warm *, const struct Sigmet_DataType *, unsigned);
+int SigmetRaw_WarmRead(struct SigmetRaw_Warm *, FILE *, const char *, struct Sigmet_ErrMsg *);
+int SigmetRaw_WarmLearn(struct SigmetRaw_Warm *, FILE *, const char *, struct Sigmet_ErrMsg *);
+int SigmetRaw_WarmStart(struct SigmetRaw_Warm *, unsigned, unsigned, SigmetRaw_WarmFn *, void *,
+	struct Sigmet_ErrMsg *);
+void SigmetRaw_WarmStop(struct SigmetRaw_Warm *);
+void SigmetRaw_WarmWait(struct SigmetRaw_Warm *);
+
+/* Memory accounting and eviction. See sigmet_raw_mem.c */
+struct SigmetRaw_Mem;
+struct SigmetRaw_MemItem;
+typedef int (SigmetRaw_MemEvictFn)(void *);
+struct SigmetRaw_Mem * SigmetRaw_MemInit(size_t, struct Sigmet_ErrMsg *);
+void SigmetRaw_MemFree(struct SigmetRaw_Mem *);
+struct SigmetRaw_MemItem * SigmetRaw_MemAdd(struct SigmetRaw_Mem *, size_t, SigmetRaw_MemEvictFn *,
+	void *, struct Sigmet_ErrMsg *);
+void SigmetRaw_MemPin(struct SigmetRaw_Mem *, struct SigmetRaw_MemItem *);
+void SigmetRaw_MemUnpin(struct SigmetRaw_Mem *, struct SigmetRaw_MemItem *);
+void SigmetRaw_MemRemove(struct SigmetRaw_Mem *, struct SigmetRaw_MemItem *);
+size_t SigmetRaw_MemUsed(struct SigmetRaw_Mem *);
+size_t SigmetRaw_MemShrink(struct SigmetRaw_Mem *, size_t);
+int SigmetRaw_MemPressureOpen(struct Sigmet_ErrMsg *);
+size_t SigmetRaw_MemOnPressure(struct SigmetRaw_Mem *);
+int SigmetRaw_MemEventsOpen(struct SigmetRaw_Mem *, struct Sigmet_ErrMsg *);
+size_t SigmetRaw_MemOnEvents(struct SigmetRaw_Mem *, int);
+
+/* Shared memory volume store. Processes attach decoded volumes published by the first process to
+ * read them. See sigmet_raw_shm.c */
+struct SigmetRaw_ShmVol;
+struct SigmetRaw_ShmVol * SigmetRaw_ShmAttach(const char *, const char *, size_t,
+	struct Sigmet_ErrMsg *);
+void SigmetRaw_ShmDetach(struct SigmetRaw_ShmVol *);
+const struct Sigmet_VolHdr * SigmetRaw_ShmVolHdr(const struct SigmetRaw_ShmVol *);
+unsigned SigmetRaw_ShmNumSwps(const struct SigmetRaw_ShmVol *);
+unsigned SigmetRaw_ShmNumRays(const struct SigmetRaw_ShmVol *);
+const struct Sigmet_SwpHdr * SigmetRaw_ShmSwpHdr(const struct SigmetRaw_ShmVol *, unsigned);
+const struct Sigmet_RayHdr * SigmetRaw_ShmRayHdr(const struct SigmetRaw_ShmVol *, unsigned,
+	unsigned, unsigned);
+const float * SigmetRaw_ShmRay(const struct SigmetRaw_ShmVol *, unsigned, unsigned, unsigned);
+size_t SigmetRaw_ShmEvict(const char *, size_t);
+
+/* Work split over threads. Thread functions given to SigmetRaw_RowsRun receive a
+ * struct SigmetRaw_Rows and process rows i0 to i1 - 1. See sigmet_raw_thrds.c */
+struct SigmetRaw_Rows {
+    void * arg;
+    size_t i0, i1;
+};
+unsigned SigmetRaw_NumThreads(unsigned);
+void SigmetRaw_ThreadsRun(unsigned, void * (*)(void *), void *, size_t);
+void SigmetRaw_RowsRun(unsigned, size_t, void * (*)(void *), void *);
+
+/* Palette PNG encoder. See sigmet_raw_png.c */
+int SigmetRaw_PngPalette(unsigned, unsigned, const uint8_t *, const uint8_t (*)[3], unsigned,
+	unsigned, unsigned, void **, size_t *, struct Sigmet_ErrMsg *);
+
+/* PPI renderer. Color c, 1 to num_colors, covers values from bounds[c - 1] up to bounds[c].
+ * Color 0 is no data. See sigmet_raw_ppi.c */
+#define SIGMETRAW_PPI_MAX_COLORS 255
+struct SigmetRaw_PpiLevels {
+    unsigned num_colors;
+    float bounds[SIGMETRAW_PPI_MAX_COLORS + 1];
+    int bot_sat, top_sat;			/* Values outside bounds get end colors */
+};
+int SigmetRaw_PpiLevelsFmCsd(const struct Sigmet_ColorScaleDef *, struct SigmetRaw_PpiLevels *,
+	struct Sigmet_ErrMsg *);
+void SigmetRaw_PpiLevelsFixed(float, float, unsigned, struct SigmetRaw_PpiLevels *);
+/* Sweep prepared for drawing, with a color index for each bin and the ray for each azimuth cell.
+ * Zero before first use. */
+#define SIGMETRAW_PPI_AZ_CELLS 3600		/* Azimuth cells, 0.1 degree each */
+#define SIGMETRAW_PPI_NO_BIN UINT16_MAX	/* Pixel is outside the range bins */
+struct SigmetRaw_PpiSwp {
+    int ray_of_az[SIGMETRAW_PPI_AZ_CELLS];	/* Ray index for each azimuth cell, or -1 */
+    unsigned num_rays, num_bins_max;
+    int * num_bins;				/* [num_rays] 0 for empty rays */
+    uint8_t * cls;				/* [num_rays][num_bins_max] color indeces */
+    size_t cls_sz;
+    unsigned num_rays_max;
+};
+int SigmetRaw_PpiSwpSet(struct SigmetRaw_PpiSwp *, const struct SigmetRaw_PpiLevels *, unsigned,
+	const struct Sigmet_RayHdr *, const float * const *, struct Sigmet_ErrMsg *);
+void SigmetRaw_PpiSwpFree(struct SigmetRaw_PpiSwp *);
+void SigmetRaw_PpiPalette(unsigned, const uint8_t (*)[3], unsigned, uint8_t (*)[3]);
+unsigned SigmetRaw_PpiAzCell(double);
+
+/* Return color index for azimuth cell c, bin b of sweep swp_p. b may be SIGMETRAW_PPI_NO_BIN,
+ * which exceeds any bin count. */
+static inline uint8_t SigmetRaw_PpiSwpColor(const struct SigmetRaw_PpiSwp * swp_p, unsigned c,
+	unsigned b)
+{
+    int r = swp_p->ray_of_az[c];
+    return (r == -1 || b >= (unsigned)swp_p->num_bins[r]) ? 0
+	: swp_p->cls[(size_t)r * swp_p->num_bins_max + b];
+}
+
+struct SigmetRaw_Ppi;
+struct SigmetRaw_Ppi * SigmetRaw_PpiInit(unsigned, unsigned, struct Sigmet_ErrMsg *);
+void SigmetRaw_PpiFree(struct SigmetRaw_Ppi *);
+int SigmetRaw_PpiSetPalette(struct SigmetRaw_Ppi *, const uint8_t (*)[3], unsigned,
+	struct Sigmet_ErrMsg *);
+int SigmetRaw_PpiRender(struct SigmetRaw_Ppi *, const struct SigmetRaw_PpiLevels *, float, float,
+	float, unsigned, const struct Sigmet_RayHdr *, const float * const *, void **, size_t *,
+	struct Sigmet_ErrMsg *);
+
+/* XYZ map tile generator. See sigmet_raw_tiles.c */
+#define SIGMETRAW_TILES_MAX_ZOOM 20
+struct SigmetRaw_Tiles;
+struct SigmetRaw_Tiles * SigmetRaw_TilesInit(double, double, float, float, float, unsigned, size_t,
+	struct Sigmet_ErrMsg *);
+void SigmetRaw_TilesFree(struct SigmetRaw_Tiles *);
+int SigmetRaw_TilesWrite(struct SigmetRaw_Tiles *, const struct SigmetRaw_PpiLevels *, unsigned,
+	const struct Sigmet_RayHdr *, const float * const *, unsigned, unsigned, const char *,
+	size_t *, struct Sigmet_ErrMsg *);
+
+/* Sweep pyramids and pyramid cache. See sigmet_raw_pyr.c */
+static inline unsigned SigmetRaw_PyrHalf(unsigned n)
+{
+    return (n + 1) / 2;
+}
+void SigmetRaw_PyrDecimate(unsigned, unsigned, const float *, const float *,
+	enum SigmetRaw_PyrMode, float *, float *);
+struct SigmetRaw_PyrCache;
+struct SigmetRaw_PyrCache * SigmetRaw_PyrCacheInit(unsigned, struct Sigmet_ErrMsg *);
+void SigmetRaw_PyrCacheFree(struct SigmetRaw_PyrCache *);
+const float * SigmetRaw_PyrCacheGet(struct SigmetRaw_PyrCache *, uint64_t, int, const char *,
+	enum SigmetRaw_PyrMode, unsigned, unsigned *, unsigned *, struct Sigmet_ErrMsg *);
+const float * SigmetRaw_PyrCacheBuild(struct SigmetRaw_PyrCache *, uint64_t, int, const char *,
+	enum SigmetRaw_PyrMode, unsigned, unsigned, const float *, unsigned, unsigned *,
+	unsigned *, struct Sigmet_ErrMsg *);
+
+/* Regular azimuth grid resampling. See sigmet_raw_azgrid.c */
+#define SIGMETRAW_AZGRID_MAX_AZ 36000
+enum SigmetRaw_AzGridMode { SigmetRawAzGridNearest, SigmetRawAzGridOverlap };
+struct SigmetRaw_AzGrid;
+struct SigmetRaw_AzGrid * SigmetRaw_AzGridInit(unsigned, enum SigmetRaw_AzGridMode,
+	struct Sigmet_ErrMsg *);
+void SigmetRaw_AzGridFree(struct SigmetRaw_AzGrid *);
+unsigned SigmetRaw_AzGridNumAz(const struct SigmetRaw_AzGrid *);
+int SigmetRaw_AzGridResample(struct SigmetRaw_AzGrid *, unsigned, const struct Sigmet_RayHdr *,
+	const float * const *, unsigned, float *, struct Sigmet_ErrMsg *);
+
+/* Storm cell identification. See sigmet_raw_cells.c */
+struct SigmetRaw_CellsCfg {
+    float thresh;			/* Gates with values at or above thresh are in cells */
+    unsigned min_gates;			/* Drop smaller cells */
+    int three_d;			/* If true, connect gates across sweeps */
+    float rng0, drng;			/* Range to start of first bin, bin step, meters */
+    float beam_width;			/* Vertical beam width, radians */
+};
+struct SigmetRaw_Cell {
+    unsigned swp0, swp1;		/* First and last sweep */
+    unsigned num_gates;
+    float area;				/* Horizontal area, square meters */
+    float vol;				/* Volume, cubic meters */
+    float x, y, z;			/* Centroid, meters east, north, and above radar */
+    float max;				/* Maximum value, at sweep, azimuth cell, bin */
+    unsigned max_swp, max_az, max_bin;
+};
+struct SigmetRaw_Cells;
+struct SigmetRaw_Cells * SigmetRaw_CellsInit(struct Sigmet_ErrMsg *);
+void SigmetRaw_CellsFree(struct SigmetRaw_Cells *);
+int SigmetRaw_CellsFind(struct SigmetRaw_Cells *, const struct SigmetRaw_CellsCfg *, unsigned,
+	unsigned, unsigned, const double *, const float *, uint32_t *, struct Sigmet_ErrMsg *);
+const struct SigmetRaw_Cell * SigmetRaw_CellsGet(const struct SigmetRaw_Cells *, unsigned *);
+
+/* Motion estimation and extrapolation nowcasts. See sigmet_raw_nowcast.c */
+#define SIGMETRAW_NOWCAST_MAX_SEARCH 32		/* Largest search, cells */
+struct SigmetRaw_NowcastCfg {
+    unsigned sz;			/* Grid is sz by sz cells, centered on radar */
+    float dx;				/* Cell size, meters */
+    unsigned block;			/* Block matching block size, cells */
+    unsigned search;			/* Maximum displacement searched, cells, 1 to
+					 * SIGMETRAW_NOWCAST_MAX_SEARCH */
+    float floor;			/* Missing values and values below floor count as floor */
+    float echo;				/* Motion only from blocks with values at or above echo */
+    unsigned num_threads;		/* 0 => one per processor */
+};
+struct SigmetRaw_Nowcast;
+struct SigmetRaw_Nowcast * SigmetRaw_NowcastInit(const struct SigmetRaw_NowcastCfg *,
+	struct Sigmet_ErrMsg *);
+void SigmetRaw_NowcastFree(struct SigmetRaw_Nowcast *);
+void SigmetRaw_NowcastCart(struct SigmetRaw_Nowcast *, unsigned, unsigned, float, float,
+	const float *, float *);
+unsigned SigmetRaw_NowcastMotion(struct SigmetRaw_Nowcast *, const float *, const float *, float,
+	float *, float *);
+void SigmetRaw_NowcastExtrap(const struct SigmetRaw_Nowcast *, const float *, const float *,
+	const float *, float, float *);
+
+/* Linear least squares derivatives of velocity. See sigmet_raw_llsd.c */
+struct SigmetRaw_LlsdCfg {
+    float az_len, rng_len;		/* Kernel size across and along the beam, meters */
+    float min_frac;			/* Fraction of kernel that must have values */
+    unsigned num_threads;		/* 0 => one per processor */
+};
+int SigmetRaw_Llsd(const struct SigmetRaw_LlsdCfg *, unsigned, const struct Sigmet_RayHdr *,
+	const float * const *, float, float, unsigned, float *, float *, struct Sigmet_ErrMsg *);
+
+/* Hydrometeor classification. See sigmet_raw_hca.c */
+#define SIGMETRAW_HCA_NUM_CLASSES 10
+enum SigmetRaw_HcaClass {
+    SigmetRawHcaNone,			/* No echo or not classified */
+    SigmetRawHcaGC,			/* Ground clutter or anomalous propagation */
+    SigmetRawHcaBS,			/* Biological scatterers */
+    SigmetRawHcaDS,			/* Dry snow */
+    SigmetRawHcaWS,			/* Wet snow */
+    SigmetRawHcaCR,			/* Crystals */
+    SigmetRawHcaGR,			/* Graupel */
+    SigmetRawHcaBD,			/* Big drops */
+    SigmetRawHcaRA,			/* Light and moderate rain */
+    SigmetRawHcaHR,			/* Heavy rain */
+    SigmetRawHcaRH			/* Rain and hail */
+};
+#define SIGMETRAW_HCA_NUM_IN 5
+enum SigmetRaw_HcaIn {
+    SigmetRawHcaZ,			/* DB_DBZ, dBZ */
+    SigmetRawHcaZdr,			/* DB_ZDR, dB */
+    SigmetRawHcaRhohv,			/* DB_RHOHV */
+    SigmetRawHcaKdp,			/* DB_KDP, degrees per kilometer */
+    SigmetRawHcaTemp			/* DB_TEMPERATURE16, degrees Celsius */
+};
+struct SigmetRaw_HcaCfg {
+    float ml_bot, ml_top;		/* Melting layer, meters above radar, or NAN if unknown */
+    float ml_t_bot, ml_t_top;		/* Melting layer, degrees Celsius */
+};
+void SigmetRaw_HcaRay(const struct SigmetRaw_HcaCfg *, int, const float * const *, float, float,
+	float, uint8_t *, float *);
+void SigmetRaw_HcaSwp(const struct SigmetRaw_HcaCfg *, unsigned, const struct Sigmet_RayHdr *,
+	const float * const (*)[SIGMETRAW_HCA_NUM_IN], float, float, unsigned, uint8_t *, float *);
+
+/* Clutter maps. See sigmet_raw_clutter.c */
+#define SIGMETRAW_CLUTTER_MAX_SWPS 32
+#define SIGMETRAW_CLUTTER_MAX_BINS 65536
+struct SigmetRaw_ClutterAcc;
+struct SigmetRaw_ClutterAcc * SigmetRaw_ClutterAccInit(unsigned, unsigned, float, float, float,
+	struct Sigmet_ErrMsg *);
+void SigmetRaw_ClutterAccFree(struct SigmetRaw_ClutterAcc *);
+int SigmetRaw_ClutterAccSwp(struct SigmetRaw_ClutterAcc *, double, unsigned,
+	const struct Sigmet_RayHdr *, const float * const *, struct Sigmet_ErrMsg *);
+int SigmetRaw_ClutterAccMerge(struct SigmetRaw_ClutterAcc *, const struct SigmetRaw_ClutterAcc *,
+	struct Sigmet_ErrMsg *);
+int SigmetRaw_ClutterMapWrite(const struct SigmetRaw_ClutterAcc *, float, unsigned, const char *,
+	struct Sigmet_ErrMsg *);
+struct SigmetRaw_ClutterMap;
+struct SigmetRaw_ClutterMap * SigmetRaw_ClutterMapOpen(const char *, struct Sigmet_ErrMsg *);
+void SigmetRaw_ClutterMapClose(struct SigmetRaw_ClutterMap *);
+unsigned SigmetRaw_ClutterMapRng(const struct SigmetRaw_ClutterMap *, float *, float *);
+int SigmetRaw_ClutterMapSwp(const struct SigmetRaw_ClutterMap *, double);
+unsigned SigmetRaw_ClutterMapApply(const struct SigmetRaw_ClutterMap *, int,
+	const struct Sigmet_RayHdr *, int, float *);
+
+/* Beam height and blockage tables. See sigmet_raw_geom.c */
+#define SIGMETRAW_GEOM_MAX_SWPS 32
+struct SigmetRaw_GeomKey {
+    double lat, lon;			/* Radar location, radians */
+    float alt;				/* Antenna height above sea level, meters */
+    float beam_width;			/* Vertical beam width, radians */
+    float rng0, drng;			/* Range to start of first bin, bin size, meters */
+    unsigned num_bins;			/* Bins per ray */
+    unsigned num_az;			/* Azimuth cells in blockage tables */
+    unsigned num_swps;			/* Sweeps */
+    float angl[SIGMETRAW_GEOM_MAX_SWPS];	/* Sweep angles, radians */
+};
+struct SigmetRaw_Dem;
+struct SigmetRaw_Dem * SigmetRaw_DemRead(const char *, struct Sigmet_ErrMsg *);
+void SigmetRaw_DemFree(struct SigmetRaw_Dem *);
+float SigmetRaw_DemElev(const struct SigmetRaw_Dem *, double, double);
+int SigmetRaw_GeomKeyFmVol(const struct Sigmet_VolHdr *, const struct Sigmet_SwpHdr *, unsigned,
+	unsigned, struct SigmetRaw_GeomKey *, struct Sigmet_ErrMsg *);
+struct SigmetRaw_Geom;
+struct SigmetRaw_Geom * SigmetRaw_GeomGet(const char *, const struct SigmetRaw_GeomKey *,
+	const char *, unsigned, struct Sigmet_ErrMsg *);
+void SigmetRaw_GeomFree(struct SigmetRaw_Geom *);
+const struct SigmetRaw_GeomKey * SigmetRaw_GeomGetKey(const struct SigmetRaw_Geom *);
+int SigmetRaw_GeomSwp(const struct SigmetRaw_Geom *, double);
+const float * SigmetRaw_GeomHt(const struct SigmetRaw_Geom *, unsigned);
+const uint8_t * SigmetRaw_GeomBlk(const struct SigmetRaw_Geom *, unsigned, float, float);
+
 /* Functions */
 static inline _Bool SigmetRaw_GetAllSwps(unsigned i_swp) { return i_swp == UINT_MAX; }
 int SigmetRaw_DmnConnect(const char *, struct Sigmet_ErrMsg *);
+int SigmetRaw_DmnProto(const char *, struct Sigmet_ErrMsg *);
 int SigmetRaw_Rqst(const char *, enum SigmetRaw_SubCmdN, const struct Sigmet_DataType *, int, int,
 	enum SigmetRaw_Status *, int *, int *, int *, double *, char * tz, char *, struct Sigmet_ErrMsg *);
-int SigmetRaw_Dmn_VolHdr(int, struct Sigmet_VolHdr *, struct Sigmet_ErrMsg *);
+int SigmetRaw_Dmn_VolHdr(const char *, struct Sigmet_VolHdr *, struct Sigmet_ErrMsg *);
+int SigmetRaw_Dmn_PyrDat(int, struct SigmetRaw_Rqst *, unsigned *, unsigned *, float **,
+	struct Sigmet_ErrMsg *);
+int SigmetRaw_Dmn_SwpDat(int, struct SigmetRaw_Rqst *, struct SigmetRaw_RhCache *,
+	const struct SigmetRaw_RayHdr **, unsigned *, float **, size_t *, struct Sigmet_ErrMsg *);
+int SigmetRaw_Dmn_SwpDat1(const char *, const char *, int, struct SigmetRaw_RayHdr **, unsigned *,
+	float **, size_t *, struct Sigmet_ErrMsg *);
 int SigmetRaw_Rqst_RayHdrs(unsigned *, unsigned *, double [SIGMET_MAX_SWPS], char [SIGMET_TZ_STRLEN],
 	const char *, const struct Sigmet_DataType *, unsigned, struct Sigmet_ErrMsg *);
 
@@ -0,0 +1,371 @@
+/*
+ *	sigmet_raw_azgrid.c --
+ *		Resample sweeps to a regular azimuth grid.
+ *	--
+ *
+ *	Ray azimuths drift from scan to scan, so sweeps from different volumes do not line up ray
+ *	for ray. A resampler puts a sweep on a fixed grid of num_az azimuth cells by num_bins bins,
+ *	with cell i covering azimuths from i * 2 pi / num_az up to (i + 1) * 2 pi / num_az, north
+ *	to east. Grids from different volumes can then be differenced or accumulated value for
+ *	value.
+ *
+ *	SigmetRawAzGridNearest gives each cell the bins of the ray whose sector contains the cell
+ *	center, or of the ray whose center is nearest if several do. SigmetRawAzGridOverlap gives
+ *	each cell the mean of the rays that overlap it, weighted by the overlap, ignoring NAN.
+ *	Cells that no ray reaches are NAN.
+ *
+ *	Ray to cell mapping depends only on ray azimuths and which rays are empty. Empty rays
+ *	take no cells. The resampler keeps the mapping for the last sweep, and reuses it while
+ *	these match, which they usually do for every data type in a sweep and often for repeated
+ *	scans of a task. Resamplers are not thread safe.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define TWO_PI (2.0 * M_PI)
+
+struct SigmetRaw_AzGrid {
+    unsigned num_az;
+    enum SigmetRaw_AzGridMode mode;
+
+    /* Azimuths and empty rays the mapping is for */
+    _Bool valid;				/* False until a mapping is built */
+    unsigned num_rays;
+    float (*az)[2];			/* [num_rays] az0, az1 */
+    _Bool * empty;			/* [num_rays] true if ray has no data */
+    unsigned num_rays_max;
+
+    /* Mapping. Cell c gets rays ray[off[c]] to ray[off[c + 1] - 1] with weights wt. */
+    unsigned * off;			/* [num_az + 1] */
+    unsigned * ray;
+    float * wt;
+    size_t num_ents, num_ents_max;
+
+    /* Scratch for SigmetRawAzGridOverlap */
+    float * wsum;			/* [num_bins_max] */
+    unsigned num_bins_max;
+};
+
+/* Return resampler for num_az azimuth cells, or NULL on failure. */
+struct SigmetRaw_AzGrid * SigmetRaw_AzGridInit(unsigned num_az, enum SigmetRaw_AzGridMode mode,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    if (num_az == 0 || num_az > SIGMETRAW_AZGRID_MAX_AZ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: azimuth cell count must be 1 to %d, got %u.",
+		__func__, SIGMETRAW_AZGRID_MAX_AZ, num_az);
+	return NULL;
+    }
+    if (mode != SigmetRawAzGridNearest && mode != SigmetRawAzGridOverlap) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: unknown resampling mode %d.", __func__, mode);
+	return NULL;
+    }
+    struct SigmetRaw_AzGrid * grid = calloc(1, sizeof *grid);
+    if (grid == NULL || (grid->off = calloc(num_az + 1, sizeof *grid->off)) == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate resampler for %u azimuths.",
+		__func__, num_az);
+	free(grid);
+	return NULL;
+    }
+    grid->num_az = num_az;
+    grid->mode = mode;
+    return grid;
+}
+
+void SigmetRaw_AzGridFree(struct SigmetRaw_AzGrid * grid)
+{
+    if (grid == NULL) {
+	return;
+    }
+    free(grid->az);
+    free(grid->empty);
+    free(grid->off);
+    free(grid->ray);
+    free(grid->wt);
+    free(grid->wsum);
+    free(grid);
+}
+
+unsigned SigmetRaw_AzGridNumAz(const struct SigmetRaw_AzGrid * grid)
+{
+    return grid->num_az;
+}
+
+/* Put the sector of a ray with azimuths az0 and az1 at lo, hi, with lo <= hi, unwrapped. Rays
+ * go from az0 to az1 the short way around, in either direction. A ray with no width gets
+ * nominal width dflt. */
+static void ray_sector(float az0, float az1, double dflt, double * lo_p, double * hi_p)
+{
+    double a0 = fmod(az0, TWO_PI), d = fmod((double)az1 - az0, TWO_PI);
+    if (a0 < 0.0) {
+	a0 += TWO_PI;
+    }
+    if (d > M_PI) {
+	d -= TWO_PI;
+    } else if (d < -M_PI) {
+	d += TWO_PI;
+    }
+    if (d == 0.0) {
+	*lo_p = a0 - 0.5 * dflt;
+	*hi_p = a0 + 0.5 * dflt;
+    } else {
+	*lo_p = (d > 0.0) ? a0 : a0 + d;
+	*hi_p = *lo_p + fabs(d);
+    }
+}
+
+static inline unsigned wrap(long k, unsigned n)
+{
+    long c = k % (long)n;
+    return (unsigned)(c < 0 ? c + (long)n : c);
+}
+
+/* Add entry ray r, weight w for cell c. In the counting pass, cnt is not NULL, and this only
+ * counts. */
+static void ent_add(struct SigmetRaw_AzGrid * grid, unsigned * cnt, unsigned c, unsigned r,
+	float w)
+{
+    if (cnt) {
+	cnt[c]++;
+    } else {
+	size_t e = grid->off[c]++;
+	grid->ray[e] = r;
+	grid->wt[e] = w;
+    }
+}
+
+/* Add overlap entries for rays to cells, or count them if cnt is not NULL. */
+static void map_overlap(struct SigmetRaw_AzGrid * grid, unsigned * cnt)
+{
+    unsigned num_az = grid->num_az;
+    double dc = TWO_PI / num_az, dflt = TWO_PI / grid->num_rays;
+    for (unsigned r = 0; r < grid->num_rays; r++) {
+	if (grid->empty[r]) {
+	    continue;
+	}
+	double lo, hi;
+	ray_sector(grid->az[r][0], grid->az[r][1], dflt, &lo, &hi);
+	for (long k = (long)floor(lo / dc); k * dc < hi; k++) {
+	    double ov = fmin(hi, (k + 1) * dc) - fmax(lo, k * dc);
+	    if (ov > 0.0) {
+		ent_add(grid, cnt, wrap(k, num_az), r, (float)(ov / dc));
+	    }
+	}
+    }
+}
+
+/* Put the nearest ray with data for each cell, or -1, at near. */
+static void map_nearest(const struct SigmetRaw_AzGrid * grid, int * near, double * dist)
+{
+    unsigned num_az = grid->num_az;
+    double dc = TWO_PI / num_az, dflt = TWO_PI / grid->num_rays;
+    for (unsigned c = 0; c < num_az; c++) {
+	near[c] = -1;
+	dist[c] = HUGE_VAL;
+    }
+    for (unsigned r = 0; r < grid->num_rays; r++) {
+	if (grid->empty[r]) {
+	    continue;
+	}
+	double lo, hi;
+	ray_sector(grid->az[r][0], grid->az[r][1], dflt, &lo, &hi);
+	double ctr = 0.5 * (lo + hi);
+	for (long k = (long)ceil(lo / dc - 0.5); (k + 0.5) * dc <= hi; k++) {
+	    unsigned c = wrap(k, num_az);
+	    double d = fabs((k + 0.5) * dc - ctr);
+	    if (d < dist[c]) {
+		near[c] = (int)r;
+		dist[c] = d;
+	    }
+	}
+    }
+}
+
+/* Build mapping for num_rays rays with headers ray_hdrs and values dat, unless the current
+ * mapping is for the same azimuths and empty rays. Empty rays, with no values or no bins, get no
+ * cells, so cells they would have covered go to neighboring rays or are NAN. Return 1/0 on
+ * success/failure. */
+static int map(struct SigmetRaw_AzGrid * grid, unsigned num_rays,
+	const struct Sigmet_RayHdr * ray_hdrs, const float * const * dat,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    if (grid->valid && grid->num_rays == num_rays) {
+	unsigned r;
+	for (r = 0; r < num_rays; r++) {
+	    if (grid->az[r][0] != ray_hdrs[r].az0 || grid->az[r][1] != ray_hdrs[r].az1
+		    || grid->empty[r] != (dat[r] == NULL || ray_hdrs[r].num_bins <= 0)) {
+		break;
+	    }
+	}
+	if (r == num_rays) {
+	    return 1;
+	}
+    }
+    if (num_rays > grid->num_rays_max || grid->az == NULL || grid->empty == NULL) {
+	float (*az)[2] = realloc(grid->az, (num_rays ? num_rays : 1) * sizeof *az);
+	if (az) {
+	    grid->az = az;
+	}
+	_Bool * empty = realloc(grid->empty, (num_rays ? num_rays : 1) * sizeof *empty);
+	if (empty) {
+	    grid->empty = empty;
+	}
+	if (az == NULL || empty == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate azimuths for %u rays.",
+		    __func__, num_rays);
+	    return 0;
+	}
+	grid->num_rays_max = num_rays;
+    }
+    grid->valid = 0;
+    for (unsigned r = 0; r < num_rays; r++) {
+	grid->az[r][0] = ray_hdrs[r].az0;
+	grid->az[r][1] = ray_hdrs[r].az1;
+	grid->empty[r] = (dat[r] == NULL || ray_hdrs[r].num_bins <= 0);
+    }
+
+    /* Count entries, make room, then fill. off[c] is the start of cell c while filling,
+     * then the end of cell c, which is shifted back down. */
+    unsigned num_az = grid->num_az;
+    unsigned * cnt = grid->off;
+    memset(cnt, 0, (num_az + 1) * sizeof *cnt);
+    int * near = NULL;
+    double * dist = NULL;
+    grid->num_rays = num_rays;
+    if (grid->mode == SigmetRawAzGridNearest) {
+	near = malloc(num_az * sizeof *near);
+	dist = malloc(num_az * sizeof *dist);
+	if (near == NULL || dist == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate nearest ray table for %u "
+		    "azimuths.", __func__, num_az);
+	    free(near);
+	    free(dist);
+	    return 0;
+	}
+	map_nearest(grid, near, dist);
+	for (unsigned c = 0; c < num_az; c++) {
+	    cnt[c] = (near[c] != -1);
+	}
+    } else {
+	map_overlap(grid, cnt);
+    }
+    size_t n = 0;
+    for (unsigned c = 0; c < num_az; c++) {
+	unsigned k = cnt[c];
+	cnt[c] = n;
+	n += k;
+    }
+    cnt[num_az] = n;
+    if (n > grid->num_ents_max) {
+	unsigned * ray = realloc(grid->ray, n * sizeof *ray);
+	if (ray) {
+	    grid->ray = ray;
+	}
+	float * wt = realloc(grid->wt, n * sizeof *wt);
+	if (wt) {
+	    grid->wt = wt;
+	}
+	if (ray == NULL || wt == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate mapping with %zu entries.",
+		    __func__, n);
+	    free(near);
+	    free(dist);
+	    return 0;
+	}
+	grid->num_ents_max = n;
+    }
+    if (grid->mode == SigmetRawAzGridNearest) {
+	for (unsigned c = 0; c < num_az; c++) {
+	    if (near[c] != -1) {
+		ent_add(grid, NULL, c, (unsigned)near[c], 1.0f);
+	    }
+	}
+	free(near);
+	free(dist);
+    } else {
+	map_overlap(grid, NULL);
+    }
+    memmove(grid->off + 1, grid->off, num_az * sizeof *grid->off);
+    grid->off[0] = 0;
+    grid->num_ents = n;
+    grid->valid = 1;
+    return 1;
+}
+
+/* Resample num_rays rays with headers ray_hdrs and values dat to grid, putting num_az by
+ * num_bins values at out. dat[r] has ray_hdrs[r].num_bins values, NAN where missing, or is NULL
+ * if ray r has no data. Values past the end of a ray are missing. Return 1/0 on success/failure. */
+int SigmetRaw_AzGridResample(struct SigmetRaw_AzGrid * grid, unsigned num_rays,
+	const struct Sigmet_RayHdr * ray_hdrs, const float * const * dat, unsigned num_bins,
+	float * out, struct Sigmet_ErrMsg * err_msg_p)
+{
+    if ( !map(grid, num_rays, ray_hdrs, dat, err_msg_p) ) {
+	return 0;
+    }
+    if (grid->mode == SigmetRawAzGridOverlap && num_bins > grid->num_bins_max) {
+	float * wsum = realloc(grid->wsum, num_bins * sizeof *wsum);
+	if (wsum == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate weights for %u bins.",
+		    __func__, num_bins);
+	    return 0;
+	}
+	grid->wsum = wsum;
+	grid->num_bins_max = num_bins;
+    }
+    float * wsum = grid->wsum;
+    for (unsigned c = 0; c < grid->num_az; c++) {
+	float * o = out + (size_t)c * num_bins;
+	unsigned e0 = grid->off[c], e1 = grid->off[c + 1];
+	if (grid->mode == SigmetRawAzGridNearest) {
+	    unsigned nb = 0;
+	    if (e1 > e0) {
+		unsigned r = grid->ray[e0];
+		if (dat[r] && ray_hdrs[r].num_bins > 0) {
+		    nb = (unsigned)ray_hdrs[r].num_bins < num_bins
+			? (unsigned)ray_hdrs[r].num_bins : num_bins;
+		    memcpy(o, dat[r], nb * sizeof *o);
+		}
+	    }
+	    for (unsigned b = nb; b < num_bins; b++) {
+		o[b] = NAN;
+	    }
+	    continue;
+	}
+
+	/* Weighted sums. Branch free inner loops, so they vectorize. */
+	for (unsigned b = 0; b < num_bins; b++) {
+	    o[b] = 0.0f;
+	    wsum[b] = 0.0f;
+	}
+	for (unsigned e = e0; e < e1; e++) {
+	    unsigned r = grid->ray[e];
+	    float w = grid->wt[e];
+	    const float * d = dat[r];
+	    if (d == NULL || ray_hdrs[r].num_bins <= 0) {
+		continue;
+	    }
+	    unsigned nb = (unsigned)ray_hdrs[r].num_bins < num_bins
+		? (unsigned)ray_hdrs[r].num_bins : num_bins;
+	    for (unsigned b = 0; b < nb; b++) {
+		_Bool ok = !isnan(d[b]);
+		o[b] += ok ? w * d[b] : 0.0f;
+		wsum[b] += ok ? w : 0.0f;
+	    }
+	}
+	for (unsigned b = 0; b < num_bins; b++) {
+	    o[b] = (wsum[b] > 0.0f) ? o[b] / wsum[b] : NAN;
+	}
+    }
+    return 1;
+}
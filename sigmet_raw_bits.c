@@ -0,0 +1,252 @@
+/*
+ *	sigmet_raw_bits.c --
+ *		Valid gate bitmaps for sigmet_raw sweeps.
+ *	--
+ *
+ *	Bit b of a bitmap is set if bin b has a value, i.e. is not NAN, or passes a threshold.
+ *	Bits are packed into 32 bit words, least significant bit first, as in copy_bits.c.
+ *	A bitmap for a ray of num_bins floats is 1/32 the size of the ray.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+/* Return a word with bit i set if v[i] is not NAN, for i in 0..31. */
+static inline uint32_t valid_wd(const float * v)
+{
+#if defined(__AVX__)
+    uint32_t wd = 0;
+    for (int i = 0; i < SIGMETRAW_BITS_PER_WD; i += 8) {
+	__m256 x = _mm256_loadu_ps(v + i);
+	wd |= (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(x, x, _CMP_ORD_Q)) << i;
+    }
+    return wd;
+#elif defined(__SSE2__)
+    uint32_t wd = 0;
+    for (int i = 0; i < SIGMETRAW_BITS_PER_WD; i += 4) {
+	__m128 x = _mm_loadu_ps(v + i);
+	wd |= (uint32_t)_mm_movemask_ps(_mm_cmpord_ps(x, x)) << i;
+    }
+    return wd;
+#else
+    uint32_t wd = 0;
+    for (int i = 0; i < SIGMETRAW_BITS_PER_WD; i++) {
+	wd |= (uint32_t)!isnan(v[i]) << i;
+    }
+    return wd;
+#endif
+}
+
+/* Return a word with bit i set if v[i] > t, for i in 0..31. NAN is never greater than t. */
+static inline uint32_t gt_wd(const float * v, float t)
+{
+#if defined(__AVX__)
+    uint32_t wd = 0;
+    __m256 tt = _mm256_set1_ps(t);
+    for (int i = 0; i < SIGMETRAW_BITS_PER_WD; i += 8) {
+	__m256 x = _mm256_loadu_ps(v + i);
+	wd |= (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(x, tt, _CMP_GT_OQ)) << i;
+    }
+    return wd;
+#elif defined(__SSE2__)
+    uint32_t wd = 0;
+    __m128 tt = _mm_set1_ps(t);
+    for (int i = 0; i < SIGMETRAW_BITS_PER_WD; i += 4) {
+	__m128 x = _mm_loadu_ps(v + i);
+	wd |= (uint32_t)_mm_movemask_ps(_mm_cmpgt_ps(x, tt)) << i;
+    }
+    return wd;
+#else
+    uint32_t wd = 0;
+    for (int i = 0; i < SIGMETRAW_BITS_PER_WD; i++) {
+	wd |= (uint32_t)(v[i] > t) << i;
+    }
+    return wd;
+#endif
+}
+
+/* Set bits at bits for the num_bins values at vals that are not NAN. bits must have space for
+ * SigmetRaw_BitsNumWds(num_bins) words. Unused bits in the last word are cleared. */
+void SigmetRaw_BitsValid(size_t num_bins, const float * vals, uint32_t * bits)
+{
+    size_t n = num_bins / SIGMETRAW_BITS_PER_WD;
+    for (size_t w = 0; w < n; w++) {
+	bits[w] = valid_wd(vals + w * SIGMETRAW_BITS_PER_WD);
+    }
+    size_t rem = num_bins % SIGMETRAW_BITS_PER_WD;
+    if (rem > 0) {
+	uint32_t wd = 0;
+	const float * v = vals + n * SIGMETRAW_BITS_PER_WD;
+	for (size_t i = 0; i < rem; i++) {
+	    wd |= (uint32_t)!isnan(v[i]) << i;
+	}
+	bits[n] = wd;
+    }
+}
+
+/* Set bits at bits for the num_bins values at vals that are greater than t. bits must have space
+ * for SigmetRaw_BitsNumWds(num_bins) words. */
+void SigmetRaw_BitsGt(size_t num_bins, const float * vals, float t, uint32_t * bits)
+{
+    size_t n = num_bins / SIGMETRAW_BITS_PER_WD;
+    for (size_t w = 0; w < n; w++) {
+	bits[w] = gt_wd(vals + w * SIGMETRAW_BITS_PER_WD, t);
+    }
+    size_t rem = num_bins % SIGMETRAW_BITS_PER_WD;
+    if (rem > 0) {
+	uint32_t wd = 0;
+	const float * v = vals + n * SIGMETRAW_BITS_PER_WD;
+	for (size_t i = 0; i < rem; i++) {
+	    wd |= (uint32_t)(v[i] > t) << i;
+	}
+	bits[n] = wd;
+    }
+}
+
+/* Return number of set bits in num_wds words at bits. */
+size_t SigmetRaw_BitsCount(size_t num_wds, const uint32_t * bits)
+{
+    size_t c = 0;
+    for (size_t w = 0; w < num_wds; w++) {
+	c += __builtin_popcount(bits[w]);
+    }
+    return c;
+}
+
+/* Replace num_wds words at dest with dest AND src. */
+void SigmetRaw_BitsAnd(size_t num_wds, uint32_t * restrict dest, const uint32_t * restrict src)
+{
+    for (size_t w = 0; w < num_wds; w++) {
+	dest[w] &= src[w];
+    }
+}
+
+/* Replace num_wds words at dest with dest OR src. */
+void SigmetRaw_BitsOr(size_t num_wds, uint32_t * restrict dest, const uint32_t * restrict src)
+{
+    for (size_t w = 0; w < num_wds; w++) {
+	dest[w] |= src[w];
+    }
+}
+
+/* Return index of first set bit at or after bit b in bitmap of num_bins bits at bits, or -1 if there
+ * are no more set bits. Iterate with
+ *	for (long b = SigmetRaw_BitsNext(n, bits, 0); b != -1; b = SigmetRaw_BitsNext(n, bits, b + 1))
+ */
+long SigmetRaw_BitsNext(size_t num_bins, const uint32_t * bits, size_t b)
+{
+    if (b >= num_bins) {
+	return -1;
+    }
+    size_t num_wds = SigmetRaw_BitsNumWds(num_bins);
+    size_t w = b / SIGMETRAW_BITS_PER_WD;
+    uint32_t wd = bits[w] & (UINT32_MAX << (b % SIGMETRAW_BITS_PER_WD));
+    while (wd == 0) {
+	if (++w == num_wds) {
+	    return -1;
+	}
+	wd = bits[w];
+    }
+    size_t n = w * SIGMETRAW_BITS_PER_WD + __builtin_ctz(wd);
+    return (n < num_bins) ? (long)n : -1;
+}
+
+/* Allocate bitmaps for a sweep with num_rays rays, with num_bins[r] bins in ray r. Bitmaps are
+ * initially clear. All memory comes from one call to malloc. Return 1/0 on success/failure. */
+int SigmetRaw_SwpBitsAlloc(struct SigmetRaw_SwpBits * swp_bits_p, unsigned num_rays,
+	const int * num_bins, struct Sigmet_ErrMsg * err_msg_p)
+{
+    size_t num_wds = 0;
+    for (unsigned r = 0; r < num_rays; r++) {
+	num_wds += SigmetRaw_BitsNumWds(num_bins[r] > 0 ? num_bins[r] : 0);
+    }
+    /* Word offsets first, then bin counts, then bitmap words, to keep members aligned. */
+    size_t off_sz = (num_rays + 1) * sizeof *swp_bits_p->wd_off;
+    size_t nb_sz = num_rays * sizeof *swp_bits_p->num_bins;
+    char * block = calloc(1, off_sz + nb_sz + num_wds * sizeof(uint32_t));
+    if (block == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate bitmaps for %u rays, %zu words.",
+		__func__, num_rays, num_wds);
+	return 0;
+    }
+    swp_bits_p->num_rays = num_rays;
+    swp_bits_p->wd_off = (size_t *)block;
+    swp_bits_p->num_bins = (int *)(block + off_sz);
+    swp_bits_p->wds = (uint32_t *)(block + off_sz + nb_sz);
+    size_t off = 0;
+    for (unsigned r = 0; r < num_rays; r++) {
+	swp_bits_p->num_bins[r] = num_bins[r] > 0 ? num_bins[r] : 0;
+	swp_bits_p->wd_off[r] = off;
+	off += SigmetRaw_BitsNumWds(swp_bits_p->num_bins[r]);
+    }
+    swp_bits_p->wd_off[num_rays] = off;
+    return 1;
+}
+
+void SigmetRaw_SwpBitsFree(struct SigmetRaw_SwpBits * swp_bits_p)
+{
+    free(swp_bits_p->wd_off);
+    *swp_bits_p = (struct SigmetRaw_SwpBits){0};
+}
+
+/* Return total number of set bits in sweep bitmaps at swp_bits_p. */
+size_t SigmetRaw_SwpBitsCount(const struct SigmetRaw_SwpBits * swp_bits_p)
+{
+    return SigmetRaw_BitsCount(swp_bits_p->wd_off[swp_bits_p->num_rays], swp_bits_p->wds);
+}
+
+/* Combine sweep bitmaps src into dest with AND (or_ false) or OR (or_ true), ray by ray. src and
+ * dest may come from different data types in the same sweep, so bin counts can differ. Bits
+ * beyond the bins in src are cleared for AND and left unchanged for OR. Bits beyond the bins in
+ * dest stay clear, as SigmetRaw_SwpBitsCount and SigmetRaw_BitsNext expect. */
+static void swp_bits_op(struct SigmetRaw_SwpBits * dest, const struct SigmetRaw_SwpBits * src,
+	_Bool or_)
+{
+    unsigned num_rays = dest->num_rays < src->num_rays ? dest->num_rays : src->num_rays;
+    for (unsigned r = 0; r < num_rays; r++) {
+	uint32_t * d = SigmetRaw_SwpBitsRay(dest, r);
+	const uint32_t * s = SigmetRaw_SwpBitsRay(src, r);
+	size_t d_wds = SigmetRaw_BitsNumWds(dest->num_bins[r]);
+	size_t s_wds = SigmetRaw_BitsNumWds(src->num_bins[r]);
+	size_t n = d_wds < s_wds ? d_wds : s_wds;
+	if (or_) {
+	    SigmetRaw_BitsOr(n, d, s);
+	    int rem = dest->num_bins[r] % SIGMETRAW_BITS_PER_WD;
+	    if (n == d_wds && rem > 0) {
+		d[d_wds - 1] &= UINT32_MAX >> (SIGMETRAW_BITS_PER_WD - rem);
+	    }
+	} else {
+	    SigmetRaw_BitsAnd(n, d, s);
+	    memset(d + n, 0, (d_wds - n) * sizeof *d);
+	}
+    }
+    if ( !or_ ) {
+	for (unsigned r = num_rays; r < dest->num_rays; r++) {
+	    memset(SigmetRaw_SwpBitsRay(dest, r), 0,
+		    SigmetRaw_BitsNumWds(dest->num_bins[r]) * sizeof(uint32_t));
+	}
+    }
+}
+void SigmetRaw_SwpBitsAnd(struct SigmetRaw_SwpBits * dest, const struct SigmetRaw_SwpBits * src)
+{
+    swp_bits_op(dest, src, 0);
+}
+void SigmetRaw_SwpBitsOr(struct SigmetRaw_SwpBits * dest, const struct SigmetRaw_SwpBits * src)
+{
+    swp_bits_op(dest, src, 1);
+}
@@ -0,0 +1,392 @@
+/*
+ *	sigmet_raw_cells.c --
+ *		Storm cell identification by connected component labeling.
+ *	--
+ *
+ *	A storm cell is a connected region of gates with values at or above a threshold, such as
+ *	reflectivity. Input is a stack of sweeps on a regular azimuth grid, see sigmet_raw_azgrid.c,
+ *	num_az cells by num_bins bins per sweep. Gates connect to neighbors in azimuth and range, and
+ *	azimuth wraps around, so the last azimuth cell connects to the first. In three dimensional
+ *	mode, gates also connect to the same azimuth cell and bin in the sweeps above and below,
+ *	so sweeps should be in order of elevation.
+ *
+ *	Labeling takes one pass over the gates. Each gate gets the provisional label of a neighbor
+ *	already visited, or a new one, and labels that meet are joined with union find. Cell
+ *	properties are summed per provisional label in the same pass, so resolving the labels and
+ *	merging the sums afterward only visits labels, not gates.
+ *
+ *	Gate geometry uses the 4/3 earth radius model. Cell area is the horizontal area of the
+ *	gates, or in three dimensional mode, of the gates in the sweep where the cell is largest.
+ *	Gate volume extends halfway to the adjacent sweeps, or half a beam width at the ends of the
+ *	stack and in two dimensional mode.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define TWO_PI (2.0 * M_PI)
+#define EFF_EARTH_RADIUS (4.0 / 3.0 * 6371000.0)	/* meters */
+
+/* Sums for one provisional label */
+struct acc {
+    unsigned num_gates;
+    double area, vol;
+    double sx, sy, sz;			/* Area weighted positions */
+    float max;
+    unsigned max_swp, max_az, max_bin;
+};
+
+struct SigmetRaw_Cells {
+    uint32_t * par;			/* [num_lbls_max] Union find parent, 0 unused */
+    struct acc * accs;			/* [num_lbls_max] */
+    uint32_t num_lbls_max;
+    uint32_t * lbl;			/* [num_gates_max] Provisional labels, if caller has none */
+    size_t num_gates_max;
+    uint32_t * swp_lbl;			/* [num_swps + 1] First provisional label of each sweep */
+    double * own_area;			/* [num_lbls_max] Area of each provisional label */
+    struct SigmetRaw_Cell * cells;
+    unsigned num_cells;
+};
+
+struct SigmetRaw_Cells * SigmetRaw_CellsInit(struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct SigmetRaw_Cells * cells = calloc(1, sizeof *cells);
+    if (cells == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate cell finder.", __func__);
+    }
+    return cells;
+}
+
+void SigmetRaw_CellsFree(struct SigmetRaw_Cells * cells)
+{
+    if (cells == NULL) {
+	return;
+    }
+    free(cells->par);
+    free(cells->accs);
+    free(cells->lbl);
+    free(cells->swp_lbl);
+    free(cells->own_area);
+    free(cells->cells);
+    free(cells);
+}
+
+static inline uint32_t find(uint32_t * par, uint32_t l)
+{
+    while (par[l] != l) {
+	par[l] = par[par[l]];		/* Path halving */
+	l = par[l];
+    }
+    return l;
+}
+
+/* Join the sets with labels l0 and l1. The lower root survives, so roots stay in scan order. */
+static inline void join(uint32_t * par, uint32_t l0, uint32_t l1)
+{
+    l0 = find(par, l0);
+    l1 = find(par, l1);
+    if (l0 < l1) {
+	par[l1] = l0;
+    } else if (l1 < l0) {
+	par[l0] = l1;
+    }
+}
+
+/* Put a new provisional label at l_p. Return 1/0 on success/failure. */
+static int lbl_new(struct SigmetRaw_Cells * cells, uint32_t * num_lbls_p, uint32_t * l_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    uint32_t l = *num_lbls_p;
+    if (l >= cells->num_lbls_max) {
+	uint32_t n = cells->num_lbls_max ? 2 * cells->num_lbls_max : 4096;
+	uint32_t * par = realloc(cells->par, n * sizeof *par);
+	if (par) {
+	    cells->par = par;
+	}
+	struct acc * accs = realloc(cells->accs, n * sizeof *accs);
+	if (accs) {
+	    cells->accs = accs;
+	}
+	double * own_area = realloc(cells->own_area, n * sizeof *own_area);
+	if (own_area) {
+	    cells->own_area = own_area;
+	}
+	if (par == NULL || accs == NULL || own_area == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate %u labels.", __func__, n);
+	    return 0;
+	}
+	cells->num_lbls_max = n;
+    }
+    cells->par[l] = l;
+    memset(cells->accs + l, 0, sizeof cells->accs[l]);
+    cells->accs[l].max = -HUGE_VALF;
+    *num_lbls_p = l + 1;
+    *l_p = l;
+    return 1;
+}
+
+/* Per bin geometry for a sweep */
+struct bin_geom {
+    float gr;				/* Ground range, meters */
+    float z;				/* Height above radar, meters */
+    float area, vol;			/* Gate area and volume per radian of azimuth */
+};
+
+static void swp_geom(double tilt, double dtilt, float rng0, float drng, unsigned num_bins,
+	struct bin_geom * g)
+{
+    double ce = cos(tilt), se = sin(tilt), R = EFF_EARTH_RADIUS;
+    for (unsigned b = 0; b < num_bins; b++) {
+	double r = rng0 + (b + 0.5) * drng;
+	double z = sqrt(r * r + R * R + 2.0 * r * R * se) - R;
+	g[b].gr = (float)(R * asin(r * ce / (R + z)));
+	g[b].z = (float)z;
+	g[b].area = (float)(r * ce * drng * ce);
+	g[b].vol = (float)(r * r * ce * drng * dtilt);
+    }
+}
+
+/* Find cells in num_swps sweeps of num_az by num_bins values at dat, with sweep angles tilts,
+ * radians, from lowest to highest if cfg_p->three_d is set. If lbl is not NULL, it receives a
+ * cell number for each gate, starting at 1, with 0 for gates not in a cell. Cells are
+ * available from SigmetRaw_CellsGet until the next call. Return 1/0 on success/failure. */
+int SigmetRaw_CellsFind(struct SigmetRaw_Cells * cells, const struct SigmetRaw_CellsCfg * cfg_p,
+	unsigned num_swps, unsigned num_az, unsigned num_bins, const double * tilts,
+	const float * dat, uint32_t * lbl, struct Sigmet_ErrMsg * err_msg_p)
+{
+    size_t swp_sz = (size_t)num_az * num_bins, num_gates = num_swps * swp_sz;
+    _Bool three_d = cfg_p->three_d;
+    cells->num_cells = 0;
+    if (num_gates == 0) {
+	return 1;
+    }
+    if (lbl == NULL) {
+	if (num_gates > cells->num_gates_max) {
+	    uint32_t * l = realloc(cells->lbl, num_gates * sizeof *l);
+	    if (l == NULL) {
+		Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate labels for %zu gates.",
+			__func__, num_gates);
+		return 0;
+	    }
+	    cells->lbl = l;
+	    cells->num_gates_max = num_gates;
+	}
+	lbl = cells->lbl;
+    }
+    uint32_t * swp_lbl = realloc(cells->swp_lbl, (num_swps + 1) * sizeof *swp_lbl);
+    double (*az_sc)[2] = malloc(num_az * sizeof *az_sc);
+    struct bin_geom * geom = malloc(num_bins * sizeof *geom);
+    if (swp_lbl) {
+	cells->swp_lbl = swp_lbl;
+    }
+    if (swp_lbl == NULL || az_sc == NULL || geom == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate sweep geometry.", __func__);
+	free(az_sc);
+	free(geom);
+	return 0;
+    }
+    double daz = TWO_PI / num_az;
+    for (unsigned a = 0; a < num_az; a++) {
+	az_sc[a][0] = sin((a + 0.5) * daz);
+	az_sc[a][1] = cos((a + 0.5) * daz);
+    }
+
+    /* Label 0 means no cell */
+    uint32_t num_lbls = 0, l0;
+    if ( !lbl_new(cells, &num_lbls, &l0, err_msg_p) ) {
+	goto error;
+    }
+    float thresh = cfg_p->thresh;
+    for (unsigned s = 0; s < num_swps; s++) {
+	double lo = (three_d && s > 0) ? 0.5 * (tilts[s] - tilts[s - 1])
+	    : 0.5 * cfg_p->beam_width;
+	double hi = (three_d && s + 1 < num_swps) ? 0.5 * (tilts[s + 1] - tilts[s])
+	    : 0.5 * cfg_p->beam_width;
+	swp_geom(tilts[s], fabs(lo) + fabs(hi), cfg_p->rng0, cfg_p->drng, num_bins, geom);
+	swp_lbl[s] = num_lbls;
+	const float * d = dat + s * swp_sz;
+	uint32_t * l = lbl + s * swp_sz;
+	for (unsigned a = 0; a < num_az; a++) {
+	    for (unsigned b = 0; b < num_bins; b++) {
+		size_t i = (size_t)a * num_bins + b;
+		if ( !(d[i] >= thresh) ) {
+		    l[i] = 0;
+		    continue;
+		}
+		uint32_t left = b > 0 ? l[i - 1] : 0;
+		uint32_t up = a > 0 ? l[i - num_bins] : 0;
+		uint32_t k = left ? left : up;
+		if (left && up) {
+		    join(cells->par, left, up);
+		}
+		if (k == 0 && !lbl_new(cells, &num_lbls, &k, err_msg_p)) {
+		    goto error;
+		}
+		if (a == num_az - 1 && a > 0 && l[b]) {
+		    join(cells->par, k, l[b]);		/* Azimuth wraps */
+		}
+		if (three_d && s > 0 && l[i - swp_sz]) {
+		    join(cells->par, k, l[i - swp_sz]);
+		}
+		l[i] = k;
+		struct acc * acc = cells->accs + k;
+		double area = geom[b].area * daz;
+		acc->num_gates++;
+		acc->area += area;
+		acc->vol += geom[b].vol * daz;
+		acc->sx += area * geom[b].gr * az_sc[a][0];
+		acc->sy += area * geom[b].gr * az_sc[a][1];
+		acc->sz += area * geom[b].z;
+		if (d[i] > acc->max) {
+		    acc->max = d[i];
+		    acc->max_swp = s;
+		    acc->max_az = a;
+		    acc->max_bin = b;
+		}
+	    }
+	}
+    }
+    swp_lbl[num_swps] = num_lbls;
+
+    /* Resolve labels, flattening par so par[k] is the root, and merge sums into roots. Keep the
+     * area of each provisional label, all of whose gates are in one sweep, in own_area. */
+    struct acc * accs = cells->accs;
+    uint32_t * par = cells->par;
+    double * own_area = cells->own_area;
+    for (uint32_t k = 1; k < num_lbls; k++) {
+	uint32_t r = par[k] = find(par, k);
+	own_area[k] = accs[k].area;
+	if (r == k) {
+	    continue;
+	}
+	struct acc * a = accs + r, * b = accs + k;
+	a->num_gates += b->num_gates;
+	a->area += b->area;
+	a->vol += b->vol;
+	a->sx += b->sx;
+	a->sy += b->sy;
+	a->sz += b->sz;
+	if (b->max > a->max) {
+	    a->max = b->max;
+	    a->max_swp = b->max_swp;
+	    a->max_az = b->max_az;
+	    a->max_bin = b->max_bin;
+	}
+    }
+
+    /* Roots come first in scan order, so a root is in the lowest sweep of its cell. The last
+     * sweep, and in three dimensional mode the largest sweep area, come from the labels of
+     * each sweep. swp_area and big are indexed by root. */
+    double * swp_area = calloc(num_lbls, sizeof *swp_area);
+    double * big = calloc(num_lbls, sizeof *big);
+    unsigned * swp1 = calloc(num_lbls, sizeof *swp1);
+    uint32_t * cell_n = malloc(num_lbls * sizeof *cell_n);
+    if (swp_area == NULL || big == NULL || swp1 == NULL || cell_n == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate cell tables for %u labels.",
+		__func__, num_lbls);
+	free(swp_area);
+	free(big);
+	free(swp1);
+	free(cell_n);
+	goto error;
+    }
+    for (unsigned s = 0; s < num_swps; s++) {
+	for (uint32_t k = swp_lbl[s]; k < swp_lbl[s + 1]; k++) {
+	    swp_area[par[k]] += own_area[k];
+	    swp1[par[k]] = s;
+	}
+	for (uint32_t k = swp_lbl[s]; k < swp_lbl[s + 1]; k++) {
+	    uint32_t r = par[k];
+	    if (swp_area[r] > big[r]) {
+		big[r] = swp_area[r];
+	    }
+	    swp_area[r] = 0.0;
+	}
+    }
+
+    /* Number the cells with enough gates, in order of their roots. */
+    unsigned num_cells = 0;
+    for (uint32_t k = 1; k < num_lbls; k++) {
+	if (par[k] == k && accs[k].num_gates >= cfg_p->min_gates) {
+	    num_cells++;
+	}
+    }
+    struct SigmetRaw_Cell * c = realloc(cells->cells, (num_cells ? num_cells : 1) * sizeof *c);
+    if (c == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate %u cells.", __func__, num_cells);
+	free(swp_area);
+	free(big);
+	free(swp1);
+	free(cell_n);
+	goto error;
+    }
+    cells->cells = c;
+    cell_n[0] = 0;
+    for (uint32_t k = 1; k < num_lbls; k++) {
+	struct acc * acc = accs + k;
+	if (par[k] != k) {
+	    cell_n[k] = cell_n[par[k]];
+	    continue;
+	}
+	if (acc->num_gates < cfg_p->min_gates) {
+	    cell_n[k] = 0;
+	    continue;
+	}
+	cell_n[k] = ++cells->num_cells;
+	c->swp0 = 0;
+	for (unsigned s = 0; s < num_swps; s++) {
+	    if (k < swp_lbl[s + 1]) {
+		c->swp0 = s;
+		break;
+	    }
+	}
+	c->swp1 = swp1[k];
+	c->num_gates = acc->num_gates;
+	c->area = (float)(three_d ? big[k] : acc->area);
+	c->vol = (float)acc->vol;
+	c->x = (float)(acc->sx / acc->area);
+	c->y = (float)(acc->sy / acc->area);
+	c->z = (float)(acc->sz / acc->area);
+	c->max = acc->max;
+	c->max_swp = acc->max_swp;
+	c->max_az = acc->max_az;
+	c->max_bin = acc->max_bin;
+	c++;
+    }
+    if (lbl != cells->lbl) {
+	for (size_t i = 0; i < num_gates; i++) {
+	    lbl[i] = cell_n[lbl[i]];
+	}
+    }
+    free(swp_area);
+    free(big);
+    free(swp1);
+    free(cell_n);
+    free(az_sc);
+    free(geom);
+    return 1;
+
+error:
+    free(az_sc);
+    free(geom);
+    return 0;
+}
+
+/* Return cells from the last call to SigmetRaw_CellsFind, with count at num_cells_p. */
+const struct SigmetRaw_Cell * SigmetRaw_CellsGet(const struct SigmetRaw_Cells * cells,
+	unsigned * num_cells_p)
+{
+    *num_cells_p = cells->num_cells;
+    return cells->cells;
+}
@@ -19,18 +19,30 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/uio.h>
 #include "sigmet.h"
 #include "sigmet_raw.h"
 
+/* Milliseconds to wait for a daemon to answer a protocol version probe */
+#define DMN_PROBE_MS 2000
+
+/* Daemons whose protocol version SigmetRaw_DmnProto remembers */
+#define DMN_PROTO_CACHE 8
+
+/* Attempts at a sweep data request while the daemon's volume keeps changing */
+#define SWPDAT_TRIES 3
+
 struct SigmetRaw_Rqst SigmetRaw_Rqst_Init(void)
 {
     struct SigmetRaw_Rqst rqst = (struct SigmetRaw_Rqst){
-	.sub_cmd_n = -1, .s = -1, .hd_fd = -1, .err_fd = -1
+	.sub_cmd_n = -1, .s = -1, .deadline = {0, 0}, .hd_fd = -1, .err_fd = -1
     };
     memset(rqst.abbrv, 0, SIGMET_DATA_TYPE_LEN);
+    memset(rqst.expr, 0, SIGMETRAW_EXPR_LEN);
     return rqst;
 }
 void SigmetRaw_Rqst_Set_SubCmd(struct SigmetRaw_Rqst * rqst_p, enum SigmetRaw_SubCmdN sub_cmd_n)
@@ -45,6 +57,35 @@ void SigmetRaw_Rqst_Set_Swp(struct SigmetRaw_Rqst * rqst_p, unsigned s)
 {
     rqst_p->s = s;
 }
+/* Return 1/0 if expression fits/does not fit in request */
+int SigmetRaw_Rqst_Set_Expr(struct SigmetRaw_Rqst * rqst_p, const char * expr)
+{
+    return snprintf(rqst_p->expr, SIGMETRAW_EXPR_LEN, "%s", expr) < SIGMETRAW_EXPR_LEN;
+}
+/* Ask daemon to abandon request if it cannot finish within timeout seconds. Return 1/0 on
+ * success/failure. */
+int SigmetRaw_Rqst_Set_Timeout(struct SigmetRaw_Rqst * rqst_p, double timeout)
+{
+    struct timespec now;
+    if (!(timeout > 0.0) || clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+	return 0;
+    }
+    double ns = now.tv_nsec + fmod(timeout, 1.0) * 1.0e9;
+    rqst_p->deadline.tv_sec = now.tv_sec + (time_t)timeout + (time_t)(ns / 1.0e9);
+    rqst_p->deadline.tv_nsec = (long)fmod(ns, 1.0e9);
+    return 1;
+}
+/* Ask for pyramid level lvl, with cells from the mean or maximum as given by mode, instead of
+ * full resolution sweep data. Return 1/0 on success/failure. */
+int SigmetRaw_Rqst_Set_Pyr(struct SigmetRaw_Rqst * rqst_p, unsigned lvl, enum SigmetRaw_PyrMode mode)
+{
+    if (lvl > SIGMETRAW_PYR_MAX_LVL || (mode != SigmetRawPyrMean && mode != SigmetRawPyrMax)) {
+	return 0;
+    }
+    rqst_p->pyr.lvl = lvl;
+    rqst_p->pyr.mode = mode;
+    return 1;
+}
 void SigmetRaw_Rqst_Set_ShFD(struct SigmetRaw_Rqst * rqst_p, int hd_fd)
 {
     rqst_p->hd_fd = hd_fd;
@@ -124,6 +165,33 @@ int SigmetRaw_Rqst_Send(int skt_fd, struct SigmetRaw_Rqst * rqst_p, struct Sigme
     return 1;
 }
 
+/* Daemon side. Return true if request at rqst_p has a deadline that has passed. */
+_Bool SigmetRaw_Rqst_Expired(const struct SigmetRaw_Rqst * rqst_p)
+{
+    struct timespec now;
+    if (rqst_p->deadline.tv_sec == 0 || clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+	return false;
+    }
+    return now.tv_sec > rqst_p->deadline.tv_sec
+	|| (now.tv_sec == rqst_p->deadline.tv_sec && now.tv_nsec >= rqst_p->deadline.tv_nsec);
+}
+
+/* Daemon side. Return true if nobody will see the result of request at rqst_p, because the
+ * reader of its shared descriptor has gone away. Does not block. Meant to be called between
+ * rays, so the daemon can abandon work for clients that timed out or exited. Only the shared
+ * descriptor counts. A client may close its end of the socket as soon as it has sent a request
+ * whose output goes to the shared descriptor, so a closed socket does not mean the output is
+ * unwanted. */
+_Bool SigmetRaw_Rqst_Orphaned(const struct SigmetRaw_Rqst * rqst_p)
+{
+    struct pollfd pfd = { .fd = rqst_p->hd_fd, .events = POLLOUT };
+    if (rqst_p->hd_fd < 0 || poll(&pfd, 1, 0) <= 0) {
+	return false;
+    }
+    /* A pipe or socket whose reader has closed reports POLLERR to the writer. */
+    return (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+}
+
 int SigmetRaw_DmnConnect(const char * skt_path, struct Sigmet_ErrMsg * err_msg_p)
 {
     errno = 0;
@@ -154,40 +222,369 @@ int SigmetRaw_DmnConnect(const char * skt_path, struct Sigmet_ErrMsg * err_msg_p
     return skt_fd;
 }
 
-/* Obtain volume headers from sigmet_raw daemon connection at skt_fd. Put the volume headers at
- * vol_hdr_p. Return 1/0 on success/failure. On failure, error information will be in err_msg_p,
- * which must point to storage for SIGMET_ERR_LEN bytes. */
-int SigmetRaw_Dmn_VolHdr(int skt_fd, struct Sigmet_VolHdr * vol_hdr_p, struct Sigmet_ErrMsg * err_msg_p)
+/* Return protocol version, 1 or 2, of the daemon at socket skt_path, or 0 on failure. Daemons
+ * built before version 2 only understand version 1. Answers for the last DMN_PROTO_CACHE
+ * paths are kept, so repeated calls for a daemon cost one probe. Not thread safe. */
+int SigmetRaw_DmnProto(const char * skt_path, struct Sigmet_ErrMsg * err_msg_p)
 {
-    /* Daemon will write volume headers to pipe */
-    int p[2];
-    if (pipe(p) == -1) {
+    static struct {
+	char path[sizeof ((struct sockaddr_un *)NULL)->sun_path];
+	int vsn;
+    } prv[DMN_PROTO_CACHE];
+    static unsigned nxt;
+    for (unsigned d = 0; d < DMN_PROTO_CACHE; d++) {
+	if (prv[d].vsn != 0 && strcmp(prv[d].path, skt_path) == 0) {
+	    return prv[d].vsn;
+	}
+    }
+    int skt_fd = SigmetRaw_DmnConnect(skt_path, err_msg_p);
+    if (skt_fd == -1) {
+	return 0;
+    }
+    /* Send a version 2 request for volume headers, which is small and has no side effects. A
+     * version 2 response starts with SIGMETRAW_PROTO2_MAGIC. A version 1 daemon closes the
+     * connection, sends a version 1 status, or sends nothing. */
+    struct SigmetRaw_Rqst rqst = SigmetRaw_Rqst_Init();
+    SigmetRaw_Rqst_Set_SubCmd(&rqst, SigmetRawVolumeHeaders);
+    if ( !SigmetRaw_Rqst2_Send(skt_fd, &rqst, err_msg_p) ) {
+	close(skt_fd);
+	return 0;
+    }
+    int vsn = 1;
+    struct pollfd pfd = { .fd = skt_fd, .events = POLLIN };
+    uint32_t magic = 0;
+    if (poll(&pfd, 1, DMN_PROBE_MS) == 1
+	    && recv(skt_fd, &magic, sizeof magic, MSG_WAITALL) == (ssize_t)sizeof magic
+	    && magic == SIGMETRAW_PROTO2_MAGIC) {
+	vsn = 2;
+    }
+    close(skt_fd);
+    snprintf(prv[nxt].path, sizeof prv[nxt].path, "%s", skt_path);
+    prv[nxt].vsn = vsn;
+    nxt = (nxt + 1) % DMN_PROTO_CACHE;
+    return vsn;
+}
+
+/* Send request rqst_p to daemon at socket skt_path with protocol version 1, on a connection of
+ * its own, with pipes for output and errors. Put the output in a buffer from malloc at *dat_p,
+ * which caller must free, and its size in *dat_sz_p. Return 1/0 on success/failure. */
+static int rqst1_pipe(const char * skt_path, struct SigmetRaw_Rqst * rqst_p, char ** dat_p,
+	size_t * dat_sz_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    int skt_fd = SigmetRaw_DmnConnect(skt_path, err_msg_p);
+    if (skt_fd == -1) {
+	return 0;
+    }
+    int dat_pipe[2], err_pipe[2];
+    if (pipe(dat_pipe) == -1) {
 	Sigmet_ErrMsg_Print(err_msg_p, "%s could not create pipe to daemon. %s.",
 		__func__, strerror(errno));
+	close(skt_fd);
 	return 0;
     }
-    FILE *vol_hdr_fl = fdopen(p[0], "r");
-    if (vol_hdr_fl == NULL) {
-	Sigmet_ErrMsg_Print(err_msg_p, "%s could not configure pipe to daemon. %s.",
-		__func__, strerror(errno));
+    if (pipe(err_pipe) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not create pipe to read error information from "
+		"daemon. %s.", __func__, strerror(errno));
+	close(dat_pipe[0]);
+	close(dat_pipe[1]);
+	close(skt_fd);
+	return 0;
+    }
+    SigmetRaw_Rqst_Set_ShFD(rqst_p, dat_pipe[1]);
+    SigmetRaw_Rqst_Set_ErrFD(rqst_p, err_pipe[1]);
+    enum SigmetRaw_Status status = SigmetRawError;
+    struct msghdr rps = {
+	.msg_iov = (struct iovec [1]){
+	    [0] = { .iov_base = &status, .iov_len = sizeof status }
+	},
+	.msg_iovlen = 1
+    };
+    int sent = SigmetRaw_Rqst_Send(skt_fd, rqst_p, err_msg_p);
+    ssize_t rcvd = sent ? recvmsg(skt_fd, &rps, 0) : -1;
+    close(dat_pipe[1]);			/* Daemon writes to pipes. This process reads from them. */
+    close(err_pipe[1]);
+    close(skt_fd);
+    SigmetRaw_Rqst_Set_ShFD(rqst_p, -1);
+    SigmetRaw_Rqst_Set_ErrFD(rqst_p, -1);
+    if ( !sent || rcvd <= 0 || status != SigmetRawOkay ) {
+	if (sent && rcvd <= 0) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s: could not get response from daemon. %s.",
+		    __func__, strerror(errno));
+	} else if (sent) {
+	    /* Copy error information from error channel to err_msg_p. */
+	    ssize_t n = read(err_pipe[0], err_msg_p->str, err_msg_p->sz - 1);
+	    err_msg_p->str[(n > 0) ? n : 0] = '\0';
+	}
+	close(dat_pipe[0]);
+	close(err_pipe[0]);
+	return 0;
+    }
+    close(err_pipe[0]);
+    char * dat = NULL;
+    size_t dat_sz = 0, dat_cap = 0;
+    ssize_t n = 0;
+    do {
+	if (dat_sz == dat_cap) {
+	    size_t cap = (dat_cap == 0) ? 65536 : 2 * dat_cap;
+	    char * d = realloc(dat, cap);
+	    if (d == NULL) {
+		Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate %zu bytes for data from "
+			"daemon.", __func__, cap);
+		free(dat);
+		close(dat_pipe[0]);
+		return 0;
+	    }
+	    dat = d;
+	    dat_cap = cap;
+	}
+	n = read(dat_pipe[0], dat + dat_sz, dat_cap - dat_sz);
+	if (n > 0) {
+	    dat_sz += n;
+	}
+    } while (n > 0 || (n == -1 && errno == EINTR));
+    close(dat_pipe[0]);
+    *dat_p = dat;
+    *dat_sz_p = dat_sz;
+    return 1;
+}
+
+/* Obtain volume headers from sigmet_raw daemon at socket skt_path. Put the volume headers at
+ * vol_hdr_p. Return 1/0 on success/failure. On failure, error information will be in err_msg_p,
+ * which must point to storage for SIGMET_ERR_LEN bytes. A version 2 daemon sends serialized
+ * headers inline in the response. A version 1 daemon writes them to a pipe, serialized if it
+ * is recent enough, otherwise as a struct Sigmet_VolHdr whose data type pointers belong to the
+ * daemon, so they are rebuilt here from the data type mask. */
+int SigmetRaw_Dmn_VolHdr(const char * skt_path, struct Sigmet_VolHdr * vol_hdr_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    int vsn = SigmetRaw_DmnProto(skt_path, err_msg_p);
+    if (vsn == 0) {
 	return 0;
     }
-    /* Send request, get response. */
     struct SigmetRaw_Rqst rqst = SigmetRaw_Rqst_Init();
     SigmetRaw_Rqst_Set_SubCmd(&rqst, SigmetRawVolumeHeaders);
-    SigmetRaw_Rqst_Set_ShFD(&rqst, p[1]);
-    if ( !SigmetRaw_Rqst_Send(skt_fd, &rqst, err_msg_p) ) {
-	fclose(vol_hdr_fl);
+    char * buf = NULL;
+    size_t buf_sz = 0;
+    if (vsn == 2) {
+	int skt_fd = SigmetRaw_DmnConnect(skt_path, err_msg_p);
+	if (skt_fd == -1) {
+	    return 0;
+	}
+	struct SigmetRaw_Rps2Hdr rps;
+	void * inl = NULL;
+	int status = SigmetRaw_Rqst2_Send(skt_fd, &rqst, err_msg_p)
+	    && SigmetRaw_Rps2_Recv(skt_fd, &rps, &inl, &buf_sz, err_msg_p);
+	close(skt_fd);
+	buf = inl;
+	if ( !status ) {
+	    free(buf);
+	    return 0;
+	}
+    } else if ( !rqst1_pipe(skt_path, &rqst, &buf, &buf_sz, err_msg_p) ) {
+	return 0;
+    }
+    int status = 1;
+    if (buf_sz >= 4 && memcmp(buf, "SRVH", 4) == 0) {
+	status = SigmetRaw_VolHdrDeser(buf, buf_sz, vol_hdr_p, err_msg_p);
+    } else if (buf_sz == sizeof *vol_hdr_p) {
+	memcpy(vol_hdr_p, buf, sizeof *vol_hdr_p);
+	unsigned num_types = vol_hdr_p->num_types;
+	vol_hdr_p->num_types = Sigmet_DataTypes_FmMask(vol_hdr_p->types, vol_hdr_p);
+	if (vol_hdr_p->num_types != num_types) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s: daemon volume headers have %u data types, data "
+		    "type mask has %u.", __func__, num_types, vol_hdr_p->num_types);
+	    status = 0;
+	}
+    } else {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: daemon sent %zu bytes of volume headers, expected "
+		"serialized headers or %zu bytes.", __func__, buf_sz, sizeof *vol_hdr_p);
+	status = 0;
+    }
+    free(buf);
+    return status;
+}
+
+/* Send request rqst_p to daemon at skt_fd with protocol version 2 and a pipe for output. Put
+ * the output in a buffer from malloc at *dat_p, which caller must free, its size in *dat_sz_p,
+ * and the response header at rps_p. Return 1/0 on success/failure. */
+static int rqst_pipe(int skt_fd, struct SigmetRaw_Rqst * rqst_p, char ** dat_p, size_t * dat_sz_p,
+	struct SigmetRaw_Rps2Hdr * rps_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    int dat_pipe[2];
+    if (pipe(dat_pipe) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not create pipe to daemon. %s.",
+		__func__, strerror(errno));
 	return 0;
     }
-    /* Read volume headers from the pipe */
-    if (fread(vol_hdr_p, sizeof *vol_hdr_p, 1, vol_hdr_fl) != 1) {
-	Sigmet_ErrMsg_Print(err_msg_p, "%s could not read of volume headers from daemon.", __func__);
-	fclose(vol_hdr_fl);
+    SigmetRaw_Rqst_Set_ShFD(rqst_p, dat_pipe[1]);
+    int status = SigmetRaw_Rqst2_Send(skt_fd, rqst_p, err_msg_p);
+    close(dat_pipe[1]);			/* Daemon writes to pipe. This process reads from it. */
+    SigmetRaw_Rqst_Set_ShFD(rqst_p, -1);
+    if ( !status ) {
+	close(dat_pipe[0]);
+	return 0;
+    }
+    /* Daemon sends the response after the data, so read the pipe to end of file first. */
+    char * dat = NULL;
+    size_t dat_sz = 0, dat_cap = 0;
+    ssize_t n = 0;
+    do {
+	if (dat_sz == dat_cap) {
+	    size_t cap = (dat_cap == 0) ? 65536 : 2 * dat_cap;
+	    char * d = realloc(dat, cap);
+	    if (d == NULL) {
+		Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate %zu bytes for data from "
+			"daemon.", __func__, cap);
+		free(dat);
+		close(dat_pipe[0]);
+		return 0;
+	    }
+	    dat = d;
+	    dat_cap = cap;
+	}
+	n = read(dat_pipe[0], dat + dat_sz, dat_cap - dat_sz);
+	if (n > 0) {
+	    dat_sz += n;
+	}
+    } while (n > 0 || (n == -1 && errno == EINTR));
+    close(dat_pipe[0]);
+    void * inl;
+    size_t inl_sz;
+    status = SigmetRaw_Rps2_Recv(skt_fd, rps_p, &inl, &inl_sz, err_msg_p);
+    free(inl);
+    if ( !status ) {
+	free(dat);
 	return 0;
     }
-    fclose(vol_hdr_fl);
-    close(p[1]);			/* Only daemon writes to pipe. */
+    *dat_p = dat;
+    *dat_sz_p = dat_sz;
     return 1;
 }
 
+/* Request sweep data from sigmet_raw daemon connection at skt_fd with protocol version 2.
+ * Callers should check that the daemon speaks version 2 with SigmetRaw_DmnProto, and use
+ * SigmetRaw_Dmn_SwpDat1 otherwise. rqst_p should be a SigmetRawData or SigmetRawExpr request.
+ * Put the ray headers for the request's data type and sweep at *wray_hdrs_p and the ray count
+ * in *num_rays_p. The ray headers come from cache, or from the daemon if the volume generation
+ * in the daemon's response does not match the cached ones, and belong to the cache. If the
+ * daemon's volume changes between the data and the ray headers, the request is repeated. Put
+ * the data values, num_bins for each ray in ray order, in a buffer from malloc at *dat_p, which
+ * caller must free, and their count in *num_bins_tot_p. Return 1/0 on success/failure. */
+int SigmetRaw_Dmn_SwpDat(int skt_fd, struct SigmetRaw_Rqst * rqst_p,
+	struct SigmetRaw_RhCache * cache, const struct SigmetRaw_RayHdr ** wray_hdrs_p,
+	unsigned * num_rays_p, float ** dat_p, size_t * num_bins_tot_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    char * dat;
+    size_t dat_sz;
+    for (int try = 0; ; try++) {
+	struct SigmetRaw_Rps2Hdr rps;
+	if ( !rqst_pipe(skt_fd, rqst_p, &dat, &dat_sz, &rps, err_msg_p) ) {
+	    return 0;
+	}
+	uint64_t gen = rps.gen;
+	*wray_hdrs_p = SigmetRaw_RhCacheGet(cache, skt_fd, &gen, rqst_p->abbrv, rqst_p->s,
+		num_rays_p, err_msg_p);
+	if (*wray_hdrs_p != NULL) {
+	    break;
+	}
+	free(dat);
+	if (gen == rps.gen || try + 1 == SWPDAT_TRIES) {
+	    return 0;
+	}
+    }
+    size_t num_bins_tot = 0;
+    for (unsigned r = 0; r < *num_rays_p; r++) {
+	num_bins_tot += (*wray_hdrs_p)[r].ray_hdr.num_bins;
+    }
+    if (dat_sz != num_bins_tot * sizeof(float)) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: daemon sent %zu bytes of data, ray headers call for "
+		"%zu values.", __func__, dat_sz, num_bins_tot);
+	free(dat);
+	return 0;
+    }
+    *dat_p = (float *)dat;
+    *num_bins_tot_p = num_bins_tot;
+    return 1;
+}
+
+/* Request data for data type abbrv, sweep s from sigmet_raw daemon at socket skt_path with
+ * protocol version 1, which every daemon understands. Ray headers and data come from separate
+ * requests, each on a connection of its own. If the bin counts of the ray headers do not match
+ * the data, e.g. because the daemon's volume changed between them, the requests are repeated.
+ * Put the ray headers in a buffer from malloc at *wray_hdrs_p, and the ray count in
+ * *num_rays_p. Put the data values, num_bins for each ray in ray order, in a buffer from malloc
+ * at *dat_p, and their count in *num_bins_tot_p. Caller must free both buffers. Return 1/0 on
+ * success/failure. */
+int SigmetRaw_Dmn_SwpDat1(const char * skt_path, const char * abbrv, int s,
+	struct SigmetRaw_RayHdr ** wray_hdrs_p, unsigned * num_rays_p, float ** dat_p,
+	size_t * num_bins_tot_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct SigmetRaw_Rqst rh_rqst = SigmetRaw_Rqst_Init();
+    SigmetRaw_Rqst_Set_SubCmd(&rh_rqst, SigmetRawRayHeaders);
+    SigmetRaw_Rqst_Set_DataType(&rh_rqst, abbrv);
+    SigmetRaw_Rqst_Set_Swp(&rh_rqst, s);
+    struct SigmetRaw_Rqst dat_rqst = rh_rqst;
+    SigmetRaw_Rqst_Set_SubCmd(&dat_rqst, SigmetRawData);
+    for (int try = 0; try < SWPDAT_TRIES; try++) {
+	char * rh_buf, * dat;
+	size_t rh_sz, dat_sz;
+	if ( !rqst1_pipe(skt_path, &rh_rqst, &rh_buf, &rh_sz, err_msg_p) ) {
+	    return 0;
+	}
+	struct SigmetRaw_RayHdr * wray_hdrs = (struct SigmetRaw_RayHdr *)rh_buf;
+	unsigned num_rays = rh_sz / sizeof *wray_hdrs;
+	if (num_rays == 0 || rh_sz % sizeof *wray_hdrs != 0) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s: daemon sent %zu bytes of ray headers.",
+		    __func__, rh_sz);
+	    free(rh_buf);
+	    return 0;
+	}
+	if ( !rqst1_pipe(skt_path, &dat_rqst, &dat, &dat_sz, err_msg_p) ) {
+	    free(rh_buf);
+	    return 0;
+	}
+	size_t num_bins_tot = 0;
+	for (unsigned r = 0; r < num_rays; r++) {
+	    num_bins_tot += (wray_hdrs[r].ray_hdr.num_bins > 0) ? wray_hdrs[r].ray_hdr.num_bins : 0;
+	}
+	if (dat_sz == num_bins_tot * sizeof(float)) {
+	    *wray_hdrs_p = wray_hdrs;
+	    *num_rays_p = num_rays;
+	    *dat_p = (float *)dat;
+	    *num_bins_tot_p = num_bins_tot;
+	    return 1;
+	}
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: daemon sent %zu bytes of data, ray headers call for "
+		"%zu values.", __func__, dat_sz, num_bins_tot);
+	free(rh_buf);
+	free(dat);
+    }
+    return 0;
+}
+
+/* Request sweep pyramid level from sigmet_raw daemon connection at skt_fd with protocol version
+ * 2. rqst_p should be a SigmetRawData or SigmetRawExpr request with a pyramid level above 0. Put
+ * the grid dimensions at *num_rays_p and *num_bins_p, and the values, ray by ray, in a buffer from
+ * malloc at *dat_p, which caller must free. Return 1/0 on success/failure. */
+int SigmetRaw_Dmn_PyrDat(int skt_fd, struct SigmetRaw_Rqst * rqst_p, unsigned * num_rays_p,
+	unsigned * num_bins_p, float ** dat_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    char * dat;
+    size_t dat_sz;
+    struct SigmetRaw_Rps2Hdr rps;
+    if ( !rqst_pipe(skt_fd, rqst_p, &dat, &dat_sz, &rps, err_msg_p) ) {
+	return 0;
+    }
+    if (rps.num_rays < 0 || rps.num_swp_bins < 0
+	    || dat_sz != (size_t)rps.num_rays * rps.num_swp_bins * sizeof(float)) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: daemon sent %zu bytes of data for %d by %d grid.",
+		__func__, dat_sz, rps.num_rays, rps.num_swp_bins);
+	free(dat);
+	return 0;
+    }
+    *num_rays_p = rps.num_rays;
+    *num_bins_p = rps.num_swp_bins;
+    *dat_p = (float *)dat;
+    return 1;
+}
@@ -0,0 +1,422 @@
+/*
+ *	sigmet_raw_clutter.c --
+ *		Clutter maps built from clear air volumes.
+ *	--
+ *
+ *	An accumulator counts, for each sweep angle, azimuth cell, and range bin, how many rays
+ *	observed the cell and how many of those had a value above a threshold at the bin, e.g.
+ *	reflectivity above 40 dBZ on clear days. Sweeps go to the sweep angle slot within
+ *	CLUTTER_ANGL_TOL of their angle, or a new slot. Rays go to the azimuth cell containing the
+ *	middle of the ray. Above threshold gates are found with SigmetRaw_BitsGt, so only echoes,
+ *	which are rare in clear air, cost more than a few instructions per 32 bins. Accumulators are
+ *	not shared. To accumulate in parallel, give each thread its own accumulator, then combine
+ *	them with SigmetRaw_ClutterAccMerge.
+ *
+ *	SigmetRaw_ClutterMapWrite stores a map with one bit per sweep angle, azimuth cell, and range
+ *	bin, set where the fraction of observations above threshold reaches a given frequency. Rows
+ *	of bits are packed as in sigmet_raw_bits.c, so a map for 10 sweeps of 720 by 1000 gates
+ *	needs less than a megabyte. The map is written to a temporary file, synced, and renamed into
+ *	place, so readers never see a partial map, even after a crash. SigmetRaw_ClutterMapOpen
+ *	maps the file read only. Processes that open the same map share its pages, and threads can
+ *	share one struct SigmetRaw_ClutterMap without locking, since nothing modifies it after
+ *	opening.
+ *	SigmetRaw_ClutterMapApply sets gates flagged in the map to NAN.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define TWO_PI 6.28318530717958647688
+#define CLUTTER_ANGL_TOL 0.0035		/* Sweep angle tolerance, radians, 0.2 degrees */
+#define CLUTTER_VSN 1
+
+static const char magic[8] = "SRCLUTR";
+
+/* Map file header. Bits follow, dimensioned [num_swps][num_az][num_wds]. */
+struct clutter_hdr {
+    char magic[8];
+    uint32_t vsn;
+    uint32_t num_swps, num_az, num_bins;
+    uint32_t num_wds;			/* SigmetRaw_BitsNumWds(num_bins) */
+    float rng0, drng;			/* Range to start of first bin, bin size, meters */
+    float angl[SIGMETRAW_CLUTTER_MAX_SWPS];	/* Sweep angles, radians */
+    uint64_t sz;			/* File size, bytes */
+};
+
+struct SigmetRaw_ClutterAcc {
+    unsigned num_az, num_bins;
+    float thresh;
+    float rng0, drng;
+    unsigned num_swps;
+    float angl[SIGMETRAW_CLUTTER_MAX_SWPS];
+    uint32_t * obs[SIGMETRAW_CLUTTER_MAX_SWPS];		/* [num_az] rays observed */
+    uint32_t * hits[SIGMETRAW_CLUTTER_MAX_SWPS];	/* [num_az][num_bins] values above thresh */
+    uint32_t * bits;					/* Scratch, one ray */
+};
+
+struct SigmetRaw_ClutterMap {
+    void * map;
+    size_t sz;
+    const struct clutter_hdr * hdr;
+    const uint32_t * bits;
+};
+
+/* Create an accumulator for num_az azimuth cells and num_bins bins with the given range to the
+ * start of the first bin and bin size, in meters, counting values above thresh. Return the
+ * accumulator, or NULL on failure. */
+struct SigmetRaw_ClutterAcc * SigmetRaw_ClutterAccInit(unsigned num_az, unsigned num_bins,
+	float rng0, float drng, float thresh, struct Sigmet_ErrMsg * err_msg_p)
+{
+    if (num_az == 0 || num_az > SIGMETRAW_AZGRID_MAX_AZ
+	    || num_bins == 0 || num_bins > SIGMETRAW_CLUTTER_MAX_BINS) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: bad dimensions %u by %u.", __func__, num_az, num_bins);
+	return NULL;
+    }
+    struct SigmetRaw_ClutterAcc * acc = calloc(1, sizeof *acc);
+    uint32_t * bits = calloc(SigmetRaw_BitsNumWds(num_bins), sizeof *bits);
+    if (acc == NULL || bits == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not allocate clutter accumulator.", __func__);
+	free(acc);
+	free(bits);
+	return NULL;
+    }
+    acc->num_az = num_az;
+    acc->num_bins = num_bins;
+    acc->rng0 = rng0;
+    acc->drng = drng;
+    acc->thresh = thresh;
+    acc->bits = bits;
+    return acc;
+}
+
+void SigmetRaw_ClutterAccFree(struct SigmetRaw_ClutterAcc * acc)
+{
+    if (acc == NULL) {
+	return;
+    }
+    for (unsigned s = 0; s < acc->num_swps; s++) {
+	free(acc->obs[s]);
+	free(acc->hits[s]);
+    }
+    free(acc->bits);
+    free(acc);
+}
+
+/* Return index of sweep angle in num_swps angles at angl within CLUTTER_ANGL_TOL of a, or -1. */
+static int angl_idx(unsigned num_swps, const float * angl, double a)
+{
+    int s_min = -1;
+    double d_min = CLUTTER_ANGL_TOL;
+    for (unsigned s = 0; s < num_swps; s++) {
+	double d = fabs(angl[s] - a);
+	if (d <= d_min) {
+	    s_min = s;
+	    d_min = d;
+	}
+    }
+    return s_min;
+}
+
+/* Return index of sweep angle slot for angle a in acc, adding one if necessary, or -1 on
+ * failure. */
+static int acc_slot(struct SigmetRaw_ClutterAcc * acc, double a, struct Sigmet_ErrMsg * err_msg_p)
+{
+    int s = angl_idx(acc->num_swps, acc->angl, a);
+    if (s != -1) {
+	return s;
+    }
+    if (acc->num_swps == SIGMETRAW_CLUTTER_MAX_SWPS) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: clutter map can only have %d sweep angles.",
+		__func__, SIGMETRAW_CLUTTER_MAX_SWPS);
+	return -1;
+    }
+    s = acc->num_swps;
+    acc->obs[s] = calloc(acc->num_az, sizeof *acc->obs[s]);
+    acc->hits[s] = calloc((size_t)acc->num_az * acc->num_bins, sizeof *acc->hits[s]);
+    if (acc->obs[s] == NULL || acc->hits[s] == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not allocate clutter counts for %u by %u "
+		"gates.", __func__, acc->num_az, acc->num_bins);
+	free(acc->obs[s]);
+	free(acc->hits[s]);
+	acc->obs[s] = acc->hits[s] = NULL;
+	return -1;
+    }
+    acc->angl[s] = a;
+    acc->num_swps++;
+    return s;
+}
+
+/* Return index of azimuth cell, out of num_az, containing the middle of a ray from az0 to az1,
+ * going the short way around. */
+static unsigned ray_cell(float az0, float az1, unsigned num_az)
+{
+    double az = az0 + 0.5 * remainder((double)az1 - az0, TWO_PI);
+    az = fmod(az, TWO_PI);
+    if (az < 0.0) {
+	az += TWO_PI;
+    }
+    unsigned i = az / TWO_PI * num_az;
+    return (i < num_az) ? i : num_az - 1;
+}
+
+/* Add sweep with angle angl, radians, to acc. The sweep has num_rays rays, with headers at
+ * ray_hdrs and values at dat[r], or NULL for empty rays. Bins beyond the accumulator bin count
+ * are ignored. Return 1/0 on success/failure. */
+int SigmetRaw_ClutterAccSwp(struct SigmetRaw_ClutterAcc * acc, double angl, unsigned num_rays,
+	const struct Sigmet_RayHdr * ray_hdrs, const float * const * dat,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    int s = acc_slot(acc, angl, err_msg_p);
+    if (s == -1) {
+	return 0;
+    }
+    uint32_t * obs = acc->obs[s];
+    uint32_t * hits = acc->hits[s];
+    for (unsigned r = 0; r < num_rays; r++) {
+	int nb = ray_hdrs[r].num_bins;
+	if (dat[r] == NULL || nb <= 0) {
+	    continue;
+	}
+	size_t n = ((unsigned)nb < acc->num_bins) ? (unsigned)nb : acc->num_bins;
+	unsigned i = ray_cell(ray_hdrs[r].az0, ray_hdrs[r].az1, acc->num_az);
+	uint32_t * h = hits + (size_t)i * acc->num_bins;
+	obs[i]++;
+	SigmetRaw_BitsGt(n, dat[r], acc->thresh, acc->bits);
+	for (long b = SigmetRaw_BitsNext(n, acc->bits, 0); b != -1;
+		b = SigmetRaw_BitsNext(n, acc->bits, b + 1)) {
+	    h[b]++;
+	}
+    }
+    return 1;
+}
+
+/* Add the counts in src to dest. Both must have the same dimensions, geometry, and threshold.
+ * Return 1/0 on success/failure. */
+int SigmetRaw_ClutterAccMerge(struct SigmetRaw_ClutterAcc * dest,
+	const struct SigmetRaw_ClutterAcc * src, struct Sigmet_ErrMsg * err_msg_p)
+{
+    if (dest->num_az != src->num_az || dest->num_bins != src->num_bins
+	    || dest->rng0 != src->rng0 || dest->drng != src->drng
+	    || dest->thresh != src->thresh) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: clutter accumulators do not match.", __func__);
+	return 0;
+    }
+    size_t num_gates = (size_t)src->num_az * src->num_bins;
+    for (unsigned ss = 0; ss < src->num_swps; ss++) {
+	int sd = acc_slot(dest, src->angl[ss], err_msg_p);
+	if (sd == -1) {
+	    return 0;
+	}
+	uint32_t * obs = dest->obs[sd], * hits = dest->hits[sd];
+	const uint32_t * s_obs = src->obs[ss], * s_hits = src->hits[ss];
+	for (unsigned i = 0; i < src->num_az; i++) {
+	    obs[i] += s_obs[i];
+	}
+	for (size_t g = 0; g < num_gates; g++) {
+	    hits[g] += s_hits[g];
+	}
+    }
+    return 1;
+}
+
+/* Write a map to path flagging gates in acc that were above threshold in at least fraction freq
+ * of at least min_obs observations. Return 1/0 on success/failure. */
+int SigmetRaw_ClutterMapWrite(const struct SigmetRaw_ClutterAcc * acc, float freq,
+	unsigned min_obs, const char * path, struct Sigmet_ErrMsg * err_msg_p)
+{
+    size_t num_wds = SigmetRaw_BitsNumWds(acc->num_bins);
+    size_t bits_sz = (size_t)acc->num_swps * acc->num_az * num_wds * sizeof(uint32_t);
+    struct clutter_hdr hdr;
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, magic, sizeof magic);
+    hdr.vsn = CLUTTER_VSN;
+    hdr.num_swps = acc->num_swps;
+    hdr.num_az = acc->num_az;
+    hdr.num_bins = acc->num_bins;
+    hdr.num_wds = num_wds;
+    hdr.rng0 = acc->rng0;
+    hdr.drng = acc->drng;
+    memcpy(hdr.angl, acc->angl, sizeof acc->angl);
+    hdr.sz = sizeof hdr + bits_sz;
+    uint32_t * bits = calloc(bits_sz > 0 ? bits_sz : 1, 1);
+    if (bits == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not allocate %zu bytes for clutter map.",
+		__func__, bits_sz);
+	return 0;
+    }
+    uint32_t * row = bits;
+    for (unsigned s = 0; s < acc->num_swps; s++) {
+	for (unsigned i = 0; i < acc->num_az; i++, row += num_wds) {
+	    uint32_t n = acc->obs[s][i];
+	    if (n == 0 || n < min_obs) {
+		continue;
+	    }
+	    /* Integer test, hits >= freq * n, so rounding is the same for every gate. */
+	    uint32_t n_min = ceil((double)freq * n);
+	    n_min = (n_min > 0) ? n_min : 1;
+	    const uint32_t * h = acc->hits[s] + (size_t)i * acc->num_bins;
+	    for (unsigned b = 0; b < acc->num_bins; b++) {
+		row[b / SIGMETRAW_BITS_PER_WD] |= (uint32_t)(h[b] >= n_min)
+		    << (b % SIGMETRAW_BITS_PER_WD);
+	    }
+	}
+    }
+
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof tmp, "%s.XXXXXX", path) >= (int)sizeof tmp) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: temporary path for %s too long.", __func__, path);
+	free(bits);
+	return 0;
+    }
+    int fd = mkstemp(tmp);
+    if (fd == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not create %s. %s.", __func__, tmp,
+		strerror(errno));
+	free(bits);
+	return 0;
+    }
+    const char * segs[2] = { (const char *)&hdr, (const char *)bits };
+    size_t seg_szs[2] = { sizeof hdr, bits_sz };
+    for (int g = 0; g < 2; g++) {
+	for (size_t n = 0; n < seg_szs[g]; ) {
+	    ssize_t w = write(fd, segs[g] + n, seg_szs[g] - n);
+	    if (w == -1 && errno != EINTR) {
+		Sigmet_ErrMsg_Print(err_msg_p, "%s: could not write %s. %s.", __func__, tmp,
+			strerror(errno));
+		close(fd);
+		unlink(tmp);
+		free(bits);
+		return 0;
+	    }
+	    n += (w > 0) ? w : 0;
+	}
+    }
+    free(bits);
+    if (fchmod(fd, 0644) == -1 || fsync(fd) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not write %s. %s.", __func__, tmp,
+		strerror(errno));
+	close(fd);
+	unlink(tmp);
+	return 0;
+    }
+    if (close(fd) == -1 || rename(tmp, path) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not put clutter map at %s. %s.", __func__, path,
+		strerror(errno));
+	unlink(tmp);
+	return 0;
+    }
+    return 1;
+}
+
+/* Map the clutter map at path read only. Return the map, or NULL on failure. */
+struct SigmetRaw_ClutterMap * SigmetRaw_ClutterMapOpen(const char * path,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not open clutter map %s. %s",
+		__func__, path, strerror(errno));
+	return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct clutter_hdr)) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: clutter map %s is missing or truncated.",
+		__func__, path);
+	close(fd);
+	return NULL;
+    }
+    size_t sz = st.st_size;
+    void * map = mmap(NULL, sz, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not map clutter map %s. %s",
+		__func__, path, strerror(errno));
+	return NULL;
+    }
+    /* Bound the dimensions before multiplying them. */
+    const struct clutter_hdr * hdr = map;
+    if (memcmp(hdr->magic, magic, sizeof magic) != 0 || hdr->vsn != CLUTTER_VSN
+	    || hdr->sz != sz || hdr->num_swps > SIGMETRAW_CLUTTER_MAX_SWPS
+	    || hdr->num_az == 0 || hdr->num_az > SIGMETRAW_AZGRID_MAX_AZ
+	    || hdr->num_bins == 0 || hdr->num_bins > SIGMETRAW_CLUTTER_MAX_BINS
+	    || hdr->num_wds != SigmetRaw_BitsNumWds(hdr->num_bins)
+	    || sizeof *hdr + (uint64_t)hdr->num_swps * hdr->num_az * hdr->num_wds
+		* sizeof(uint32_t) != sz) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: %s is not a clutter map.", __func__, path);
+	munmap(map, sz);
+	return NULL;
+    }
+    struct SigmetRaw_ClutterMap * clut = malloc(sizeof *clut);
+    if (clut == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not allocate clutter map.", __func__);
+	munmap(map, sz);
+	return NULL;
+    }
+    clut->map = map;
+    clut->sz = sz;
+    clut->hdr = hdr;
+    clut->bits = (const uint32_t *)((const char *)map + sizeof *hdr);
+    return clut;
+}
+
+void SigmetRaw_ClutterMapClose(struct SigmetRaw_ClutterMap * clut)
+{
+    if (clut != NULL) {
+	munmap(clut->map, clut->sz);
+	free(clut);
+    }
+}
+
+/* Put the range to the start of the first bin and the bin size, meters, of the map at rng0_p and
+ * drng_p. Return the number of bins per ray. */
+unsigned SigmetRaw_ClutterMapRng(const struct SigmetRaw_ClutterMap * clut, float * rng0_p,
+	float * drng_p)
+{
+    *rng0_p = clut->hdr->rng0;
+    *drng_p = clut->hdr->drng;
+    return clut->hdr->num_bins;
+}
+
+/* Return index of the map sweep for sweep angle angl, radians, or -1 if the map has none. */
+int SigmetRaw_ClutterMapSwp(const struct SigmetRaw_ClutterMap * clut, double angl)
+{
+    return angl_idx(clut->hdr->num_swps, clut->hdr->angl, angl);
+}
+
+/* Set values at vals, which has num_bins bins for the ray with header ray_hdr, to NAN where map
+ * sweep s, from SigmetRaw_ClutterMapSwp, flags clutter. Does nothing if s is -1. Return number
+ * of gates set. */
+unsigned SigmetRaw_ClutterMapApply(const struct SigmetRaw_ClutterMap * clut, int s,
+	const struct Sigmet_RayHdr * ray_hdr, int num_bins, float * vals)
+{
+    const struct clutter_hdr * hdr = clut->hdr;
+    if (s < 0 || (unsigned)s >= hdr->num_swps || num_bins <= 0) {
+	return 0;
+    }
+    size_t n = ((unsigned)num_bins < hdr->num_bins) ? (unsigned)num_bins : hdr->num_bins;
+    unsigned i = ray_cell(ray_hdr->az0, ray_hdr->az1, hdr->num_az);
+    const uint32_t * row = clut->bits + ((size_t)s * hdr->num_az + i) * hdr->num_wds;
+    unsigned c = 0;
+    for (long b = SigmetRaw_BitsNext(n, row, 0); b != -1; b = SigmetRaw_BitsNext(n, row, b + 1)) {
+	vals[b] = NAN;
+	c++;
+    }
+    return c;
+}
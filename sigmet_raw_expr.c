@@ -0,0 +1,426 @@
+/*
+ *	sigmet_raw_expr.c --
+ *		Expressions that compute derived fields from several data types in a sweep.
+ *	--
+ *
+ *	Grammar, lowest precedence first:
+ *		expr	:= and { "||" and }
+ *		and	:= cmp { "&&" cmp }
+ *		cmp	:= add [ ("<" | "<=" | ">" | ">=" | "==" | "!=") add ]
+ *		add	:= mul { ("+" | "-") mul }
+ *		mul	:= unary { ("*" | "/") unary }
+ *		unary	:= ("-" | "!") unary | primary
+ *		primary	:= number | NAN | data_type | func "(" expr { "," expr } ")" | "(" expr ")"
+ *		func	:= abs | min | max | clamp | where
+ *	where data_type is a Sigmet data type abbreviation such as DB_DBZ.
+ *	where(c, a, b) is a where c is true (not zero), otherwise b. clamp(x, lo, hi) limits x
+ *	to [lo, hi]. Comparisons and logical operators give 1 or 0. Any operation on NAN gives NAN,
+ *	except that where gives the selected operand.
+ *
+ *	Compilation produces an array of nodes in postfix order, so children always precede their
+ *	parent. Evaluation runs every node over one block of SIGMETRAW_EXPR_BLK bins before moving
+ *	to the next block, so intermediate results stay in cache and the whole expression makes
+ *	one pass over the input sweeps. Each node kernel is a simple loop the compiler vectorizes.
+ *
+ *	Output rays have the bin count of the first data type in the expression. Bins beyond the
+ *	end of shorter rays of other data types are NAN.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define SIGMETRAW_EXPR_BLK 256
+#define MAX_NODES 128
+
+enum expr_op {
+    OpConst, OpType, OpNeg, OpNot, OpAbs,
+    OpAdd, OpSub, OpMul, OpDiv, OpLT, OpLE, OpGT, OpGE, OpEQ, OpNE, OpAnd, OpOr, OpMin, OpMax,
+    OpClamp, OpWhere
+};
+
+struct expr_node {
+    enum expr_op op;
+    int a, b, c;			/* Indeces of operand nodes, or -1 */
+    float k;				/* Value for OpConst */
+    int slot;				/* Input index for OpType */
+    const float * res;			/* Result for current block */
+    float * buf;			/* Storage for result, SIGMETRAW_EXPR_BLK floats */
+};
+
+struct SigmetRaw_Expr {
+    int num_nodes;
+    struct expr_node nodes[MAX_NODES];
+    unsigned num_types;
+    const struct Sigmet_DataType * types[SIGMET_NUM_DATA_TYPES];
+    float * bufs;			/* Block buffers for all nodes */
+};
+
+/* Parser state */
+struct expr_parser {
+    const char * p;			/* Current position in expression text */
+    struct SigmetRaw_Expr * expr;
+    struct Sigmet_ErrMsg * err_msg_p;
+};
+
+static int parse_or(struct expr_parser *);
+
+static void skip_space(struct expr_parser * ps)
+{
+    while (isspace((unsigned char)*ps->p)) {
+	ps->p++;
+    }
+}
+
+/* If text at current position starts with tok, consume it and return true. */
+static _Bool accept_tok(struct expr_parser * ps, const char * tok)
+{
+    skip_space(ps);
+    size_t n = strlen(tok);
+    if (strncmp(ps->p, tok, n) == 0) {
+	ps->p += n;
+	return 1;
+    }
+    return 0;
+}
+
+/* Append node and return its index, or -2 on failure. Operand index -1 means no operand. */
+static int add_node(struct expr_parser * ps, enum expr_op op, int a, int b, int c)
+{
+    if (a == -2 || b == -2 || c == -2) {
+	return -2;			/* Propagate earlier failure */
+    }
+    struct SigmetRaw_Expr * expr = ps->expr;
+    if (expr->num_nodes == MAX_NODES) {
+	Sigmet_ErrMsg_Print(ps->err_msg_p, "expression too complicated, limit is %d terms.",
+		MAX_NODES);
+	return -2;
+    }
+    expr->nodes[expr->num_nodes] = (struct expr_node){ .op = op, .a = a, .b = b, .c = c };
+    return expr->num_nodes++;
+}
+
+static int parse_args(struct expr_parser * ps, const char * fn, int num_args, int args[3])
+{
+    if ( !accept_tok(ps, "(") ) {
+	Sigmet_ErrMsg_Print(ps->err_msg_p, "expected ( after %s.", fn);
+	return 0;
+    }
+    for (int n = 0; n < num_args; n++) {
+	if (n > 0 && !accept_tok(ps, ",")) {
+	    Sigmet_ErrMsg_Print(ps->err_msg_p, "%s needs %d arguments.", fn, num_args);
+	    return 0;
+	}
+	if ((args[n] = parse_or(ps)) == -2) {
+	    return 0;
+	}
+    }
+    if ( !accept_tok(ps, ")") ) {
+	Sigmet_ErrMsg_Print(ps->err_msg_p, "expected ) after arguments to %s.", fn);
+	return 0;
+    }
+    return 1;
+}
+
+static int parse_primary(struct expr_parser * ps)
+{
+    skip_space(ps);
+    const char * p = ps->p;
+    if (accept_tok(ps, "(")) {
+	int n = parse_or(ps);
+	if (n != -2 && !accept_tok(ps, ")")) {
+	    Sigmet_ErrMsg_Print(ps->err_msg_p, "expected ) at %s", ps->p);
+	    return -2;
+	}
+	return n;
+    }
+    if (isdigit((unsigned char)*p) || *p == '.') {
+	char * e;
+	float k = strtof(p, &e);
+	ps->p = e;
+	int n = add_node(ps, OpConst, -1, -1, -1);
+	if (n >= 0) {
+	    ps->expr->nodes[n].k = k;
+	}
+	return n;
+    }
+    if ( !(isalpha((unsigned char)*p) || *p == '_') ) {
+	Sigmet_ErrMsg_Print(ps->err_msg_p, "unexpected input at %s", p);
+	return -2;
+    }
+    char nm[SIGMET_DATA_TYPE_LEN + 1];
+    size_t len = 0;
+    while (isalnum((unsigned char)p[len]) || p[len] == '_') {
+	len++;
+    }
+    if (len > SIGMET_DATA_TYPE_LEN) {
+	Sigmet_ErrMsg_Print(ps->err_msg_p, "name too long at %s", p);
+	return -2;
+    }
+    memcpy(nm, p, len);
+    nm[len] = '\0';
+    ps->p += len;
+    int args[3] = {-1, -1, -1};
+    static const struct { const char * nm; enum expr_op op; int num_args; } fns[] = {
+	{"abs", OpAbs, 1}, {"min", OpMin, 2}, {"max", OpMax, 2}, {"clamp", OpClamp, 3},
+	{"where", OpWhere, 3}
+    };
+    for (size_t f = 0; f < sizeof fns / sizeof fns[0]; f++) {
+	if (strcmp(nm, fns[f].nm) == 0) {
+	    if ( !parse_args(ps, nm, fns[f].num_args, args) ) {
+		return -2;
+	    }
+	    return add_node(ps, fns[f].op, args[0], args[1], args[2]);
+	}
+    }
+    if (strcmp(nm, "NAN") == 0) {
+	int n = add_node(ps, OpConst, -1, -1, -1);
+	if (n >= 0) {
+	    ps->expr->nodes[n].k = NAN;
+	}
+	return n;
+    }
+    const struct Sigmet_DataType * type = Sigmet_DataTypeGet(nm);
+    if (type == NULL) {
+	Sigmet_ErrMsg_Print(ps->err_msg_p, "%s is not a Sigmet data type or function.", nm);
+	return -2;
+    }
+    struct SigmetRaw_Expr * expr = ps->expr;
+    unsigned slot = 0;
+    while (slot < expr->num_types && expr->types[slot] != type) {
+	slot++;
+    }
+    if (slot == expr->num_types) {
+	expr->types[expr->num_types++] = type;
+    }
+    int n = add_node(ps, OpType, -1, -1, -1);
+    if (n >= 0) {
+	expr->nodes[n].slot = slot;
+    }
+    return n;
+}
+
+static int parse_unary(struct expr_parser * ps)
+{
+    if (accept_tok(ps, "-")) {
+	return add_node(ps, OpNeg, parse_unary(ps), -1, -1);
+    }
+    if (accept_tok(ps, "!") ) {
+	if (*ps->p == '=') {
+	    Sigmet_ErrMsg_Print(ps->err_msg_p, "unexpected != at %s", ps->p - 1);
+	    return -2;
+	}
+	return add_node(ps, OpNot, parse_unary(ps), -1, -1);
+    }
+    return parse_primary(ps);
+}
+
+static int parse_mul(struct expr_parser * ps)
+{
+    int n = parse_unary(ps);
+    while (n != -2) {
+	if (accept_tok(ps, "*")) {
+	    n = add_node(ps, OpMul, n, parse_unary(ps), -1);
+	} else if (accept_tok(ps, "/")) {
+	    n = add_node(ps, OpDiv, n, parse_unary(ps), -1);
+	} else {
+	    break;
+	}
+    }
+    return n;
+}
+
+static int parse_add(struct expr_parser * ps)
+{
+    int n = parse_mul(ps);
+    while (n != -2) {
+	if (accept_tok(ps, "+")) {
+	    n = add_node(ps, OpAdd, n, parse_mul(ps), -1);
+	} else if (accept_tok(ps, "-")) {
+	    n = add_node(ps, OpSub, n, parse_mul(ps), -1);
+	} else {
+	    break;
+	}
+    }
+    return n;
+}
+
+static int parse_cmp(struct expr_parser * ps)
+{
+    int n = parse_add(ps);
+    /* Check two character operators first. */
+    static const struct { const char * tok; enum expr_op op; } cmps[] = {
+	{"<=", OpLE}, {">=", OpGE}, {"==", OpEQ}, {"!=", OpNE}, {"<", OpLT}, {">", OpGT}
+    };
+    for (size_t c = 0; n != -2 && c < sizeof cmps / sizeof cmps[0]; c++) {
+	if (accept_tok(ps, cmps[c].tok)) {
+	    return add_node(ps, cmps[c].op, n, parse_add(ps), -1);
+	}
+    }
+    return n;
+}
+
+static int parse_and(struct expr_parser * ps)
+{
+    int n = parse_cmp(ps);
+    while (n != -2 && accept_tok(ps, "&&")) {
+	n = add_node(ps, OpAnd, n, parse_cmp(ps), -1);
+    }
+    return n;
+}
+
+static int parse_or(struct expr_parser * ps)
+{
+    int n = parse_and(ps);
+    while (n != -2 && accept_tok(ps, "||")) {
+	n = add_node(ps, OpOr, n, parse_and(ps), -1);
+    }
+    return n;
+}
+
+/* Compile expression in text src. Return compiled expression, or NULL on failure, in which case
+ * err_msg_p will have error information. Caller should free return value with SigmetRaw_ExprFree.
+ * A compiled expression holds scratch space, so each thread needs its own. */
+struct SigmetRaw_Expr * SigmetRaw_ExprCompile(const char * src, struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct SigmetRaw_Expr * expr = calloc(1, sizeof *expr);
+    if (expr == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate expression.", __func__);
+	return NULL;
+    }
+    struct expr_parser ps = { .p = src, .expr = expr, .err_msg_p = err_msg_p };
+    if (parse_or(&ps) == -2) {
+	free(expr);
+	return NULL;
+    }
+    skip_space(&ps);
+    if (*ps.p != '\0') {
+	Sigmet_ErrMsg_Print(err_msg_p, "unexpected input at %s", ps.p);
+	free(expr);
+	return NULL;
+    }
+    if (expr->num_types == 0) {
+	Sigmet_ErrMsg_Print(err_msg_p, "expression %s does not use any data types.", src);
+	free(expr);
+	return NULL;
+    }
+    expr->bufs = malloc((size_t)expr->num_nodes * SIGMETRAW_EXPR_BLK * sizeof *expr->bufs);
+    if (expr->bufs == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate expression buffers.", __func__);
+	free(expr);
+	return NULL;
+    }
+    for (int n = 0; n < expr->num_nodes; n++) {
+	struct expr_node * node = expr->nodes + n;
+	node->buf = expr->bufs + (size_t)n * SIGMETRAW_EXPR_BLK;
+	node->res = node->buf;
+	if (node->op == OpConst) {
+	    for (int i = 0; i < SIGMETRAW_EXPR_BLK; i++) {
+		node->buf[i] = node->k;
+	    }
+	}
+    }
+    return expr;
+}
+
+void SigmetRaw_ExprFree(struct SigmetRaw_Expr * expr)
+{
+    if (expr != NULL) {
+	free(expr->bufs);
+	free(expr);
+    }
+}
+
+/* Return number of data types expr uses. Data types are numbered 0 to return value - 1, in order
+ * of first appearance in the expression. */
+unsigned SigmetRaw_ExprNumTypes(const struct SigmetRaw_Expr * expr)
+{
+    return expr->num_types;
+}
+
+/* Return data type with index i in expr. */
+const struct Sigmet_DataType * SigmetRaw_ExprType(const struct SigmetRaw_Expr * expr, unsigned i)
+{
+    return (i < expr->num_types) ? expr->types[i] : NULL;
+}
+
+/* Kernels. n <= SIGMETRAW_EXPR_BLK. */
+#define BIN_KERNEL(o, x, y, n, e) \
+    for (int i = 0; i < (n); i++) { float u = (x)[i], v = (y)[i]; (o)[i] = (e); }
+#define CMP(e) (isnan(u) || isnan(v)) ? NAN : ((e) ? 1.0f : 0.0f)
+
+static void eval_node(struct expr_node * nodes, struct expr_node * node, int n)
+{
+    float * restrict o = node->buf;
+    const float * x = (node->a >= 0) ? nodes[node->a].res : NULL;
+    const float * y = (node->b >= 0) ? nodes[node->b].res : NULL;
+    const float * z = (node->c >= 0) ? nodes[node->c].res : NULL;
+    switch (node->op) {
+	case OpConst:
+	case OpType:
+	    break;
+	case OpNeg:
+	    for (int i = 0; i < n; i++) { o[i] = -x[i]; }
+	    break;
+	case OpNot:
+	    for (int i = 0; i < n; i++) { o[i] = isnan(x[i]) ? NAN : (x[i] == 0.0f); }
+	    break;
+	case OpAbs:
+	    for (int i = 0; i < n; i++) { o[i] = fabsf(x[i]); }
+	    break;
+	case OpAdd: BIN_KERNEL(o, x, y, n, u + v); break;
+	case OpSub: BIN_KERNEL(o, x, y, n, u - v); break;
+	case OpMul: BIN_KERNEL(o, x, y, n, u * v); break;
+	case OpDiv: BIN_KERNEL(o, x, y, n, u / v); break;
+	case OpLT:  BIN_KERNEL(o, x, y, n, CMP(u < v)); break;
+	case OpLE:  BIN_KERNEL(o, x, y, n, CMP(u <= v)); break;
+	case OpGT:  BIN_KERNEL(o, x, y, n, CMP(u > v)); break;
+	case OpGE:  BIN_KERNEL(o, x, y, n, CMP(u >= v)); break;
+	case OpEQ:  BIN_KERNEL(o, x, y, n, CMP(u == v)); break;
+	case OpNE:  BIN_KERNEL(o, x, y, n, CMP(u != v)); break;
+	case OpAnd: BIN_KERNEL(o, x, y, n, CMP(u != 0.0f && v != 0.0f)); break;
+	case OpOr:  BIN_KERNEL(o, x, y, n, CMP(u != 0.0f || v != 0.0f)); break;
+	case OpMin: BIN_KERNEL(o, x, y, n, (isnan(u) || isnan(v)) ? NAN : (u < v ? u : v)); break;
+	case OpMax: BIN_KERNEL(o, x, y, n, (isnan(u) || isnan(v)) ? NAN : (u > v ? u : v)); break;
+	case OpClamp:
+	    for (int i = 0; i < n; i++) {
+		float u = x[i] < y[i] ? y[i] : x[i];
+		o[i] = u > z[i] ? z[i] : u;
+	    }
+	    break;
+	case OpWhere:
+	    for (int i = 0; i < n; i++) {
+		o[i] = isnan(x[i]) ? NAN : (x[i] != 0.0f ? y[i] : z[i]);
+	    }
+	    break;
+    }
+}
+
+/* Evaluate expr for one ray of num_bins bins. vals[i] must point to num_bins values for data
+ * type SigmetRaw_ExprType(expr, i), padded with NAN if necessary. Put result in out. */
+void SigmetRaw_ExprEval(struct SigmetRaw_Expr * expr, int num_bins, const float * const * vals,
+	float * out)
+{
+    struct expr_node * nodes = expr->nodes;
+    int num_nodes = expr->num_nodes;
+    for (int b0 = 0; b0 < num_bins; b0 += SIGMETRAW_EXPR_BLK) {
+	int n = (num_bins - b0 < SIGMETRAW_EXPR_BLK) ? num_bins - b0 : SIGMETRAW_EXPR_BLK;
+	for (int d = 0; d < num_nodes; d++) {
+	    if (nodes[d].op == OpType) {
+		nodes[d].res = vals[nodes[d].slot] + b0;
+	    } else {
+		eval_node(nodes, nodes + d, n);
+	    }
+	}
+	memcpy(out + b0, nodes[num_nodes - 1].res, n * sizeof *out);
+    }
+}
@@ -0,0 +1,209 @@
+/*
+ *	sigmet_raw_flight.c --
+ *		Request coalescing for the sigmet_raw daemon.
+ *	--
+ *
+ *	When many clients send identical requests at once, e.g. the same SigmetRawData or
+ *	SigmetRawRayHeaders request right after a new volume arrives, only the first, the leader,
+ *	computes the result. Other requesters join the leader's flight and wait for the result,
+ *	then each writes the shared copy to its own client. A flight ends when the leader
+ *	finishes, so a later identical request starts a new computation, picking up any new volume.
+ *
+ *	Usage in a request handler thread:
+ *
+ *		_Bool leader;
+ *		struct SigmetRaw_Flight * flt = SigmetRaw_FlightJoin(flts, &rqst, &leader);
+ *		if (leader) {
+ *		    ... compute result into malloc'ed buffer ...
+ *		    SigmetRaw_FlightDone(flts, flt, status, buf, buf_sz, err_str);
+ *		}
+ *		SigmetRaw_FlightWait(flts, flt, &status, &buf, &buf_sz, &err_str);
+ *		... send buf or err_str to client ...
+ *		SigmetRaw_FlightRelease(flts, flt);
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define NUM_BUCKETS 64
+
+/* Identity of a request. Descriptors are not part of it. */
+struct flight_key {
+    enum SigmetRaw_SubCmdN sub_cmd_n;
+    char abbrv[SIGMET_DATA_TYPE_LEN];
+    int s;
+    char expr[SIGMETRAW_EXPR_LEN];
+    struct SigmetRaw_PyrSel pyr;
+};
+
+struct SigmetRaw_Flight {
+    struct flight_key key;
+    unsigned refs;			/* Leader and waiters still using the flight */
+    _Bool done;				/* Leader has posted the result */
+    enum SigmetRaw_Status status;
+    void * buf;				/* Result, freed with the flight */
+    size_t buf_sz;
+    char err_str[SIGMET_ERR_LEN1];
+    pthread_cond_t cond;
+    struct SigmetRaw_Flight * next;	/* Next flight in bucket */
+};
+
+struct SigmetRaw_Flights {
+    pthread_mutex_t mtx;
+    struct SigmetRaw_Flight * buckets[NUM_BUCKETS];
+};
+
+static struct flight_key flight_key(const struct SigmetRaw_Rqst * rqst_p)
+{
+    struct flight_key key;
+    memset(&key, 0, sizeof key);
+    key.sub_cmd_n = rqst_p->sub_cmd_n;
+    strncpy(key.abbrv, rqst_p->abbrv, SIGMET_DATA_TYPE_LEN);
+    key.s = rqst_p->s;
+    strncpy(key.expr, rqst_p->expr, SIGMETRAW_EXPR_LEN);
+    key.pyr = rqst_p->pyr;
+    return key;
+}
+
+static _Bool key_eq(const struct flight_key * k0, const struct flight_key * k1)
+{
+    return k0->sub_cmd_n == k1->sub_cmd_n && k0->s == k1->s
+	&& k0->pyr.lvl == k1->pyr.lvl && k0->pyr.mode == k1->pyr.mode
+	&& strncmp(k0->abbrv, k1->abbrv, SIGMET_DATA_TYPE_LEN) == 0
+	&& strncmp(k0->expr, k1->expr, SIGMETRAW_EXPR_LEN) == 0;
+}
+
+/* FNV-1a */
+static unsigned key_hash(const struct flight_key * key)
+{
+    uint32_t h = 2166136261u;
+    const unsigned char * p, * e;
+    h = (h ^ key->sub_cmd_n) * 16777619u;
+    h = (h ^ (uint32_t)key->s) * 16777619u;
+    h = (h ^ (uint32_t)key->pyr.lvl) * 16777619u;
+    h = (h ^ (uint32_t)key->pyr.mode) * 16777619u;
+    p = (const unsigned char *)key->abbrv;
+    e = p + SIGMET_DATA_TYPE_LEN;
+    for ( ; p < e && *p; p++) {
+	h = (h ^ *p) * 16777619u;
+    }
+    p = (const unsigned char *)key->expr;
+    e = p + SIGMETRAW_EXPR_LEN;
+    for ( ; p < e && *p; p++) {
+	h = (h ^ *p) * 16777619u;
+    }
+    return h % NUM_BUCKETS;
+}
+
+struct SigmetRaw_Flights * SigmetRaw_FlightsInit(struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct SigmetRaw_Flights * flts = calloc(1, sizeof *flts);
+    if (flts == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate flight table.", __func__);
+	return NULL;
+    }
+    pthread_mutex_init(&flts->mtx, NULL);
+    return flts;
+}
+
+/* Free flight table. Caller must ensure no flights are in progress. */
+void SigmetRaw_FlightsFree(struct SigmetRaw_Flights * flts)
+{
+    if (flts != NULL) {
+	pthread_mutex_destroy(&flts->mtx);
+	free(flts);
+    }
+}
+
+/* Join the flight for request at rqst_p, starting one if none is in progress. Set *leader_p to
+ * true if caller started the flight and must compute the result. Return the flight, or NULL
+ * if memory runs out, in which case caller should handle the request on its own. */
+struct SigmetRaw_Flight * SigmetRaw_FlightJoin(struct SigmetRaw_Flights * flts,
+	const struct SigmetRaw_Rqst * rqst_p, _Bool * leader_p)
+{
+    struct flight_key key = flight_key(rqst_p);
+    unsigned h = key_hash(&key);
+    pthread_mutex_lock(&flts->mtx);
+    struct SigmetRaw_Flight * flt;
+    for (flt = flts->buckets[h]; flt != NULL; flt = flt->next) {
+	if (key_eq(&flt->key, &key)) {
+	    flt->refs++;
+	    *leader_p = 0;
+	    pthread_mutex_unlock(&flts->mtx);
+	    return flt;
+	}
+    }
+    flt = calloc(1, sizeof *flt);
+    if (flt != NULL) {
+	flt->key = key;
+	flt->refs = 1;
+	pthread_cond_init(&flt->cond, NULL);
+	flt->next = flts->buckets[h];
+	flts->buckets[h] = flt;
+	*leader_p = 1;
+    }
+    pthread_mutex_unlock(&flts->mtx);
+    return flt;
+}
+
+/* Leader posts result and wakes waiters. The flight takes ownership of buf, which must come from
+ * malloc. err_str, which may be NULL, describes a failure. */
+void SigmetRaw_FlightDone(struct SigmetRaw_Flights * flts, struct SigmetRaw_Flight * flt,
+	enum SigmetRaw_Status status, void * buf, size_t buf_sz, const char * err_str)
+{
+    pthread_mutex_lock(&flts->mtx);
+    flt->status = status;
+    flt->buf = buf;
+    flt->buf_sz = buf_sz;
+    snprintf(flt->err_str, sizeof flt->err_str, "%s", err_str ? err_str : "");
+    flt->done = 1;
+    /* Remove from table so later requests compute a fresh result. */
+    struct SigmetRaw_Flight ** p = &flts->buckets[key_hash(&flt->key)];
+    while (*p != flt) {
+	p = &(*p)->next;
+    }
+    *p = flt->next;
+    pthread_cond_broadcast(&flt->cond);
+    pthread_mutex_unlock(&flts->mtx);
+}
+
+/* Wait for flight result. On return, result is at *buf_p, with *buf_sz_p bytes, and *err_str_p
+ * describes any error. These remain valid until caller calls SigmetRaw_FlightRelease. */
+void SigmetRaw_FlightWait(struct SigmetRaw_Flights * flts, struct SigmetRaw_Flight * flt,
+	enum SigmetRaw_Status * status_p, const void ** buf_p, size_t * buf_sz_p,
+	const char ** err_str_p)
+{
+    pthread_mutex_lock(&flts->mtx);
+    while ( !flt->done ) {
+	pthread_cond_wait(&flt->cond, &flts->mtx);
+    }
+    pthread_mutex_unlock(&flts->mtx);
+    *status_p = flt->status;
+    *buf_p = flt->buf;
+    *buf_sz_p = flt->buf_sz;
+    *err_str_p = flt->err_str;
+}
+
+/* Caller is done with flight. Last caller frees it. */
+void SigmetRaw_FlightRelease(struct SigmetRaw_Flights * flts, struct SigmetRaw_Flight * flt)
+{
+    pthread_mutex_lock(&flts->mtx);
+    _Bool last = (--flt->refs == 0);
+    pthread_mutex_unlock(&flts->mtx);
+    if (last) {
+	pthread_cond_destroy(&flt->cond);
+	free(flt->buf);
+	free(flt);
+    }
+}
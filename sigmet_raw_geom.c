@@ -0,0 +1,550 @@
+/*
+ *	sigmet_raw_geom.c --
+ *		Beam height and beam blockage tables from a digital elevation model.
+ *	--
+ *
+ *	Beam height and blockage depend only on the radar site, the scan strategy, and the
+ *	terrain, so they are computed once and cached on disk. A struct SigmetRaw_GeomKey describes
+ *	the site and scan geometry: radar location and antenna height, vertical beam width, range
+ *	bins, sweep angles, and the number of azimuth cells in the blockage table. The cache file
+ *	name is a hash of the key and the identity of the elevation model file: its path, size, and
+ *	modification time. A changed scan strategy or elevation model therefore gets a new file.
+ *	Tables are written to a temporary file and renamed into place, then mapped read only, so
+ *	processes using the same geometry share one copy, and threads can share a
+ *	struct SigmetRaw_Geom without locking.
+ *
+ *	Beam height is the height of the beam center above sea level at each bin center, for a 4/3
+ *	effective earth radius. It does not depend on azimuth, so there is one row of heights per
+ *	sweep. Blockage is the cumulative fraction of the beam cross section below terrain, with
+ *	the beam cross section a disk of diameter equal to the vertical beam width, as in Bech et
+ *	al., 2003, "The sensitivity of single polarization weather radar beam blockage correction to
+ *	variability in the vertical refractivity gradient", J. Atmos. Oceanic Technol., 20, 845-855.
+ *	Terrain is sampled along GEOM_SUB_AZ sub rays across each azimuth cell, and cell blockage
+ *	is the mean over the sub rays. Blockage is stored as 0 to 255 for 0 to 1. Azimuth cells and
+ *	sweeps are split over threads.
+ *
+ *	The elevation model is an ESRI ASCII grid in degrees of latitude and longitude, e.g. from
+ *	"gdal_translate -of AAIGrid". Samples outside the grid or without data do not block.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define TWO_PI (2.0 * M_PI)
+#define EARTH_RADIUS 6371000.0				/* meters */
+#define EFF_EARTH_RADIUS (4.0 / 3.0 * EARTH_RADIUS)	/* meters */
+#define GEOM_SUB_AZ 5			/* Terrain samples across each azimuth cell */
+#define GEOM_ANGL_TOL 0.0035		/* Sweep angle tolerance, radians, 0.2 degrees */
+#define GEOM_VSN 1
+#define GEOM_SFX ".srgm"
+
+static const char magic[8] = "SRGEOM";
+
+/* Cache file header. Heights follow, dimensioned [num_swps][num_bins], then blockage,
+ * dimensioned [num_swps][num_az][num_bins]. */
+struct geom_hdr {
+    char magic[8];
+    uint32_t vsn;
+    uint32_t pad;
+    struct SigmetRaw_GeomKey key;
+    uint64_t dem_id[4];			/* Path hash, size, modification time */
+    uint64_t ht_off, blk_off, sz;	/* Offsets and size, bytes */
+};
+
+struct SigmetRaw_Dem {
+    unsigned ncols, nrows;
+    double lon0, lat0;			/* Center of south west cell, degrees */
+    double cell;			/* Cell size, degrees */
+    float * elev;			/* [nrows][ncols], south to north, NAN for no data */
+};
+
+struct SigmetRaw_Geom {
+    void * map;
+    size_t sz;
+    const struct geom_hdr * hdr;
+    const float * ht;
+    const uint8_t * blk;
+};
+
+/* Read the ESRI ASCII grid at path. Return the elevation model, or NULL on failure. */
+struct SigmetRaw_Dem * SigmetRaw_DemRead(const char * path, struct Sigmet_ErrMsg * err_msg_p)
+{
+    FILE * fl = fopen(path, "r");
+    if (fl == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not open elevation model %s. %s",
+		__func__, path, strerror(errno));
+	return NULL;
+    }
+    long ncols = 0, nrows = 0;
+    double x0 = NAN, y0 = NAN, cell = NAN, no_data = NAN;
+    _Bool ctr = 0;
+    char nm[32];
+    double v;
+    long pos = ftell(fl);
+    while (fscanf(fl, " %31s %lf", nm, &v) == 2) {
+	if (strcasecmp(nm, "ncols") == 0) {
+	    ncols = v;
+	} else if (strcasecmp(nm, "nrows") == 0) {
+	    nrows = v;
+	} else if (strcasecmp(nm, "xllcorner") == 0 || strcasecmp(nm, "xllcenter") == 0) {
+	    x0 = v;
+	    ctr = strcasecmp(nm, "xllcenter") == 0;
+	} else if (strcasecmp(nm, "yllcorner") == 0 || strcasecmp(nm, "yllcenter") == 0) {
+	    y0 = v;
+	} else if (strcasecmp(nm, "cellsize") == 0) {
+	    cell = v;
+	} else if (strcasecmp(nm, "nodata_value") == 0) {
+	    no_data = v;
+	} else {
+	    break;
+	}
+	pos = ftell(fl);
+    }
+    struct SigmetRaw_Dem * dem = NULL;
+    if (ncols <= 0 || nrows <= 0 || ncols > INT_MAX || nrows > INT_MAX
+	    || isnan(x0) || isnan(y0) || !(cell > 0.0) || fseek(fl, pos, SEEK_SET) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: %s does not have an ESRI ASCII grid header.",
+		__func__, path);
+	goto error;
+    }
+    if ((dem = calloc(1, sizeof *dem)) == NULL
+	    || (dem->elev = malloc((size_t)ncols * nrows * sizeof *dem->elev)) == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate %ld by %ld elevation model.",
+		__func__, nrows, ncols);
+	goto error;
+    }
+    dem->ncols = ncols;
+    dem->nrows = nrows;
+    dem->cell = cell;
+    dem->lon0 = ctr ? x0 : x0 + 0.5 * cell;
+    dem->lat0 = ctr ? y0 : y0 + 0.5 * cell;
+    /* File rows go north to south. */
+    for (long j = nrows - 1; j >= 0; j--) {
+	float * e = dem->elev + (size_t)j * ncols;
+	for (long i = 0; i < ncols; i++) {
+	    if (fscanf(fl, "%lf", &v) != 1) {
+		Sigmet_ErrMsg_Print(err_msg_p, "%s: elevation model %s is truncated.",
+			__func__, path);
+		goto error;
+	    }
+	    e[i] = (v == no_data) ? NAN : v;
+	}
+    }
+    fclose(fl);
+    return dem;
+
+error:
+    fclose(fl);
+    SigmetRaw_DemFree(dem);
+    return NULL;
+}
+
+void SigmetRaw_DemFree(struct SigmetRaw_Dem * dem)
+{
+    if (dem != NULL) {
+	free(dem->elev);
+	free(dem);
+    }
+}
+
+/* Return elevation, meters, at latitude lat and longitude lon, radians, interpolated
+ * bilinearly, or NAN if not available. */
+float SigmetRaw_DemElev(const struct SigmetRaw_Dem * dem, double lat, double lon)
+{
+    double x = (lon * 180.0 / M_PI - dem->lon0) / dem->cell;
+    double y = (lat * 180.0 / M_PI - dem->lat0) / dem->cell;
+    if ( !(x >= 0.0 && y >= 0.0 && x <= dem->ncols - 1 && y <= dem->nrows - 1) ) {
+	return NAN;
+    }
+    /* Cell with south west corner at i, j. On the north or east edge, use the cell below or to
+     * the left, unless the grid is one cell wide. */
+    unsigned i = x, j = y;
+    if (i + 1 >= dem->ncols) {
+	i = (dem->ncols > 1) ? dem->ncols - 2 : 0;
+    }
+    if (j + 1 >= dem->nrows) {
+	j = (dem->nrows > 1) ? dem->nrows - 2 : 0;
+    }
+    unsigned di = (dem->ncols > 1) ? 1 : 0, dj = (dem->nrows > 1) ? dem->ncols : 0;
+    const float * e = dem->elev + (size_t)j * dem->ncols + i;
+    float fx = x - i, fy = y - j;
+    return (1.0f - fy) * ((1.0f - fx) * e[0] + fx * e[di])
+	+ fy * ((1.0f - fx) * e[dj] + fx * e[dj + di]);
+}
+
+/* Fill in key for the radar and range geometry in vol_hdr and num_az azimuth cells. For PPI
+ * tasks, sweep angles are the configured elevations, so a truncated volume gets the same key as
+ * a complete one. Otherwise they come from the num_swps sweeps read, in swp_hdrs. Only the first
+ * SIGMETRAW_GEOM_MAX_SWPS sweeps get tables. SigmetRaw_GeomSwp returns -1 for the rest. Return
+ * 1/0 on success/failure. */
+int SigmetRaw_GeomKeyFmVol(const struct Sigmet_VolHdr * vol_hdr_p,
+	const struct Sigmet_SwpHdr * swp_hdrs, unsigned num_swps, unsigned num_az,
+	struct SigmetRaw_GeomKey * key_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    const struct Sigmet_TaskScanInfo * scan_info = &vol_hdr_p->ingst_hdr.task_cfg.task_scan_info;
+    _Bool ppi = scan_info->scan_mode == PPI_S || scan_info->scan_mode == PPI_C;
+    if (ppi) {
+	num_swps = Sigmet_VolNumSwps(vol_hdr_p);
+	num_swps = (num_swps < SIGMET_MAX_SWPS) ? num_swps : SIGMET_MAX_SWPS;
+    }
+    num_swps = (num_swps < SIGMETRAW_GEOM_MAX_SWPS) ? num_swps : SIGMETRAW_GEOM_MAX_SWPS;
+    if (num_swps == 0) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: volume has no sweeps.", __func__);
+	return 0;
+    }
+    if (num_az == 0 || num_az > SIGMETRAW_AZGRID_MAX_AZ || Sigmet_VolNumBins(vol_hdr_p) == 0) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: bad dimensions %u by %u.", __func__,
+		num_az, Sigmet_VolNumBins(vol_hdr_p));
+	return 0;
+    }
+    /* Zero padding too, since keys are hashed and compared as bytes. */
+    memset(key_p, 0, sizeof *key_p);
+    const struct Sigmet_IngstCfg * ingst_cfg = &vol_hdr_p->ingst_hdr.ingst_cfg;
+    double lat = Sigmet_Bin4Rad(ingst_cfg->lat);
+    double lon = Sigmet_Bin4Rad(ingst_cfg->lon);
+    key_p->lat = lat - ((lat > M_PI) ? TWO_PI : 0.0);
+    key_p->lon = lon - ((lon > M_PI) ? TWO_PI : 0.0);
+    key_p->alt = (float)ingst_cfg->ground_elev + ingst_cfg->radar_ht;
+    key_p->beam_width
+	= Sigmet_Bin4Rad(vol_hdr_p->ingst_hdr.task_cfg.task_misc_info.vert_beam_width);
+    const struct Sigmet_TaskRngInfo * rng_info = &vol_hdr_p->ingst_hdr.task_cfg.task_rng_info;
+    key_p->rng0 = rng_info->rng_1st_bin * 0.01f;
+    key_p->drng = rng_info->step_out * 0.01f;
+    key_p->num_bins = Sigmet_VolNumBins(vol_hdr_p);
+    key_p->num_az = num_az;
+    key_p->num_swps = num_swps;
+    for (unsigned s = 0; s < num_swps; s++) {
+	double angl = ppi ? Sigmet_Bin2Rad(scan_info->scan_info.task_ppi_scan_info.elev[s])
+	    : swp_hdrs[s].angl;
+	key_p->angl[s] = angl - ((angl > M_PI) ? TWO_PI : 0.0);
+    }
+    return 1;
+}
+
+static uint64_t fnv1a(uint64_t h, const void * buf, size_t n)
+{
+    const unsigned char * b = buf;
+    for (size_t i = 0; i < n; i++) {
+	h ^= b[i];
+	h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Fraction of a disk of radius a whose center is y above a horizontal line that is below the
+ * line. */
+static double blk_frac(double y, double a)
+{
+    if (y >= a) {
+	return 0.0;
+    } else if (y <= -a) {
+	return 1.0;
+    }
+    double u = -y;
+    return (u * sqrt(a * a - u * u) + a * a * asin(u / a) + 0.5 * M_PI * a * a) / (M_PI * a * a);
+}
+
+/* Shared by the threads */
+struct geom_calc {
+    const struct SigmetRaw_GeomKey * key_p;
+    const struct SigmetRaw_Dem * dem;
+    const float * ht;			/* [num_swps][num_bins] */
+    const double * sin_d, * cos_d;	/* [num_swps][num_bins] Ground distance, earth radians */
+    uint8_t * blk;			/* [num_swps][num_az][num_bins] */
+};
+
+/* Rows are (sweep, azimuth cell) pairs */
+static void * rows_thread(void * arg)
+{
+    struct SigmetRaw_Rows * rows = arg;
+    struct geom_calc * calc = rows->arg;
+    const struct SigmetRaw_GeomKey * key_p = calc->key_p;
+    unsigned num_bins = key_p->num_bins, num_az = key_p->num_az;
+    double sin_lat = sin(key_p->lat), cos_lat = cos(key_p->lat);
+    float cum[GEOM_SUB_AZ];
+    for (size_t i = rows->i0; i < rows->i1; i++) {
+	unsigned s = i / num_az, a = i % num_az;
+	const float * ht = calc->ht + (size_t)s * num_bins;
+	const double * sin_d = calc->sin_d + (size_t)s * num_bins;
+	const double * cos_d = calc->cos_d + (size_t)s * num_bins;
+	uint8_t * blk = calc->blk + i * num_bins;
+	double sin_az[GEOM_SUB_AZ], cos_az[GEOM_SUB_AZ];
+	for (int k = 0; k < GEOM_SUB_AZ; k++) {
+	    double az = (a + (k + 0.5) / GEOM_SUB_AZ) * TWO_PI / num_az;
+	    sin_az[k] = sin(az);
+	    cos_az[k] = cos(az);
+	    cum[k] = 0.0f;
+	}
+	for (unsigned b = 0; b < num_bins; b++) {
+	    double rng = key_p->rng0 + (b + 0.5) * key_p->drng;
+	    double rad = 0.5 * rng * key_p->beam_width;
+	    float sum = 0.0f;
+	    for (int k = 0; k < GEOM_SUB_AZ; k++) {
+		if (cum[k] < 1.0f) {
+		    /* Point at ground distance d along azimuth az from the radar */
+		    double sin_lat2 = sin_lat * cos_d[b] + cos_lat * sin_d[b] * cos_az[k];
+		    double lat2 = asin(sin_lat2);
+		    double lon2 = key_p->lon + atan2(sin_az[k] * sin_d[b] * cos_lat,
+			    cos_d[b] - sin_lat * sin_lat2);
+		    float z = SigmetRaw_DemElev(calc->dem, lat2, lon2);
+		    if (!isnan(z)) {
+			float f = blk_frac(ht[b] - z, rad);
+			cum[k] = (f > cum[k]) ? f : cum[k];
+		    }
+		}
+		sum += cum[k];
+	    }
+	    blk[b] = lrintf(255.0f * sum / GEOM_SUB_AZ);
+	}
+    }
+    return NULL;
+}
+
+/* Compute tables for key from dem on num_threads threads, or one per processor if 0, into
+ * ht and blk, laid out as in a cache file. Return 1/0 on success/failure. */
+static int geom_calc(const struct SigmetRaw_GeomKey * key_p, const struct SigmetRaw_Dem * dem,
+	unsigned num_threads, float * ht, uint8_t * blk, struct Sigmet_ErrMsg * err_msg_p)
+{
+    unsigned num_swps = key_p->num_swps, num_bins = key_p->num_bins;
+    size_t n = (size_t)num_swps * num_bins;
+    double * sin_d = malloc(n * sizeof *sin_d), * cos_d = malloc(n * sizeof *cos_d);
+    if (sin_d == NULL || cos_d == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate memory for %u by %u gates.",
+		__func__, num_swps, num_bins);
+	free(sin_d);
+	free(cos_d);
+	return 0;
+    }
+    for (unsigned s = 0; s < num_swps; s++) {
+	double sin_el = sin(key_p->angl[s]), cos_el = cos(key_p->angl[s]);
+	for (unsigned b = 0; b < num_bins; b++) {
+	    double rng = key_p->rng0 + (b + 0.5) * key_p->drng;
+	    double h = sqrt(rng * rng + EFF_EARTH_RADIUS * EFF_EARTH_RADIUS
+		    + 2.0 * rng * EFF_EARTH_RADIUS * sin_el) - EFF_EARTH_RADIUS;
+	    double d = asin(rng * cos_el / (EFF_EARTH_RADIUS + h)) * EFF_EARTH_RADIUS
+		/ EARTH_RADIUS;
+	    ht[(size_t)s * num_bins + b] = key_p->alt + h;
+	    sin_d[(size_t)s * num_bins + b] = sin(d);
+	    cos_d[(size_t)s * num_bins + b] = cos(d);
+	}
+    }
+    struct geom_calc calc = {
+	.key_p = key_p, .dem = dem, .ht = ht, .sin_d = sin_d, .cos_d = cos_d, .blk = blk
+    };
+
+    SigmetRaw_RowsRun(SigmetRaw_NumThreads(num_threads), (size_t)num_swps * key_p->num_az,
+	    rows_thread, &calc);
+    free(sin_d);
+    free(cos_d);
+    return 1;
+}
+
+/* Compute tables for hdr from elevation model at dem_path and write them to fd. Return 1/0 on
+ * success/failure. */
+static int build_ent(int fd, const struct geom_hdr * hdr, const char * dem_path,
+	unsigned num_threads, struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct SigmetRaw_Dem * dem = SigmetRaw_DemRead(dem_path, err_msg_p);
+    if (dem == NULL) {
+	return 0;
+    }
+    int status = 0;
+    char * buf = calloc(hdr->sz, 1);
+    if (buf == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate %llu bytes for geometry tables.",
+		__func__, (unsigned long long)hdr->sz);
+	goto done;
+    }
+    memcpy(buf, hdr, sizeof *hdr);
+    if ( !geom_calc(&hdr->key, dem, num_threads, (float *)(buf + hdr->ht_off),
+		(uint8_t *)(buf + hdr->blk_off), err_msg_p) ) {
+	goto done;
+    }
+    for (size_t n = 0; n < hdr->sz; ) {
+	ssize_t w = write(fd, buf + n, hdr->sz - n);
+	if (w == -1 && errno != EINTR) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not write geometry tables. %s",
+		    __func__, strerror(errno));
+	    goto done;
+	}
+	n += (w > 0) ? w : 0;
+    }
+    status = fchmod(fd, 0644) == 0;
+
+done:
+    free(buf);
+    SigmetRaw_DemFree(dem);
+    return status;
+}
+
+/* Map tables for key, computed from the elevation model at dem_path, from cache directory dir,
+ * or the default cache if dir is NULL or empty. If they are not cached, compute them on
+ * num_threads threads, or one per processor if 0, and add them to the cache. Return the
+ * tables, which caller should eventually give to SigmetRaw_GeomFree, or NULL on failure. */
+struct SigmetRaw_Geom * SigmetRaw_GeomGet(const char * dir, const struct SigmetRaw_GeomKey * key_p,
+	const char * dem_path, unsigned num_threads, struct Sigmet_ErrMsg * err_msg_p)
+{
+    char dir_path[PATH_MAX], real_path[PATH_MAX], ent_path[PATH_MAX + 32];
+    struct stat st;
+    int n = (dir != NULL && *dir != '\0') ? snprintf(dir_path, sizeof dir_path, "%s", dir)
+	: snprintf(dir_path, sizeof dir_path, "/var/tmp/sigmet_raw-geom-%u", (unsigned)getuid());
+    if (n < 0 || (size_t)n >= sizeof dir_path) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: geometry cache path too long.", __func__);
+	return NULL;
+    }
+    if (mkdir(dir_path, 0755) == -1 && errno != EEXIST) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not create geometry cache %s. %s",
+		__func__, dir_path, strerror(errno));
+	return NULL;
+    }
+    /* As in sigmet_raw_shm.c, other users must not be able to plant or replace entries. */
+    if (lstat(dir_path, &st) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not get information about geometry cache %s. %s",
+		__func__, dir_path, strerror(errno));
+	return NULL;
+    }
+    if ( !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: geometry cache %s must be a directory owned by this "
+		"user, writable only by its owner.", __func__, dir_path);
+	return NULL;
+    }
+    if (realpath(dem_path, real_path) == NULL || stat(real_path, &st) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not get information about %s. %s",
+		__func__, dem_path, strerror(errno));
+	return NULL;
+    }
+
+    /* Expected header, which also names the cache file */
+    struct geom_hdr hdr;
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, magic, sizeof magic);
+    hdr.vsn = GEOM_VSN;
+    memcpy(&hdr.key, key_p, sizeof hdr.key);
+    hdr.dem_id[0] = fnv1a(0xcbf29ce484222325ULL, real_path, strlen(real_path));
+    hdr.dem_id[1] = st.st_size;
+    hdr.dem_id[2] = st.st_mtim.tv_sec;
+    hdr.dem_id[3] = st.st_mtim.tv_nsec;
+    size_t num_hts = (size_t)key_p->num_swps * key_p->num_bins;
+    hdr.ht_off = sizeof hdr;
+    hdr.blk_off = hdr.ht_off + num_hts * sizeof(float);
+    hdr.sz = hdr.blk_off + num_hts * key_p->num_az;
+    uint64_t h = fnv1a(0xcbf29ce484222325ULL, &hdr, sizeof hdr);
+    snprintf(ent_path, sizeof ent_path, "%s/%016llx" GEOM_SFX, dir_path, (unsigned long long)h);
+
+    int fd = open(ent_path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1 && errno == ENOENT) {
+	/* Not cached. Another process might be computing the same tables, in which case the
+	 * last rename wins, with identical contents. */
+	char tmp_path[PATH_MAX + 32];
+	snprintf(tmp_path, sizeof tmp_path, "%s/.tmpXXXXXX", dir_path);
+	int tmp_fd = mkstemp(tmp_path);
+	if (tmp_fd == -1) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not create file in geometry cache %s. %s",
+		    __func__, dir_path, strerror(errno));
+	    return NULL;
+	}
+	int status = build_ent(tmp_fd, &hdr, real_path, num_threads, err_msg_p);
+	status = (close(tmp_fd) == 0) && status && rename(tmp_path, ent_path) == 0;
+	if ( !status ) {
+	    unlink(tmp_path);
+	    return NULL;
+	}
+	fd = open(ent_path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    }
+    if (fd == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not open geometry cache entry %s. %s",
+		__func__, ent_path, strerror(errno));
+	return NULL;
+    }
+    void * map = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == getuid()
+	    && (uint64_t)st.st_size == hdr.sz)
+	? mmap(NULL, hdr.sz, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED || memcmp(map, &hdr, sizeof hdr) != 0) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: geometry cache entry %s is damaged, does not "
+		"match, or is not owned by this user.", __func__, ent_path);
+	if (map != MAP_FAILED) {
+	    munmap(map, hdr.sz);
+	}
+	return NULL;
+    }
+    struct SigmetRaw_Geom * geom = malloc(sizeof *geom);
+    if (geom == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate geometry tables.", __func__);
+	munmap(map, hdr.sz);
+	return NULL;
+    }
+    geom->map = map;
+    geom->sz = hdr.sz;
+    geom->hdr = map;
+    geom->ht = (const float *)((const char *)map + hdr.ht_off);
+    geom->blk = (const uint8_t *)map + hdr.blk_off;
+    return geom;
+}
+
+void SigmetRaw_GeomFree(struct SigmetRaw_Geom * geom)
+{
+    if (geom != NULL) {
+	munmap(geom->map, geom->sz);
+	free(geom);
+    }
+}
+
+/* Return index of sweep in geom with angle within GEOM_ANGL_TOL of angl, radians, or -1. */
+int SigmetRaw_GeomSwp(const struct SigmetRaw_Geom * geom, double angl)
+{
+    const struct SigmetRaw_GeomKey * key_p = &geom->hdr->key;
+    int s_min = -1;
+    double d_min = GEOM_ANGL_TOL;
+    for (unsigned s = 0; s < key_p->num_swps; s++) {
+	double d = fabs(remainder(key_p->angl[s] - angl, TWO_PI));
+	if (d <= d_min) {
+	    s_min = s;
+	    d_min = d;
+	}
+    }
+    return s_min;
+}
+
+/* Return beam heights above sea level, meters, for the key.num_bins bins of sweep s. */
+const float * SigmetRaw_GeomHt(const struct SigmetRaw_Geom * geom, unsigned s)
+{
+    return geom->ht + (size_t)s * geom->hdr->key.num_bins;
+}
+
+/* Return blockage, 0 to 255 for none to total, for the key.num_bins bins of sweep s for the
+ * azimuth cell containing the middle of a ray from az0 to az1, radians. */
+const uint8_t * SigmetRaw_GeomBlk(const struct SigmetRaw_Geom * geom, unsigned s, float az0,
+	float az1)
+{
+    unsigned num_az = geom->hdr->key.num_az;
+    double az = fmod(az0 + 0.5 * remainder((double)az1 - az0, TWO_PI), TWO_PI);
+    az += (az < 0.0) ? TWO_PI : 0.0;
+    unsigned i = az / TWO_PI * num_az;
+    i = (i < num_az) ? i : num_az - 1;
+    return geom->blk + ((size_t)s * num_az + i) * geom->hdr->key.num_bins;
+}
+
+/* Return the key for geom. */
+const struct SigmetRaw_GeomKey * SigmetRaw_GeomGetKey(const struct SigmetRaw_Geom * geom)
+{
+    return &geom->hdr->key;
+}
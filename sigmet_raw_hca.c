@@ -0,0 +1,287 @@
+/*
+ *	sigmet_raw_hca.c --
+ *		Fuzzy logic hydrometeor classification.
+ *	--
+ *
+ *	Classes and membership functions follow Park et al., 2009, "The hydrometeor
+ *	classification algorithm for the polarimetric WSR-88D", Wea. Forecasting, 24, 730-748,
+ *	without the texture variables, which need neighboring gates. Inputs are reflectivity
+ *	(DB_DBZ), differential reflectivity (DB_ZDR), correlation coefficient (DB_RHOHV), specific
+ *	differential phase (DB_KDP), and optionally temperature (DB_TEMPERATURE16).
+ *
+ *	Each class has a trapezoidal membership function for each input. Some depend on
+ *	reflectivity. A class score is the weighted mean of the memberships of the inputs present at
+ *	a gate. The melting layer rules out some classes: frozen classes below it and rain classes
+ *	above it. A gate is in, above, or below the melting layer according to its temperature if
+ *	available, otherwise according to its height and the melting layer heights in the
+ *	configuration. If neither is available, all classes are possible. The class with the
+ *	highest score wins, and the score is the confidence, from 0 to 1. Gates without
+ *	reflectivity get SigmetRawHcaNone and confidence NAN.
+ *
+ *	Rays are classified in blocks of SIGMETRAW_HCA_BLK bins. For each block, every membership
+ *	function and score runs as a simple loop over the bins, which compilers vectorize.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define SIGMETRAW_HCA_BLK 256
+#define EFF_EARTH_RADIUS (4.0 / 3.0 * 6371000.0)	/* meters */
+
+/* Membership function inputs. LKDP is 10 log10(KDP). */
+enum { IN_Z, IN_ZDR, IN_RHOHV, IN_LKDP, NUM_VARS };
+
+/* Trapezoid breakpoints. Breakpoints that depend on reflectivity are given as one of the
+ * functions below, plus an offset. */
+enum bp_fn { BP_K, BP_F1, BP_F2, BP_F3, BP_G1, BP_G2, NUM_BP_FNS };
+struct bp {
+    enum bp_fn fn;
+    float k;
+};
+#define K(x) { BP_K, (x) }
+#define F1(x) { BP_F1, (x) }
+#define F2(x) { BP_F2, (x) }
+#define F3(x) { BP_F3, (x) }
+#define G1(x) { BP_G1, (x) }
+#define G2(x) { BP_G2, (x) }
+
+/* Park et al., 2009, Table 1, S band, and Table 2 weights */
+static const struct {
+    struct bp mf[NUM_VARS][4];
+    float wt[NUM_VARS];
+} classes[SIGMETRAW_HCA_NUM_CLASSES + 1] = {
+    [SigmetRawHcaGC] = {
+	{ { K(15), K(20), K(70), K(80) }, { K(-4), K(-2), K(1), K(2) },
+	  { K(0.5), K(0.6), K(0.9), K(0.95) }, { K(-30), K(-25), K(10), K(20) } },
+	{ 0.2, 0.4, 1.0, 0.0 }
+    },
+    [SigmetRawHcaBS] = {
+	{ { K(5), K(10), K(20), K(30) }, { K(0), K(2), K(10), K(12) },
+	  { K(0.3), K(0.5), K(0.8), K(0.83) }, { K(-30), K(-25), K(10), K(10.01) } },
+	{ 0.4, 0.6, 1.0, 0.0 }
+    },
+    [SigmetRawHcaDS] = {
+	{ { K(5), K(10), K(35), K(40) }, { K(-0.3), K(0), K(0.3), K(0.6) },
+	  { K(0.95), K(0.98), K(1), K(1.01) }, { K(-30), K(-25), K(10), K(20) } },
+	{ 1.0, 0.8, 0.6, 0.0 }
+    },
+    [SigmetRawHcaWS] = {
+	{ { K(25), K(30), K(40), K(50) }, { K(0.5), K(1), K(2), K(3) },
+	  { K(0.88), K(0.92), K(0.95), K(0.985) }, { K(-30), K(-25), K(10), K(20) } },
+	{ 0.6, 0.8, 1.0, 0.0 }
+    },
+    [SigmetRawHcaCR] = {
+	{ { K(0), K(5), K(20), K(25) }, { K(0.1), K(0.4), K(3), K(3.3) },
+	  { K(0.95), K(0.98), K(1), K(1.01) }, { K(-5), K(0), K(10), K(15) } },
+	{ 1.0, 0.6, 0.4, 0.5 }
+    },
+    [SigmetRawHcaGR] = {
+	{ { K(25), K(35), K(50), K(55) }, { K(-0.3), K(0), F1(0), F1(0.3) },
+	  { K(0.9), K(0.97), K(1), K(1.01) }, { K(-30), K(-25), K(10), K(20) } },
+	{ 0.8, 1.0, 0.4, 0.0 }
+    },
+    [SigmetRawHcaBD] = {
+	{ { K(20), K(25), K(45), K(50) }, { F2(-0.3), F2(0), F3(0), F3(1) },
+	  { K(0.92), K(0.95), K(1), K(1.01) }, { G1(-1), G1(0), G2(0), G2(1) } },
+	{ 0.8, 1.0, 0.6, 0.0 }
+    },
+    [SigmetRawHcaRA] = {
+	{ { K(5), K(10), K(45), K(50) }, { F1(-0.3), F1(0), F2(0), F2(0.5) },
+	  { K(0.95), K(0.97), K(1), K(1.01) }, { G1(-1), G1(0), G2(0), G2(1) } },
+	{ 1.0, 0.8, 0.6, 0.0 }
+    },
+    [SigmetRawHcaHR] = {
+	{ { K(40), K(45), K(55), K(60) }, { F1(-0.3), F1(0), F2(0), F2(0.5) },
+	  { K(0.92), K(0.95), K(1), K(1.01) }, { G1(-1), G1(0), G2(0), G2(1) } },
+	{ 1.0, 0.8, 0.6, 1.0 }
+    },
+    [SigmetRawHcaRH] = {
+	{ { K(45), K(50), K(75), K(80) }, { K(-0.3), K(0), F1(0), F1(0.5) },
+	  { K(0.85), K(0.9), K(1), K(1.01) }, { K(-10), K(-4), G1(0), G1(1) } },
+	{ 1.0, 0.8, 0.6, 1.0 }
+    },
+};
+
+/* Classes allowed below, in, and above the melting layer */
+enum { LYR_BELOW, LYR_IN, LYR_ABOVE, NUM_LYRS };
+#define B(c) (1u << (c))
+static const unsigned allowed[NUM_LYRS] = {
+    [LYR_BELOW] = B(SigmetRawHcaGC) | B(SigmetRawHcaBS) | B(SigmetRawHcaGR) | B(SigmetRawHcaBD)
+	| B(SigmetRawHcaRA) | B(SigmetRawHcaHR) | B(SigmetRawHcaRH),
+    [LYR_IN] = B(SigmetRawHcaGC) | B(SigmetRawHcaBS) | B(SigmetRawHcaDS) | B(SigmetRawHcaWS)
+	| B(SigmetRawHcaGR) | B(SigmetRawHcaBD) | B(SigmetRawHcaRA) | B(SigmetRawHcaHR)
+	| B(SigmetRawHcaRH),
+    [LYR_ABOVE] = B(SigmetRawHcaDS) | B(SigmetRawHcaCR) | B(SigmetRawHcaGR) | B(SigmetRawHcaRH),
+};
+
+/* Ternary forms, which compilers vectorize, unlike calls to fminf and fmaxf */
+static inline float min2(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+static inline float max2(float a, float b)
+{
+    return a > b ? a : b;
+}
+
+/* Evaluate trapezoid with breakpoints x1 to x4 at n values of x, putting result times w in p.
+ * NAN input gives 0. */
+static void trap(int n, const float * x, const float * x1, const float * x2, const float * x3,
+	const float * x4, float w, float * p)
+{
+    for (int b = 0; b < n; b++) {
+	float up = (x[b] - x1[b]) / (x2[b] - x1[b]);
+	float dn = (x4[b] - x[b]) / (x4[b] - x3[b]);
+	float m = min2(max2(min2(up, dn), 0.0f), 1.0f);
+	p[b] = isnan(x[b]) ? 0.0f : w * m;
+    }
+}
+
+/* Same as trap, for breakpoints that do not depend on reflectivity */
+static void trap_k(int n, const float * x, float x1, float x2, float x3, float x4, float w,
+	float * p)
+{
+    float s_up = 1.0f / (x2 - x1), s_dn = 1.0f / (x4 - x3);
+    for (int b = 0; b < n; b++) {
+	float m = min2(max2(min2((x[b] - x1) * s_up, (x4 - x[b]) * s_dn), 0.0f), 1.0f);
+	p[b] = isnan(x[b]) ? 0.0f : w * m;
+    }
+}
+
+/* Classify one ray of num_bins bins. vals[i], for i a SigmetRaw_HcaIn, points to num_bins
+ * values of that input, padded with NAN if necessary, or is NULL if the input is not available.
+ * Range to first bin is rng0, bin step is drng, meters, and tilt is the ray elevation, radians,
+ * for gate heights. Put classes in cls and confidences in conf. */
+void SigmetRaw_HcaRay(const struct SigmetRaw_HcaCfg * cfg_p, int num_bins,
+	const float * const * vals, float rng0, float drng, float tilt, uint8_t * cls, float * conf)
+{
+    enum { BLK = SIGMETRAW_HCA_BLK };
+    float x[NUM_VARS][BLK];		/* Membership function inputs */
+    float bp[NUM_BP_FNS][BLK];		/* Breakpoint functions of reflectivity */
+    float bk[4][BLK];			/* Breakpoints for current class and input */
+    float p[BLK], sum[BLK], wsum[BLK], best[BLK];
+    uint8_t best_c[BLK];
+    unsigned lyr[BLK];			/* Mask of allowed classes */
+    double se = sin(tilt), R = EFF_EARTH_RADIUS;
+    _Bool hav_ml = !isnan(cfg_p->ml_bot) && !isnan(cfg_p->ml_top);
+    const unsigned all = ((1u << (SIGMETRAW_HCA_NUM_CLASSES + 1)) - 1) & ~B(SigmetRawHcaNone);
+
+    for (int b0 = 0; b0 < num_bins; b0 += BLK) {
+	int n = (num_bins - b0 < BLK) ? num_bins - b0 : BLK;
+
+	/* Inputs, with missing ones all NAN */
+	const float * z = vals[SigmetRawHcaZ] ? vals[SigmetRawHcaZ] + b0 : NULL;
+	const float * zdr = vals[SigmetRawHcaZdr] ? vals[SigmetRawHcaZdr] + b0 : NULL;
+	const float * rho = vals[SigmetRawHcaRhohv] ? vals[SigmetRawHcaRhohv] + b0 : NULL;
+	const float * kdp = vals[SigmetRawHcaKdp] ? vals[SigmetRawHcaKdp] + b0 : NULL;
+	const float * tmp = vals[SigmetRawHcaTemp] ? vals[SigmetRawHcaTemp] + b0 : NULL;
+	if (z == NULL) {
+	    for (int b = 0; b < n; b++) {
+		cls[b0 + b] = SigmetRawHcaNone;
+		conf[b0 + b] = NAN;
+	    }
+	    continue;
+	}
+	for (int b = 0; b < n; b++) {
+	    x[IN_Z][b] = z[b];
+	    x[IN_ZDR][b] = zdr ? zdr[b] : NAN;
+	    x[IN_RHOHV][b] = rho ? rho[b] : NAN;
+	    float k = kdp ? kdp[b] : NAN;
+	    x[IN_LKDP][b] = isnan(k) ? NAN : (k > 0.001f) ? 10.0f * log10f(k) : -30.0f;
+	}
+	for (int b = 0; b < n; b++) {
+	    float zz = x[IN_Z][b];
+	    bp[BP_K][b] = 0.0f;
+	    bp[BP_F1][b] = -0.50f + 2.50e-3f * zz + 7.50e-4f * zz * zz;
+	    bp[BP_F2][b] = 0.68f - 4.81e-2f * zz + 2.92e-3f * zz * zz;
+	    bp[BP_F3][b] = 1.42f + 6.67e-2f * zz + 4.85e-4f * zz * zz;
+	    bp[BP_G1][b] = -44.0f + 0.8f * zz;
+	    bp[BP_G2][b] = -22.0f + 0.5f * zz;
+	}
+
+	/* Melting layer */
+	for (int b = 0; b < n; b++) {
+	    lyr[b] = all;
+	    float t = tmp ? tmp[b] : NAN;
+	    if ( !isnan(t) ) {
+		lyr[b] = (t >= cfg_p->ml_t_bot) ? allowed[LYR_BELOW]
+		    : (t <= cfg_p->ml_t_top) ? allowed[LYR_ABOVE] : allowed[LYR_IN];
+	    } else if (hav_ml) {
+		double r = rng0 + (b0 + b + 0.5) * drng;
+		double h = sqrt(r * r + R * R + 2.0 * r * R * se) - R;
+		lyr[b] = (h < cfg_p->ml_bot) ? allowed[LYR_BELOW]
+		    : (h > cfg_p->ml_top) ? allowed[LYR_ABOVE] : allowed[LYR_IN];
+	    }
+	}
+
+	/* Scores */
+	for (int b = 0; b < n; b++) {
+	    best[b] = -1.0f;
+	    best_c[b] = SigmetRawHcaNone;
+	}
+	for (int c = 1; c <= SIGMETRAW_HCA_NUM_CLASSES; c++) {
+	    for (int b = 0; b < n; b++) {
+		sum[b] = wsum[b] = 0.0f;
+	    }
+	    for (int v = 0; v < NUM_VARS; v++) {
+		float w = classes[c].wt[v];
+		if (w == 0.0f) {
+		    continue;
+		}
+		const struct bp * q = classes[c].mf[v];
+		if (q[0].fn == BP_K && q[1].fn == BP_K && q[2].fn == BP_K && q[3].fn == BP_K) {
+		    trap_k(n, x[v], q[0].k, q[1].k, q[2].k, q[3].k, w, p);
+		} else {
+		    for (int k = 0; k < 4; k++) {
+			const float * f = bp[q[k].fn];
+			for (int b = 0; b < n; b++) {
+			    bk[k][b] = f[b] + q[k].k;
+			}
+		    }
+		    trap(n, x[v], bk[0], bk[1], bk[2], bk[3], w, p);
+		}
+		for (int b = 0; b < n; b++) {
+		    sum[b] += p[b];
+		    wsum[b] += isnan(x[v][b]) ? 0.0f : w;
+		}
+	    }
+	    for (int b = 0; b < n; b++) {
+		float a = (wsum[b] > 0.0f && (lyr[b] & (1u << c))) ? sum[b] / wsum[b] : -1.0f;
+		_Bool better = a > best[b];
+		best[b] = better ? a : best[b];
+		best_c[b] = better ? (uint8_t)c : best_c[b];
+	    }
+	}
+	for (int b = 0; b < n; b++) {
+	    _Bool ok = !isnan(x[IN_Z][b]) && best[b] >= 0.0f;
+	    cls[b0 + b] = ok ? best_c[b] : SigmetRawHcaNone;
+	    conf[b0 + b] = ok ? best[b] : NAN;
+	}
+    }
+}
+
+/* Classify a sweep with num_rays rays with headers ray_hdrs. vals[r][i] is as for
+ * SigmetRaw_HcaRay for ray r, with vals[r][SigmetRawHcaZ] NULL for an empty ray. cls and conf
+ * receive num_rays by num_bins values. */
+void SigmetRaw_HcaSwp(const struct SigmetRaw_HcaCfg * cfg_p, unsigned num_rays,
+	const struct Sigmet_RayHdr * ray_hdrs, const float * const (*vals)[SIGMETRAW_HCA_NUM_IN],
+	float rng0, float drng, unsigned num_bins, uint8_t * cls, float * conf)
+{
+    for (unsigned r = 0; r < num_rays; r++) {
+	float tilt = 0.5f * (ray_hdrs[r].tilt0 + ray_hdrs[r].tilt1);
+	SigmetRaw_HcaRay(cfg_p, num_bins, vals[r], rng0, drng, tilt,
+		cls + (size_t)r * num_bins, conf + (size_t)r * num_bins);
+    }
+}
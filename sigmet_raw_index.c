@@ -0,0 +1,300 @@
+/*
+ *	sigmet_raw_index.c --
+ *		Sidecar index files with zone maps for Sigmet raw product files.
+ *	--
+ *
+ *	An index stores minimum, maximum, and valid bin count for each data type in each sweep,
+ *	and for blocks of SIGMETRAW_IDX_RAY_BLK rays by SIGMETRAW_IDX_BIN_BLK bins within each
+ *	sweep. Archive tools can consult the index to skip files and sweeps that cannot satisfy a
+ *	predicate such as "DB_DBZ > 50 within 100 km" without decoding them.
+ *
+ *	The index for raw product file path is path.idx. It records the size and modification
+ *	time of the raw product file, and is ignored if the raw product file changes.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define IDX_MAGIC "SRAWIDX"
+#define IDX_VSN 1
+
+/* Fixed part of index file. Zone arrays follow. */
+struct idx_file_hdr {
+    char magic[8];
+    uint32_t vsn;
+    int64_t src_sz;			/* Size of raw product file */
+    int64_t src_mtime;			/* Modification time of raw product file */
+    uint32_t num_swps, num_types, num_ray_blks, num_bin_blks;
+    float rng0, drng;
+};
+
+static struct SigmetRaw_Zone zone_init(void)
+{
+    return (struct SigmetRaw_Zone){ .min = INFINITY, .max = -INFINITY, .count = 0 };
+}
+
+/* Fold num_bins values at vals into zone at zone_p. */
+static void zone_add(struct SigmetRaw_Zone * zone_p, const float * vals, int num_bins)
+{
+    float min = zone_p->min, max = zone_p->max;
+    uint32_t count = 0;
+    for (int b = 0; b < num_bins; b++) {
+	float v = vals[b];
+	if ( !isnan(v) ) {
+	    min = (v < min) ? v : min;
+	    max = (v > max) ? v : max;
+	    count++;
+	}
+    }
+    zone_p->min = min;
+    zone_p->max = max;
+    zone_p->count += count;
+}
+
+static void zone_merge(struct SigmetRaw_Zone * dest, const struct SigmetRaw_Zone * src)
+{
+    dest->min = (src->min < dest->min) ? src->min : dest->min;
+    dest->max = (src->max > dest->max) ? src->max : dest->max;
+    dest->count += src->count;
+}
+
+/* Put path of index for raw product file at path into buf, which has space for buf_sz
+ * characters. Return 1/0 on success/failure. */
+int SigmetRaw_IdxPath(char * buf, size_t buf_sz, const char * path)
+{
+    return snprintf(buf, buf_sz, "%s.idx", path) < (int)buf_sz;
+}
+
+/* Allocate zone arrays in idx_p for its dimensions. Return 1/0 on success/failure. */
+static int idx_alloc(struct SigmetRaw_Idx * idx_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    size_t num_swp_zones = (size_t)idx_p->num_swps * idx_p->num_types;
+    size_t num_blk_zones = num_swp_zones * idx_p->num_ray_blks * idx_p->num_bin_blks;
+    idx_p->swp_zones = calloc(num_swp_zones + num_blk_zones, sizeof *idx_p->swp_zones);
+    if (idx_p->swp_zones == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate %zu zones.",
+		__func__, num_swp_zones + num_blk_zones);
+	return 0;
+    }
+    idx_p->blk_zones = idx_p->swp_zones + num_swp_zones;
+    return 1;
+}
+
+void SigmetRaw_IdxFree(struct SigmetRaw_Idx * idx_p)
+{
+    free(idx_p->swp_zones);
+    *idx_p = (struct SigmetRaw_Idx){0};
+}
+
+/* Compute zone maps for a volume read with Sigmet_VolReadDat. Return 1/0 on success/failure. */
+int SigmetRaw_IdxBuild(struct SigmetRaw_Idx * idx_p, const struct Sigmet_VolHdr * vol_hdr_p,
+	unsigned num_swps, unsigned num_rays, unsigned num_types,
+	struct Sigmet_Ray (*rays)[num_rays][num_types], struct Sigmet_ErrMsg * err_msg_p)
+{
+    int num_bins = Sigmet_VolNumBins(vol_hdr_p);
+    if (num_bins <= 0) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: volume claims %d bins per ray.", __func__, num_bins);
+	return 0;
+    }
+    *idx_p = (struct SigmetRaw_Idx){
+	.num_swps = num_swps, .num_types = num_types,
+	.num_ray_blks = (num_rays + SIGMETRAW_IDX_RAY_BLK - 1) / SIGMETRAW_IDX_RAY_BLK,
+	.num_bin_blks = (num_bins + SIGMETRAW_IDX_BIN_BLK - 1) / SIGMETRAW_IDX_BIN_BLK,
+	/* Task range info is in centimeters */
+	.rng0 = vol_hdr_p->ingst_hdr.task_cfg.task_rng_info.rng_1st_bin * 0.01f,
+	.drng = vol_hdr_p->ingst_hdr.task_cfg.task_rng_info.step_out * 0.01f
+    };
+    for (unsigned y = 0; y < num_types; y++) {
+	snprintf(idx_p->abbrvs[y], SIGMET_DATA_TYPE_LEN + 1, "%s",
+		Sigmet_DataTypeAbbrv(vol_hdr_p->types[y]));
+    }
+    if ( !idx_alloc(idx_p, err_msg_p) ) {
+	return 0;
+    }
+    float * dat = malloc(num_bins * sizeof *dat);
+    if (dat == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate ray of %d bins.", __func__, num_bins);
+	SigmetRaw_IdxFree(idx_p);
+	return 0;
+    }
+    const struct Sigmet_DataType * xhdr = Sigmet_DataTypeGet("DB_XHDR");
+    for (unsigned s = 0; s < num_swps; s++) {
+	for (unsigned y = 0; y < num_types; y++) {
+	    const struct Sigmet_DataType * type = vol_hdr_p->types[y];
+	    struct SigmetRaw_Zone * swp_zone = SigmetRaw_IdxSwpZone(idx_p, s, y);
+	    *swp_zone = zone_init();
+	    for (unsigned rb = 0; rb < idx_p->num_ray_blks; rb++) {
+		for (unsigned bb = 0; bb < idx_p->num_bin_blks; bb++) {
+		    *SigmetRaw_IdxBlkZone(idx_p, s, y, rb, bb) = zone_init();
+		}
+	    }
+	    if (type == xhdr) {
+		/* Extended headers are not data */
+		continue;
+	    }
+	    for (unsigned r = 0; r < num_rays; r++) {
+		void * idat = rays[s][r][y].dat;
+		int nb = rays[s][r][y].ray_hdr.num_bins;
+		if (idat == NULL || nb <= 0) {
+		    continue;
+		}
+		nb = (nb > num_bins) ? num_bins : nb;
+		Sigmet_DataTypeStorToVal(type, nb, dat, idat, vol_hdr_p);
+		unsigned rb = r / SIGMETRAW_IDX_RAY_BLK;
+		for (int b0 = 0, bb = 0; b0 < nb; b0 += SIGMETRAW_IDX_BIN_BLK, bb++) {
+		    int n = (nb - b0 < SIGMETRAW_IDX_BIN_BLK) ? nb - b0 : SIGMETRAW_IDX_BIN_BLK;
+		    zone_add(SigmetRaw_IdxBlkZone(idx_p, s, y, rb, bb), dat + b0, n);
+		}
+	    }
+	    for (unsigned rb = 0; rb < idx_p->num_ray_blks; rb++) {
+		for (unsigned bb = 0; bb < idx_p->num_bin_blks; bb++) {
+		    zone_merge(swp_zone, SigmetRaw_IdxBlkZone(idx_p, s, y, rb, bb));
+		}
+	    }
+	}
+    }
+    free(dat);
+    return 1;
+}
+
+/* Write index at idx_p to idx_fl. st_p should have information about the raw product file.
+ * Return 1/0 on success/failure. */
+int SigmetRaw_IdxWrite(FILE * idx_fl, const struct SigmetRaw_Idx * idx_p, const struct stat * st_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct idx_file_hdr fhdr = {
+	.magic = IDX_MAGIC, .vsn = IDX_VSN,
+	.src_sz = st_p->st_size, .src_mtime = st_p->st_mtime,
+	.num_swps = idx_p->num_swps, .num_types = idx_p->num_types,
+	.num_ray_blks = idx_p->num_ray_blks, .num_bin_blks = idx_p->num_bin_blks,
+	.rng0 = idx_p->rng0, .drng = idx_p->drng
+    };
+    size_t num_zones = (size_t)idx_p->num_swps * idx_p->num_types
+	* (1 + idx_p->num_ray_blks * idx_p->num_bin_blks);
+    if (fwrite(&fhdr, sizeof fhdr, 1, idx_fl) != 1
+	    || fwrite(idx_p->abbrvs, sizeof idx_p->abbrvs[0], idx_p->num_types, idx_fl)
+	    != idx_p->num_types
+	    || fwrite(idx_p->swp_zones, sizeof *idx_p->swp_zones, num_zones, idx_fl) != num_zones) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not write index. %s.", __func__, strerror(errno));
+	return 0;
+    }
+    return 1;
+}
+
+/* Read index from idx_fl into idx_p. st_p should have information about the raw product file,
+ * and vol_hdr_p its volume headers. Return 1/0 on success/failure. Fail if the index is not for
+ * the current version of the raw product file, or its dimensions do not match the volume. */
+int SigmetRaw_IdxRead(FILE * idx_fl, struct SigmetRaw_Idx * idx_p, const struct stat * st_p,
+	const struct Sigmet_VolHdr * vol_hdr_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct idx_file_hdr fhdr;
+    if (fread(&fhdr, sizeof fhdr, 1, idx_fl) != 1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not read index header.", __func__);
+	return 0;
+    }
+    if (memcmp(fhdr.magic, IDX_MAGIC, sizeof fhdr.magic) != 0 || fhdr.vsn != IDX_VSN) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: not a sigmet_raw index, or wrong version.", __func__);
+	return 0;
+    }
+    if (fhdr.src_sz != st_p->st_size || fhdr.src_mtime != st_p->st_mtime) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: index is out of date.", __func__);
+	return 0;
+    }
+    /* Zone array sizes come from the file, so check them against the volume before
+     * allocating. */
+    unsigned num_rays = Sigmet_VolNumRays(vol_hdr_p);
+    int num_bins = Sigmet_VolNumBins(vol_hdr_p);
+    if (fhdr.num_swps > SIGMET_MAX_SWPS || fhdr.num_types > SIGMET_NUM_DATA_TYPES
+	    || fhdr.num_swps != Sigmet_VolNumSwps(vol_hdr_p)
+	    || fhdr.num_types != Sigmet_VolNumTypes(vol_hdr_p) || num_bins <= 0
+	    || fhdr.num_ray_blks != (num_rays + SIGMETRAW_IDX_RAY_BLK - 1) / SIGMETRAW_IDX_RAY_BLK
+	    || fhdr.num_bin_blks
+	    != ((unsigned)num_bins + SIGMETRAW_IDX_BIN_BLK - 1) / SIGMETRAW_IDX_BIN_BLK) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: index is corrupt, claims %u sweeps, %u types, "
+		"%u by %u blocks, which do not match the volume.", __func__, fhdr.num_swps,
+		fhdr.num_types, fhdr.num_ray_blks, fhdr.num_bin_blks);
+	return 0;
+    }
+    *idx_p = (struct SigmetRaw_Idx){
+	.num_swps = fhdr.num_swps, .num_types = fhdr.num_types,
+	.num_ray_blks = fhdr.num_ray_blks, .num_bin_blks = fhdr.num_bin_blks,
+	.rng0 = fhdr.rng0, .drng = fhdr.drng
+    };
+    if (fread(idx_p->abbrvs, sizeof idx_p->abbrvs[0], idx_p->num_types, idx_fl)
+	    != idx_p->num_types) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not read data types from index.", __func__);
+	return 0;
+    }
+    for (unsigned y = 0; y < idx_p->num_types; y++) {
+	idx_p->abbrvs[y][SIGMET_DATA_TYPE_LEN] = '\0';
+    }
+    if ( !idx_alloc(idx_p, err_msg_p) ) {
+	return 0;
+    }
+    size_t num_zones = (size_t)idx_p->num_swps * idx_p->num_types
+	* (1 + idx_p->num_ray_blks * idx_p->num_bin_blks);
+    if (fread(idx_p->swp_zones, sizeof *idx_p->swp_zones, num_zones, idx_fl) != num_zones) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not read zones from index.", __func__);
+	SigmetRaw_IdxFree(idx_p);
+	return 0;
+    }
+    return 1;
+}
+
+/* Return index of data type with abbreviation abbrv in index, or -1 if absent. */
+int SigmetRaw_IdxTypeIdx(const struct SigmetRaw_Idx * idx_p, const char * abbrv)
+{
+    for (unsigned y = 0; y < idx_p->num_types; y++) {
+	if (strcmp(idx_p->abbrvs[y], abbrv) == 0) {
+	    return y;
+	}
+    }
+    return -1;
+}
+
+/* Return true if sweep s might have a value of data type y greater than thresh at range less
+ * than max_rng meters. max_rng <= 0 means any range. Return false only if zone maps show that no
+ * such value exists, in which case the sweep need not be decoded. */
+_Bool SigmetRaw_IdxSwpMayExceed(const struct SigmetRaw_Idx * idx_p, unsigned s, int y, float thresh,
+	float max_rng)
+{
+    if (s >= idx_p->num_swps || y < 0 || (unsigned)y >= idx_p->num_types) {
+	return 0;
+    }
+    const struct SigmetRaw_Zone * swp_zone = SigmetRaw_IdxSwpZone(idx_p, s, y);
+    if (swp_zone->count == 0 || !(swp_zone->max > thresh)) {
+	return 0;
+    }
+    unsigned num_bin_blks = idx_p->num_bin_blks;
+    if (max_rng > 0.0f && idx_p->drng > 0.0f) {
+	/* Only bin blocks that start within max_rng are relevant. */
+	float b = (max_rng - idx_p->rng0) / idx_p->drng;
+	if (b < 0.0f) {
+	    return 0;
+	}
+	unsigned n = (unsigned)b / SIGMETRAW_IDX_BIN_BLK + 1;
+	num_bin_blks = (n < num_bin_blks) ? n : num_bin_blks;
+    }
+    for (unsigned rb = 0; rb < idx_p->num_ray_blks; rb++) {
+	for (unsigned bb = 0; bb < num_bin_blks; bb++) {
+	    const struct SigmetRaw_Zone * z = SigmetRaw_IdxBlkZone(idx_p, s, y, rb, bb);
+	    if (z->count > 0 && z->max > thresh) {
+		return 1;
+	    }
+	}
+    }
+    return 0;
+}
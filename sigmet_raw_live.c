@@ -0,0 +1,358 @@
+/*
+ *	sigmet_raw_live.c --
+ *		Build a volume incrementally from a feed of raw product records, as an ingest
+ *		process produces them.
+ *	--
+ *
+ *	One thread, the writer, calls SigmetRaw_LiveFeed, which reads records from a file
+ *	descriptor (a fifo or local socket) and decodes rays into storage allocated when the
+ *	volume headers arrive. Storage never moves, and each sweep has a ray counter that the
+ *	writer increments with release semantics only after all data types for the ray are in
+ *	place. Readers load the counter with acquire semantics and may then read any ray below
+ *	it without locks, so ingest never waits for readers, and completed rays are available as
+ *	soon as they are decoded rather than when the volume is complete.
+ *
+ *	Record layout is from the IRIS Programmer's Manual: raw_prod_bhdr, then at the start of
+ *	each sweep one ingest_data_header per data type, then compressed ray data which may span
+ *	records.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define REC_LEN SIGMETRAW_REC_LEN
+#define BHDR_LEN 12			/* raw_prod_bhdr */
+#define IDH_LEN 76			/* ingest_data_header */
+#define RAY_HDR_WDS 6			/* Words in ray header at start of each decompressed ray */
+
+struct SigmetRaw_Live {
+    struct Sigmet_VolHdr vol_hdr;
+    unsigned num_swps, num_rays, num_types;
+    struct Sigmet_SwpHdr swp_hdrs[SIGMET_MAX_SWPS];
+    struct Sigmet_Ray * rays;		/* [num_swps][num_rays][num_types] */
+    size_t ray_sz[SIGMET_NUM_DATA_TYPES]; /* Storage per ray for each data type */
+    size_t swp_sz;			/* Storage per sweep */
+    char * dat;				/* Storage for all rays, in file representation */
+    int datum_sz[SIGMET_NUM_DATA_TYPES];
+
+    /* Published to readers */
+    atomic_uint num_swps_started;	/* Sweeps with sweep headers in swp_hdrs */
+    atomic_uint num_swps_done;		/* Complete sweeps */
+    atomic_uint num_rays_done[SIGMET_MAX_SWPS];	/* Complete rays in each sweep */
+
+    /* Writer decoder state */
+    int s;				/* Current sweep, or -1 */
+    unsigned r, y;			/* Current ray and data type */
+    uint16_t * ray_wds;			/* Decompressed words for current ray */
+    size_t ray_wds_max, num_ray_wds;
+    unsigned lit_left;			/* Literal words remaining in current run */
+};
+
+static inline uint16_t le16(const unsigned char * p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+static inline int32_t le32(const unsigned char * p)
+{
+    return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16)
+	    | ((uint32_t)p[3] << 24));
+}
+
+/* Read one record from fd into rec. Return 1 on success, 0 at end of feed, -1 on error. */
+static int read_rec(int fd, unsigned char * rec, struct Sigmet_ErrMsg * err_msg_p)
+{
+    size_t n = 0;
+    while (n < REC_LEN) {
+	ssize_t rd = read(fd, rec + n, REC_LEN - n);
+	if (rd == 0) {
+	    if (n == 0) {
+		return 0;
+	    }
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s: feed ended in middle of record.", __func__);
+	    return -1;
+	}
+	if (rd == -1) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not read feed. %s.", __func__, strerror(errno));
+	    return -1;
+	}
+	n += rd;
+    }
+    return 1;
+}
+
+/* Read product and ingest header records from fd and set up storage for the volume they
+ * describe. Return new live volume, or NULL on failure. */
+struct SigmetRaw_Live * SigmetRaw_LiveInit(int fd, struct Sigmet_ErrMsg * err_msg_p)
+{
+    unsigned char hdr_recs[2 * REC_LEN];
+    if (read_rec(fd, hdr_recs, err_msg_p) != 1 || read_rec(fd, hdr_recs + REC_LEN, err_msg_p) != 1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not read header records from feed.", __func__);
+	return NULL;
+    }
+    struct SigmetRaw_Live * live = calloc(1, sizeof *live);
+    if (live == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate live volume.", __func__);
+	return NULL;
+    }
+    FILE * hdr_fl = fmemopen(hdr_recs, sizeof hdr_recs, "r");
+    if (hdr_fl == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not open header records. %s.",
+		__func__, strerror(errno));
+	free(live);
+	return NULL;
+    }
+    int ok = Sigmet_VolReadVHdr(hdr_fl, &live->vol_hdr, err_msg_p);
+    fclose(hdr_fl);
+    if ( !ok ) {
+	free(live);
+	return NULL;
+    }
+    struct Sigmet_VolHdr * vol_hdr_p = &live->vol_hdr;
+    live->num_swps = Sigmet_VolNumSwps(vol_hdr_p);
+    live->num_rays = Sigmet_VolNumRays(vol_hdr_p);
+    live->num_types = Sigmet_VolNumTypes(vol_hdr_p);
+    if (live->num_swps == 0 || live->num_swps > SIGMET_MAX_SWPS || live->num_rays == 0
+	    || live->num_types == 0) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: volume headers claim %u sweeps, %u rays, %u types.",
+		__func__, live->num_swps, live->num_rays, live->num_types);
+	free(live);
+	return NULL;
+    }
+    /* Fixed storage slot for every ray, so nothing moves while readers look at it. */
+    size_t ray_sz_max = 0;
+    for (unsigned y = 0; y < live->num_types; y++) {
+	int sz = Sigmet_DataType_MaxRayDatSz(vol_hdr_p->types[y], vol_hdr_p, err_msg_p);
+	live->datum_sz[y] = Sigmet_DataType_DatumSz(vol_hdr_p->types[y], vol_hdr_p, err_msg_p);
+	if (sz <= 0 || live->datum_sz[y] <= 0) {
+	    free(live);
+	    return NULL;
+	}
+	live->ray_sz[y] = sz;
+	live->swp_sz += live->num_rays * live->ray_sz[y];
+	ray_sz_max = (live->ray_sz[y] > ray_sz_max) ? live->ray_sz[y] : ray_sz_max;
+    }
+    live->rays = calloc((size_t)live->num_swps * live->num_rays * live->num_types,
+	    sizeof *live->rays);
+    live->dat = malloc(live->num_swps * live->swp_sz);
+    live->ray_wds_max = RAY_HDR_WDS + (ray_sz_max + 1) / 2;
+    live->ray_wds = malloc(live->ray_wds_max * sizeof *live->ray_wds);
+    if (live->rays == NULL || live->dat == NULL || live->ray_wds == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate storage for %u sweeps.",
+		__func__, live->num_swps);
+	SigmetRaw_LiveFree(live);
+	return NULL;
+    }
+    live->s = -1;
+    return live;
+}
+
+void SigmetRaw_LiveFree(struct SigmetRaw_Live * live)
+{
+    if (live != NULL) {
+	free(live->rays);
+	free(live->dat);
+	free(live->ray_wds);
+	free(live);
+    }
+}
+
+static struct Sigmet_Ray * live_ray(const struct SigmetRaw_Live * live, unsigned s, unsigned r,
+	unsigned y)
+{
+    return live->rays + ((size_t)s * live->num_rays + r) * live->num_types + y;
+}
+
+/* Mark current sweep complete. */
+static void swp_done(struct SigmetRaw_Live * live)
+{
+    if (live->s >= 0) {
+	atomic_store_explicit(&live->num_swps_done, live->s + 1, memory_order_release);
+    }
+}
+
+/* Start sweep s with ingest data headers at idh. Readers may already hold the headers and rays
+ * of sweeps that have started, so sweep s must follow them. Return 1/0 on success/failure. */
+static int swp_start(struct SigmetRaw_Live * live, unsigned s, const unsigned char * idh,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    unsigned num_swps = atomic_load_explicit(&live->num_swps_started, memory_order_relaxed);
+    if (s < num_swps) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: sweep %u arrived after %u sweeps had started. "
+		"Feed must start a new volume.", __func__, s + 1, num_swps);
+	return 0;
+    }
+    swp_done(live);
+    struct Sigmet_SwpHdr * swp_hdr = live->swp_hdrs + s;
+    uint16_t msec = le16(idh + 16);
+    swp_hdr->tm = (struct Sigmet_YMDS_Tm){
+	.sec = le32(idh + 12),
+	.msec = msec & 0x3ff,
+	.dst = (msec >> 10) & 1,
+	.utc = (msec >> 11) & 1,
+	.ldst = (msec >> 12) & 1,
+	.yr = (int16_t)le16(idh + 18),
+	.mon = (int16_t)le16(idh + 20),
+	.day = (int16_t)le16(idh + 22)
+    };
+    swp_hdr->angl = Sigmet_Bin2Rad(le16(idh + 34));
+    live->s = s;
+    live->r = live->y = 0;
+    live->num_ray_wds = live->lit_left = 0;
+    atomic_store_explicit(&live->num_swps_started, s + 1, memory_order_release);
+    return 1;
+}
+
+/* Store the decompressed ray in ray_wds as data type y of ray r in the current sweep. Publish
+ * the ray once all of its data types are in place. */
+static void ray_done(struct SigmetRaw_Live * live)
+{
+    unsigned s = live->s, r = live->r, y = live->y;
+    struct Sigmet_Ray * ray = live_ray(live, s, r, y);
+    const uint16_t * wds = live->ray_wds;
+    if (live->num_ray_wds >= RAY_HDR_WDS) {
+	size_t off = s * live->swp_sz;
+	for (unsigned yy = 0; yy < y; yy++) {
+	    off += live->num_rays * live->ray_sz[yy];
+	}
+	char * dat = live->dat + off + r * live->ray_sz[y];
+	ray->ray_hdr = (struct Sigmet_RayHdr){
+	    .az0 = Sigmet_Bin2Rad(wds[0]), .tilt0 = Sigmet_Bin2Rad(wds[1]),
+	    .az1 = Sigmet_Bin2Rad(wds[2]), .tilt1 = Sigmet_Bin2Rad(wds[3]),
+	    .num_bins = (int16_t)wds[4], .tm = wds[5]
+	};
+	size_t sz = (ray->ray_hdr.num_bins > 0) ? (size_t)ray->ray_hdr.num_bins * live->datum_sz[y] : 0;
+	sz = (sz < live->ray_sz[y]) ? sz : live->ray_sz[y];
+	size_t avail = (live->num_ray_wds - RAY_HDR_WDS) * 2;
+	size_t n = (sz < avail) ? sz : avail;
+	for (size_t i = 0; i < n; i++) {
+	    uint16_t wd = wds[RAY_HDR_WDS + i / 2];
+	    dat[i] = (i % 2 == 0) ? (wd & 0xff) : (wd >> 8);
+	}
+	memset(dat + n, 0, sz - n);	/* Storage value 0 means no data */
+	ray->dat = dat;
+    } else {
+	ray->ray_hdr = (struct Sigmet_RayHdr){0};
+	ray->dat = NULL;
+    }
+    live->num_ray_wds = 0;
+    if (++live->y == live->num_types) {
+	live->y = 0;
+	live->r++;
+	atomic_store_explicit(&live->num_rays_done[s], live->r, memory_order_release);
+    }
+}
+
+static void push_wd(struct SigmetRaw_Live * live, uint16_t wd)
+{
+    if (live->num_ray_wds < live->ray_wds_max) {
+	live->ray_wds[live->num_ray_wds++] = wd;
+    }
+}
+
+/* Decompress data words in rec from offset pos. */
+static void decode_rec(struct SigmetRaw_Live * live, const unsigned char * rec, size_t pos)
+{
+    for ( ; pos + 2 <= REC_LEN && live->r < live->num_rays; pos += 2) {
+	uint16_t wd = le16(rec + pos);
+	if (live->lit_left > 0) {
+	    push_wd(live, wd);
+	    live->lit_left--;
+	} else if (wd & 0x8000) {
+	    live->lit_left = wd & 0x7fff;
+	} else if (wd == 1) {
+	    ray_done(live);
+	} else {
+	    for (unsigned n = 0; n < wd; n++) {
+		push_wd(live, 0);
+	    }
+	}
+    }
+}
+
+/* Read data records from fd into live volume until the feed ends. This function is the only
+ * writer. Return 1/0 on success/failure. */
+int SigmetRaw_LiveFeed(struct SigmetRaw_Live * live, int fd, struct Sigmet_ErrMsg * err_msg_p)
+{
+    unsigned char rec[REC_LEN];
+    int rd;
+    while ((rd = read_rec(fd, rec, err_msg_p)) == 1) {
+	int swp_num = (int16_t)le16(rec + 2);	/* 1 based */
+	if (swp_num < 1 || (unsigned)swp_num > live->num_swps) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s: record %d has invalid sweep number %d.",
+		    __func__, (int16_t)le16(rec), swp_num);
+	    return 0;
+	}
+	size_t pos = BHDR_LEN;
+	if (swp_num - 1 != live->s) {
+	    if (BHDR_LEN + live->num_types * IDH_LEN > REC_LEN) {
+		Sigmet_ErrMsg_Print(err_msg_p, "%s: too many data types for record.", __func__);
+		return 0;
+	    }
+	    if ( !swp_start(live, swp_num - 1, rec + BHDR_LEN, err_msg_p) ) {
+		return 0;
+	    }
+	    pos += live->num_types * IDH_LEN;
+	}
+	decode_rec(live, rec, pos);
+    }
+    swp_done(live);
+    return rd == 0;
+}
+
+/* Reader functions. These may be called from any thread while SigmetRaw_LiveFeed runs. */
+
+const struct Sigmet_VolHdr * SigmetRaw_LiveVolHdr(const struct SigmetRaw_Live * live)
+{
+    return &live->vol_hdr;
+}
+
+/* Return number of sweeps that have started. */
+unsigned SigmetRaw_LiveNumSwps(struct SigmetRaw_Live * live)
+{
+    return atomic_load_explicit(&live->num_swps_started, memory_order_acquire);
+}
+
+/* Return number of complete sweeps. */
+unsigned SigmetRaw_LiveNumSwpsDone(struct SigmetRaw_Live * live)
+{
+    return atomic_load_explicit(&live->num_swps_done, memory_order_acquire);
+}
+
+/* Return header for sweep s, or NULL if sweep s has not started. */
+const struct Sigmet_SwpHdr * SigmetRaw_LiveSwpHdr(struct SigmetRaw_Live * live, unsigned s)
+{
+    return (s < SigmetRaw_LiveNumSwps(live)) ? live->swp_hdrs + s : NULL;
+}
+
+/* Return number of complete rays in sweep s. Rays 0 to return value - 1 are readable. */
+unsigned SigmetRaw_LiveNumRays(struct SigmetRaw_Live * live, unsigned s)
+{
+    return (s < SIGMET_MAX_SWPS)
+	? atomic_load_explicit(&live->num_rays_done[s], memory_order_acquire) : 0;
+}
+
+/* Return ray r of data type y in sweep s, or NULL if it is not complete yet. */
+const struct Sigmet_Ray * SigmetRaw_LiveRay(struct SigmetRaw_Live * live, unsigned s, unsigned r,
+	unsigned y)
+{
+    if (y >= live->num_types || r >= SigmetRaw_LiveNumRays(live, s)) {
+	return NULL;
+    }
+    return live_ray(live, s, r, y);
+}
@@ -0,0 +1,256 @@
+/*
+ *	sigmet_raw_llsd.c --
+ *		Linear least squares derivatives (LLSD) of velocity sweeps.
+ *	--
+ *
+ *	For each gate, a plane v = a + b * s + c * t is fit by least squares to the velocities of
+ *	the gates in a kernel around it, where s is distance across the beam, positive toward
+ *	increasing azimuth, and t is distance along the beam, both from the gate, in meters. b is
+ *	azimuthal shear and c is radial divergence, both per second. Positive azimuthal shear is
+ *	cyclonic in the northern hemisphere. Missing values are left out of the fit, so shear near
+ *	gaps and edges comes from the gates that are present, and gates where fewer than min_frac
+ *	of the kernel is present get NAN.
+ *
+ *	The kernel is az_len meters across the beam and rng_len meters along it. The number of rays
+ *	it spans shrinks with range, so each bin gets its own ray count, from ray spacing in the ray
+ *	headers. Rays are neighbors in ray order, with the last ray next to the first if the sweep
+ *	covers a full circle, and s comes from the actual ray azimuths, so uneven ray spacing is
+ *	accounted for.
+ *
+ *	Sums for the fit accumulate over all bins of a neighbor ray at once, in branch free loops
+ *	that compilers vectorize, and rays are split over threads.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define TWO_PI (2.0 * M_PI)
+#define MAX_HALF_RAYS 32		/* Kernel spans at most this many rays on each side */
+
+/* Shared by the threads */
+struct llsd {
+    const struct SigmetRaw_LlsdCfg * cfg_p;
+    unsigned num_rays, num_bins;
+    const struct Sigmet_RayHdr * ray_hdrs;
+    const float * const * dat;
+    float rng0, drng;
+    _Bool wrap;				/* Sweep covers full circle */
+    const double * az;			/* [num_rays] Ray center azimuths */
+    const unsigned * half_rays;		/* [num_bins] Kernel half width, rays */
+    const unsigned * reach;		/* [half_rays_max + 1] Bins with half_rays at least k */
+    unsigned half_bins;			/* Kernel half length, bins */
+    unsigned half_rays_max;
+    float * shear, * div;
+    pthread_mutex_t mtx;
+    _Bool fail;
+};
+
+/* Return center azimuth of a ray with azimuths az0 and az1, from 0 to 2 pi */
+static double ray_az(float az0, float az1)
+{
+    double d = remainder((double)az1 - az0, TWO_PI);
+    double a = fmod(az0 + 0.5 * d, TWO_PI);
+    return (a < 0.0) ? a + TWO_PI : a;
+}
+
+/* Sums for the fit, one per bin */
+enum { N, SX, ST, SXX, STT, SXT, SV, SXV, STV, NUM_SUMS };
+
+static void * rays_thread(void * arg);
+
+/* Compute azimuthal shear, and if div is not NULL, radial divergence, for num_rays rays with
+ * headers ray_hdrs and velocities dat, with dat[r] NULL for an empty ray. Range to first bin
+ * is rng0, bin step is drng, meters. shear and div receive num_rays by num_bins values.
+ * Return 1/0 on success/failure. */
+int SigmetRaw_Llsd(const struct SigmetRaw_LlsdCfg * cfg_p, unsigned num_rays,
+	const struct Sigmet_RayHdr * ray_hdrs, const float * const * dat, float rng0, float drng,
+	unsigned num_bins, float * shear, float * div, struct Sigmet_ErrMsg * err_msg_p)
+{
+    if ( !(drng > 0.0f && cfg_p->az_len > 0.0f && cfg_p->rng_len > 0.0f) ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: invalid geometry, bin step %g, kernel %g by %g "
+		"meters.", __func__, drng, cfg_p->az_len, cfg_p->rng_len);
+	return 0;
+    }
+    if (num_rays == 0 || num_bins == 0) {
+	return 1;
+    }
+    double * az = malloc(num_rays * sizeof *az);
+    unsigned * half_rays = malloc(num_bins * sizeof *half_rays);
+    unsigned * reach = calloc(MAX_HALF_RAYS + 1, sizeof *reach);
+    if (az == NULL || half_rays == NULL || reach == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate kernel tables.", __func__);
+	free(az);
+	free(half_rays);
+	free(reach);
+	return 0;
+    }
+
+    /* Mean ray spacing, from the span of the rays. The sweep wraps if the gap from the last ray
+     * to the first is no more than two spacings. */
+    double span = 0.0;
+    for (unsigned r = 0; r < num_rays; r++) {
+	az[r] = ray_az(ray_hdrs[r].az0, ray_hdrs[r].az1);
+	if (r > 0) {
+	    span += fabs(remainder(az[r] - az[r - 1], TWO_PI));
+	}
+    }
+    double daz = (num_rays > 1) ? span / (num_rays - 1) : TWO_PI;
+    _Bool wrap = num_rays > 2 && fabs(remainder(az[0] - az[num_rays - 1], TWO_PI)) <= 2.0 * daz;
+
+    /* Kernel size in rays and bins. Ray count does not increase with range, so the bins that
+     * reach k rays to either side are bins 0 to reach[k] - 1. */
+    unsigned half_bins = (unsigned)lrint(0.5 * cfg_p->rng_len / drng);
+    half_bins = half_bins ? half_bins : 1;
+    unsigned half_rays_max = 1;
+    unsigned half_rays_lim = wrap ? (num_rays - 1) / 2 : num_rays - 1;
+    half_rays_lim = (half_rays_lim < MAX_HALF_RAYS) ? half_rays_lim : MAX_HALF_RAYS;
+    for (unsigned b = 0; b < num_bins; b++) {
+	double rng = rng0 + (b + 0.5) * drng;
+	long h = lrint(0.5 * cfg_p->az_len / (rng * daz));
+	h = (h < 1) ? 1 : h;
+	half_rays[b] = ((unsigned)h < half_rays_lim) ? (unsigned)h : half_rays_lim;
+	half_rays_max = (half_rays[b] > half_rays_max) ? half_rays[b] : half_rays_max;
+	for (unsigned k = 0; k <= half_rays[b]; k++) {
+	    reach[k] = b + 1;
+	}
+    }
+
+    struct llsd llsd = {
+	.cfg_p = cfg_p, .num_rays = num_rays, .num_bins = num_bins, .ray_hdrs = ray_hdrs,
+	.dat = dat, .rng0 = rng0, .drng = drng, .wrap = wrap, .az = az,
+	.half_rays = half_rays, .reach = reach, .half_bins = half_bins,
+	.half_rays_max = half_rays_max,
+	.shear = shear, .div = div, .mtx = PTHREAD_MUTEX_INITIALIZER, .fail = 0
+    };
+
+    SigmetRaw_RowsRun(SigmetRaw_NumThreads(cfg_p->num_threads), num_rays, rays_thread, &llsd);
+    free(az);
+    free(half_rays);
+    free(reach);
+    if (llsd.fail) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate sums for %u bins.",
+		__func__, num_bins);
+	return 0;
+    }
+    return 1;
+}
+
+static void * rays_thread(void * arg)
+{
+    struct SigmetRaw_Rows * rows = arg;
+    struct llsd * llsd = rows->arg;
+    unsigned num_rays = llsd->num_rays, num_bins = llsd->num_bins;
+    unsigned half_bins = llsd->half_bins;
+    int h_max = (int)llsd->half_rays_max;
+    double * sums = malloc(NUM_SUMS * num_bins * sizeof *sums);
+    double * rng = malloc(num_bins * sizeof *rng);
+    if (sums == NULL || rng == NULL) {
+	free(sums);
+	free(rng);
+	pthread_mutex_lock(&llsd->mtx);
+	llsd->fail = 1;
+	pthread_mutex_unlock(&llsd->mtx);
+	return NULL;
+    }
+    double * s[NUM_SUMS];
+    for (int k = 0; k < NUM_SUMS; k++) {
+	s[k] = sums + (size_t)k * num_bins;
+    }
+    for (unsigned b = 0; b < num_bins; b++) {
+	rng[b] = llsd->rng0 + (b + 0.5) * llsd->drng;
+    }
+    double min_frac = llsd->cfg_p->min_frac;
+    for (unsigned r = rows->i0; r < rows->i1; r++) {
+	float * shear = llsd->shear + (size_t)r * num_bins;
+	float * div = llsd->div ? llsd->div + (size_t)r * num_bins : NULL;
+	if (llsd->dat[r] == NULL) {
+	    for (unsigned b = 0; b < num_bins; b++) {
+		shear[b] = NAN;
+		if (div) {
+		    div[b] = NAN;
+		}
+	    }
+	    continue;
+	}
+	memset(sums, 0, NUM_SUMS * num_bins * sizeof *sums);
+	for (int k = -h_max; k <= h_max; k++) {
+	    long rr = (long)r + k;
+	    if (llsd->wrap) {
+		rr = (rr + num_rays) % num_rays;
+	    } else if (rr < 0 || rr >= (long)num_rays) {
+		continue;
+	    }
+	    const float * d = llsd->dat[rr];
+	    if (d == NULL) {
+		continue;
+	    }
+	    int nb = llsd->ray_hdrs[rr].num_bins;
+	    nb = (nb < 0) ? 0 : ((unsigned)nb < num_bins) ? nb : (int)num_bins;
+	    double dth = remainder(llsd->az[rr] - llsd->az[r], TWO_PI);
+	    unsigned reach = llsd->reach[abs(k)];
+
+	    /* Neighbor gate b + j contributes to gate b, for j from -half_bins to half_bins. */
+	    for (int j = -(int)half_bins; j <= (int)half_bins; j++) {
+		long e = (long)nb - j;
+		unsigned b0 = (j < 0) ? (unsigned)-j : 0;
+		unsigned b1 = (e < 0) ? 0 : (e < (long)reach) ? (unsigned)e : reach;
+		double t = j * (double)llsd->drng;
+		for (unsigned b = b0; b < b1; b++) {
+		    float v = d[b + j];
+		    double w = isnan(v) ? 0.0 : 1.0;
+		    double vv = isnan(v) ? 0.0 : v;
+		    double x = rng[b] * dth;
+		    s[N][b] += w;
+		    s[SX][b] += w * x;
+		    s[ST][b] += w * t;
+		    s[SXX][b] += w * x * x;
+		    s[STT][b] += w * t * t;
+		    s[SXT][b] += w * x * t;
+		    s[SV][b] += w * vv;
+		    s[SXV][b] += w * x * vv;
+		    s[STV][b] += w * t * vv;
+		}
+	    }
+	}
+
+	/* Solve the normal equations by Cramer's rule */
+	for (unsigned b = 0; b < num_bins; b++) {
+	    double n = s[N][b], sx = s[SX][b], st = s[ST][b];
+	    double sxx = s[SXX][b], stt = s[STT][b], sxt = s[SXT][b];
+	    double sv = s[SV][b], sxv = s[SXV][b], stv = s[STV][b];
+	    double full = (2.0 * llsd->half_rays[b] + 1.0) * (2.0 * half_bins + 1.0);
+	    double det = n * (sxx * stt - sxt * sxt) - sx * (sx * stt - sxt * st)
+		+ st * (sx * sxt - sxx * st);
+	    if (n < 3.0 || n < min_frac * full || !(fabs(det) > 1.0e-9 * n * sxx * stt)) {
+		shear[b] = NAN;
+		if (div) {
+		    div[b] = NAN;
+		}
+		continue;
+	    }
+	    double db = n * (sxv * stt - sxt * stv) - sv * (sx * stt - sxt * st)
+		+ st * (sx * stv - sxv * st);
+	    shear[b] = (float)(db / det);
+	    if (div) {
+		double dc = n * (sxx * stv - sxv * sxt) - sx * (sx * stv - sxv * st)
+		    + sv * (sx * sxt - sxx * st);
+		div[b] = (float)(dc / det);
+	    }
+	}
+    }
+    free(sums);
+    free(rng);
+    return NULL;
+}
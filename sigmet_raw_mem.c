@@ -0,0 +1,343 @@
+/*
+ *	sigmet_raw_mem.c --
+ *		Memory accounting and eviction for the sigmet_raw daemon.
+ *	--
+ *
+ *	Everything the daemon holds in memory, loaded volumes and converted sweeps, is registered
+ *	here with its size and a function that releases it. Registered items form a list ordered
+ *	from most to least recently used. When the total exceeds the budget, or the system reports
+ *	memory pressure, the least recently used items that are not pinned are released, so the
+ *	daemon keeps its hot set and gives back the rest before the kernel has to kill it.
+ *
+ *	Pressure comes from two sources, both files the daemon can poll for POLLPRI:
+ *	    PSI, via a trigger written to the memory.pressure file of the daemon's cgroup, or to
+ *		/proc/pressure/memory. The kernel signals when tasks stall waiting for memory.
+ *	    memory.events of the daemon's cgroup. The kernel signals when the "high" or "max"
+ *		counters increase, i.e. the cgroup hit its limits.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+/* PSI trigger. Signal if tasks stall on memory for 100 ms in any 1 s window. */
+#define PSI_TRIGGER "some 100000 1000000"
+
+/* On pressure, shrink to this fraction of current use. */
+#define PRESSURE_SHRINK 0.75
+
+struct SigmetRaw_MemItem {
+    size_t sz;
+    unsigned pins;			/* If > 0, item is in use and cannot be evicted */
+    SigmetRaw_MemEvictFn * evict;	/* Release the item */
+    void * arg;				/* Argument for evict */
+    struct SigmetRaw_MemItem * prev, * next;	/* Neighbors in use order */
+};
+
+struct SigmetRaw_Mem {
+    pthread_mutex_t mtx;
+    size_t budget;			/* Maximum bytes to hold */
+    size_t used;			/* Bytes in registered items */
+    struct SigmetRaw_MemItem * mru, * lru;	/* Most and least recently used items */
+    unsigned long num_evicted;
+    unsigned long long events_seen;	/* Sum of high and max counters in memory.events */
+};
+
+/* Copy path to cgroup file nm for this process into path, which has space for LINE_MAX chars.
+ * Return 1/0 on success/failure. Only cgroup v2 is supported. */
+static int cgroup_path(const char * nm, char * path)
+{
+    FILE * fl = fopen("/proc/self/cgroup", "r");
+    if (fl == NULL) {
+	return 0;
+    }
+    char ln[LINE_MAX];
+    int status = 0;
+    while (fgets(ln, sizeof ln, fl) != NULL) {
+	if (strncmp(ln, "0::", 3) == 0) {
+	    ln[strcspn(ln, "\n")] = '\0';
+	    status = snprintf(path, LINE_MAX, "/sys/fs/cgroup%s/%s", ln + 3, nm) < LINE_MAX;
+	    break;
+	}
+    }
+    fclose(fl);
+    return status;
+}
+
+/* Read cgroup limit file nm, e.g. memory.high. Return limit, or 0 if none. */
+static size_t cgroup_limit(const char * nm)
+{
+    char path[LINE_MAX];
+    if ( !cgroup_path(nm, path) ) {
+	return 0;
+    }
+    FILE * fl = fopen(path, "r");
+    if (fl == NULL) {
+	return 0;
+    }
+    unsigned long long lim = 0;
+    if (fscanf(fl, "%llu", &lim) != 1) {
+	lim = 0;			/* "max" => no limit */
+    }
+    fclose(fl);
+    return lim;
+}
+
+/* Create memory accountant with given budget in bytes. If budget is 0, use 3/4 of the cgroup
+ * memory.high or memory.max limit, whichever is smaller, or no budget if neither is set. */
+struct SigmetRaw_Mem * SigmetRaw_MemInit(size_t budget, struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct SigmetRaw_Mem * mem = calloc(1, sizeof *mem);
+    if (mem == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate memory accountant.", __func__);
+	return NULL;
+    }
+    if (budget == 0) {
+	size_t high = cgroup_limit("memory.high"), max = cgroup_limit("memory.max");
+	size_t lim = (high == 0 || (max != 0 && max < high)) ? max : high;
+	budget = (lim == 0) ? SIZE_MAX : lim / 4 * 3;
+    }
+    mem->budget = budget;
+    pthread_mutex_init(&mem->mtx, NULL);
+    return mem;
+}
+
+/* Free accountant. Registered items are released. */
+void SigmetRaw_MemFree(struct SigmetRaw_Mem * mem)
+{
+    if (mem == NULL) {
+	return;
+    }
+    struct SigmetRaw_MemItem * item, * next;
+    for (item = mem->mru; item != NULL; item = next) {
+	next = item->next;
+	item->evict(item->arg);
+	free(item);
+    }
+    pthread_mutex_destroy(&mem->mtx);
+    free(mem);
+}
+
+static void unlink_item(struct SigmetRaw_Mem * mem, struct SigmetRaw_MemItem * item)
+{
+    if (item->prev) {
+	item->prev->next = item->next;
+    } else {
+	mem->mru = item->next;
+    }
+    if (item->next) {
+	item->next->prev = item->prev;
+    } else {
+	mem->lru = item->prev;
+    }
+    item->prev = item->next = NULL;
+}
+
+static void push_mru(struct SigmetRaw_Mem * mem, struct SigmetRaw_MemItem * item)
+{
+    item->prev = NULL;
+    item->next = mem->mru;
+    if (mem->mru) {
+	mem->mru->prev = item;
+    } else {
+	mem->lru = item;
+    }
+    mem->mru = item;
+}
+
+/* Release least recently used unpinned items until use is at most target bytes. Caller must
+ * hold the lock. Return bytes released. */
+static size_t shrink(struct SigmetRaw_Mem * mem, size_t target)
+{
+    size_t freed = 0;
+    struct SigmetRaw_MemItem * item = mem->lru, * prev;
+    for ( ; item != NULL && mem->used > target; item = prev) {
+	prev = item->prev;
+	if (item->pins > 0 || !item->evict(item->arg)) {
+	    continue;
+	}
+	unlink_item(mem, item);
+	mem->used -= item->sz;
+	freed += item->sz;
+	mem->num_evicted++;
+	free(item);
+    }
+    return freed;
+}
+
+/* Register an item of sz bytes, released by calling evict(arg). The item starts pinned, so it
+ * survives until the caller unpins it. Older items may be evicted to make room. Return the item,
+ * or NULL if memory runs out.
+ *
+ * evict runs with the accountant locked, so it must not call SigmetRaw_Mem functions. If it
+ * needs a lock that is held while calling them, e.g. the lock on the daemon's cache index, it
+ * should only try the lock, and return 0 to leave the item in place if the lock is busy.
+ * Otherwise it releases the item and returns 1. */
+struct SigmetRaw_MemItem * SigmetRaw_MemAdd(struct SigmetRaw_Mem * mem, size_t sz,
+	SigmetRaw_MemEvictFn * evict, void * arg, struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct SigmetRaw_MemItem * item = calloc(1, sizeof *item);
+    if (item == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate memory item.", __func__);
+	return NULL;
+    }
+    *item = (struct SigmetRaw_MemItem){ .sz = sz, .pins = 1, .evict = evict, .arg = arg };
+    pthread_mutex_lock(&mem->mtx);
+    shrink(mem, (sz < mem->budget) ? mem->budget - sz : 0);
+    push_mru(mem, item);
+    mem->used += sz;
+    pthread_mutex_unlock(&mem->mtx);
+    return item;
+}
+
+/* Pin item, i.e. mark it in use and recently used. Pinned items are not evicted. */
+void SigmetRaw_MemPin(struct SigmetRaw_Mem * mem, struct SigmetRaw_MemItem * item)
+{
+    pthread_mutex_lock(&mem->mtx);
+    item->pins++;
+    unlink_item(mem, item);
+    push_mru(mem, item);
+    pthread_mutex_unlock(&mem->mtx);
+}
+
+/* Unpin item. If use exceeds budget, evict items, possibly including this one. */
+void SigmetRaw_MemUnpin(struct SigmetRaw_Mem * mem, struct SigmetRaw_MemItem * item)
+{
+    pthread_mutex_lock(&mem->mtx);
+    item->pins--;
+    if (mem->used > mem->budget) {
+	shrink(mem, mem->budget);
+    }
+    pthread_mutex_unlock(&mem->mtx);
+}
+
+/* Remove item without calling its evict function. Item must be pinned once, by the caller. */
+void SigmetRaw_MemRemove(struct SigmetRaw_Mem * mem, struct SigmetRaw_MemItem * item)
+{
+    pthread_mutex_lock(&mem->mtx);
+    unlink_item(mem, item);
+    mem->used -= item->sz;
+    pthread_mutex_unlock(&mem->mtx);
+    free(item);
+}
+
+/* Return bytes in registered items. */
+size_t SigmetRaw_MemUsed(struct SigmetRaw_Mem * mem)
+{
+    pthread_mutex_lock(&mem->mtx);
+    size_t used = mem->used;
+    pthread_mutex_unlock(&mem->mtx);
+    return used;
+}
+
+/* Evict until use is at most target bytes. Return bytes released. */
+size_t SigmetRaw_MemShrink(struct SigmetRaw_Mem * mem, size_t target)
+{
+    pthread_mutex_lock(&mem->mtx);
+    size_t freed = shrink(mem, target);
+    pthread_mutex_unlock(&mem->mtx);
+    return freed;
+}
+
+/* Open a PSI trigger for memory stalls. Return a descriptor the daemon should poll for POLLPRI,
+ * then call SigmetRaw_MemOnPressure, or -1 if the system does not support PSI. */
+int SigmetRaw_MemPressureOpen(struct Sigmet_ErrMsg * err_msg_p)
+{
+    char path[LINE_MAX];
+    int fd = -1;
+    if (cgroup_path("memory.pressure", path)) {
+	fd = open(path, O_RDWR | O_NONBLOCK);
+    }
+    if (fd == -1) {
+	snprintf(path, sizeof path, "/proc/pressure/memory");
+	fd = open(path, O_RDWR | O_NONBLOCK);
+    }
+    if (fd == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not open memory pressure file. %s",
+		__func__, strerror(errno));
+	return -1;
+    }
+    if (write(fd, PSI_TRIGGER, strlen(PSI_TRIGGER) + 1) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not set trigger in %s. %s",
+		__func__, path, strerror(errno));
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+/* Respond to memory pressure by releasing cold items. Return bytes released. */
+size_t SigmetRaw_MemOnPressure(struct SigmetRaw_Mem * mem)
+{
+    pthread_mutex_lock(&mem->mtx);
+    size_t target = (size_t)(mem->used * PRESSURE_SHRINK);
+    if (target > mem->budget) {
+	target = mem->budget;
+    }
+    size_t freed = shrink(mem, target);
+    pthread_mutex_unlock(&mem->mtx);
+    return freed;
+}
+
+/* Return sum of "high" and "max" counters in memory.events file at fd. */
+static unsigned long long events_count(int fd)
+{
+    char buf[512];
+    ssize_t n = pread(fd, buf, sizeof buf - 1, 0);
+    if (n <= 0) {
+	return 0;
+    }
+    buf[n] = '\0';
+    unsigned long long events = 0, count;
+    char key[32];
+    int off;
+    for (char * b = buf; sscanf(b, "%31s %llu%n", key, &count, &off) == 2; b += off) {
+	if (strcmp(key, "high") == 0 || strcmp(key, "max") == 0) {
+	    events += count;
+	}
+    }
+    return events;
+}
+
+/* Open memory.events for the daemon's cgroup. Return a descriptor the daemon should poll for
+ * POLLPRI, then call SigmetRaw_MemOnEvents, or -1 if not in a cgroup v2 hierarchy. */
+int SigmetRaw_MemEventsOpen(struct SigmetRaw_Mem * mem, struct Sigmet_ErrMsg * err_msg_p)
+{
+    char path[LINE_MAX];
+    int fd = -1;
+    if ( !cgroup_path("memory.events", path) || (fd = open(path, O_RDONLY)) == -1 ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not open cgroup memory.events.", __func__);
+	return -1;
+    }
+    unsigned long long events = events_count(fd);
+    pthread_mutex_lock(&mem->mtx);
+    mem->events_seen = events;
+    pthread_mutex_unlock(&mem->mtx);
+    return fd;
+}
+
+/* Read memory.events from fd. If the cgroup reached its high or max limit since the last call,
+ * release cold items as for memory pressure. Return bytes released. */
+size_t SigmetRaw_MemOnEvents(struct SigmetRaw_Mem * mem, int fd)
+{
+    unsigned long long events = events_count(fd);
+    pthread_mutex_lock(&mem->mtx);
+    _Bool hit = events > mem->events_seen;
+    mem->events_seen = events;
+    pthread_mutex_unlock(&mem->mtx);
+    return hit ? SigmetRaw_MemOnPressure(mem) : 0;
+}
@@ -0,0 +1,381 @@
+/*
+ *	sigmet_raw_nowcast.c --
+ *		Motion estimation and extrapolation nowcasts.
+ *	--
+ *
+ *	A nowcaster works on a square Cartesian grid of sz by sz cells, dx meters each, centered on
+ *	the radar, with row 0 at the north edge and column 0 at the west edge. Values come from
+ *	sweeps on a regular azimuth grid, see sigmet_raw_azgrid.c, with a lookup table that gives
+ *	the azimuth cell and bin for each grid cell. Range is slant range, as in the PPI renderer.
+ *
+ *	Motion comes from block matching. The current grid is divided into blocks of block by block
+ *	cells, and each block is compared with the previous grid at every displacement up to search
+ *	cells in each direction. The displacement with the least mean absolute difference, refined
+ *	with a parabola through its neighbors, gives the block motion. Missing values, and values
+ *	below floor, count as floor, so empty areas match each other. Blocks without enough echo
+ *	get the mean motion of the blocks that have it. Block motions are smoothed, then
+ *	interpolated to the cells.
+ *
+ *	Extrapolation is semi-Lagrangian. For each cell, the trajectory is followed backward
+ *	through the motion field for the lead time, in steps that move at most one cell, and the
+ *	nowcast value is the current value at the start of the trajectory.
+ *
+ *	Matching and extrapolation are split over threads, by block rows and grid rows. Inner
+ *	loops are branch free loops over contiguous values, so compilers can vectorize them.
+ *	Nowcasters are not thread safe.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define NO_IDX UINT32_MAX		/* Grid cell is outside the sweep */
+#define MIN_ECHO_FRAC 0.1		/* Blocks need this fraction of cells with echo */
+
+struct SigmetRaw_Nowcast {
+    struct SigmetRaw_NowcastCfg cfg;
+
+    /* Lookup table, and the sweep geometry it is for */
+    unsigned num_az, num_bins;
+    float rng0, drng;
+    uint32_t * lut;			/* [sz * sz] Index in azimuth grid, or NO_IDX */
+
+    /* Motion */
+    float * prev, * cur;		/* [sz * sz] Grids with missing values at floor */
+    unsigned nbx;			/* Blocks per row and column */
+    float (*bmv)[2];			/* [nbx * nbx] Block motion, cells per interval, or NAN */
+    float (*bmv1)[2];			/* [nbx * nbx] Smoothed */
+};
+
+/* Create nowcaster with configuration cfg_p. Return NULL on failure. */
+struct SigmetRaw_Nowcast * SigmetRaw_NowcastInit(const struct SigmetRaw_NowcastCfg * cfg_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    if (cfg_p->sz == 0 || !(cfg_p->dx > 0.0f) || cfg_p->block == 0 || cfg_p->block > cfg_p->sz
+	    || cfg_p->search == 0 || cfg_p->search > SIGMETRAW_NOWCAST_MAX_SEARCH) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: invalid nowcast grid, %u cells of %g meters, "
+		"block %u, search %u.", __func__, cfg_p->sz, cfg_p->dx, cfg_p->block,
+		cfg_p->search);
+	return NULL;
+    }
+    struct SigmetRaw_Nowcast * nc = calloc(1, sizeof *nc);
+    if (nc == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate nowcaster.", __func__);
+	return NULL;
+    }
+    nc->cfg = *cfg_p;
+    nc->cfg.num_threads = SigmetRaw_NumThreads(nc->cfg.num_threads);
+    size_t n = (size_t)cfg_p->sz * cfg_p->sz;
+    nc->nbx = cfg_p->sz / cfg_p->block;
+    nc->lut = malloc(n * sizeof *nc->lut);
+    nc->prev = malloc(n * sizeof *nc->prev);
+    nc->cur = malloc(n * sizeof *nc->cur);
+    nc->bmv = malloc((size_t)nc->nbx * nc->nbx * sizeof *nc->bmv);
+    nc->bmv1 = malloc((size_t)nc->nbx * nc->nbx * sizeof *nc->bmv1);
+    if (nc->lut == NULL || nc->prev == NULL || nc->cur == NULL || nc->bmv == NULL
+	    || nc->bmv1 == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate nowcast grids, %u by %u cells.",
+		__func__, cfg_p->sz, cfg_p->sz);
+	SigmetRaw_NowcastFree(nc);
+	return NULL;
+    }
+    return nc;
+}
+
+void SigmetRaw_NowcastFree(struct SigmetRaw_Nowcast * nc)
+{
+    if (nc == NULL) {
+	return;
+    }
+    free(nc->lut);
+    free(nc->prev);
+    free(nc->cur);
+    free(nc->bmv);
+    free(nc->bmv1);
+    free(nc);
+}
+
+static void lut_update(struct SigmetRaw_Nowcast * nc, unsigned num_az, unsigned num_bins,
+	float rng0, float drng)
+{
+    if (nc->num_az == num_az && nc->num_bins == num_bins && nc->rng0 == rng0
+	    && nc->drng == drng) {
+	return;
+    }
+    unsigned sz = nc->cfg.sz;
+    double dx = nc->cfg.dx, h = 0.5 * sz;
+    for (unsigned i = 0; i < sz; i++) {
+	double y = (h - i - 0.5) * dx;
+	for (unsigned j = 0; j < sz; j++) {
+	    double x = (j + 0.5 - h) * dx;
+	    double b = floor((sqrt(x * x + y * y) - rng0) / drng);
+	    uint32_t * l = nc->lut + (size_t)i * sz + j;
+	    if (b < 0.0 || b >= num_bins) {
+		*l = NO_IDX;
+		continue;
+	    }
+	    double az = atan2(x, y);
+	    unsigned a = (unsigned)((az < 0.0 ? az + 2.0 * M_PI : az) / (2.0 * M_PI) * num_az);
+	    *l = (uint32_t)((a < num_az ? a : num_az - 1) * num_bins + (unsigned)b);
+	}
+    }
+    nc->num_az = num_az;
+    nc->num_bins = num_bins;
+    nc->rng0 = rng0;
+    nc->drng = drng;
+}
+
+/* Put sweep with num_az by num_bins values at swp, range to first bin rng0, bin step drng,
+ * meters, on the nowcast grid at cart, with NAN outside the sweep. */
+void SigmetRaw_NowcastCart(struct SigmetRaw_Nowcast * nc, unsigned num_az, unsigned num_bins,
+	float rng0, float drng, const float * swp, float * cart)
+{
+    lut_update(nc, num_az, num_bins, rng0, drng);
+    size_t n = (size_t)nc->cfg.sz * nc->cfg.sz;
+    for (size_t p = 0; p < n; p++) {
+	cart[p] = (nc->lut[p] == NO_IDX) ? NAN : swp[nc->lut[p]];
+    }
+}
+
+/* Copy n values from src to dst, with missing values and values below fl at fl */
+static void floor_copy(const float * src, size_t n, float fl, float * dst)
+{
+    for (size_t p = 0; p < n; p++) {
+	dst[p] = (src[p] >= fl) ? src[p] : fl;
+    }
+}
+
+/* Mean absolute difference of block by block cells at a and b, rows sz apart. */
+static float sad(const float * a, const float * b, unsigned block, unsigned sz)
+{
+    float s = 0.0f;
+    for (unsigned i = 0; i < block; i++, a += sz, b += sz) {
+	for (unsigned k = 0; k < block; k++) {
+	    s += fabsf(a[k] - b[k]);
+	}
+    }
+    return s / (block * block);
+}
+
+/* Offset of the vertex of the parabola through (-1, m), (0, c), (1, p) */
+static float vertex(float m, float c, float p)
+{
+    float d = m - 2.0f * c + p;
+    return (d > 0.0f) ? 0.5f * (m - p) / d : 0.0f;
+}
+
+static void * match_thread(void * arg)
+{
+    struct SigmetRaw_Rows * rows = arg;
+    struct SigmetRaw_Nowcast * nc = rows->arg;
+    unsigned sz = nc->cfg.sz, block = nc->cfg.block;
+    int search = (int)nc->cfg.search, ns = 2 * search + 1;
+    float echo = nc->cfg.echo;
+    float cost[2 * SIGMETRAW_NOWCAST_MAX_SEARCH + 1][2 * SIGMETRAW_NOWCAST_MAX_SEARCH + 1];
+    for (unsigned bi = rows->i0; bi < rows->i1; bi++) {
+	for (unsigned bj = 0; bj < nc->nbx; bj++) {
+	    unsigned i0 = bi * block, j0 = bj * block;
+	    const float * c = nc->cur + (size_t)i0 * sz + j0;
+	    float (*mv)[2] = nc->bmv + (size_t)bi * nc->nbx + bj;
+	    unsigned num_echo = 0;
+	    for (unsigned i = 0; i < block; i++) {
+		for (unsigned k = 0; k < block; k++) {
+		    num_echo += (c[(size_t)i * sz + k] >= echo);
+		}
+	    }
+	    (*mv)[0] = (*mv)[1] = NAN;
+	    if (num_echo < MIN_ECHO_FRAC * block * block) {
+		continue;
+	    }
+
+	    /* Echo now at c was at c - (dj, di) in the previous grid. */
+	    int best_di = 0, best_dj = 0;
+	    float best = HUGE_VALF;
+	    for (int di = -search; di <= search; di++) {
+		for (int dj = -search; dj <= search; dj++) {
+		    long pi = (long)i0 - di, pj = (long)j0 - dj;
+		    float s = HUGE_VALF;
+		    if (pi >= 0 && pj >= 0 && pi + block <= sz && pj + block <= sz) {
+			s = sad(c, nc->prev + (size_t)pi * sz + pj, block, sz);
+		    }
+		    cost[di + search][dj + search] = s;
+		    if (s < best || (s == best && abs(di) + abs(dj) < abs(best_di) + abs(best_dj))) {
+			best = s;
+			best_di = di;
+			best_dj = dj;
+		    }
+		}
+	    }
+	    if (best == HUGE_VALF) {
+		continue;
+	    }
+	    int ci = best_di + search, cj = best_dj + search;
+	    float fi = 0.0f, fj = 0.0f;
+	    if (ci > 0 && ci < ns - 1 && cost[ci - 1][cj] < HUGE_VALF
+		    && cost[ci + 1][cj] < HUGE_VALF) {
+		fi = vertex(cost[ci - 1][cj], best, cost[ci + 1][cj]);
+	    }
+	    if (cj > 0 && cj < ns - 1 && cost[ci][cj - 1] < HUGE_VALF
+		    && cost[ci][cj + 1] < HUGE_VALF) {
+		fj = vertex(cost[ci][cj - 1], best, cost[ci][cj + 1]);
+	    }
+	    (*mv)[0] = best_dj + fj;
+	    (*mv)[1] = best_di + fi;
+	}
+    }
+    return NULL;
+}
+
+/* Estimate motion from grid prev to grid cur, dt seconds later, both from SigmetRaw_NowcastCart.
+ * Put motion of each cell, meters per second toward east and north, at u and v. Return number
+ * of blocks with echo, from which motion was measured, or 0 if none, in which case motion is
+ * zero. */
+unsigned SigmetRaw_NowcastMotion(struct SigmetRaw_Nowcast * nc, const float * prev,
+	const float * cur, float dt, float * u, float * v)
+{
+    unsigned sz = nc->cfg.sz, nbx = nc->nbx, block = nc->cfg.block;
+    size_t n = (size_t)sz * sz;
+    floor_copy(prev, n, nc->cfg.floor, nc->prev);
+    floor_copy(cur, n, nc->cfg.floor, nc->cur);
+    SigmetRaw_RowsRun(nc->cfg.num_threads, nbx, match_thread, nc);
+
+    /* Fill blocks without echo with mean motion, then smooth with a 3 by 3 mean of the blocks
+     * with echo. */
+    unsigned num_valid = 0;
+    double su = 0.0, sv = 0.0;
+    for (size_t k = 0; k < (size_t)nbx * nbx; k++) {
+	if ( !isnan(nc->bmv[k][0]) ) {
+	    su += nc->bmv[k][0];
+	    sv += nc->bmv[k][1];
+	    num_valid++;
+	}
+    }
+    float mu = num_valid ? su / num_valid : 0.0f, mv = num_valid ? sv / num_valid : 0.0f;
+    for (unsigned bi = 0; bi < nbx; bi++) {
+	for (unsigned bj = 0; bj < nbx; bj++) {
+	    float s0 = 0.0f, s1 = 0.0f;
+	    unsigned m = 0;
+	    for (unsigned i = (bi ? bi - 1 : 0); i <= bi + 1 && i < nbx; i++) {
+		for (unsigned j = (bj ? bj - 1 : 0); j <= bj + 1 && j < nbx; j++) {
+		    const float * b = nc->bmv[(size_t)i * nbx + j];
+		    if ( !isnan(b[0]) ) {
+			s0 += b[0];
+			s1 += b[1];
+			m++;
+		    }
+		}
+	    }
+	    float * b1 = nc->bmv1[(size_t)bi * nbx + bj];
+	    b1[0] = m ? s0 / m : mu;
+	    b1[1] = m ? s1 / m : mv;
+	}
+    }
+
+    /* Interpolate block motion, at block centers, to cells. Grid rows go south. */
+    float scale = nc->cfg.dx / dt;
+    for (unsigned i = 0; i < sz; i++) {
+	float fi = ((i + 0.5f) / block) - 0.5f;
+	fi = fminf(fmaxf(fi, 0.0f), nbx - 1);
+	unsigned i0 = (unsigned)fi, i1 = (i0 + 1 < nbx) ? i0 + 1 : i0;
+	float wi = fi - i0;
+	for (unsigned j = 0; j < sz; j++) {
+	    float fj = ((j + 0.5f) / block) - 0.5f;
+	    fj = fminf(fmaxf(fj, 0.0f), nbx - 1);
+	    unsigned j0 = (unsigned)fj, j1 = (j0 + 1 < nbx) ? j0 + 1 : j0;
+	    float wj = fj - j0;
+	    const float * b00 = nc->bmv1[(size_t)i0 * nbx + j0];
+	    const float * b01 = nc->bmv1[(size_t)i0 * nbx + j1];
+	    const float * b10 = nc->bmv1[(size_t)i1 * nbx + j0];
+	    const float * b11 = nc->bmv1[(size_t)i1 * nbx + j1];
+	    float mj = (1 - wi) * ((1 - wj) * b00[0] + wj * b01[0])
+		+ wi * ((1 - wj) * b10[0] + wj * b11[0]);
+	    float mi = (1 - wi) * ((1 - wj) * b00[1] + wj * b01[1])
+		+ wi * ((1 - wj) * b10[1] + wj * b11[1]);
+	    u[(size_t)i * sz + j] = mj * scale;
+	    v[(size_t)i * sz + j] = -mi * scale;
+	}
+    }
+    return num_valid;
+}
+
+/* Arguments for extrap_thread */
+struct extrap {
+    const struct SigmetRaw_Nowcast * nc;
+    const float * cur, * u, * v;
+    float * out;
+    unsigned num_steps;
+    float step;				/* Cells per meter per second for one step */
+};
+
+/* Bilinear interpolation of grid g at column x, row y. NAN outside the grid. If any of the four
+ * cells is missing, use the nearest. */
+static inline float interp(const float * g, unsigned sz, float x, float y)
+{
+    float fx = x - 0.5f, fy = y - 0.5f;
+    if ( !(fx >= -0.5f && fy >= -0.5f && fx <= sz - 0.5f && fy <= sz - 0.5f) ) {
+	return NAN;
+    }
+    fx = fminf(fmaxf(fx, 0.0f), sz - 1);
+    fy = fminf(fmaxf(fy, 0.0f), sz - 1);
+    unsigned j0 = (unsigned)fx, i0 = (unsigned)fy;
+    unsigned j1 = (j0 + 1 < sz) ? j0 + 1 : j0, i1 = (i0 + 1 < sz) ? i0 + 1 : i0;
+    float wj = fx - j0, wi = fy - i0;
+    float g00 = g[(size_t)i0 * sz + j0], g01 = g[(size_t)i0 * sz + j1];
+    float g10 = g[(size_t)i1 * sz + j0], g11 = g[(size_t)i1 * sz + j1];
+    float r = (1 - wi) * ((1 - wj) * g00 + wj * g01) + wi * ((1 - wj) * g10 + wj * g11);
+    if (isnan(r)) {
+	r = (wi < 0.5f) ? ((wj < 0.5f) ? g00 : g01) : ((wj < 0.5f) ? g10 : g11);
+    }
+    return r;
+}
+
+static void * extrap_thread(void * arg)
+{
+    struct SigmetRaw_Rows * rows = arg;
+    const struct extrap * ex = rows->arg;
+    unsigned sz = ex->nc->cfg.sz;
+    for (unsigned i = rows->i0; i < rows->i1; i++) {
+	for (unsigned j = 0; j < sz; j++) {
+	    float x = j + 0.5f, y = i + 0.5f;
+	    for (unsigned k = 0; k < ex->num_steps; k++) {
+		float u = interp(ex->u, sz, x, y), v = interp(ex->v, sz, x, y);
+		if (isnan(u)) {
+		    break;
+		}
+		x -= u * ex->step;
+		y += v * ex->step;
+	    }
+	    ex->out[(size_t)i * sz + j] = interp(ex->cur, sz, x, y);
+	}
+    }
+    return NULL;
+}
+
+/* Extrapolate grid cur with motion u, v from SigmetRaw_NowcastMotion lead seconds ahead, putting
+ * the nowcast at out. */
+void SigmetRaw_NowcastExtrap(const struct SigmetRaw_Nowcast * nc, const float * cur,
+	const float * u, const float * v, float lead, float * out)
+{
+    size_t n = (size_t)nc->cfg.sz * nc->cfg.sz;
+    float vmax = 0.0f;
+    for (size_t p = 0; p < n; p++) {
+	vmax = fmaxf(vmax, fmaxf(fabsf(u[p]), fabsf(v[p])));
+    }
+    float dist = vmax * fabsf(lead) / nc->cfg.dx;	/* Cells */
+    unsigned num_steps = (dist > 1.0f) ? (unsigned)ceilf(dist) : 1;
+    struct extrap ex = {
+	.nc = nc, .cur = cur, .u = u, .v = v, .out = out, .num_steps = num_steps,
+	.step = lead / num_steps / nc->cfg.dx
+    };
+    SigmetRaw_RowsRun(nc->cfg.num_threads, nc->cfg.sz, extrap_thread, &ex);
+}
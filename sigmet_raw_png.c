@@ -0,0 +1,345 @@
+/*
+ *	sigmet_raw_png.c --
+ *		Palette PNG encoder for rendered radar images.
+ *	--
+ *
+ *	Radar images are 8 bit color indeces with long runs of one color along rows, e.g. no data
+ *	outside the radar range, and strong similarity between adjacent rows. A general purpose
+ *	deflate spends most of its time searching for matches these images do not need. This
+ *	encoder only tries two matches at each pixel, the previous pixel (a run) and the pixel
+ *	above, and codes them with the fixed Huffman codes, which need no tables in the stream.
+ *
+ *	Bands of rows are compressed on separate threads. Each band ends with an empty stored block,
+ *	which byte aligns the output, so the bands can be concatenated into one zlib stream. Matches
+ *	do not cross bands.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_DIST 32768
+
+/* Deflate length and distance codes, RFC 1951 3.2.5 */
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_xbits[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_xbits[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/* Fixed Huffman codes, bit reversed for the LSB first bit stream, and CRC table */
+static uint16_t lit_code[288];
+static uint8_t lit_len[288];
+static uint8_t dist_code[30];
+static uint8_t len_sym[MAX_MATCH + 1];	/* Length => index in len_base */
+static uint32_t crc_tbl[256];
+static pthread_once_t tbl_once = PTHREAD_ONCE_INIT;
+
+static unsigned rev(unsigned code, unsigned n)
+{
+    unsigned r = 0;
+    for (unsigned i = 0; i < n; i++, code >>= 1) {
+	r = (r << 1) | (code & 1);
+    }
+    return r;
+}
+
+static void tbl_init(void)
+{
+    for (unsigned c = 0; c < 288; c++) {
+	if (c < 144) {
+	    lit_len[c] = 8;
+	    lit_code[c] = rev(0x30 + c, 8);
+	} else if (c < 256) {
+	    lit_len[c] = 9;
+	    lit_code[c] = rev(0x190 + c - 144, 9);
+	} else if (c < 280) {
+	    lit_len[c] = 7;
+	    lit_code[c] = rev(c - 256, 7);
+	} else {
+	    lit_len[c] = 8;
+	    lit_code[c] = rev(0xc0 + c - 280, 8);
+	}
+    }
+    for (unsigned d = 0; d < 30; d++) {
+	dist_code[d] = rev(d, 5);
+    }
+    for (unsigned l = MIN_MATCH, i = 0; l <= MAX_MATCH; l++) {
+	while (i < 28 && l >= len_base[i + 1]) {
+	    i++;
+	}
+	len_sym[l] = i;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+	uint32_t c = n;
+	for (int k = 0; k < 8; k++) {
+	    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+	}
+	crc_tbl[n] = c;
+    }
+}
+
+/* LSB first bit writer */
+struct bits {
+    uint8_t * p;
+    uint64_t acc;
+    unsigned n;
+};
+
+static inline void put(struct bits * bw, uint32_t v, unsigned n)
+{
+    bw->acc |= (uint64_t)v << bw->n;
+    bw->n += n;
+    while (bw->n >= 8) {
+	*bw->p++ = bw->acc;
+	bw->acc >>= 8;
+	bw->n -= 8;
+    }
+}
+
+static inline void put_match(struct bits * bw, unsigned len, unsigned dist)
+{
+    unsigned l = len_sym[len];
+    put(bw, lit_code[257 + l], lit_len[257 + l]);
+    put(bw, len - len_base[l], len_xbits[l]);
+    unsigned d = 0;
+    while (d < 29 && dist >= dist_base[d + 1]) {
+	d++;
+    }
+    put(bw, dist_code[d], 5);
+    put(bw, dist - dist_base[d], dist_xbits[d]);
+}
+
+/* Return bytes needed to compress n bytes with compress_band. */
+static size_t band_bound(size_t n)
+{
+    return n * 9 / 8 + 16;
+}
+
+/* Compress n bytes at buf, which are rows of stride bytes, into out as a fixed Huffman block
+ * followed by an empty stored block. Return bytes written. */
+static size_t compress_band(const uint8_t * buf, size_t n, size_t stride, uint8_t * out)
+{
+    struct bits bw = { .p = out };
+    put(&bw, 0, 1);			/* BFINAL = 0 */
+    put(&bw, 1, 2);			/* BTYPE = fixed Huffman */
+    size_t dists[2] = { 1, stride };
+    size_t i = 0;
+    while (i < n) {
+	unsigned best_len = 0;
+	size_t best_dist = 0;
+	size_t max = (n - i < MAX_MATCH) ? n - i : MAX_MATCH;
+	for (int k = 0; k < 2; k++) {
+	    size_t d = dists[k];
+	    if (d > i || d > MAX_DIST) {
+		continue;
+	    }
+	    const uint8_t * a = buf + i, * b = buf + i - d;
+	    unsigned l = 0;
+	    while (l < max && a[l] == b[l]) {
+		l++;
+	    }
+	    if (l > best_len) {
+		best_len = l;
+		best_dist = d;
+	    }
+	}
+	if (best_len >= MIN_MATCH) {
+	    put_match(&bw, best_len, best_dist);
+	    i += best_len;
+	} else {
+	    put(&bw, lit_code[buf[i]], lit_len[buf[i]]);
+	    i++;
+	}
+    }
+    put(&bw, lit_code[256], lit_len[256]);	/* End of block */
+    put(&bw, 0, 3);			/* Stored block, BFINAL = 0 */
+    if (bw.n > 0) {
+	put(&bw, 0, 8 - bw.n);
+    }
+    memcpy(bw.p, "\x00\x00\xff\xff", 4);	/* LEN = 0, NLEN = ~0 */
+    return bw.p + 4 - out;
+}
+
+struct band {
+    const uint8_t * buf;
+    size_t n, stride;
+    uint8_t * out;
+    size_t out_sz;
+};
+
+static void * band_thread(void * arg)
+{
+    struct band * band = arg;
+    band->out_sz = compress_band(band->buf, band->n, band->stride, band->out);
+    return NULL;
+}
+
+static uint32_t crc(uint32_t c, const uint8_t * b, size_t n)
+{
+    c = ~c;
+    for (size_t i = 0; i < n; i++) {
+	c = crc_tbl[(c ^ b[i]) & 0xff] ^ (c >> 8);
+    }
+    return ~c;
+}
+
+static uint32_t adler32(const uint8_t * b, size_t n)
+{
+    uint32_t s1 = 1, s2 = 0;
+    while (n > 0) {
+	size_t k = (n < 5552) ? n : 5552;	/* Largest run without overflow */
+	n -= k;
+	while (k-- > 0) {
+	    s1 += *b++;
+	    s2 += s1;
+	}
+	s1 %= 65521;
+	s2 %= 65521;
+    }
+    return (s2 << 16) | s1;
+}
+
+static uint8_t * put32(uint8_t * p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+    return p + 4;
+}
+
+/* Append chunk of type typ with len bytes of data at dat to PNG at p. Return end of chunk. */
+static uint8_t * put_chunk(uint8_t * p, const char * typ, const uint8_t * dat, size_t len)
+{
+    p = put32(p, len);
+    uint8_t * c = p;
+    memcpy(p, typ, 4);
+    if (len > 0 && dat != p + 4) {
+	memmove(p + 4, dat, len);
+    }
+    p += 4 + len;
+    return put32(p, crc(0, c, 4 + len));
+}
+
+/* Encode w by h image of palette indeces pix, row major, as a PNG with num_colors palette
+ * entries rgb. If transp is less than num_colors, palette entry transp is transparent. Compress
+ * on up to num_threads threads. Put the PNG in a buffer from malloc at *png_p, which caller
+ * must free, and its size at *png_sz_p. Return 1/0 on success/failure. */
+int SigmetRaw_PngPalette(unsigned w, unsigned h, const uint8_t * pix,
+	const uint8_t (*rgb)[3], unsigned num_colors, unsigned transp, unsigned num_threads,
+	void ** png_p, size_t * png_sz_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    pthread_once(&tbl_once, tbl_init);
+    if (w == 0 || h == 0 || w >= MAX_DIST || num_colors == 0 || num_colors > 256) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: cannot encode %u by %u image with %u colors.",
+		__func__, w, h, num_colors);
+	return 0;
+    }
+    if (num_threads == 0) {
+	num_threads = 1;
+    }
+    if (num_threads > h) {
+	num_threads = h;
+    }
+
+    /* Scan lines, each with filter type 0 (none) */
+    size_t stride = (size_t)w + 1;
+    size_t raw_sz = stride * h;
+    size_t bound = band_bound(raw_sz) + num_threads * 16;
+    size_t png_sz = 8 + 25 + (12 + 3 * num_colors) + (12 + 256) + (12 + 2 + bound + 6) + 12;
+    uint8_t * raw = malloc(raw_sz);
+    uint8_t * png = malloc(png_sz);
+    struct band * bands = calloc(num_threads, sizeof *bands);
+    if (raw == NULL || png == NULL || bands == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate memory for %u by %u image.",
+		__func__, w, h);
+	goto error;
+    }
+    for (size_t r = 0; r < h; r++) {
+	raw[r * stride] = 0;
+	memcpy(raw + r * stride + 1, pix + r * w, w);
+    }
+
+    uint8_t * p = png;
+    memcpy(p, "\x89PNG\r\n\x1a\n", 8);
+    p += 8;
+    uint8_t ihdr[13];
+    put32(ihdr, w);
+    put32(ihdr + 4, h);
+    memcpy(ihdr + 8, "\x08\x03\x00\x00\x00", 5);	/* 8 bit, palette, deflate, no interlace */
+    p = put_chunk(p, "IHDR", ihdr, sizeof ihdr);
+    p = put_chunk(p, "PLTE", (const uint8_t *)rgb, 3 * num_colors);
+    if (transp < num_colors) {
+	uint8_t alpha[256];
+	memset(alpha, 0xff, transp);
+	alpha[transp] = 0;
+	p = put_chunk(p, "tRNS", alpha, transp + 1);
+    }
+
+    /* IDAT: zlib header, one band per thread, empty final block, Adler-32. Bands go straight
+     * into the chunk, after space for its length and type. */
+    uint8_t * idat = p + 8;
+    uint8_t * z = idat;
+    *z++ = 0x78;
+    *z++ = 0x01;
+    size_t rows_per = (h + num_threads - 1) / num_threads;
+    unsigned num_bands = 0;
+    uint8_t * out = z;
+    for (unsigned t = 0; t < num_threads; t++) {
+	size_t r0 = t * rows_per, r1 = (r0 + rows_per < h) ? r0 + rows_per : h;
+	if (r0 >= r1) {
+	    break;
+	}
+	bands[t] = (struct band){
+	    .buf = raw + r0 * stride, .n = (r1 - r0) * stride, .stride = stride, .out = out
+	};
+	out += band_bound(bands[t].n);
+	num_bands++;
+    }
+    SigmetRaw_ThreadsRun(num_bands, band_thread, bands, sizeof *bands);
+    for (unsigned t = 0; t < num_bands; t++) {
+	memmove(z, bands[t].out, bands[t].out_sz);
+	z += bands[t].out_sz;
+    }
+    memcpy(z, "\x03\x00", 2);		/* Empty final fixed Huffman block */
+    z += 2;
+    z = put32(z, adler32(raw, raw_sz));
+    p = put_chunk(p, "IDAT", idat, z - idat);
+    p = put_chunk(p, "IEND", NULL, 0);
+
+    free(raw);
+    free(bands);
+    *png_p = png;
+    *png_sz_p = p - png;
+    return 1;
+
+error:
+    free(raw);
+    free(png);
+    free(bands);
+    return 0;
+}
@@ -0,0 +1,397 @@
+/*
+ *	sigmet_raw_ppi.c --
+ *		Render sweeps as plan position indicator (PPI) images.
+ *	--
+ *
+ *	A renderer draws sweeps into a square image, north up, centered on the radar. Each pixel
+ *	gets a palette index: 0 for no data, or 1 to num_colors from the color levels, which
+ *	normally come from the color scale definition in the product configuration. Images are
+ *	encoded as palette PNG, see sigmet_raw_png.c.
+ *
+ *	Pixel to polar mapping does not change from sweep to sweep, so the renderer keeps a lookup
+ *	table that gives range bin and azimuth cell for each pixel, and only rebuilds it when the
+ *	image geometry or range bins change. For each sweep, the renderer maps azimuth cells to
+ *	rays from the ray headers, converts each bin to a color index once, then fills image rows
+ *	on several threads with table lookups only.
+ *
+ *	Range is slant range, as in the raw product, drawn as distance from the radar on the image.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define NO_BIN SIGMETRAW_PPI_NO_BIN
+#define AZ_CELLS SIGMETRAW_PPI_AZ_CELLS
+#define MAX_AZ_GAP 20			/* Fill gaps between rays up to this many cells */
+#define TWO_PI (2.0 * M_PI)
+
+/* Color scale definition flags, IRIS Programmer's Manual, color_scale_def */
+#define CSD_VARIABLE 0x0100		/* Levels come from ilevel_seams */
+#define CSD_TOP_SAT 0x0200		/* Values above top level get top color */
+#define CSD_BOT_SAT 0x0400		/* Values below bottom level get bottom color */
+
+struct SigmetRaw_Ppi {
+    unsigned sz;			/* Image is sz by sz pixels */
+    unsigned num_threads;
+    uint8_t (*rgb)[3];			/* Palette from caller, or NULL for default */
+    unsigned num_rgb;
+
+    /* Lookup table and the geometry it is for */
+    float rng_max, rng0, drng;
+    uint16_t * lut_bin;			/* [sz * sz] Range bin, or NO_BIN */
+    uint16_t * lut_az;			/* [sz * sz] Azimuth cell */
+
+    struct SigmetRaw_PpiSwp swp;	/* Current sweep */
+    uint8_t * pix;			/* [sz * sz] image */
+};
+
+/* Default palette, interpolated to the number of colors in the levels. */
+static const uint8_t dflt_rgb[][3] = {
+    {0, 236, 236}, {1, 160, 246}, {0, 0, 246}, {0, 255, 0}, {0, 200, 0}, {0, 144, 0},
+    {255, 255, 0}, {231, 192, 0}, {255, 144, 0}, {255, 0, 0}, {214, 0, 0}, {192, 0, 0},
+    {255, 0, 255}, {153, 85, 201}, {235, 235, 235}
+};
+#define NUM_DFLT_RGB (sizeof dflt_rgb / sizeof dflt_rgb[0])
+
+/* Set levels from color scale definition csd_p. IRIS gives levels in hundredths of data units.
+ * Return 1/0 on success/failure. */
+int SigmetRaw_PpiLevelsFmCsd(const struct Sigmet_ColorScaleDef * csd_p,
+	struct SigmetRaw_PpiLevels * lvls_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    int n = csd_p->icolcnt;
+    if (csd_p->flags & CSD_VARIABLE) {
+	/* Colors fall between seams, so 16 seams give at most 15 colors. */
+	if (n <= 0 || n > 15) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s: color scale has %d variable levels.", __func__, n);
+	    return 0;
+	}
+	for (int c = 0; c <= n; c++) {
+	    lvls_p->bounds[c] = (int16_t)csd_p->ilevel_seams[c] * 0.01f;
+	}
+    } else {
+	if (n <= 0 || n > SIGMETRAW_PPI_MAX_COLORS || csd_p->istep <= 0) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s: color scale has %d levels with step %d.",
+		    __func__, n, csd_p->istep);
+	    return 0;
+	}
+	SigmetRaw_PpiLevelsFixed(csd_p->istart * 0.01f, csd_p->istep * 0.01f, n, lvls_p);
+    }
+    lvls_p->num_colors = n;
+    lvls_p->bot_sat = (csd_p->flags & CSD_BOT_SAT) != 0;
+    lvls_p->top_sat = (csd_p->flags & CSD_TOP_SAT) != 0;
+    return 1;
+}
+
+/* Set num_colors levels of width step starting at start. Values outside the levels are no
+ * data. */
+void SigmetRaw_PpiLevelsFixed(float start, float step, unsigned num_colors,
+	struct SigmetRaw_PpiLevels * lvls_p)
+{
+    if (num_colors > SIGMETRAW_PPI_MAX_COLORS) {
+	num_colors = SIGMETRAW_PPI_MAX_COLORS;
+    }
+    for (unsigned c = 0; c <= num_colors; c++) {
+	lvls_p->bounds[c] = start + c * step;
+    }
+    lvls_p->num_colors = num_colors;
+    lvls_p->bot_sat = lvls_p->top_sat = 0;
+}
+
+/* Return color index for value v. */
+static uint8_t color(const struct SigmetRaw_PpiLevels * lvls_p, float v)
+{
+    unsigned n = lvls_p->num_colors;
+    if (isnan(v)) {
+	return 0;
+    }
+    if (v < lvls_p->bounds[0]) {
+	return lvls_p->bot_sat ? 1 : 0;
+    }
+    if (v >= lvls_p->bounds[n]) {
+	return lvls_p->top_sat ? n : 0;
+    }
+    unsigned lo = 0, hi = n;		/* bounds[lo] <= v < bounds[hi] */
+    while (hi - lo > 1) {
+	unsigned mid = (lo + hi) / 2;
+	if (v < lvls_p->bounds[mid]) {
+	    hi = mid;
+	} else {
+	    lo = mid;
+	}
+    }
+    return lo + 1;
+}
+
+/* Create renderer for sz by sz pixel images, using num_threads threads, or one per processor if
+ * num_threads is 0. */
+struct SigmetRaw_Ppi * SigmetRaw_PpiInit(unsigned sz, unsigned num_threads,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    if (sz == 0 || sz > 8192) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: image size must be 1 to 8192 pixels, got %u.",
+		__func__, sz);
+	return NULL;
+    }
+    struct SigmetRaw_Ppi * ppi = calloc(1, sizeof *ppi);
+    size_t num_pix = (size_t)sz * sz;
+    if (ppi == NULL
+	    || (ppi->lut_bin = malloc(num_pix * sizeof *ppi->lut_bin)) == NULL
+	    || (ppi->lut_az = malloc(num_pix * sizeof *ppi->lut_az)) == NULL
+	    || (ppi->pix = malloc(num_pix)) == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate %u by %u image.", __func__, sz, sz);
+	SigmetRaw_PpiFree(ppi);
+	return NULL;
+    }
+    ppi->sz = sz;
+    ppi->num_threads = SigmetRaw_NumThreads(num_threads);
+    ppi->rng_max = -1.0f;		/* No lookup table yet */
+    return ppi;
+}
+
+void SigmetRaw_PpiFree(struct SigmetRaw_Ppi * ppi)
+{
+    if (ppi == NULL) {
+	return;
+    }
+    free(ppi->rgb);
+    free(ppi->lut_bin);
+    free(ppi->lut_az);
+    SigmetRaw_PpiSwpFree(&ppi->swp);
+    free(ppi->pix);
+    free(ppi);
+}
+
+/* Use num_rgb colors rgb for color indeces 1 to num_rgb. Color index 0, no data, is
+ * transparent. If rgb is NULL, go back to the default palette. Return 1/0 on success/failure. */
+int SigmetRaw_PpiSetPalette(struct SigmetRaw_Ppi * ppi, const uint8_t (*rgb)[3], unsigned num_rgb,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    free(ppi->rgb);
+    ppi->rgb = NULL;
+    ppi->num_rgb = 0;
+    if (rgb == NULL) {
+	return 1;
+    }
+    if (num_rgb == 0 || num_rgb > SIGMETRAW_PPI_MAX_COLORS) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: palette must have 1 to %d colors, got %u.",
+		__func__, SIGMETRAW_PPI_MAX_COLORS, num_rgb);
+	return 0;
+    }
+    if ((ppi->rgb = calloc(num_rgb, sizeof *ppi->rgb)) == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate palette.", __func__);
+	return 0;
+    }
+    memcpy(ppi->rgb, rgb, num_rgb * sizeof *rgb);
+    ppi->num_rgb = num_rgb;
+    return 1;
+}
+
+/* Return azimuth cell for azimuth az, radians clockwise from north. */
+unsigned SigmetRaw_PpiAzCell(double az)
+{
+    az = fmod(az, TWO_PI);
+    az += (az < 0.0) ? TWO_PI : 0.0;
+    unsigned c = az * (AZ_CELLS / TWO_PI);
+    return (c < AZ_CELLS) ? c : AZ_CELLS - 1;
+}
+
+/* Rebuild lookup table if geometry has changed. */
+static void lut_update(struct SigmetRaw_Ppi * ppi, float rng0, float drng, float rng_max)
+{
+    if (ppi->rng_max == rng_max && ppi->rng0 == rng0 && ppi->drng == drng) {
+	return;
+    }
+    unsigned sz = ppi->sz;
+    double px = 2.0 * rng_max / sz;	/* Pixel size, meters */
+    for (unsigned i = 0; i < sz; i++) {
+	double y = (sz / 2.0 - i - 0.5) * px;
+	for (unsigned j = 0; j < sz; j++) {
+	    double x = (j + 0.5 - sz / 2.0) * px;
+	    size_t p = (size_t)i * sz + j;
+	    double rng = sqrt(x * x + y * y);
+	    double b = floor((rng - rng0) / drng);
+	    ppi->lut_bin[p] = (rng > rng_max || b < 0.0 || b >= NO_BIN) ? NO_BIN : (uint16_t)b;
+	    ppi->lut_az[p] = SigmetRaw_PpiAzCell(atan2(x, y));
+	}
+    }
+    ppi->rng0 = rng0;
+    ppi->drng = drng;
+    ppi->rng_max = rng_max;
+}
+
+/* Map azimuth cells to the rays that cover them. */
+static void az_update(struct SigmetRaw_PpiSwp * swp_p, unsigned num_rays,
+	const struct Sigmet_RayHdr * ray_hdrs, const float * const * dat)
+{
+    double k = AZ_CELLS / TWO_PI;
+    for (unsigned c = 0; c < AZ_CELLS; c++) {
+	swp_p->ray_of_az[c] = -1;
+    }
+    for (unsigned r = 0; r < num_rays; r++) {
+	if (dat[r] == NULL) {
+	    continue;
+	}
+	double a0 = fmod(ray_hdrs[r].az0, TWO_PI), a1 = fmod(ray_hdrs[r].az1, TWO_PI);
+	a0 += (a0 < 0.0) ? TWO_PI : 0.0;
+	a1 += (a1 < 0.0) ? TWO_PI : 0.0;
+	double span = fmod(a1 - a0 + TWO_PI, TWO_PI);
+	if (span > M_PI) {
+	    /* Counterclockwise scan */
+	    double t = a0;
+	    a0 = a1;
+	    a1 = t;
+	    span = TWO_PI - span;
+	}
+	unsigned c0 = a0 * k, n = ceil(span * k);
+	for (unsigned c = 0; c <= n; c++) {
+	    swp_p->ray_of_az[(c0 + c) % AZ_CELLS] = r;
+	}
+    }
+    /* Extend each ray up to MAX_AZ_GAP cells into an empty gap after it. Start at a covered
+     * cell so gaps that wrap through north are handled. */
+    unsigned c0 = 0;
+    while (c0 < AZ_CELLS && swp_p->ray_of_az[c0] == -1) {
+	c0++;
+    }
+    if (c0 == AZ_CELLS) {
+	return;
+    }
+    int prev = swp_p->ray_of_az[c0];
+    unsigned gap = 0;
+    for (unsigned n = 1; n < AZ_CELLS; n++) {
+	int * roa = swp_p->ray_of_az + (c0 + n) % AZ_CELLS;
+	if (*roa != -1) {
+	    prev = *roa;
+	    gap = 0;
+	} else if (++gap <= MAX_AZ_GAP) {
+	    *roa = prev;
+	}
+    }
+}
+
+/* Prepare sweep with num_rays rays, headers ray_hdrs and values dat, with dat[r] NULL for an
+ * empty ray, for drawing with color levels lvls_p. swp_p must be zeroed before first use, and
+ * can be reused for other sweeps. Return 1/0 on success/failure. */
+int SigmetRaw_PpiSwpSet(struct SigmetRaw_PpiSwp * swp_p, const struct SigmetRaw_PpiLevels * lvls_p,
+	unsigned num_rays, const struct Sigmet_RayHdr * ray_hdrs, const float * const * dat,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    unsigned num_bins_max = 0;
+    for (unsigned r = 0; r < num_rays; r++) {
+	if (dat[r] != NULL && ray_hdrs[r].num_bins > (int)num_bins_max) {
+	    num_bins_max = ray_hdrs[r].num_bins;
+	}
+    }
+    size_t cls_sz = (size_t)num_rays * num_bins_max;
+    if (cls_sz > swp_p->cls_sz) {
+	uint8_t * cls = realloc(swp_p->cls, cls_sz);
+	if (cls == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate color indeces for %u rays.",
+		    __func__, num_rays);
+	    return 0;
+	}
+	swp_p->cls = cls;
+	swp_p->cls_sz = cls_sz;
+    }
+    if (num_rays > swp_p->num_rays_max) {
+	int * num_bins = realloc(swp_p->num_bins, num_rays * sizeof *num_bins);
+	if (num_bins == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate bin counts for %u rays.",
+		    __func__, num_rays);
+	    return 0;
+	}
+	swp_p->num_bins = num_bins;
+	swp_p->num_rays_max = num_rays;
+    }
+    az_update(swp_p, num_rays, ray_hdrs, dat);
+    swp_p->num_rays = num_rays;
+    swp_p->num_bins_max = num_bins_max;
+    for (unsigned r = 0; r < num_rays; r++) {
+	int nb = (dat[r] != NULL) ? ray_hdrs[r].num_bins : 0;
+	uint8_t * cls = swp_p->cls + (size_t)r * num_bins_max;
+	swp_p->num_bins[r] = nb;
+	for (int b = 0; b < nb; b++) {
+	    cls[b] = color(lvls_p, dat[r][b]);
+	}
+    }
+    return 1;
+}
+
+void SigmetRaw_PpiSwpFree(struct SigmetRaw_PpiSwp * swp_p)
+{
+    free(swp_p->cls);
+    free(swp_p->num_bins);
+    swp_p->cls = NULL;
+    swp_p->num_bins = NULL;
+    swp_p->cls_sz = 0;
+    swp_p->num_rays = swp_p->num_rays_max = 0;
+}
+
+/* Fill palette pal with no data color followed by num_colors colors. Colors come from num_rgb
+ * colors at rgb, or from the default palette if rgb is NULL. */
+void SigmetRaw_PpiPalette(unsigned num_colors, const uint8_t (*rgb)[3], unsigned num_rgb,
+	uint8_t (*pal)[3])
+{
+    memset(pal[0], 0, sizeof pal[0]);
+    for (unsigned c = 1; c <= num_colors; c++) {
+	if (rgb != NULL) {
+	    memcpy(pal[c], rgb[((c <= num_rgb) ? c : num_rgb) - 1], sizeof pal[c]);
+	} else {
+	    double f = (num_colors > 1) ? (c - 1.0) / (num_colors - 1.0) * (NUM_DFLT_RGB - 1) : 0;
+	    unsigned i = f;
+	    unsigned i1 = (i + 1 < NUM_DFLT_RGB) ? i + 1 : i;
+	    for (int k = 0; k < 3; k++) {
+		pal[c][k] = lround(dflt_rgb[i][k] + (f - i) * (dflt_rgb[i1][k] - dflt_rgb[i][k]));
+	    }
+	}
+    }
+}
+
+static void * rows_thread(void * arg)
+{
+    struct SigmetRaw_Rows * rows = arg;
+    struct SigmetRaw_Ppi * ppi = rows->arg;
+    size_t p0 = (size_t)rows->i0 * ppi->sz, p1 = (size_t)rows->i1 * ppi->sz;
+    for (size_t p = p0; p < p1; p++) {
+	ppi->pix[p] = SigmetRaw_PpiSwpColor(&ppi->swp, ppi->lut_az[p], ppi->lut_bin[p]);
+    }
+    return NULL;
+}
+
+/* Render sweep with num_rays rays, headers ray_hdrs and values dat, with dat[r] NULL for an
+ * empty ray, using color levels lvls_p. Range to first bin is rng0, bin step is drng, and the
+ * image extends rng_max from the radar, all in meters. Put PNG in a buffer from malloc at
+ * *png_p, which caller must free, and its size at *png_sz_p. Return 1/0 on success/failure. */
+int SigmetRaw_PpiRender(struct SigmetRaw_Ppi * ppi, const struct SigmetRaw_PpiLevels * lvls_p,
+	float rng0, float drng, float rng_max, unsigned num_rays,
+	const struct Sigmet_RayHdr * ray_hdrs, const float * const * dat,
+	void ** png_p, size_t * png_sz_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    if ( !(drng > 0.0f && rng_max > 0.0f) ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: invalid range geometry, bin step %g, maximum range %g.",
+		__func__, drng, rng_max);
+	return 0;
+    }
+    lut_update(ppi, rng0, drng, rng_max);
+    if ( !SigmetRaw_PpiSwpSet(&ppi->swp, lvls_p, num_rays, ray_hdrs, dat, err_msg_p) ) {
+	return 0;
+    }
+
+    SigmetRaw_RowsRun(ppi->num_threads, ppi->sz, rows_thread, ppi);
+
+    uint8_t pal[SIGMETRAW_PPI_MAX_COLORS + 1][3];
+    SigmetRaw_PpiPalette(lvls_p->num_colors, (const uint8_t (*)[3])ppi->rgb, ppi->num_rgb, pal);
+    return SigmetRaw_PngPalette(ppi->sz, ppi->sz, ppi->pix, (const uint8_t (*)[3])pal,
+	    lvls_p->num_colors + 1, 0, ppi->num_threads, png_p, png_sz_p, err_msg_p);
+}
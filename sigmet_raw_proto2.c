@@ -0,0 +1,275 @@
+/*
+ *	sigmet_raw_proto2.c --
+ *		Version 2 of the client-daemon protocol.
+ *	--
+ *
+ *	Version 1 sends a fixed size request with two descriptors, a shared output descriptor and
+ *	an error pipe, substituting /dev/null when the client has none. The client reads errors with
+ *	fgetc from the error pipe, and metadata results from another pipe. A metadata request
+ *	therefore costs several pipe, fdopen, open, and close calls besides the request itself.
+ *
+ *	Version 2 frames each message with a header that gives its length:
+ *	    Request:  struct SigmetRaw_Rqst2Hdr, data type abbreviation, expression.
+ *		      A descriptor travels with the request only if the client wants output
+ *		      streamed to it, e.g. data for standard output.
+ *	    Response: struct SigmetRaw_Rps2Hdr, error message, inline result.
+ *		      Errors and small results, such as volume headers, come back in the
+ *		      response, so a metadata request is one sendmsg and a few reads.
+ *
+ *	Every response carries the generation of the daemon's volume, so a client can tell whether
+ *	metadata it cached from an earlier response, e.g. ray headers, still applies. The daemon
+ *	sends ray headers inline for a SigmetRawRayHeaders request that has no descriptor. A data
+ *	request that selects a sweep pyramid level gets a regular grid of values, with dimensions
+ *	in the num_rays and num_swp_bins members of the response.
+ *
+ *	Requests start with SIGMETRAW_PROTO2_MAGIC, which is never a valid version 1 subcommand
+ *	number, so a daemon can accept both versions on the same socket. Responses start with it
+ *	too, so a client can tell whether a daemon speaks version 2 before relying on it. See
+ *	SigmetRaw_DmnProto.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+/* Read exactly n bytes from fd into buf. Return 1/0 on success/failure. */
+static int read_full(int fd, void * buf, size_t n)
+{
+    char * b = buf;
+    while (n > 0) {
+	ssize_t r = read(fd, b, n);
+	if (r == -1 && errno == EINTR) {
+	    continue;
+	}
+	if (r <= 0) {
+	    return 0;
+	}
+	b += r;
+	n -= r;
+    }
+    return 1;
+}
+
+/* Send all of msg to skt_fd, resending after partial writes. Return 1/0 on success/failure. */
+static int sendmsg_full(int skt_fd, struct msghdr * msg)
+{
+    while (msg->msg_iovlen > 0) {
+	ssize_t w = sendmsg(skt_fd, msg, MSG_NOSIGNAL);
+	if (w == -1 && errno == EINTR) {
+	    continue;
+	}
+	if (w == -1) {
+	    return 0;
+	}
+	msg->msg_control = NULL;	/* Descriptors went with the first bytes */
+	msg->msg_controllen = 0;
+	while (msg->msg_iovlen > 0 && (size_t)w >= msg->msg_iov->iov_len) {
+	    w -= msg->msg_iov->iov_len;
+	    msg->msg_iov++;
+	    msg->msg_iovlen--;
+	}
+	if (msg->msg_iovlen > 0) {
+	    msg->msg_iov->iov_base = (char *)msg->msg_iov->iov_base + w;
+	    msg->msg_iov->iov_len -= w;
+	}
+    }
+    return 1;
+}
+
+/* Client side. Send request at rqst_p to daemon at skt_fd using protocol version 2. The request
+ * carries rqst_p->hd_fd only if it is not -1. rqst_p->err_fd is not used. Return 1/0 on
+ * success/failure. */
+int SigmetRaw_Rqst2_Send(int skt_fd, const struct SigmetRaw_Rqst * rqst_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    size_t abbrv_len = strnlen(rqst_p->abbrv, SIGMET_DATA_TYPE_LEN - 1);
+    size_t expr_len = strnlen(rqst_p->expr, SIGMETRAW_EXPR_LEN - 1);
+    struct SigmetRaw_Rqst2Hdr hdr = {
+	.magic = SIGMETRAW_PROTO2_MAGIC,
+	.len = abbrv_len + expr_len,
+	.sub_cmd_n = rqst_p->sub_cmd_n,
+	.s = rqst_p->s,
+	.deadline = rqst_p->deadline,
+	.pyr = rqst_p->pyr,
+	.abbrv_len = abbrv_len,
+	.expr_len = expr_len,
+	.stream = rqst_p->hd_fd >= 0
+    };
+    struct iovec iov[3] = {
+	{ .iov_base = &hdr, .iov_len = sizeof hdr },
+	{ .iov_base = (void *)rqst_p->abbrv, .iov_len = abbrv_len },
+	{ .iov_base = (void *)rqst_p->expr, .iov_len = expr_len }
+    };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 3 };
+    union {
+	char buf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr align;
+    } cmsgbuf = {0};
+    if (hdr.stream) {
+	msg.msg_control = cmsgbuf.buf;
+	msg.msg_controllen = sizeof cmsgbuf.buf;
+	struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &rqst_p->hd_fd, sizeof(int));
+    }
+    if ( !sendmsg_full(skt_fd, &msg) ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s failed to send message to daemon. %s.",
+		__func__, strerror(errno));
+	return 0;
+    }
+    return 1;
+}
+
+/* Client side. Receive response from daemon at skt_fd into rps_p. If the response has an inline
+ * result, put it in a buffer from malloc at *dat_p, which caller must free, and its size in
+ * *dat_sz_p. Otherwise *dat_p is NULL. Return 1 if daemon reports success. Otherwise, return 0
+ * with the daemon's error message, or a description of the transfer failure, in err_msg_p. */
+int SigmetRaw_Rps2_Recv(int skt_fd, struct SigmetRaw_Rps2Hdr * rps_p, void ** dat_p,
+	size_t * dat_sz_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    *dat_p = NULL;
+    *dat_sz_p = 0;
+    if ( !read_full(skt_fd, rps_p, sizeof *rps_p) ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not get response from daemon.", __func__);
+	return 0;
+    }
+    if (rps_p->magic != SIGMETRAW_PROTO2_MAGIC) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: daemon does not speak protocol version 2.", __func__);
+	return 0;
+    }
+    if (rps_p->err_len > SIGMET_ERR_LEN || rps_p->dat_len > SIGMETRAW_INLINE_MAX) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: daemon sent corrupt response.", __func__);
+	return 0;
+    }
+    char err_str[SIGMET_ERR_LEN + 1];
+    if ( !read_full(skt_fd, err_str, rps_p->err_len) ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not get error message from daemon.", __func__);
+	return 0;
+    }
+    err_str[rps_p->err_len] = '\0';
+    if (rps_p->dat_len > 0) {
+	if ((*dat_p = malloc(rps_p->dat_len)) == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate %u bytes for response.",
+		    __func__, rps_p->dat_len);
+	    return 0;
+	}
+	if ( !read_full(skt_fd, *dat_p, rps_p->dat_len) ) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s: could not get result from daemon.", __func__);
+	    free(*dat_p);
+	    *dat_p = NULL;
+	    return 0;
+	}
+	*dat_sz_p = rps_p->dat_len;
+    }
+    if (rps_p->status != SigmetRawOkay) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s", err_str);
+	return 0;
+    }
+    return 1;
+}
+
+/* Daemon side. Receive version 2 request from client at skt_fd into rqst_p. Caller should
+ * identify the version by peeking at the first four bytes with recv(..., MSG_PEEK), because a
+ * plain read would discard the descriptor that arrives with them. If the request carries a
+ * descriptor, put it in rqst_p->hd_fd, otherwise set that to -1. rqst_p->err_fd is always -1,
+ * errors go back in the response. Return 1/0 on success/failure. */
+int SigmetRaw_Rqst2_Recv(int skt_fd, struct SigmetRaw_Rqst * rqst_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct SigmetRaw_Rqst2Hdr hdr;
+    size_t rem = sizeof hdr;
+    union {
+	char buf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr align;
+    } cmsgbuf = {0};
+    struct msghdr msg = {
+	.msg_iov = (struct iovec [1]){
+	    { .iov_base = &hdr, .iov_len = rem }
+	},
+	.msg_iovlen = 1,
+	.msg_control = cmsgbuf.buf,
+	.msg_controllen = sizeof cmsgbuf.buf
+    };
+    ssize_t r;
+    while ((r = recvmsg(skt_fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR) {
+	continue;
+    }
+    if (r != (ssize_t)rem) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not read request header.", __func__);
+	return 0;
+    }
+    *rqst_p = SigmetRaw_Rqst_Init();
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+	memcpy(&rqst_p->hd_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    if (hdr.magic != SIGMETRAW_PROTO2_MAGIC
+	    || hdr.abbrv_len >= SIGMET_DATA_TYPE_LEN || hdr.expr_len >= SIGMETRAW_EXPR_LEN
+	    || hdr.len != (uint32_t)hdr.abbrv_len + hdr.expr_len
+	    || hdr.pyr.lvl < 0 || hdr.pyr.lvl > SIGMETRAW_PYR_MAX_LVL
+	    || (hdr.pyr.mode != SigmetRawPyrMean && hdr.pyr.mode != SigmetRawPyrMax)
+	    || (_Bool)hdr.stream != (rqst_p->hd_fd != -1)) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: corrupt request.", __func__);
+	if (rqst_p->hd_fd != -1) {
+	    close(rqst_p->hd_fd);
+	}
+	return 0;
+    }
+    rqst_p->sub_cmd_n = hdr.sub_cmd_n;
+    rqst_p->s = hdr.s;
+    rqst_p->deadline = hdr.deadline;
+    rqst_p->pyr = hdr.pyr;
+    if ( !read_full(skt_fd, rqst_p->abbrv, hdr.abbrv_len)
+	    || !read_full(skt_fd, rqst_p->expr, hdr.expr_len) ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not read request.", __func__);
+	if (rqst_p->hd_fd != -1) {
+	    close(rqst_p->hd_fd);
+	}
+	return 0;
+    }
+    return 1;
+}
+
+/* Daemon side. Send response rps_p to client at skt_fd, with error message err_str, which may be
+ * NULL, and dat_len bytes of inline result at dat. Fill in rps_p->err_len and rps_p->dat_len.
+ * Return 1/0 on success/failure. */
+int SigmetRaw_Rps2_Send(int skt_fd, struct SigmetRaw_Rps2Hdr * rps_p, const char * err_str,
+	const void * dat, size_t dat_len, struct Sigmet_ErrMsg * err_msg_p)
+{
+    size_t err_len = err_str ? strnlen(err_str, SIGMET_ERR_LEN) : 0;
+    if (dat_len > SIGMETRAW_INLINE_MAX) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: result of %zu bytes is too large to send inline.",
+		__func__, dat_len);
+	return 0;
+    }
+    rps_p->magic = SIGMETRAW_PROTO2_MAGIC;
+    rps_p->err_len = err_len;
+    rps_p->dat_len = dat_len;
+    struct iovec iov[3] = {
+	{ .iov_base = rps_p, .iov_len = sizeof *rps_p },
+	{ .iov_base = (void *)err_str, .iov_len = err_len },
+	{ .iov_base = (void *)dat, .iov_len = dat_len }
+    };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 3 };
+    if ( !sendmsg_full(skt_fd, &msg) ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s failed to send response to client. %s.",
+		__func__, strerror(errno));
+	return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,261 @@
+/*
+ *	sigmet_raw_pyr.c --
+ *		Multi-resolution sweep pyramids.
+ *	--
+ *
+ *	Level 0 of a pyramid is a sweep on a regular grid of num_rays rays by num_bins bins, with
+ *	NAN for missing values and past the end of short rays. Each level above halves the ray and
+ *	bin counts, rounding up, by combining blocks of 2 rays by 2 bins into one cell, so level l
+ *	has about 1/4^l of the values. Cells get the mean or the maximum of the values present in
+ *	the block. Means are weighted by the number of level 0 values behind each cell, so every
+ *	level has the mean of the level 0 values it covers, and a cell is NAN only if all of them
+ *	are.
+ *
+ *	A pyramid cache, for daemons, keeps levels for recently requested sweeps, keyed by volume
+ *	generation, sweep, data type or expression, and mode. Levels are built on demand, from the
+ *	highest level already in the cache, or from level 0 if the sweep is not in the cache. The
+ *	cache is not thread safe.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define MAX_LVL SIGMETRAW_PYR_MAX_LVL
+
+static inline float max2(float a, float b)
+{
+    return isnan(a) ? b : (isnan(b) || a > b) ? a : b;
+}
+
+/* Put level above the num_rays by num_bins grid at src into dst, which must have space for
+ * SigmetRaw_PyrHalf(num_rays) by SigmetRaw_PyrHalf(num_bins) values. For SigmetRawPyrMean, src_wt
+ * gives the weight of each value at src, or is NULL if each value present has weight 1, and
+ * dst_wt receives the weights of the values at dst, or is NULL if they are not needed. */
+void SigmetRaw_PyrDecimate(unsigned num_rays, unsigned num_bins, const float * src,
+	const float * src_wt, enum SigmetRaw_PyrMode mode, float * dst, float * dst_wt)
+{
+    unsigned nr = SigmetRaw_PyrHalf(num_rays), nb = SigmetRaw_PyrHalf(num_bins);
+    for (unsigned r = 0; r < nr; r++) {
+	/* Rays 2r and 2r + 1, or 2r twice at the end of an odd count, with no weight for the
+	 * second. */
+	const float * s0 = src + (size_t)(2 * r) * num_bins;
+	_Bool two = 2 * r + 1 < num_rays;
+	const float * s1 = two ? s0 + num_bins : s0;
+	float * d = dst + (size_t)r * nb;
+	if (mode == SigmetRawPyrMax) {
+	    for (unsigned b = 0; b < num_bins / 2; b++) {
+		d[b] = max2(max2(s0[2 * b], s0[2 * b + 1]), max2(s1[2 * b], s1[2 * b + 1]));
+	    }
+	    if (num_bins % 2) {
+		d[nb - 1] = max2(s0[num_bins - 1], s1[num_bins - 1]);
+	    }
+	    continue;
+	}
+	const float * w0 = src_wt ? src_wt + (size_t)(2 * r) * num_bins : NULL;
+	const float * w1 = src_wt ? (two ? w0 + num_bins : w0) : NULL;
+	float * dw = dst_wt ? dst_wt + (size_t)r * nb : NULL;
+	for (unsigned b = 0; b < nb; b++) {
+	    float sum = 0.0f, w = 0.0f;
+	    for (unsigned k = 0; k < (two ? 2u : 1u); k++) {
+		const float * s = k ? s1 : s0;
+		const float * sw = k ? w1 : w0;
+		for (unsigned bb = 2 * b; bb < 2 * b + 2 && bb < num_bins; bb++) {
+		    if ( !isnan(s[bb]) ) {
+			float wt = sw ? sw[bb] : 1.0f;
+			sum += wt * s[bb];
+			w += wt;
+		    }
+		}
+	    }
+	    d[b] = (w > 0.0f) ? sum / w : NAN;
+	    if (dw) {
+		dw[b] = w;
+	    }
+	}
+    }
+}
+
+/* Pyramid cache */
+struct ent {
+    uint64_t gen;
+    char key[SIGMETRAW_EXPR_LEN];	/* Data type abbreviation or expression */
+    int s;
+    enum SigmetRaw_PyrMode mode;
+    unsigned num_rays[MAX_LVL + 1], num_bins[MAX_LVL + 1];
+    float * lvls[MAX_LVL + 1];		/* Level values, or NULL. lvls[0] is not kept. */
+    float * wts[MAX_LVL + 1];		/* Weights for SigmetRawPyrMean */
+    unsigned top;			/* Highest level built, 0 => entry is empty */
+    unsigned long used;
+};
+
+struct SigmetRaw_PyrCache {
+    unsigned num_ents;
+    unsigned long use_count;
+    struct ent ents[];
+};
+
+/* Return cache with space for num_ents pyramids, or NULL on failure. */
+struct SigmetRaw_PyrCache * SigmetRaw_PyrCacheInit(unsigned num_ents,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    if (num_ents == 0) {
+	num_ents = 1;
+    }
+    struct SigmetRaw_PyrCache * cache = calloc(1, sizeof *cache + num_ents * sizeof cache->ents[0]);
+    if (cache == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate pyramid cache for %u sweeps.",
+		__func__, num_ents);
+	return NULL;
+    }
+    cache->num_ents = num_ents;
+    return cache;
+}
+
+static void ent_clear(struct ent * ent)
+{
+    for (unsigned l = 0; l <= MAX_LVL; l++) {
+	free(ent->lvls[l]);
+	free(ent->wts[l]);
+    }
+    memset(ent, 0, sizeof *ent);
+}
+
+void SigmetRaw_PyrCacheFree(struct SigmetRaw_PyrCache * cache)
+{
+    if (cache == NULL) {
+	return;
+    }
+    for (unsigned e = 0; e < cache->num_ents; e++) {
+	ent_clear(cache->ents + e);
+    }
+    free(cache);
+}
+
+/* Build levels above ent->top up to lvl, from src, with weights src_wt, at level ent->top.
+ * Return 1/0 on success/failure. */
+static int ent_build(struct ent * ent, const float * src, const float * src_wt, unsigned lvl,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    for (unsigned l = ent->top + 1; l <= lvl; l++) {
+	unsigned nr = SigmetRaw_PyrHalf(ent->num_rays[l - 1]);
+	unsigned nb = SigmetRaw_PyrHalf(ent->num_bins[l - 1]);
+	size_t n = (size_t)nr * nb;
+	ent->lvls[l] = malloc(n * sizeof *ent->lvls[l]);
+	if (ent->mode == SigmetRawPyrMean) {
+	    ent->wts[l] = malloc(n * sizeof *ent->wts[l]);
+	}
+	if (ent->lvls[l] == NULL || (ent->mode == SigmetRawPyrMean && ent->wts[l] == NULL)) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate pyramid level %u, %u rays by "
+		    "%u bins.", __func__, l, nr, nb);
+	    free(ent->lvls[l]);
+	    free(ent->wts[l]);
+	    ent->lvls[l] = ent->wts[l] = NULL;
+	    return 0;
+	}
+	SigmetRaw_PyrDecimate(ent->num_rays[l - 1], ent->num_bins[l - 1], src, src_wt,
+		ent->mode, ent->lvls[l], ent->wts[l]);
+	ent->num_rays[l] = nr;
+	ent->num_bins[l] = nb;
+	ent->top = l;
+	src = ent->lvls[l];
+	src_wt = ent->wts[l];
+    }
+    return 1;
+}
+
+/* Look for the entry for generation gen, sweep s, data type or expression key, mode mode.
+ * Unless gen is 0, discard entries from other generations. Return the entry, or NULL, with least
+ * recently used entry at *lru_p. Generation 0 never matches. */
+static struct ent * ent_find(struct SigmetRaw_PyrCache * cache, uint64_t gen, int s,
+	const char * key, enum SigmetRaw_PyrMode mode, struct ent ** lru_p)
+{
+    struct ent * lru = cache->ents;
+    for (struct ent * ent = cache->ents; ent < cache->ents + cache->num_ents; ent++) {
+	if (gen != 0 && ent->top > 0 && ent->gen != gen) {
+	    ent_clear(ent);			/* Volume has changed */
+	}
+	if (gen != 0 && ent->top > 0 && ent->gen == gen && ent->s == s && ent->mode == mode
+		&& strncmp(ent->key, key, sizeof ent->key) == 0) {
+	    return ent;
+	}
+	if (ent->used < lru->used) {
+	    lru = ent;
+	}
+    }
+    *lru_p = lru;
+    return NULL;
+}
+
+/* Return level lvl of the pyramid for volume generation gen, sweep s, data type or expression
+ * key, mode mode, with dimensions at *num_rays_p, *num_bins_p, if the cache has it or a level
+ * below it. Otherwise return NULL, and the caller should use SigmetRaw_PyrCacheBuild. Return
+ * NULL with a message at err_msg_p if building the level fails. The values belong to the cache,
+ * and are valid until the next call with this cache. */
+const float * SigmetRaw_PyrCacheGet(struct SigmetRaw_PyrCache * cache, uint64_t gen, int s,
+	const char * key, enum SigmetRaw_PyrMode mode, unsigned lvl, unsigned * num_rays_p,
+	unsigned * num_bins_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    if (gen == 0 || lvl == 0 || lvl > MAX_LVL) {
+	return NULL;
+    }
+    struct ent * lru;
+    struct ent * ent = ent_find(cache, gen, s, key, mode, &lru);
+    if (ent == NULL) {
+	return NULL;
+    }
+    unsigned top = ent->top;
+    if (lvl > top && !ent_build(ent, ent->lvls[top], ent->wts[top], lvl, err_msg_p)) {
+	return NULL;
+    }
+    ent->used = ++cache->use_count;
+    *num_rays_p = ent->num_rays[lvl];
+    *num_bins_p = ent->num_bins[lvl];
+    return ent->lvls[lvl];
+}
+
+/* Build levels up to lvl of the pyramid for volume generation gen, sweep s, data type or
+ * expression key, mode mode, from num_rays by num_bins level 0 values at dat, and return level
+ * lvl as for SigmetRaw_PyrCacheGet. Generation 0 is never cached, so the caller should copy the
+ * values before the next call. Return NULL on failure. */
+const float * SigmetRaw_PyrCacheBuild(struct SigmetRaw_PyrCache * cache, uint64_t gen, int s,
+	const char * key, enum SigmetRaw_PyrMode mode, unsigned num_rays, unsigned num_bins,
+	const float * dat, unsigned lvl, unsigned * num_rays_p, unsigned * num_bins_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    if (lvl == 0 || lvl > MAX_LVL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: pyramid level must be 1 to %d, got %u.",
+		__func__, MAX_LVL, lvl);
+	return NULL;
+    }
+    struct ent * lru;
+    struct ent * ent = ent_find(cache, gen, s, key, mode, &lru);
+    if (ent == NULL) {
+	ent = lru;
+    }
+    ent_clear(ent);
+    ent->gen = gen;
+    snprintf(ent->key, sizeof ent->key, "%s", key);
+    ent->s = s;
+    ent->mode = mode;
+    ent->num_rays[0] = num_rays;
+    ent->num_bins[0] = num_bins;
+    if ( !ent_build(ent, dat, NULL, lvl, err_msg_p) ) {
+	ent_clear(ent);
+	return NULL;
+    }
+    ent->used = (gen == 0) ? 0 : ++cache->use_count;	/* Generation 0 goes first next time */
+    *num_rays_p = ent->num_rays[lvl];
+    *num_bins_p = ent->num_bins[lvl];
+    return ent->lvls[lvl];
+}
@@ -0,0 +1,186 @@
+/*
+ *	sigmet_raw_recs.c --
+ *		Locate and copy raw records of a Sigmet raw product file.
+ *	--
+ *
+ *	A raw product file is a sequence of SIGMETRAW_REC_LEN byte records. The first two records
+ *	are the product_hdr and ingest_header. Each later record starts with a raw_prod_bhdr, which
+ *	gives the 1 based sweep number at byte 2. Records for a sweep are contiguous, so a sweep
+ *	maps to one byte range, which can be copied to another descriptor without decoding it.
+ *
+ *	SigmetRaw_RecSend copies with sendfile or splice, so the bytes go from the page cache to the
+ *	destination without passing through this process.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define REC_LEN SIGMETRAW_REC_LEN
+#define NUM_HDR_RECS 2
+
+/* Return 1 based sweep number from raw_prod_bhdr of record r of file fd, 0 at end of file,
+ * or -1 on error. */
+static int rec_swp(int fd, off_t r, struct Sigmet_ErrMsg * err_msg_p)
+{
+    unsigned char b[4];
+    ssize_t n = pread(fd, b, sizeof b, r * REC_LEN);
+    if (n == 0) {
+	return 0;
+    }
+    if (n != sizeof b) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not read header of record %lld. %s",
+		__func__, (long long)r, (n == -1) ? strerror(errno) : "Short read.");
+	return -1;
+    }
+    return (int16_t)(b[2] | b[3] << 8);
+}
+
+/* Find byte range of raw product file fd that covers sweep s, or the header records if s is
+ * SIGMETRAW_RECS_HDR. Put offset and length in *off_p and *len_p. Sweep records are found with
+ * a binary search on their block headers, so only a few are read. Return 1/0 on
+ * success/failure. */
+int SigmetRaw_RecRange(int fd, int s, off_t * off_p, size_t * len_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not get size of raw product file. %s",
+		__func__, strerror(errno));
+	return 0;
+    }
+    off_t num_recs = st.st_size / REC_LEN;
+    if (num_recs < NUM_HDR_RECS) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: raw product file is too short.", __func__);
+	return 0;
+    }
+    if (s == SIGMETRAW_RECS_HDR) {
+	*off_p = 0;
+	*len_p = NUM_HDR_RECS * REC_LEN;
+	return 1;
+    }
+    if (s < 0) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: invalid sweep index %d.", __func__, s);
+	return 0;
+    }
+    int swp_num = s + 1;
+
+    /* Sweep numbers do not decrease with record index. Find first record with swp_num, then first
+     * record after it with a greater sweep number. */
+    off_t lo = NUM_HDR_RECS, hi = num_recs;
+    while (lo < hi) {
+	off_t mid = lo + (hi - lo) / 2;
+	int n = rec_swp(fd, mid, err_msg_p);
+	if (n == -1) {
+	    return 0;
+	}
+	if (n < swp_num) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    off_t r0 = lo;
+    int n0 = (r0 < num_recs) ? rec_swp(fd, r0, err_msg_p) : 0;
+    if (n0 == -1) {
+	return 0;
+    }
+    if (n0 != swp_num) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: raw product file has no records for sweep %d.",
+		__func__, s);
+	return 0;
+    }
+    hi = num_recs;
+    while (lo < hi) {
+	off_t mid = lo + (hi - lo) / 2;
+	int n = rec_swp(fd, mid, err_msg_p);
+	if (n == -1) {
+	    return 0;
+	}
+	if (n <= swp_num) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    *off_p = r0 * REC_LEN;
+    *len_p = (lo - r0) * REC_LEN;
+    return 1;
+}
+
+/* Copy len bytes starting at offset off of file in_fd to out_fd. Use sendfile, or splice if
+ * out_fd is a pipe and the kernel cannot sendfile to it, falling back to read and write only if
+ * neither works. Return 1/0 on success/failure. */
+int SigmetRaw_RecSend(int out_fd, int in_fd, off_t off, size_t len,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    _Bool use_sendfile = 1, use_splice = 1;
+    while (len > 0) {
+	ssize_t n = -1;
+	if (use_sendfile) {
+	    n = sendfile(out_fd, in_fd, &off, len);
+	    if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {
+		use_sendfile = 0;
+		continue;
+	    }
+	}
+#ifdef SPLICE_F_MOVE
+	else if (use_splice) {
+	    loff_t loff = off;
+	    n = splice(in_fd, &loff, out_fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+	    if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {
+		use_splice = 0;
+		continue;
+	    }
+	    if (n > 0) {
+		off = loff;
+	    }
+	}
+#endif
+	else {
+	    char buf[REC_LEN];
+	    n = pread(in_fd, buf, (len < sizeof buf) ? len : sizeof buf, off);
+	    if (n > 0) {
+		ssize_t w = 0, m = 0;
+		while (w < n && ((m = write(out_fd, buf + w, n - w)) > 0
+			    || (m == -1 && errno == EINTR))) {
+		    w += (m > 0) ? m : 0;
+		}
+		if (w < n) {
+		    n = -1;
+		} else {
+		    off += n;
+		}
+	    }
+	}
+	if (n == -1) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not copy raw records. %s",
+		    __func__, strerror(errno));
+	    return 0;
+	}
+	if (n == 0) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s: raw product file ended early.", __func__);
+	    return 0;
+	}
+	len -= n;
+    }
+    (void)use_splice;
+    return 1;
+}
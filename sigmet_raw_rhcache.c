@@ -0,0 +1,197 @@
+/*
+ *	sigmet_raw_rhcache.c --
+ *		Client side cache of ray headers from sigmet_raw daemons.
+ *	--
+ *
+ *	A client that prints sweep data as text needs the bin count of each ray, which comes from
+ *	the ray headers. Ray headers only change when the daemon's volume changes, so a client that
+ *	asks for the same sweeps again and again, e.g. a viewer redrawing, can keep them.
+ *
+ *	Entries are keyed by daemon socket address, volume generation, data type, and sweep. Every
+ *	protocol version 2 response carries the daemon's volume generation, so the client checks an
+ *	entry against the response to its data request and only goes back to the daemon for ray
+ *	headers when the generation has changed. Seeing a new generation from a daemon discards the
+ *	entries for its older volumes. A daemon should not reuse generations after a restart, e.g.
+ *	it can count from the time it started. Responses with generation 0 are never cached.
+ *
+ *	The cache is not thread safe. A pointer from SigmetRaw_RhCacheGet is valid until the next
+ *	call to SigmetRaw_RhCacheGet or SigmetRaw_RhCacheFree with the same cache.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+/* Daemon identity */
+struct dmn {
+    char path[sizeof ((struct sockaddr_un *)NULL)->sun_path];
+};
+
+struct ent {
+    struct dmn dmn;
+    uint64_t gen;
+    char abbrv[SIGMET_DATA_TYPE_LEN];
+    int s;
+    unsigned num_rays;
+    struct SigmetRaw_RayHdr * wray_hdrs;	/* NULL => entry is empty */
+    unsigned long used;			/* Value of use counter at last use */
+};
+
+struct SigmetRaw_RhCache {
+    unsigned num_ents;
+    unsigned long use_count;
+    struct ent ents[];
+};
+
+/* Return cache with space for num_ents sweeps of ray headers, or NULL on failure. */
+struct SigmetRaw_RhCache * SigmetRaw_RhCacheInit(unsigned num_ents,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    if (num_ents == 0) {
+	num_ents = 1;
+    }
+    struct SigmetRaw_RhCache * cache = calloc(1, sizeof *cache + num_ents * sizeof cache->ents[0]);
+    if (cache == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate ray header cache for %u sweeps.",
+		__func__, num_ents);
+	return NULL;
+    }
+    cache->num_ents = num_ents;
+    return cache;
+}
+
+static void ent_clear(struct ent * ent)
+{
+    free(ent->wray_hdrs);
+    memset(ent, 0, sizeof *ent);
+}
+
+void SigmetRaw_RhCacheFree(struct SigmetRaw_RhCache * cache)
+{
+    if (cache == NULL) {
+	return;
+    }
+    for (unsigned e = 0; e < cache->num_ents; e++) {
+	ent_clear(cache->ents + e);
+    }
+    free(cache);
+}
+
+/* Identify daemon at other end of connection skt_fd. Return 1/0 on success/failure. */
+static int dmn_id(int skt_fd, struct dmn * dmn_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct sockaddr_un sa_un = { .sun_family = AF_UNIX, .sun_path = {'\0'} };
+    socklen_t sa_len = sizeof sa_un;
+    if (getpeername(skt_fd, (struct sockaddr *)&sa_un, &sa_len) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not identify daemon. %s.",
+		__func__, strerror(errno));
+	return 0;
+    }
+    memset(dmn_p, 0, sizeof *dmn_p);
+    size_t path_len = (sa_len < sizeof sa_un) ? sa_len - offsetof(struct sockaddr_un, sun_path)
+	: sizeof sa_un.sun_path;
+    memcpy(dmn_p->path, sa_un.sun_path, path_len);
+    return 1;
+}
+
+/* Request ray headers for data type abbrv, sweep s from daemon at skt_fd. Daemon sends them
+ * inline. Put them in a buffer from malloc at *wray_hdrs_p, which caller must free, their count
+ * in *num_rays_p, and generation of the volume they came from in *gen_p. Return 1/0 on
+ * success/failure. */
+static int fetch(int skt_fd, const char * abbrv, int s, struct SigmetRaw_RayHdr ** wray_hdrs_p,
+	unsigned * num_rays_p, uint64_t * gen_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct SigmetRaw_Rqst rqst = SigmetRaw_Rqst_Init();
+    SigmetRaw_Rqst_Set_SubCmd(&rqst, SigmetRawRayHeaders);
+    SigmetRaw_Rqst_Set_DataType(&rqst, abbrv);
+    SigmetRaw_Rqst_Set_Swp(&rqst, s);
+    if ( !SigmetRaw_Rqst2_Send(skt_fd, &rqst, err_msg_p) ) {
+	return 0;
+    }
+    struct SigmetRaw_Rps2Hdr rps;
+    void * dat;
+    size_t dat_sz;
+    if ( !SigmetRaw_Rps2_Recv(skt_fd, &rps, &dat, &dat_sz, err_msg_p) ) {
+	free(dat);
+	return 0;
+    }
+    if (rps.num_rays <= 0 || dat_sz != (size_t)rps.num_rays * sizeof(struct SigmetRaw_RayHdr)) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: daemon sent %zu bytes for %d ray headers.",
+		__func__, dat_sz, rps.num_rays);
+	free(dat);
+	return 0;
+    }
+    *wray_hdrs_p = dat;
+    *num_rays_p = rps.num_rays;
+    *gen_p = rps.gen;
+    return 1;
+}
+
+/* Return ray headers for data type abbrv, sweep s, of volume generation *gen_p of the daemon at
+ * connection skt_fd, with ray count in *num_rays_p. *gen_p should come from the daemon's
+ * response to the request the ray headers describe. If the headers are not cached, request them
+ * from the daemon. The connection must be idle. Return NULL on failure. If the failure is because
+ * the daemon's volume is no longer generation *gen_p, *gen_p gets the new generation, and the
+ * headers for it are cached, so the caller can repeat its request and try again. */
+const struct SigmetRaw_RayHdr * SigmetRaw_RhCacheGet(struct SigmetRaw_RhCache * cache,
+	int skt_fd, uint64_t * gen_p, const char * abbrv, int s, unsigned * num_rays_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    uint64_t gen = *gen_p;
+    struct dmn dmn;
+    if ( !dmn_id(skt_fd, &dmn, err_msg_p) ) {
+	return NULL;
+    }
+    struct ent * lru = cache->ents;
+    for (struct ent * ent = cache->ents; ent < cache->ents + cache->num_ents; ent++) {
+	if (ent->wray_hdrs != NULL && memcmp(&ent->dmn, &dmn, sizeof dmn) == 0) {
+	    if (gen != 0 && ent->gen == gen && ent->s == s
+		    && strncmp(ent->abbrv, abbrv, SIGMET_DATA_TYPE_LEN) == 0) {
+		ent->used = ++cache->use_count;
+		*num_rays_p = ent->num_rays;
+		return ent->wray_hdrs;
+	    }
+	    if (ent->gen != gen) {
+		ent_clear(ent);			/* Daemon has moved on to another volume */
+	    }
+	}
+	if (ent->used < lru->used) {
+	    lru = ent;
+	}
+    }
+
+    struct SigmetRaw_RayHdr * wray_hdrs;
+    unsigned num_rays;
+    uint64_t dmn_gen;
+    if ( !fetch(skt_fd, abbrv, s, &wray_hdrs, &num_rays, &dmn_gen, err_msg_p) ) {
+	return NULL;
+    }
+    ent_clear(lru);
+    lru->dmn = dmn;
+    lru->gen = dmn_gen;
+    snprintf(lru->abbrv, sizeof lru->abbrv, "%s", abbrv);
+    lru->s = s;
+    lru->num_rays = num_rays;
+    lru->wray_hdrs = wray_hdrs;
+    lru->used = (dmn_gen == 0) ? 0 : ++cache->use_count;	/* Generation 0 goes first next time */
+    if (dmn_gen != gen) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: daemon volume changed during request.", __func__);
+	*gen_p = dmn_gen;
+	return NULL;
+    }
+    *num_rays_p = num_rays;
+    return wray_hdrs;
+}
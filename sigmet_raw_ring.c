@@ -0,0 +1,167 @@
+/*
+ *	sigmet_raw_ring.c --
+ *		Broadcast ring buffer for ray subscription streams.
+ *	--
+ *
+ *	One producer appends frames. Any number of consumers read them, each with its own cursor,
+ *	so the daemon decodes each ray once and every subscriber copies it out of the same ring.
+ *	The producer never waits for consumers. A consumer that falls more than the ring capacity
+ *	behind loses the oldest frames, and SigmetRaw_RingRead reports how many bytes it skipped.
+ *
+ *	The ring contains no pointers, so it may live in memory shared between processes.
+ *	Positions are byte counts since the ring was initialized. They only increase, so
+ *	position % capacity is the offset in the ring.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+struct SigmetRaw_Ring {
+    size_t cap;				/* Bytes in buf */
+    _Atomic uint64_t head;		/* Position after last complete frame */
+    _Atomic uint64_t tail;		/* Start of oldest frame not overwritten */
+    char buf[];
+};
+
+/* Frame prefix in ring */
+struct ring_frame_hdr {
+    uint32_t len;			/* Bytes in frame, not including this header */
+};
+
+/* Return bytes of memory needed for ring with capacity cap. */
+size_t SigmetRaw_RingSz(size_t cap)
+{
+    return sizeof(struct SigmetRaw_Ring) + cap;
+}
+
+/* Initialize ring with capacity cap in memory at mem, which must have SigmetRaw_RingSz(cap)
+ * bytes, suitably aligned. Return the ring. */
+struct SigmetRaw_Ring * SigmetRaw_RingInit(void * mem, size_t cap)
+{
+    struct SigmetRaw_Ring * ring = mem;
+    ring->cap = cap;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return ring;
+}
+
+/* Return position of next frame to be written. New consumers start here. */
+uint64_t SigmetRaw_RingHead(struct SigmetRaw_Ring * ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+static void ring_put(struct SigmetRaw_Ring * ring, uint64_t pos, const void * src, size_t n)
+{
+    size_t off = pos % ring->cap;
+    size_t n0 = (n < ring->cap - off) ? n : ring->cap - off;
+    memcpy(ring->buf + off, src, n0);
+    memcpy(ring->buf, (const char *)src + n0, n - n0);
+}
+
+static void ring_get(const struct SigmetRaw_Ring * ring, uint64_t pos, void * dest, size_t n)
+{
+    size_t off = pos % ring->cap;
+    size_t n0 = (n < ring->cap - off) ? n : ring->cap - off;
+    memcpy(dest, ring->buf + off, n0);
+    memcpy((char *)dest + n0, ring->buf, n - n0);
+}
+
+/* Append frame made of num_parts pieces, parts[i] with part_len[i] bytes. Only one thread may
+ * write. Return 1/0 on success/failure. Fail only if the frame is larger than the ring. */
+int SigmetRaw_RingWrite(struct SigmetRaw_Ring * ring, unsigned num_parts, const void * parts[],
+	const size_t part_len[])
+{
+    struct ring_frame_hdr fhdr = { .len = 0 };
+    for (unsigned i = 0; i < num_parts; i++) {
+	fhdr.len += part_len[i];
+    }
+    size_t n = sizeof fhdr + fhdr.len;
+    if (n > ring->cap) {
+	return 0;
+    }
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    /* Announce which bytes are about to be overwritten before touching them, so readers can
+     * tell whether a frame they copied was intact. */
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (head + n - tail > ring->cap) {
+	/* Drop oldest frames until the new one fits. tail stays on a frame boundary. */
+	while (head + n - tail > ring->cap) {
+	    struct ring_frame_hdr old;
+	    ring_get(ring, tail, &old, sizeof old);
+	    tail += sizeof old + old.len;
+	}
+	atomic_store_explicit(&ring->tail, tail, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+    }
+    uint64_t pos = head;
+    ring_put(ring, pos, &fhdr, sizeof fhdr);
+    pos += sizeof fhdr;
+    for (unsigned i = 0; i < num_parts; i++) {
+	ring_put(ring, pos, parts[i], part_len[i]);
+	pos += part_len[i];
+    }
+    atomic_store_explicit(&ring->head, pos, memory_order_release);
+    return 1;
+}
+
+/* Copy next frame at or after position *pos_p into dest, which has space for dest_sz bytes.
+ * Return frame length, 0 if no new frame is available, or -1 if the frame does not fit in dest.
+ * On return, *pos_p is the position of the next frame. If the consumer had fallen behind, or the
+ * frame header at *pos_p is corrupt, *lost_p gets the number of bytes skipped, otherwise 0. */
+long SigmetRaw_RingRead(struct SigmetRaw_Ring * ring, uint64_t * pos_p, void * dest, size_t dest_sz,
+	uint64_t * lost_p)
+{
+    *lost_p = 0;
+    for (;;) {
+	uint64_t pos = *pos_p;
+	uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	if (pos >= head) {
+	    return 0;
+	}
+	uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (pos < tail) {
+	    /* Overrun. Resume at the oldest intact frame. */
+	    *lost_p += tail - pos;
+	    *pos_p = tail;
+	    continue;
+	}
+	struct ring_frame_hdr fhdr;
+	ring_get(ring, pos, &fhdr, sizeof fhdr);
+	if (fhdr.len > ring->cap - sizeof fhdr || pos + sizeof fhdr + fhdr.len > head) {
+	    atomic_thread_fence(memory_order_acquire);
+	    if (atomic_load_explicit(&ring->tail, memory_order_relaxed) > pos) {
+		continue;		/* Header was overwritten while reading it */
+	    }
+	    /* Length is impossible, so the frame boundary is lost. Skip to head. */
+	    *lost_p += head - pos;
+	    *pos_p = head;
+	    return 0;
+	}
+	if (fhdr.len > dest_sz) {
+	    atomic_thread_fence(memory_order_acquire);
+	    if (atomic_load_explicit(&ring->tail, memory_order_relaxed) > pos) {
+		continue;		/* Header was overwritten while reading it */
+	    }
+	    *pos_p = pos + sizeof fhdr + fhdr.len;
+	    return -1;
+	}
+	ring_get(ring, pos + sizeof fhdr, dest, fhdr.len);
+	/* Frame is good if producer had not started overwriting it by the time it was copied. */
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&ring->tail, memory_order_relaxed) > pos) {
+	    continue;
+	}
+	*pos_p = pos + sizeof fhdr + fhdr.len;
+	return fhdr.len;
+    }
+}
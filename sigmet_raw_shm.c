@@ -0,0 +1,556 @@
+/*
+ *	sigmet_raw_shm.c --
+ *		Shared memory volume store.
+ *	--
+ *
+ *	Processes on one host that read the same raw product files can share decoded volumes
+ *	without a daemon. The first process to attach a volume decodes it, converts the data to
+ *	floats, and publishes the result as a file in a store directory, normally on tmpfs. Later
+ *	processes map the file read only.
+ *
+ *	Files are named by a hash of the raw product file path, device, inode, size, and
+ *	modification time, so a changed raw product file gets a new entry. A process that finds no
+ *	entry takes an exclusive lock on a lock file for the name, so concurrent processes wait for
+ *	one decoder instead of all decoding. The decoder writes a temporary file and renames it into
+ *	place, so readers only ever see complete entries.
+ *
+ *	Attached processes hold a shared flock on the entry, which the kernel releases if they exit
+ *	or crash, so the lock doubles as a reference count. Attaching also updates the entry
+ *	modification time. When the store exceeds its budget, entries are evicted oldest first,
+ *	skipping any that are attached, detected by failing to get an exclusive lock.
+ *
+ *	Entries are files rather than memfd regions because unrelated processes must be able to
+ *	find them by name.
+ *
+ *	Layout of an entry:
+ *	    struct shm_hdr
+ *	    Serialized volume header, see sigmet_raw_vhdr.c
+ *	    struct Sigmet_SwpHdr [num_swps]
+ *	    struct Sigmet_RayHdr [num_swps][num_rays][num_types]
+ *	    uint64_t [num_swps][num_rays][num_types], offset of each ray in data, in floats, or
+ *		    SHM_NO_RAY
+ *	    float data
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define SHM_VSN 1
+#define SHM_SFX ".srsm"
+#define SHM_NO_RAY UINT64_MAX
+#define SHM_ALIGN 8
+
+static const char magic[4] = {'S', 'R', 'S', 'M'};
+
+struct shm_hdr {
+    char magic[4];			/* "SRSM" */
+    uint32_t vsn;			/* SHM_VSN */
+    uint64_t sz;			/* Bytes in entry */
+    uint64_t src_dev, src_ino, src_sz;	/* Identity of raw product file */
+    int64_t src_mtim_sec, src_mtim_nsec;
+    uint32_t num_swps, num_rays, num_types;
+    uint64_t vhdr_off, swp_hdrs_off, ray_hdrs_off, ray_offs_off, dat_off;
+};
+
+struct SigmetRaw_ShmVol {
+    int fd;				/* Holds shared lock while attached */
+    const char * map;
+    size_t sz;
+    const struct shm_hdr * hdr;
+    struct Sigmet_VolHdr vol_hdr;
+    const struct Sigmet_SwpHdr * swp_hdrs;
+    const struct Sigmet_RayHdr * ray_hdrs;
+    const uint64_t * ray_offs;
+    const float * dat;
+};
+
+static uint64_t align(uint64_t n)
+{
+    return (n + SHM_ALIGN - 1) / SHM_ALIGN * SHM_ALIGN;
+}
+
+static uint64_t fnv1a(uint64_t h, const void * buf, size_t n)
+{
+    const unsigned char * b = buf;
+    for (size_t i = 0; i < n; i++) {
+	h ^= b[i];
+	h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static _Bool same_src(const struct shm_hdr * hdr, const struct stat * st_p)
+{
+    return hdr->src_dev == (uint64_t)st_p->st_dev && hdr->src_ino == (uint64_t)st_p->st_ino
+	&& hdr->src_sz == (uint64_t)st_p->st_size
+	&& hdr->src_mtim_sec == st_p->st_mtim.tv_sec
+	&& hdr->src_mtim_nsec == st_p->st_mtim.tv_nsec;
+}
+
+/* Return true if the sections of the entry with header hdr are in order, aligned, and large
+ * enough for its dimensions, and the entry has sz bytes. */
+static _Bool valid_layout(const struct shm_hdr * hdr, size_t sz)
+{
+    if (hdr->sz != sz || hdr->num_swps > SIGMET_MAX_SWPS
+	    || hdr->num_types > SIGMET_NUM_DATA_TYPES) {
+	return 0;
+    }
+    if (hdr->vhdr_off < sizeof *hdr || hdr->vhdr_off > hdr->swp_hdrs_off
+	    || hdr->swp_hdrs_off > hdr->ray_hdrs_off || hdr->ray_hdrs_off > hdr->ray_offs_off
+	    || hdr->ray_offs_off > hdr->dat_off || hdr->dat_off > sz) {
+	return 0;
+    }
+    if (hdr->swp_hdrs_off % SHM_ALIGN != 0 || hdr->ray_hdrs_off % SHM_ALIGN != 0
+	    || hdr->ray_offs_off % SHM_ALIGN != 0 || hdr->dat_off % SHM_ALIGN != 0) {
+	return 0;
+    }
+    /* Bound the ray count by the entry size before multiplying. */
+    size_t num_st = (size_t)hdr->num_swps * hdr->num_types;
+    if (num_st > 0 && hdr->num_rays > sz / sizeof(struct Sigmet_RayHdr) / num_st) {
+	return 0;
+    }
+    size_t num_rays_tot = num_st * hdr->num_rays;
+    return hdr->num_swps * sizeof(struct Sigmet_SwpHdr) <= hdr->ray_hdrs_off - hdr->swp_hdrs_off
+	&& num_rays_tot * sizeof(struct Sigmet_RayHdr) <= hdr->ray_offs_off - hdr->ray_hdrs_off
+	&& num_rays_tot * sizeof(uint64_t) <= hdr->dat_off - hdr->ray_offs_off;
+}
+
+/* Map entry at fd, which must have a shared lock, into vol. Check that it is an intact entry for
+ * raw product file with status st_p. Return 1/0 on success/failure. */
+static int map_ent(int fd, const struct stat * st_p, struct SigmetRaw_ShmVol * vol,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct stat ent_st;
+    if (fstat(fd, &ent_st) == -1 || (size_t)ent_st.st_size < sizeof(struct shm_hdr)) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: volume store entry is missing or truncated.", __func__);
+	return 0;
+    }
+    vol->sz = ent_st.st_size;
+    void * map = mmap(NULL, vol->sz, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not map volume store entry. %s",
+		__func__, strerror(errno));
+	return 0;
+    }
+    vol->map = map;
+    vol->hdr = map;
+    const struct shm_hdr * hdr = vol->hdr;
+    if (memcmp(hdr->magic, magic, sizeof magic) != 0 || hdr->vsn != SHM_VSN
+	    || !same_src(hdr, st_p)) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: volume store entry does not match raw product file.",
+		__func__);
+	munmap(map, vol->sz);
+	return 0;
+    }
+    if ( !valid_layout(hdr, vol->sz) ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: volume store entry is corrupt.", __func__);
+	munmap(map, vol->sz);
+	return 0;
+    }
+    if ( !SigmetRaw_VolHdrDeser(vol->map + hdr->vhdr_off, hdr->swp_hdrs_off - hdr->vhdr_off,
+		&vol->vol_hdr, err_msg_p) ) {
+	munmap(map, vol->sz);
+	return 0;
+    }
+    /* Readers index the entry with the counts from the volume header, so they must match the
+     * layout. */
+    if (Sigmet_VolNumTypes(&vol->vol_hdr) != hdr->num_types
+	    || Sigmet_VolNumSwps(&vol->vol_hdr) != hdr->num_swps
+	    || Sigmet_VolNumRays(&vol->vol_hdr) != hdr->num_rays) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: volume store entry layout does not match its volume "
+		"header.", __func__);
+	munmap(map, vol->sz);
+	return 0;
+    }
+    vol->swp_hdrs = (const void *)(vol->map + hdr->swp_hdrs_off);
+    vol->ray_hdrs = (const void *)(vol->map + hdr->ray_hdrs_off);
+    vol->ray_offs = (const void *)(vol->map + hdr->ray_offs_off);
+    vol->dat = (const void *)(vol->map + hdr->dat_off);
+
+    /* Every ray must lie within the data, so SigmetRaw_ShmRay never returns values past the
+     * end of the mapping. */
+    size_t num_rays_tot = (size_t)hdr->num_swps * hdr->num_rays * hdr->num_types;
+    uint64_t num_vals = (vol->sz - hdr->dat_off) / sizeof(float);
+    for (size_t i = 0; i < num_rays_tot; i++) {
+	uint64_t off = vol->ray_offs[i];
+	int nb = vol->ray_hdrs[i].num_bins;
+	if (off != SHM_NO_RAY && (nb < 0 || off > num_vals || (uint64_t)nb > num_vals - off)) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s: volume store entry has ray outside its data.",
+		    __func__);
+	    munmap(map, vol->sz);
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+/* Decode raw product file at path, with status st_p, and write the store entry to fd. Return
+ * 1/0 on success/failure. */
+static int build_ent(int fd, const char * path, const struct stat * st_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    int status = 0;
+    struct Sigmet_VolHdr vol_hdr;
+    struct Sigmet_SwpHdr * swp_hdrs = NULL;
+    struct Sigmet_Ray * rays = NULL;
+    void * dat_buf = NULL;
+    char * map = MAP_FAILED;
+    uint64_t sz = 0;
+    FILE * vol_fl = fopen(path, "r");
+    if (vol_fl == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not open raw product file %s. %s",
+		__func__, path, strerror(errno));
+	return 0;
+    }
+    memset(&vol_hdr, 0, sizeof vol_hdr);
+    if ( !Sigmet_VolReadVHdr(vol_fl, &vol_hdr, err_msg_p) ) {
+	goto done;
+    }
+    unsigned num_swps = Sigmet_VolNumSwps(&vol_hdr);
+    unsigned num_rays = Sigmet_VolNumRays(&vol_hdr);
+    unsigned num_types = Sigmet_VolNumTypes(&vol_hdr);
+    size_t num_rays_tot = (size_t)num_swps * num_rays * num_types;
+    size_t dat_buf_sz = Sigmet_VolIDatSz(&vol_hdr, err_msg_p);
+    if (dat_buf_sz == 0) {
+	goto done;
+    }
+    swp_hdrs = calloc(num_swps, sizeof *swp_hdrs);
+    rays = calloc(num_rays_tot, sizeof *rays);
+    dat_buf = malloc(dat_buf_sz);
+    if (swp_hdrs == NULL || rays == NULL || dat_buf == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate memory to decode %s.",
+		__func__, path);
+	goto done;
+    }
+    if (Sigmet_VolReadDat(vol_fl, &vol_hdr, num_swps, num_rays, num_types, swp_hdrs,
+		(struct Sigmet_Ray (*)[num_rays][num_types])rays, dat_buf_sz, dat_buf,
+		err_msg_p) == 0) {
+	goto done;
+    }
+
+    /* Lay out entry */
+    uint64_t num_vals = 0;
+    for (size_t i = 0; i < num_rays_tot; i++) {
+	if (rays[i].dat != NULL && rays[i].ray_hdr.num_bins > 0) {
+	    num_vals += rays[i].ray_hdr.num_bins;
+	}
+    }
+    struct shm_hdr hdr = {
+	.vsn = SHM_VSN,
+	.src_dev = st_p->st_dev, .src_ino = st_p->st_ino, .src_sz = st_p->st_size,
+	.src_mtim_sec = st_p->st_mtim.tv_sec, .src_mtim_nsec = st_p->st_mtim.tv_nsec,
+	.num_swps = num_swps, .num_rays = num_rays, .num_types = num_types
+    };
+    memcpy(hdr.magic, magic, sizeof magic);
+    hdr.vhdr_off = align(sizeof hdr);
+    hdr.swp_hdrs_off = align(hdr.vhdr_off + SigmetRaw_VolHdrSerSz(&vol_hdr));
+    hdr.ray_hdrs_off = align(hdr.swp_hdrs_off + num_swps * sizeof(struct Sigmet_SwpHdr));
+    hdr.ray_offs_off = align(hdr.ray_hdrs_off + num_rays_tot * sizeof(struct Sigmet_RayHdr));
+    hdr.dat_off = align(hdr.ray_offs_off + num_rays_tot * sizeof(uint64_t));
+    hdr.sz = sz = hdr.dat_off + num_vals * sizeof(float);
+    if (ftruncate(fd, sz) == -1
+	    || (map = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate %llu bytes in volume store. %s",
+		__func__, (unsigned long long)sz, strerror(errno));
+	goto done;
+    }
+
+    /* Fill entry */
+    memcpy(map, &hdr, sizeof hdr);
+    SigmetRaw_VolHdrSer(&vol_hdr, map + hdr.vhdr_off, hdr.swp_hdrs_off - hdr.vhdr_off);
+    memcpy(map + hdr.swp_hdrs_off, swp_hdrs, num_swps * sizeof *swp_hdrs);
+    struct Sigmet_RayHdr * ray_hdrs = (void *)(map + hdr.ray_hdrs_off);
+    uint64_t * ray_offs = (void *)(map + hdr.ray_offs_off);
+    float * dat = (void *)(map + hdr.dat_off);
+    uint64_t off = 0;
+    for (size_t i = 0; i < num_rays_tot; i++) {
+	unsigned y = i % num_types;
+	ray_hdrs[i] = rays[i].ray_hdr;
+	if (rays[i].dat != NULL && rays[i].ray_hdr.num_bins >= 0) {
+	    int nb = rays[i].ray_hdr.num_bins;
+	    ray_offs[i] = off;
+	    Sigmet_DataTypeStorToVal(vol_hdr.types[y], nb, dat + off, rays[i].dat, &vol_hdr);
+	    off += nb;
+	} else {
+	    ray_offs[i] = SHM_NO_RAY;
+	}
+    }
+    status = 1;
+
+done:
+    if (map != MAP_FAILED) {
+	munmap(map, sz);
+    }
+    fclose(vol_fl);
+    free(swp_hdrs);
+    free(rays);
+    free(dat_buf);
+    return status;
+}
+
+/* Make store directory dir, or the default if dir is NULL, and put its path in buf, which has
+ * space for buf_sz bytes. Return 1/0 on success/failure. */
+static int store_dir(const char * dir, char * buf, size_t buf_sz, struct Sigmet_ErrMsg * err_msg_p)
+{
+    int n = (dir != NULL && *dir != '\0') ? snprintf(buf, buf_sz, "%s", dir)
+	: snprintf(buf, buf_sz, "/dev/shm/sigmet_raw-%u", (unsigned)getuid());
+    if (n < 0 || (size_t)n >= buf_sz) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: volume store path too long.", __func__);
+	return 0;
+    }
+    if (mkdir(buf, 0700) == -1 && errno != EEXIST) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not create volume store %s. %s",
+		__func__, buf, strerror(errno));
+	return 0;
+    }
+    /* Other users must not be able to plant or replace entries, which this process maps and
+     * trusts. The directory might have existed before mkdir, so check it. */
+    struct stat st;
+    if (lstat(buf, &st) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not get information about volume store %s. %s",
+		__func__, buf, strerror(errno));
+	return 0;
+    }
+    if ( !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: volume store %s must be a directory owned by this user, "
+		"writable only by its owner.", __func__, buf);
+	return 0;
+    }
+    return 1;
+}
+
+/* Attach raw product file at path in volume store dir, or the default store if dir is NULL,
+ * decoding and publishing it if no other process has. After publishing, evict unattached
+ * entries until the store is within budget bytes, or a quarter of its file system if budget is
+ * 0. Return the attached volume, which caller should eventually give to SigmetRaw_ShmDetach,
+ * or NULL on failure. */
+struct SigmetRaw_ShmVol * SigmetRaw_ShmAttach(const char * dir, const char * path, size_t budget,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    char dir_path[PATH_MAX], real_path[PATH_MAX], ent_path[PATH_MAX + 32], lk_path[PATH_MAX + 40];
+    struct stat st;
+    if ( !store_dir(dir, dir_path, sizeof dir_path, err_msg_p) ) {
+	return NULL;
+    }
+    if (realpath(path, real_path) == NULL || stat(real_path, &st) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not get information about %s. %s",
+		__func__, path, strerror(errno));
+	return NULL;
+    }
+    uint64_t h = fnv1a(0xcbf29ce484222325ULL, real_path, strlen(real_path));
+    int64_t id[5] = { st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+    h = fnv1a(h, id, sizeof id);
+    snprintf(ent_path, sizeof ent_path, "%s/%016llx" SHM_SFX, dir_path, (unsigned long long)h);
+    snprintf(lk_path, sizeof lk_path, "%s.lock", ent_path);
+
+    struct SigmetRaw_ShmVol * vol = calloc(1, sizeof *vol);
+    if (vol == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate volume handle.", __func__);
+	return NULL;
+    }
+    _Bool built = 0;
+    int lk_fd = -1;
+    while ((vol->fd = open(ent_path, O_RDONLY | O_CLOEXEC)) == -1) {
+	if (errno != ENOENT || lk_fd != -1) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not open volume store entry %s. %s",
+		    __func__, ent_path, strerror(errno));
+	    goto error;
+	}
+	/* Not published. Wait for any other decoder, then check again before decoding. */
+	lk_fd = open(lk_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (lk_fd == -1 || flock(lk_fd, LOCK_EX) == -1) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not lock volume store entry %s. %s",
+		    __func__, ent_path, strerror(errno));
+	    goto error;
+	}
+	if (access(ent_path, F_OK) == 0) {
+	    continue;
+	}
+	char tmp_path[PATH_MAX + 32];
+	snprintf(tmp_path, sizeof tmp_path, "%s/.tmpXXXXXX", dir_path);
+	int tmp_fd = mkstemp(tmp_path);
+	if (tmp_fd == -1) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not create file in volume store %s. %s",
+		    __func__, dir_path, strerror(errno));
+	    goto error;
+	}
+	int status = build_ent(tmp_fd, real_path, &st, err_msg_p)
+	    && rename(tmp_path, ent_path) == 0;
+	close(tmp_fd);
+	if ( !status ) {
+	    unlink(tmp_path);
+	    goto error;
+	}
+	built = 1;
+    }
+    if (lk_fd != -1) {
+	close(lk_fd);
+	lk_fd = -1;
+    }
+    if (flock(vol->fd, LOCK_SH) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not lock volume store entry %s. %s",
+		__func__, ent_path, strerror(errno));
+	goto error;
+    }
+    futimens(vol->fd, NULL);		/* Most recently used */
+    if ( !map_ent(vol->fd, &st, vol, err_msg_p) ) {
+	goto error;
+    }
+    if (built) {
+	SigmetRaw_ShmEvict(dir_path, budget);
+    }
+    return vol;
+
+error:
+    if (lk_fd != -1) {
+	close(lk_fd);
+    }
+    if (vol->fd != -1) {
+	close(vol->fd);
+    }
+    free(vol);
+    return NULL;
+}
+
+/* Release volume attached with SigmetRaw_ShmAttach. */
+void SigmetRaw_ShmDetach(struct SigmetRaw_ShmVol * vol)
+{
+    if (vol == NULL) {
+	return;
+    }
+    munmap((void *)vol->map, vol->sz);
+    close(vol->fd);			/* Releases shared lock */
+    free(vol);
+}
+
+const struct Sigmet_VolHdr * SigmetRaw_ShmVolHdr(const struct SigmetRaw_ShmVol * vol)
+{
+    return &vol->vol_hdr;
+}
+
+unsigned SigmetRaw_ShmNumSwps(const struct SigmetRaw_ShmVol * vol)
+{
+    return vol->hdr->num_swps;
+}
+
+unsigned SigmetRaw_ShmNumRays(const struct SigmetRaw_ShmVol * vol)
+{
+    return vol->hdr->num_rays;
+}
+
+const struct Sigmet_SwpHdr * SigmetRaw_ShmSwpHdr(const struct SigmetRaw_ShmVol * vol, unsigned s)
+{
+    return vol->swp_hdrs + s;
+}
+
+/* Return header for ray r of sweep s for data type with index y in volume header. */
+const struct Sigmet_RayHdr * SigmetRaw_ShmRayHdr(const struct SigmetRaw_ShmVol * vol,
+	unsigned s, unsigned r, unsigned y)
+{
+    const struct shm_hdr * hdr = vol->hdr;
+    return vol->ray_hdrs + ((size_t)s * hdr->num_rays + r) * hdr->num_types + y;
+}
+
+/* Return values for ray r of sweep s for data type with index y in volume header, or NULL if
+ * the ray is empty. The ray header gives the number of values. */
+const float * SigmetRaw_ShmRay(const struct SigmetRaw_ShmVol * vol, unsigned s, unsigned r,
+	unsigned y)
+{
+    const struct shm_hdr * hdr = vol->hdr;
+    uint64_t off = vol->ray_offs[((size_t)s * hdr->num_rays + r) * hdr->num_types + y];
+    return (off == SHM_NO_RAY) ? NULL : vol->dat + off;
+}
+
+struct ent_info {
+    char name[NAME_MAX + 1];
+    off_t sz;
+    struct timespec mtim;
+};
+
+static int cmp_mtim(const void * a, const void * b)
+{
+    const struct timespec * ta = &((const struct ent_info *)a)->mtim;
+    const struct timespec * tb = &((const struct ent_info *)b)->mtim;
+    if (ta->tv_sec != tb->tv_sec) {
+	return (ta->tv_sec < tb->tv_sec) ? -1 : 1;
+    }
+    return (ta->tv_nsec < tb->tv_nsec) ? -1 : (ta->tv_nsec > tb->tv_nsec);
+}
+
+/* Remove least recently used entries that no process has attached from store at dir until the
+ * store uses at most budget bytes, or a quarter of its file system if budget is 0. Return the
+ * number of bytes freed. */
+size_t SigmetRaw_ShmEvict(const char * dir, size_t budget)
+{
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR * d = (dir_fd == -1) ? NULL : fdopendir(dir_fd);
+    if (d == NULL) {
+	if (dir_fd != -1) {
+	    close(dir_fd);
+	}
+	return 0;
+    }
+    if (budget == 0) {
+	struct statvfs vfs;
+	budget = (fstatvfs(dir_fd, &vfs) == 0) ? vfs.f_blocks * vfs.f_frsize / 4 : SIZE_MAX;
+    }
+    struct ent_info * ents = NULL;
+    size_t num_ents = 0, cap = 0, used = 0, freed = 0;
+    for (struct dirent * de = readdir(d); de != NULL; de = readdir(d)) {
+	size_t len = strlen(de->d_name);
+	struct stat st;
+	if (len < sizeof SHM_SFX || strcmp(de->d_name + len - (sizeof SHM_SFX - 1), SHM_SFX) != 0
+		|| fstatat(dir_fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+	    continue;
+	}
+	if (num_ents == cap) {
+	    struct ent_info * e = realloc(ents, (cap = cap ? 2 * cap : 64) * sizeof *ents);
+	    if (e == NULL) {
+		break;
+	    }
+	    ents = e;
+	}
+	snprintf(ents[num_ents].name, sizeof ents[num_ents].name, "%s", de->d_name);
+	ents[num_ents].sz = st.st_size;
+	ents[num_ents].mtim = st.st_mtim;
+	used += st.st_size;
+	num_ents++;
+    }
+    qsort(ents, num_ents, sizeof *ents, cmp_mtim);
+    for (size_t e = 0; e < num_ents && used > budget; e++) {
+	int fd = openat(dir_fd, ents[e].name, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+	    continue;
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB) == 0 && unlinkat(dir_fd, ents[e].name, 0) == 0) {
+	    char lk_name[NAME_MAX + 8];
+	    snprintf(lk_name, sizeof lk_name, "%s.lock", ents[e].name);
+	    unlinkat(dir_fd, lk_name, 0);
+	    used -= ents[e].sz;
+	    freed += ents[e].sz;
+	}
+	close(fd);
+    }
+    free(ents);
+    closedir(d);
+    return freed;
+}
@@ -0,0 +1,107 @@
+/*
+ *	sigmet_raw_thrds.c --
+ *		Split work over threads.
+ *	--
+ *
+ *	Work is run as num_threads calls to a thread function. Call 0 runs on the calling thread.
+ *	The others run on new threads. If a thread cannot be started, the caller runs its share,
+ *	so the work always completes, if slower.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "sigmet_raw.h"
+
+/*
+   Return the number of threads to use when the user asks for num_threads. 0 means one per
+   processor.
+ */
+
+unsigned SigmetRaw_NumThreads(unsigned num_threads)
+{
+    if (num_threads > 0) {
+	return num_threads;
+    }
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (unsigned)n : 1;
+}
+
+/*
+   Call fn num_threads times, concurrently. Call t receives (char *)args + t * arg_sz. If
+   arg_sz is 0, every call receives args. Return when all calls have returned.
+ */
+
+void SigmetRaw_ThreadsRun(unsigned num_threads, void * (*fn)(void *), void * args, size_t arg_sz)
+{
+    if (num_threads < 1) {
+	return;
+    }
+    pthread_t * threads = (num_threads > 1) ? calloc(num_threads, sizeof *threads) : NULL;
+    _Bool * started = (num_threads > 1) ? calloc(num_threads, sizeof *started) : NULL;
+    if (threads == NULL || started == NULL) {
+	free(threads);
+	free(started);
+	for (unsigned t = 0; t < num_threads; t++) {
+	    fn((char *)args + t * arg_sz);
+	}
+	return;
+    }
+    for (unsigned t = 1; t < num_threads; t++) {
+	started[t] = pthread_create(threads + t, NULL, fn, (char *)args + t * arg_sz) == 0;
+    }
+    fn(args);
+    for (unsigned t = 1; t < num_threads; t++) {
+	if (!started[t]) {
+	    fn((char *)args + t * arg_sz);
+	}
+    }
+    for (unsigned t = 1; t < num_threads; t++) {
+	if (started[t]) {
+	    pthread_join(threads[t], NULL);
+	}
+    }
+    free(threads);
+    free(started);
+}
+
+/*
+   Split num_rows rows into at most num_threads blocks and call fn for each block, concurrently.
+   fn receives a struct SigmetRaw_Rows with arg and the block's rows, i0 to i1 - 1.
+ */
+
+void SigmetRaw_RowsRun(unsigned num_threads, size_t num_rows, void * (*fn)(void *), void * arg)
+{
+    if (num_rows == 0) {
+	return;
+    }
+    if (num_threads < 1) {
+	num_threads = 1;
+    }
+    if (num_threads > num_rows) {
+	num_threads = num_rows;
+    }
+    struct SigmetRaw_Rows * rows = calloc(num_threads, sizeof *rows);
+    if (rows == NULL) {
+	struct SigmetRaw_Rows all = {.arg = arg, .i0 = 0, .i1 = num_rows};
+	fn(&all);
+	return;
+    }
+    size_t rows_per = (num_rows + num_threads - 1) / num_threads;
+    for (unsigned t = 0; t < num_threads; t++) {
+	size_t i0 = t * rows_per;
+	rows[t] = (struct SigmetRaw_Rows){
+	    .arg = arg,
+	    .i0 = (i0 < num_rows) ? i0 : num_rows,
+	    .i1 = (i0 + rows_per < num_rows) ? i0 + rows_per : num_rows
+	};
+    }
+    SigmetRaw_ThreadsRun(num_threads, fn, rows, sizeof *rows);
+    free(rows);
+}
@@ -0,0 +1,539 @@
+/*
+ *	sigmet_raw_tiles.c --
+ *		Write sweeps as XYZ map tiles.
+ *	--
+ *
+ *	A tile generator draws sweeps from one radar into 256 by 256 pixel palette PNG tiles in the
+ *	web Mercator (EPSG:3857) XYZ scheme, at dir/z/x/y.png, for a range of zoom levels. Colors
+ *	are as for the PPI renderer, see sigmet_raw_ppi.c.
+ *
+ *	Tile projection does not change from sweep to sweep, so the first sweep at each zoom level
+ *	finds the tiles that reach the range bins and, for each, the range bin and azimuth cell of
+ *	each pixel and the bins and azimuths the tile covers. Projection tables are kept up to a
+ *	memory budget, after which they are recomputed for each sweep. For each sweep, the
+ *	generator makes a bitmap of the gates that have a color, then skips tiles with no set bits
+ *	in their polar bounds, removing stale copies from earlier sweeps. Other tiles are drawn,
+ *	encoded, and written on several threads. Tiles are written to temporary files and renamed,
+ *	so a web server never sees a partial tile.
+ *
+ *	Range is treated as great circle distance from the radar on a spherical earth. Tiles do not
+ *	wrap across the antimeridian.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define TILE_SZ 256
+#define TILE_PIX (TILE_SZ * TILE_SZ)
+#define MAX_ZOOM SIGMETRAW_TILES_MAX_ZOOM
+#define EARTH_RADIUS 6371000.0		/* Meters */
+#define MAX_LAT 1.4844222297453324	/* Web Mercator latitude limit, radians */
+#define AZ_CELLS SIGMETRAW_PPI_AZ_CELLS
+#define NO_BIN SIGMETRAW_PPI_NO_BIN
+
+/* Tile that reaches the range bins */
+struct tile {
+    unsigned x, y;
+    unsigned c0, num_c;			/* Azimuth cells c0 to c0 + num_c - 1, modulo AZ_CELLS */
+    unsigned b0, b1;			/* Bins b0 to b1 */
+    uint16_t (*lut)[2];			/* [TILE_PIX] bin and azimuth cell, or NULL if not kept */
+};
+
+/* Tiles at one zoom level. tiles is NULL until the level is first needed. */
+struct zoom {
+    unsigned num_tiles;
+    struct tile * tiles;
+};
+
+struct SigmetRaw_Tiles {
+    double lat, lon;			/* Radar location, radians */
+    float rng0, drng, rng_max;		/* Meters */
+    unsigned num_threads;
+    size_t lut_max;			/* Budget for kept projection tables, bytes */
+    size_t lut_sz;			/* Bytes in kept projection tables */
+    struct zoom zooms[MAX_ZOOM + 1];
+};
+
+/* Create tile generator for a radar at latitude lat, longitude lon, radians, with range to first
+ * bin rng0, bin step drng, and maximum range to draw rng_max, meters. Use num_threads threads,
+ * or one per processor if num_threads is 0. Keep up to lut_max bytes of projection tables.
+ * Return NULL on failure. */
+struct SigmetRaw_Tiles * SigmetRaw_TilesInit(double lat, double lon, float rng0, float drng,
+	float rng_max, unsigned num_threads, size_t lut_max, struct Sigmet_ErrMsg * err_msg_p)
+{
+    if ( !(drng > 0.0f && rng_max > 0.0f) || !(fabs(lat) < MAX_LAT) ) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: invalid geometry, latitude %g, bin step %g, "
+		"maximum range %g.", __func__, lat, drng, rng_max);
+	return NULL;
+    }
+    struct SigmetRaw_Tiles * tiles = calloc(1, sizeof *tiles);
+    if (tiles == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate tile generator.", __func__);
+	return NULL;
+    }
+    lon = fmod(lon, 2.0 * M_PI);
+    lon += (lon > M_PI) ? -2.0 * M_PI : (lon < -M_PI) ? 2.0 * M_PI : 0.0;
+    tiles->lat = lat;
+    tiles->lon = lon;
+    tiles->rng0 = rng0;
+    tiles->drng = drng;
+    tiles->rng_max = rng_max;
+    tiles->num_threads = SigmetRaw_NumThreads(num_threads);
+    tiles->lut_max = lut_max;
+    return tiles;
+}
+
+void SigmetRaw_TilesFree(struct SigmetRaw_Tiles * tiles)
+{
+    if (tiles == NULL) {
+	return;
+    }
+    for (unsigned z = 0; z <= MAX_ZOOM; z++) {
+	struct zoom * zoom = tiles->zooms + z;
+	for (unsigned t = 0; t < zoom->num_tiles; t++) {
+	    free(zoom->tiles[t].lut);
+	}
+	free(zoom->tiles);
+    }
+    free(tiles);
+}
+
+/* Tile x, y coordinate of longitude lon, latitude lat, at zoom with n tiles across */
+static double tile_x(double lon, unsigned n)
+{
+    return (lon + M_PI) / (2.0 * M_PI) * n;
+}
+
+static double tile_y(double lat, unsigned n)
+{
+    return (1.0 - asinh(tan(lat)) / M_PI) / 2.0 * n;
+}
+
+/* Fill projection table lut for tile x, y at zoom z. Put polar bounds in tile_p. Return true if
+ * any pixel is in a range bin. */
+static _Bool lut_fill(const struct SigmetRaw_Tiles * tiles, unsigned z, unsigned x, unsigned y,
+	uint16_t (*lut)[2], struct tile * tile_p)
+{
+    double n = (double)TILE_SZ * (1u << z);	/* Pixels across the world */
+    double sin_lat0 = sin(tiles->lat), cos_lat0 = cos(tiles->lat);
+    double sin_dlon[TILE_SZ], cos_dlon[TILE_SZ];
+    for (unsigned j = 0; j < TILE_SZ; j++) {
+	double lon = ((double)x * TILE_SZ + j + 0.5) / n * 2.0 * M_PI - M_PI;
+	sin_dlon[j] = sin(lon - tiles->lon);
+	cos_dlon[j] = cos(lon - tiles->lon);
+    }
+
+    /* Azimuth bounds are offsets from the azimuth to the tile center. */
+    double xc = ((double)x + 0.5) * TILE_SZ / n * 2.0 * M_PI - M_PI;
+    double yc = atan(sinh(M_PI * (1.0 - 2.0 * ((double)y + 0.5) * TILE_SZ / n)));
+    unsigned cc = SigmetRaw_PpiAzCell(atan2(sin(xc - tiles->lon) * cos(yc),
+		cos_lat0 * sin(yc) - sin_lat0 * cos(yc) * cos(xc - tiles->lon)));
+    int dc_min = INT_MAX, dc_max = INT_MIN;
+    unsigned b0 = NO_BIN, b1 = 0;
+    for (unsigned i = 0; i < TILE_SZ; i++) {
+	double lat = atan(sinh(M_PI * (1.0 - 2.0 * ((double)y * TILE_SZ + i + 0.5) / n)));
+	double sin_lat = sin(lat), cos_lat = cos(lat);
+	for (unsigned j = 0; j < TILE_SZ; j++) {
+	    uint16_t * l = lut[i * TILE_SZ + j];
+	    double cos_d = sin_lat0 * sin_lat + cos_lat0 * cos_lat * cos_dlon[j];
+	    double rng = EARTH_RADIUS * acos(cos_d > 1.0 ? 1.0 : cos_d < -1.0 ? -1.0 : cos_d);
+	    double b = floor((rng - tiles->rng0) / tiles->drng);
+	    if (rng > tiles->rng_max || b < 0.0 || b >= NO_BIN) {
+		l[0] = NO_BIN;
+		l[1] = 0;
+		continue;
+	    }
+	    l[0] = b;
+	    l[1] = SigmetRaw_PpiAzCell(atan2(sin_dlon[j] * cos_lat,
+			cos_lat0 * sin_lat - sin_lat0 * cos_lat * cos_dlon[j]));
+	    b0 = (l[0] < b0) ? l[0] : b0;
+	    b1 = (l[0] > b1) ? l[0] : b1;
+	    int dc = ((int)l[1] - (int)cc + 3 * AZ_CELLS / 2) % AZ_CELLS - AZ_CELLS / 2;
+	    dc_min = (dc < dc_min) ? dc : dc_min;
+	    dc_max = (dc > dc_max) ? dc : dc_max;
+	}
+    }
+    if (b0 == NO_BIN) {
+	return 0;
+    }
+    double tx = tile_x(tiles->lon, 1u << z), ty = tile_y(tiles->lat, 1u << z);
+    tile_p->x = x;
+    tile_p->y = y;
+    tile_p->b0 = b0;
+    tile_p->b1 = b1;
+    if (floor(tx) == x && floor(ty) == y) {
+	/* Radar is in the tile */
+	tile_p->c0 = 0;
+	tile_p->num_c = AZ_CELLS;
+    } else {
+	tile_p->c0 = (cc + AZ_CELLS + dc_min) % AZ_CELLS;
+	tile_p->num_c = dc_max - dc_min + 1;
+    }
+    return 1;
+}
+
+/* Work shared by threads. Each thread takes the next item until there are none left or a
+ * thread fails. */
+struct work {
+    pthread_mutex_t mtx;
+    size_t next, num;
+    _Bool fail;
+    struct Sigmet_ErrMsg * err_msg_p;
+};
+
+/* Return index of next item, or -1 if done. */
+static long work_next(struct work * work)
+{
+    long i = -1;
+    pthread_mutex_lock(&work->mtx);
+    if ( !work->fail && work->next < work->num ) {
+	i = work->next++;
+    }
+    pthread_mutex_unlock(&work->mtx);
+    return i;
+}
+
+/* Record failure. msg goes to the caller's error message if no other thread has failed. */
+static void work_fail(struct work * work, const char * msg)
+{
+    pthread_mutex_lock(&work->mtx);
+    if ( !work->fail ) {
+	Sigmet_ErrMsg_Print(work->err_msg_p, "%s", msg);
+    }
+    work->fail = 1;
+    pthread_mutex_unlock(&work->mtx);
+}
+
+/* Building a zoom level */
+struct zoom_build {
+    struct work work;
+    struct SigmetRaw_Tiles * tiles;
+    unsigned z, x0, y0, nx;
+    struct tile * cands;		/* [work.num] Candidate tiles */
+    _Bool * reach;			/* [work.num] true if candidate reaches range bins */
+};
+
+static void * zoom_build_thread(void * arg)
+{
+    struct zoom_build * zb = arg;
+    struct SigmetRaw_Tiles * tiles = zb->tiles;
+    uint16_t (*lut)[2] = malloc(TILE_PIX * sizeof *lut);
+    if (lut == NULL) {
+	work_fail(&zb->work, "could not allocate tile projection table.");
+	return NULL;
+    }
+    for (long k; (k = work_next(&zb->work)) != -1; ) {
+	struct tile * tile = zb->cands + k;
+	unsigned x = zb->x0 + k % zb->nx, y = zb->y0 + k / zb->nx;
+	if ( !(zb->reach[k] = lut_fill(tiles, zb->z, x, y, lut, tile)) ) {
+	    continue;
+	}
+	_Bool keep = 0;
+	pthread_mutex_lock(&zb->work.mtx);
+	if (tiles->lut_sz + TILE_PIX * sizeof *lut <= tiles->lut_max) {
+	    tiles->lut_sz += TILE_PIX * sizeof *lut;
+	    keep = 1;
+	}
+	pthread_mutex_unlock(&zb->work.mtx);
+	tile->lut = NULL;
+	if (keep) {
+	    tile->lut = lut;
+	    if ((lut = malloc(TILE_PIX * sizeof *lut)) == NULL) {
+		work_fail(&zb->work, "could not allocate tile projection table.");
+		return NULL;
+	    }
+	}
+    }
+    free(lut);
+    return NULL;
+}
+
+/* Find the tiles at zoom z that reach the range bins. Return 1/0 on success/failure. */
+static int zoom_build(struct SigmetRaw_Tiles * tiles, unsigned z, struct Sigmet_ErrMsg * err_msg_p)
+{
+    /* Candidates are the tiles in the latitude longitude box around the range circle. */
+    unsigned n = 1u << z;
+    double dlat = tiles->rng_max / EARTH_RADIUS;
+    double lat_n = fmin(tiles->lat + dlat, MAX_LAT), lat_s = fmax(tiles->lat - dlat, -MAX_LAT);
+    double s = sin(dlat) / cos(tiles->lat);
+    double dlon = (s < 1.0 && lat_n < MAX_LAT && lat_s > -MAX_LAT) ? asin(s) : M_PI;
+    double lon_w = fmax(tiles->lon - dlon, -M_PI), lon_e = fmin(tiles->lon + dlon, M_PI);
+    unsigned x0 = fmax(tile_x(lon_w, n), 0.0), x1 = tile_x(lon_e, n);
+    unsigned y0 = fmax(tile_y(lat_n, n), 0.0), y1 = tile_y(lat_s, n);
+    x1 = (x1 < n) ? x1 : n - 1;
+    y1 = (y1 < n) ? y1 : n - 1;
+
+    struct zoom_build zb = {
+	.work = { .mtx = PTHREAD_MUTEX_INITIALIZER, .num = (size_t)(x1 - x0 + 1) * (y1 - y0 + 1),
+	    .err_msg_p = err_msg_p },
+	.tiles = tiles, .z = z, .x0 = x0, .y0 = y0, .nx = x1 - x0 + 1
+    };
+    zb.cands = calloc(zb.work.num, sizeof *zb.cands);
+    zb.reach = calloc(zb.work.num, sizeof *zb.reach);
+    if (zb.cands == NULL || zb.reach == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate %zu tiles for zoom %u.",
+		__func__, zb.work.num, z);
+	free(zb.cands);
+	free(zb.reach);
+	return 0;
+    }
+    SigmetRaw_ThreadsRun(tiles->num_threads, zoom_build_thread, &zb, 0);
+
+    /* Keep candidates that reach the range bins */
+    unsigned num_tiles = 0;
+    for (size_t k = 0; k < zb.work.num; k++) {
+	if (zb.reach[k] && !zb.work.fail) {
+	    zb.cands[num_tiles++] = zb.cands[k];
+	} else if (zb.reach[k] && zb.cands[k].lut != NULL) {
+	    free(zb.cands[k].lut);
+	    tiles->lut_sz -= TILE_PIX * sizeof *zb.cands[k].lut;
+	}
+    }
+    free(zb.reach);
+    if (zb.work.fail) {
+	free(zb.cands);
+	return 0;
+    }
+    struct tile * t = realloc(zb.cands, (num_tiles > 0 ? num_tiles : 1) * sizeof *t);
+    tiles->zooms[z].tiles = (t != NULL) ? t : zb.cands;
+    tiles->zooms[z].num_tiles = num_tiles;
+    return 1;
+}
+
+/* Writing tiles for a sweep */
+struct tiles_write {
+    struct work work;
+    struct SigmetRaw_Tiles * tiles;
+    const struct SigmetRaw_PpiSwp * swp_p;
+    const struct SigmetRaw_SwpBits * bits_p;	/* Gates with a color */
+    const uint8_t (*pal)[3];
+    unsigned num_colors;
+    const char * dir;
+    unsigned z0;
+    size_t * zoom_off;			/* Work index of first tile at each zoom, from z0 */
+    size_t num_written;
+};
+
+/* Return true if tile_p has a gate with a color in sweep swp_p with drawable gates bits_p. */
+static _Bool tile_has_dat(const struct tile * tile_p, const struct SigmetRaw_PpiSwp * swp_p,
+	const struct SigmetRaw_SwpBits * bits_p)
+{
+    int prev = -1;
+    for (unsigned n = 0; n < tile_p->num_c; n++) {
+	int r = swp_p->ray_of_az[(tile_p->c0 + n) % AZ_CELLS];
+	if (r == -1 || r == prev) {
+	    continue;
+	}
+	prev = r;
+	unsigned nb = swp_p->num_bins[r];
+	if (tile_p->b0 < nb) {
+	    long b = SigmetRaw_BitsNext(nb, SigmetRaw_SwpBitsRay(bits_p, r), tile_p->b0);
+	    if (b != -1 && (unsigned long)b <= tile_p->b1) {
+		return 1;
+	    }
+	}
+    }
+    return 0;
+}
+
+/* Make zoom and column directories for tile at path, dir/z/x/y.png. Other threads might make
+ * them first. Return 1/0 on success/failure. */
+static int tile_dirs(char * path)
+{
+    char * x_sl = strrchr(path, '/');
+    *x_sl = '\0';
+    char * z_sl = strrchr(path, '/');
+    *z_sl = '\0';
+    int ok = mkdir(path, 0777) == 0 || errno == EEXIST;
+    *z_sl = '/';
+    ok = ok && (mkdir(path, 0777) == 0 || errno == EEXIST);
+    *x_sl = '/';
+    return ok;
+}
+
+/* Write png_sz bytes at png to tile at path, by way of a temporary file. Return 1/0 on
+ * success/failure. */
+static int tile_put(char * path, const void * png, size_t png_sz,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof tmp, "%s.%ld.%lx", path, (long)getpid(),
+		(unsigned long)pthread_self()) >= (int)sizeof tmp) {
+	Sigmet_ErrMsg_Print(err_msg_p, "temporary path for %s too long.", path);
+	return 0;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1 && errno == ENOENT) {
+	/* First tile in this column */
+	if ( !tile_dirs(path) ) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "could not make directories for %s. %s.",
+		    path, strerror(errno));
+	    return 0;
+	}
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (fd == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "could not create %s. %s.", tmp, strerror(errno));
+	return 0;
+    }
+    const char * p = png;
+    for (size_t n = 0; n < png_sz; ) {
+	ssize_t w = write(fd, p + n, png_sz - n);
+	if (w == -1 && errno != EINTR) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "could not write %s. %s.", tmp, strerror(errno));
+	    close(fd);
+	    unlink(tmp);
+	    return 0;
+	}
+	n += (w > 0) ? w : 0;
+    }
+    if (close(fd) == -1 || rename(tmp, path) == -1) {
+	Sigmet_ErrMsg_Print(err_msg_p, "could not put tile at %s. %s.", path, strerror(errno));
+	unlink(tmp);
+	return 0;
+    }
+    return 1;
+}
+
+static void * tiles_write_thread(void * arg)
+{
+    struct tiles_write * tw = arg;
+    struct SigmetRaw_Tiles * tiles = tw->tiles;
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    struct Sigmet_ErrMsg * err_msg_p = &err_msg;
+    uint16_t (*lut_buf)[2] = malloc(TILE_PIX * sizeof *lut_buf);
+    uint8_t * pix = malloc(TILE_PIX);
+    if (lut_buf == NULL || pix == NULL) {
+	work_fail(&tw->work, "could not allocate tile buffers.");
+	free(lut_buf);
+	free(pix);
+	return NULL;
+    }
+    size_t num_written = 0;
+    for (long k; (k = work_next(&tw->work)) != -1; ) {
+	unsigned z = tw->z0;
+	while (tw->zoom_off[z - tw->z0 + 1] <= (size_t)k) {
+	    z++;
+	}
+	struct tile * tile = tiles->zooms[z].tiles + (k - tw->zoom_off[z - tw->z0]);
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof path, "%s/%u/%u/%u.png", tw->dir, z, tile->x, tile->y)
+		>= (int)sizeof path) {
+	    work_fail(&tw->work, "tile path too long.");
+	    break;
+	}
+	if ( !tile_has_dat(tile, tw->swp_p, tw->bits_p) ) {
+	    /* Remove tile from an earlier sweep, if any */
+	    if (unlink(path) == -1 && errno != ENOENT) {
+		Sigmet_ErrMsg_Print(err_msg_p, "could not remove %s. %s.", path, strerror(errno));
+		work_fail(&tw->work, err_msg.str);
+		break;
+	    }
+	    continue;
+	}
+	const uint16_t (*lut)[2] = (const uint16_t (*)[2])tile->lut;
+	if (lut == NULL) {
+	    struct tile t;
+	    lut_fill(tiles, z, tile->x, tile->y, lut_buf, &t);
+	    lut = (const uint16_t (*)[2])lut_buf;
+	}
+	for (unsigned p = 0; p < TILE_PIX; p++) {
+	    pix[p] = SigmetRaw_PpiSwpColor(tw->swp_p, lut[p][1], lut[p][0]);
+	}
+	void * png;
+	size_t png_sz;
+	if ( !SigmetRaw_PngPalette(TILE_SZ, TILE_SZ, pix, tw->pal, tw->num_colors + 1, 0, 1,
+		    &png, &png_sz, err_msg_p) ) {
+	    work_fail(&tw->work, err_msg.str);
+	    break;
+	}
+	int put = tile_put(path, png, png_sz, err_msg_p);
+	free(png);
+	if ( !put ) {
+	    work_fail(&tw->work, err_msg.str);
+	    break;
+	}
+	num_written++;
+    }
+    pthread_mutex_lock(&tw->work.mtx);
+    tw->num_written += num_written;
+    pthread_mutex_unlock(&tw->work.mtx);
+    free(lut_buf);
+    free(pix);
+    return NULL;
+}
+
+/* Write tiles for zoom levels z0 to z1 under directory dir, which must exist, for sweep with
+ * num_rays rays, headers ray_hdrs and values dat, with dat[r] NULL for an empty ray, using color
+ * levels lvls_p. Put number of tiles written in *num_written_p. Return 1/0 on success/failure. */
+int SigmetRaw_TilesWrite(struct SigmetRaw_Tiles * tiles, const struct SigmetRaw_PpiLevels * lvls_p,
+	unsigned num_rays, const struct Sigmet_RayHdr * ray_hdrs, const float * const * dat,
+	unsigned z0, unsigned z1, const char * dir, size_t * num_written_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    if (z0 > z1 || z1 > MAX_ZOOM) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: zoom levels must be in 0 to %d, got %u to %u.",
+		__func__, MAX_ZOOM, z0, z1);
+	return 0;
+    }
+    size_t zoom_off[MAX_ZOOM + 2];
+    zoom_off[0] = 0;
+    for (unsigned z = z0; z <= z1; z++) {
+	if (tiles->zooms[z].tiles == NULL && !zoom_build(tiles, z, err_msg_p)) {
+	    return 0;
+	}
+	zoom_off[z - z0 + 1] = zoom_off[z - z0] + tiles->zooms[z].num_tiles;
+    }
+
+    /* Color indeces, and bitmap of gates with a color */
+    struct SigmetRaw_PpiSwp swp = { .cls = NULL };
+    struct SigmetRaw_SwpBits bits;
+    if ( !SigmetRaw_PpiSwpSet(&swp, lvls_p, num_rays, ray_hdrs, dat, err_msg_p) ) {
+	SigmetRaw_PpiSwpFree(&swp);
+	return 0;
+    }
+    if ( !SigmetRaw_SwpBitsAlloc(&bits, num_rays, swp.num_bins, err_msg_p) ) {
+	SigmetRaw_PpiSwpFree(&swp);
+	return 0;
+    }
+    for (unsigned r = 0; r < num_rays; r++) {
+	const uint8_t * cls = swp.cls + (size_t)r * swp.num_bins_max;
+	uint32_t * wds = SigmetRaw_SwpBitsRay(&bits, r);
+	for (int b = 0; b < swp.num_bins[r]; b++) {
+	    if (cls[b] != 0) {
+		wds[b / SIGMETRAW_BITS_PER_WD] |= UINT32_C(1) << (b % SIGMETRAW_BITS_PER_WD);
+	    }
+	}
+    }
+
+    uint8_t pal[SIGMETRAW_PPI_MAX_COLORS + 1][3];
+    SigmetRaw_PpiPalette(lvls_p->num_colors, NULL, 0, pal);
+    struct tiles_write tw = {
+	.work = { .mtx = PTHREAD_MUTEX_INITIALIZER, .num = zoom_off[z1 - z0 + 1],
+	    .err_msg_p = err_msg_p },
+	.tiles = tiles, .swp_p = &swp, .bits_p = &bits, .pal = (const uint8_t (*)[3])pal,
+	.num_colors = lvls_p->num_colors, .dir = dir, .z0 = z0, .zoom_off = zoom_off
+    };
+    SigmetRaw_ThreadsRun(tiles->num_threads, tiles_write_thread, &tw, 0);
+    SigmetRaw_SwpBitsFree(&bits);
+    SigmetRaw_PpiSwpFree(&swp);
+    *num_written_p = tw.num_written;
+    return !tw.work.fail;
+}
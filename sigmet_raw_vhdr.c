@@ -0,0 +1,139 @@
+/*
+ *	sigmet_raw_vhdr.c --
+ *		Serialized volume headers.
+ *	--
+ *
+ *	struct Sigmet_VolHdr holds pointers to data type descriptors, which only mean something in
+ *	the process that made them. The serialized form replaces them with data type abbreviations,
+ *	and only stores the types the volume has, so it can be sent between processes, cached in a
+ *	file, or mapped into memory, and decoded back to a Sigmet_VolHdr in any process.
+ *
+ *	Layout:
+ *	    struct SigmetRaw_VolHdrSerHdr
+ *	    struct Sigmet_ProdHdr
+ *	    struct Sigmet_IngstHdr
+ *	    num_types data type abbreviations, SIGMET_DATA_TYPE_LEN bytes each, nul padded.
+ *
+ *	The product and ingest headers are stored in native layout. The serialization header records
+ *	their sizes, so a reader built with different structures rejects the buffer instead of
+ *	misreading it. Readers and writers are on the same host, so byte order is native.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+static const char magic[4] = {'S', 'R', 'V', 'H'};
+
+/* Return size of serialized form of volume header at vol_hdr_p. */
+size_t SigmetRaw_VolHdrSerSz(const struct Sigmet_VolHdr * vol_hdr_p)
+{
+    return sizeof(struct SigmetRaw_VolHdrSerHdr) + sizeof vol_hdr_p->prod_hdr
+	+ sizeof vol_hdr_p->ingst_hdr + vol_hdr_p->num_types * SIGMET_DATA_TYPE_LEN;
+}
+
+/* Serialize volume header at vol_hdr_p into buf, which has space for buf_sz bytes. Return number
+ * of bytes written, or 0 if buf is too small. */
+size_t SigmetRaw_VolHdrSer(const struct Sigmet_VolHdr * vol_hdr_p, void * buf, size_t buf_sz)
+{
+    size_t sz = SigmetRaw_VolHdrSerSz(vol_hdr_p);
+    if (sz > buf_sz) {
+	return 0;
+    }
+    struct SigmetRaw_VolHdrSerHdr ser_hdr = {
+	.vsn = SIGMETRAW_VHDR_VSN,
+	.num_types = vol_hdr_p->num_types,
+	.sz = sz,
+	.prod_hdr_sz = sizeof vol_hdr_p->prod_hdr,
+	.ingst_hdr_sz = sizeof vol_hdr_p->ingst_hdr
+    };
+    memcpy(ser_hdr.magic, magic, sizeof magic);
+    char * b = buf;
+    memcpy(b, &ser_hdr, sizeof ser_hdr);
+    b += sizeof ser_hdr;
+    memcpy(b, &vol_hdr_p->prod_hdr, sizeof vol_hdr_p->prod_hdr);
+    b += sizeof vol_hdr_p->prod_hdr;
+    memcpy(b, &vol_hdr_p->ingst_hdr, sizeof vol_hdr_p->ingst_hdr);
+    b += sizeof vol_hdr_p->ingst_hdr;
+    for (unsigned y = 0; y < vol_hdr_p->num_types; y++, b += SIGMET_DATA_TYPE_LEN) {
+	memset(b, 0, SIGMET_DATA_TYPE_LEN);
+	strncpy(b, Sigmet_DataTypeAbbrv(vol_hdr_p->types[y]), SIGMET_DATA_TYPE_LEN - 1);
+    }
+    return sz;
+}
+
+/* Check serialization header at the start of buf, which has buf_sz bytes, and copy it to
+ * ser_hdr_p. Return 1/0 if the header is valid/invalid. The rest of the buffer might not be
+ * present yet. */
+int SigmetRaw_VolHdrSerChk(const void * buf, size_t buf_sz,
+	struct SigmetRaw_VolHdrSerHdr * ser_hdr_p, struct Sigmet_ErrMsg * err_msg_p)
+{
+    if (buf_sz < sizeof *ser_hdr_p) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: serialized volume header too short.", __func__);
+	return 0;
+    }
+    memcpy(ser_hdr_p, buf, sizeof *ser_hdr_p);
+    if (memcmp(ser_hdr_p->magic, magic, sizeof magic) != 0) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: not a serialized volume header.", __func__);
+	return 0;
+    }
+    if (ser_hdr_p->vsn != SIGMETRAW_VHDR_VSN
+	    || ser_hdr_p->prod_hdr_sz != sizeof(struct Sigmet_ProdHdr)
+	    || ser_hdr_p->ingst_hdr_sz != sizeof(struct Sigmet_IngstHdr)) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: serialized volume header version %u does not match "
+		"this program, which uses version %u.", __func__, ser_hdr_p->vsn,
+		SIGMETRAW_VHDR_VSN);
+	return 0;
+    }
+    if (ser_hdr_p->num_types > SIGMET_NUM_DATA_TYPES
+	    || ser_hdr_p->sz != sizeof *ser_hdr_p + ser_hdr_p->prod_hdr_sz
+	    + ser_hdr_p->ingst_hdr_sz + ser_hdr_p->num_types * SIGMET_DATA_TYPE_LEN) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: serialized volume header is corrupt.", __func__);
+	return 0;
+    }
+    return 1;
+}
+
+/* Decode serialized volume header in buf, which has buf_sz bytes, into vol_hdr_p. Return 1/0
+ * on success/failure. */
+int SigmetRaw_VolHdrDeser(const void * buf, size_t buf_sz, struct Sigmet_VolHdr * vol_hdr_p,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct SigmetRaw_VolHdrSerHdr ser_hdr;
+    if ( !SigmetRaw_VolHdrSerChk(buf, buf_sz, &ser_hdr, err_msg_p) ) {
+	return 0;
+    }
+    if (buf_sz < ser_hdr.sz) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: serialized volume header truncated. Expected %u "
+		"bytes, got %zu.", __func__, ser_hdr.sz, buf_sz);
+	return 0;
+    }
+    const char * b = (const char *)buf + sizeof ser_hdr;
+    memcpy(&vol_hdr_p->prod_hdr, b, sizeof vol_hdr_p->prod_hdr);
+    b += sizeof vol_hdr_p->prod_hdr;
+    memcpy(&vol_hdr_p->ingst_hdr, b, sizeof vol_hdr_p->ingst_hdr);
+    b += sizeof vol_hdr_p->ingst_hdr;
+    vol_hdr_p->num_types = ser_hdr.num_types;
+    for (unsigned y = 0; y < ser_hdr.num_types; y++, b += SIGMET_DATA_TYPE_LEN) {
+	char abbrv[SIGMET_DATA_TYPE_LEN];
+	memcpy(abbrv, b, SIGMET_DATA_TYPE_LEN);
+	abbrv[SIGMET_DATA_TYPE_LEN - 1] = '\0';
+	if ((vol_hdr_p->types[y] = Sigmet_DataTypeGet(abbrv)) == NULL) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s: serialized volume header has unknown data type "
+		    "%s.", __func__, abbrv);
+	    return 0;
+	}
+    }
+    for (unsigned y = ser_hdr.num_types; y < SIGMET_NUM_DATA_TYPES; y++) {
+	vol_hdr_p->types[y] = NULL;
+    }
+    return 1;
+}
@@ -0,0 +1,326 @@
+/*
+ *	sigmet_raw_warm.c --
+ *		Cache warm-up policy for the sigmet_raw daemon.
+ *	--
+ *
+ *	Clients tend to ask for the same few sweeps right after each new volume, e.g. the lowest
+ *	two sweeps of DB_DBZ, DB_VEL and DB_ZDR. A warm-up policy lists (data type, sweep) pairs
+ *	to convert on background threads as soon as a volume loads, so the first live request for
+ *	them finds them in the cache.
+ *
+ *	The list has two parts. Static entries come from a policy file or SigmetRaw_WarmAdd.
+ *	Learned entries come from counting requests, either live with SigmetRaw_WarmRecord or from a
+ *	request log with SigmetRaw_WarmLearn. Counts halve at each volume, so the learned part
+ *	follows changes in client behavior.
+ *
+ *	Policy files and request logs have one request per line, data type abbreviation then sweep
+ *	index, e.g. "DB_DBZ 0". Blank lines and lines starting with '#' are ignored.
+ *
+ *	Warm-up threads run with the idle scheduling policy where available, so they only use
+ *	CPU time that live requests leave over.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+/* Learned entries with fewer hits than this are not warmed. */
+#define MIN_HITS 2.0
+
+struct warm_item {
+    const struct Sigmet_DataType * type;
+    unsigned s;
+    double hits;			/* Learned entries only */
+};
+
+struct SigmetRaw_Warm {
+    pthread_mutex_t mtx;		/* Protects static and learned lists */
+    unsigned max_items;			/* Maximum items to warm per volume */
+    struct warm_item * statics;		/* Static entries */
+    unsigned num_statics;
+    struct warm_item * learned;		/* Learned entries, max_items * 4 slots */
+    unsigned num_learned;
+
+    /* Current warm-up run */
+    struct warm_item * plan;		/* Items to warm, in order */
+    unsigned num_plan;
+    atomic_uint next;			/* Index in plan of next item to take */
+    atomic_bool stop;			/* If set, threads take no more items */
+    SigmetRaw_WarmFn * fn;
+    void * arg;
+    pthread_t * threads;
+    unsigned num_threads;
+};
+
+static unsigned max_learned(const struct SigmetRaw_Warm * warm)
+{
+    return 4 * warm->max_items;
+}
+
+/* Create warm-up policy that warms at most max_items sweeps per volume. */
+struct SigmetRaw_Warm * SigmetRaw_WarmInit(unsigned max_items, struct Sigmet_ErrMsg * err_msg_p)
+{
+    struct SigmetRaw_Warm * warm = calloc(1, sizeof *warm);
+    if (warm == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate warm-up policy.", __func__);
+	return NULL;
+    }
+    warm->max_items = max_items;
+    warm->statics = calloc(max_items, sizeof *warm->statics);
+    warm->learned = calloc(max_learned(warm), sizeof *warm->learned);
+    warm->plan = calloc(max_items, sizeof *warm->plan);
+    if (warm->statics == NULL || warm->learned == NULL || warm->plan == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate warm-up lists for %u items.",
+		__func__, max_items);
+	free(warm->statics);
+	free(warm->learned);
+	free(warm->plan);
+	free(warm);
+	return NULL;
+    }
+    pthread_mutex_init(&warm->mtx, NULL);
+    atomic_init(&warm->next, 0);
+    atomic_init(&warm->stop, 0);
+    return warm;
+}
+
+void SigmetRaw_WarmFree(struct SigmetRaw_Warm * warm)
+{
+    if (warm == NULL) {
+	return;
+    }
+    SigmetRaw_WarmStop(warm);
+    pthread_mutex_destroy(&warm->mtx);
+    free(warm->statics);
+    free(warm->learned);
+    free(warm->plan);
+    free(warm);
+}
+
+/* Add static entry for data type abbrv, sweep s. Return 1/0 on success/failure. */
+int SigmetRaw_WarmAdd(struct SigmetRaw_Warm * warm, const char * abbrv, unsigned s,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    const struct Sigmet_DataType * type = Sigmet_DataTypeGet(abbrv);
+    if (type == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: %s is not a Sigmet data type.", __func__, abbrv);
+	return 0;
+    }
+    pthread_mutex_lock(&warm->mtx);
+    if (warm->num_statics == warm->max_items) {
+	pthread_mutex_unlock(&warm->mtx);
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: warm-up list can have at most %u entries.",
+		__func__, warm->max_items);
+	return 0;
+    }
+    warm->statics[warm->num_statics++] = (struct warm_item){ .type = type, .s = s };
+    pthread_mutex_unlock(&warm->mtx);
+    return 1;
+}
+
+/* Count a request for data type at sweep s. */
+void SigmetRaw_WarmRecord(struct SigmetRaw_Warm * warm, const struct Sigmet_DataType * type,
+	unsigned s)
+{
+    pthread_mutex_lock(&warm->mtx);
+    struct warm_item * item, * min_item = NULL;
+    for (item = warm->learned; item < warm->learned + warm->num_learned; item++) {
+	if (item->type == type && item->s == s) {
+	    item->hits += 1.0;
+	    pthread_mutex_unlock(&warm->mtx);
+	    return;
+	}
+	if (min_item == NULL || item->hits < min_item->hits) {
+	    min_item = item;
+	}
+    }
+    if (warm->num_learned < max_learned(warm)) {
+	item = warm->learned + warm->num_learned++;
+    } else {
+	item = min_item;		/* Replace least requested entry */
+    }
+    *item = (struct warm_item){ .type = type, .s = s, .hits = 1.0 };
+    pthread_mutex_unlock(&warm->mtx);
+}
+
+/* Read lines from fl into static entries if learn is false, or count them as requests if learn
+ * is true. fl_nm is for error messages. Return 1/0 on success/failure. */
+static int warm_read(struct SigmetRaw_Warm * warm, FILE * fl, const char * fl_nm, _Bool learn,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    char ln[LINE_MAX];
+    unsigned n_ln = 0;
+    while (fgets(ln, sizeof ln, fl) != NULL) {
+	char abbrv[SIGMET_DATA_TYPE_LEN];
+	unsigned s;
+	n_ln++;
+	char * c = ln + strspn(ln, " \t");
+	if (*c == '#' || *c == '\n' || *c == '\0') {
+	    continue;
+	}
+	if (sscanf(c, "%15s %u", abbrv, &s) != 2) {
+	    if (learn) {
+		continue;			/* Logs may have other lines */
+	    }
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s: expected data type and sweep index at line %u "
+		    "of %s.", __func__, n_ln, fl_nm);
+	    return 0;
+	}
+	if (learn) {
+	    const struct Sigmet_DataType * type = Sigmet_DataTypeGet(abbrv);
+	    if (type != NULL) {
+		SigmetRaw_WarmRecord(warm, type, s);
+	    }
+	} else if ( !SigmetRaw_WarmAdd(warm, abbrv, s, err_msg_p) ) {
+	    return 0;
+	}
+    }
+    if (ferror(fl)) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s: could not read %s. %s", __func__, fl_nm,
+		strerror(errno));
+	return 0;
+    }
+    return 1;
+}
+
+/* Add static entries from policy file fl. fl_nm is for error messages. */
+int SigmetRaw_WarmRead(struct SigmetRaw_Warm * warm, FILE * fl, const char * fl_nm,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    return warm_read(warm, fl, fl_nm, 0, err_msg_p);
+}
+
+/* Count requests listed in request log fl. fl_nm is for error messages. */
+int SigmetRaw_WarmLearn(struct SigmetRaw_Warm * warm, FILE * fl, const char * fl_nm,
+	struct Sigmet_ErrMsg * err_msg_p)
+{
+    return warm_read(warm, fl, fl_nm, 1, err_msg_p);
+}
+
+static int cmp_hits(const void * a, const void * b)
+{
+    double h0 = ((const struct warm_item *)a)->hits, h1 = ((const struct warm_item *)b)->hits;
+    return (h0 < h1) - (h0 > h1);		/* Descending */
+}
+
+static _Bool in_plan(const struct SigmetRaw_Warm * warm, const struct warm_item * item)
+{
+    for (unsigned i = 0; i < warm->num_plan; i++) {
+	if (warm->plan[i].type == item->type && warm->plan[i].s == item->s) {
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/* Fill plan for a volume with num_swps sweeps. Static entries go first, then the most requested
+ * learned entries. Then age the learned counts. */
+static void warm_plan(struct SigmetRaw_Warm * warm, unsigned num_swps)
+{
+    pthread_mutex_lock(&warm->mtx);
+    warm->num_plan = 0;
+    for (unsigned i = 0; i < warm->num_statics && warm->num_plan < warm->max_items; i++) {
+	struct warm_item * item = warm->statics + i;
+	if (item->s < num_swps && !in_plan(warm, item)) {
+	    warm->plan[warm->num_plan++] = *item;
+	}
+    }
+    qsort(warm->learned, warm->num_learned, sizeof *warm->learned, cmp_hits);
+    for (unsigned i = 0; i < warm->num_learned && warm->num_plan < warm->max_items; i++) {
+	struct warm_item * item = warm->learned + i;
+	if (item->hits < MIN_HITS) {
+	    break;
+	}
+	if (item->s < num_swps && !in_plan(warm, item)) {
+	    warm->plan[warm->num_plan++] = *item;
+	}
+    }
+    for (unsigned i = 0; i < warm->num_learned; i++) {
+	warm->learned[i].hits *= 0.5;
+    }
+    pthread_mutex_unlock(&warm->mtx);
+}
+
+static void * warm_thread(void * arg)
+{
+    struct SigmetRaw_Warm * warm = arg;
+#ifdef SCHED_IDLE
+    struct sched_param param = { .sched_priority = 0 };
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+    while ( !atomic_load(&warm->stop) ) {
+	unsigned i = atomic_fetch_add(&warm->next, 1);
+	if (i >= warm->num_plan) {
+	    break;
+	}
+	warm->fn(warm->plan[i].type, warm->plan[i].s, warm->arg);
+    }
+    return NULL;
+}
+
+/* Start warming a newly loaded volume with num_swps sweeps. num_threads background threads call
+ * fn(type, s, arg) for each planned item. fn should convert the sweep and put it in the cache.
+ * Any previous run is stopped first. Return 1/0 on success/failure. */
+int SigmetRaw_WarmStart(struct SigmetRaw_Warm * warm, unsigned num_swps, unsigned num_threads,
+	SigmetRaw_WarmFn * fn, void * arg, struct Sigmet_ErrMsg * err_msg_p)
+{
+    SigmetRaw_WarmStop(warm);
+    warm_plan(warm, num_swps);
+    if (warm->num_plan == 0) {
+	return 1;
+    }
+    if (num_threads > warm->num_plan) {
+	num_threads = warm->num_plan;
+    }
+    warm->threads = calloc(num_threads, sizeof *warm->threads);
+    if (warm->threads == NULL) {
+	Sigmet_ErrMsg_Print(err_msg_p, "%s could not allocate %u warm-up threads.",
+		__func__, num_threads);
+	return 0;
+    }
+    warm->fn = fn;
+    warm->arg = arg;
+    atomic_store(&warm->next, 0);
+    atomic_store(&warm->stop, 0);
+    for (warm->num_threads = 0; warm->num_threads < num_threads; warm->num_threads++) {
+	int status = pthread_create(warm->threads + warm->num_threads, NULL, warm_thread, warm);
+	if (status != 0) {
+	    Sigmet_ErrMsg_Print(err_msg_p, "%s could not start warm-up thread. %s",
+		    __func__, strerror(status));
+	    SigmetRaw_WarmStop(warm);
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+/* Stop current warm-up run, e.g. because another volume arrived. Items in progress finish,
+ * others are skipped. Return after all warm-up threads exit. */
+void SigmetRaw_WarmStop(struct SigmetRaw_Warm * warm)
+{
+    atomic_store(&warm->stop, 1);
+    SigmetRaw_WarmWait(warm);
+}
+
+/* Wait for current warm-up run to finish. */
+void SigmetRaw_WarmWait(struct SigmetRaw_Warm * warm)
+{
+    for (unsigned i = 0; i < warm->num_threads; i++) {
+	pthread_join(warm->threads[i], NULL);
+    }
+    free(warm->threads);
+    warm->threads = NULL;
+    warm->num_threads = 0;
+}
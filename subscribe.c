@@ -0,0 +1,205 @@
+/*
+ *	subscribe.c --
+ *		Receive rays from a sigmet_raw daemon as they arrive. See sigmet_raw (1).
+ *	--
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+static void print_frames(FILE *, const struct Sigmet_DataType *, const char *, const char *);
+
+int main(int argc, char *argv[])
+{
+    /* If set, use $APP_NAME in error messages instead of argv[0]. */
+    char *cmd = getenv("APP_NAME") ? getenv("APP_NAME") : basename(argv[0]);
+    _Bool txt = 1;			/* true => print rays as text. false => send frames. */
+    if (argc == 5 && strcmp(argv[1], "-b") == 0) {
+	txt = 0;
+	argv++;
+	argc--;
+    }
+    if (argc != 4) {
+	fprintf(stderr, "Usage: %s [-b] data_type sweep_index|all socket\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    char * abbrv = argv[1];
+    char * s_swp = argv[2];
+    char * path = argv[3];
+    const struct Sigmet_DataType * type = Sigmet_DataTypeGet(abbrv);
+    if (type == NULL) {
+	fprintf(stderr, "%s: %s is not a Sigmet data type.\n", cmd, abbrv);
+	exit(EXIT_FAILURE);
+    }
+    unsigned i_swp = 0;
+    if (strcmp(s_swp, "all") == 0) {
+	i_swp = UINT_MAX;
+    } else if (sscanf(s_swp, "%u", &i_swp) != 1) {
+	fprintf(stderr, "%s: expected integer or \"all\" for sweep index, got %s\n", cmd, s_swp);
+	exit(EXIT_FAILURE);
+    }
+    struct stat st_buf;
+    if (stat(path, &st_buf) == -1 || !S_ISSOCK(st_buf.st_mode)) {
+	fprintf(stderr, "%s: %s must be a sigmet_raw daemon socket.\n", cmd, path);
+	exit(EXIT_FAILURE);
+    }
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    int skt_fd = SigmetRaw_DmnConnect(path, &err_msg);
+    if (skt_fd == -1) {
+	fprintf(stderr, "%s failed to connect to sigmet_raw daemon at %s. %s\n",
+		cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    /* Frames arrive on a pipe for text output. For binary output, the daemon writes frames
+     * straight to standard output of this process. */
+    int frm_pipe[2] = {-1, -1};
+    if (txt && pipe(frm_pipe) == -1) {
+	fprintf(stderr, "%s could not create pipe to read rays from daemon at socket %s. %s.\n",
+		cmd, path, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    int err_pipe[2];
+    if (pipe(err_pipe) == -1) {
+	fprintf(stderr, "%s could not create pipe to read error information from daemon at "
+		"socket %s. %s.\n", cmd, path, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    struct SigmetRaw_Rqst rqst = SigmetRaw_Rqst_Init();
+    SigmetRaw_Rqst_Set_SubCmd(&rqst, SigmetRawSubscribe);
+    SigmetRaw_Rqst_Set_DataType(&rqst, abbrv);
+    SigmetRaw_Rqst_Set_Swp(&rqst, i_swp);
+    SigmetRaw_Rqst_Set_ShFD(&rqst, txt ? frm_pipe[1] : STDOUT_FILENO);
+    SigmetRaw_Rqst_Set_ErrFD(&rqst, err_pipe[1]);
+    if ( !SigmetRaw_Rqst_Send(skt_fd, &rqst, &err_msg) ) {
+	fprintf(stderr, "%s failed to subscribe to daemon at socket %s. %s.\n",
+		cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    enum SigmetRaw_Status status = SigmetRawError;
+    struct msghdr rps = {
+	.msg_iov = (struct iovec [1]){
+	    [0] = { .iov_base = &status, .iov_len = sizeof status },
+	},
+	.msg_iovlen = 1
+    };
+    if (recvmsg(skt_fd, &rps, 0) == -1) {
+	fprintf(stderr, "%s: could not get response from daemon at socket %s. %s.\n",
+		cmd, path, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    close(err_pipe[1]);
+    if (txt) {
+	close(frm_pipe[1]);		/* Daemon writes to pipe. This process reads from it. */
+    }
+    if (status != SigmetRawOkay) {
+	fprintf(stderr, "%s failed for daemon at socket %s. ", cmd, path);
+	FILE * err = fdopen(err_pipe[0], "r");
+	if (err == NULL) {
+	    fprintf(stderr, "%s could not configure pipe to read error information from daemon "
+		    "at socket %s. %s.\n", cmd, path, strerror(errno));
+	    exit(EXIT_FAILURE);
+	}
+	for (int c = fgetc(err); c != EOF; c = fgetc(err)) {
+	    fputc(c, stderr);
+	}
+	fputc('\n', stderr);
+	exit(EXIT_FAILURE);
+    }
+    close(err_pipe[0]);
+    if ( !txt ) {
+	/* Daemon streams frames to standard output of this process until it closes the
+	 * subscription. Keep the socket open, the daemon drops the subscription when it closes. */
+	char c;
+	while (read(skt_fd, &c, 1) > 0) {
+	    continue;
+	}
+	exit(EXIT_SUCCESS);
+    }
+    FILE * frm_fl = fdopen(frm_pipe[0], "r");
+    if (frm_fl == NULL) {
+	fprintf(stderr, "%s could not configure pipe to read from daemon at socket %s. %s.\n",
+		cmd, path, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    print_frames(frm_fl, type, path, cmd);
+    close(skt_fd);
+    exit(EXIT_SUCCESS);
+}
+
+/* Read subscription frames from frm_fl and print rays as text, one line per ray, starting with
+ * sweep and ray index. Print a comment line when a sweep or the volume completes. Return when
+ * the daemon closes the stream. path and cmd are for error messages. */
+static void print_frames(FILE * frm_fl, const struct Sigmet_DataType * type, const char * path,
+	const char * cmd)
+{
+    const char * fmt = Sigmet_DataType_PrintFmt(type);
+    if (fmt == NULL) {
+	fprintf(stderr, "%s: could not obtain print format for data type %s.\n",
+		cmd, Sigmet_DataTypeAbbrv(type));
+	exit(EXIT_FAILURE);
+    }
+    float * dat = NULL;
+    int dat_len = 0;
+    struct SigmetRaw_SubFrame frm;
+    while (fread(&frm, sizeof frm, 1, frm_fl) == 1) {
+	switch (frm.kind) {
+	    case SigmetRawSubRay: {
+		int nb = frm.wray_hdr.ray_hdr.num_bins;
+		if (nb < 0) {
+		    fprintf(stderr, "%s: daemon at socket %s sent ray with %d bins.\n",
+			    cmd, path, nb);
+		    exit(EXIT_FAILURE);
+		}
+		if (nb > dat_len) {
+		    float * d = realloc(dat, nb * sizeof *dat);
+		    if (d == NULL) {
+			fprintf(stderr, "%s: could not allocate memory for ray of %d bins.\n",
+				cmd, nb);
+			exit(EXIT_FAILURE);
+		    }
+		    dat = d;
+		    dat_len = nb;
+		}
+		if (fread(dat, sizeof *dat, nb, frm_fl) != (size_t)nb) {
+		    fprintf(stderr, "%s: could not read ray data from daemon at socket %s.\n",
+			    cmd, path);
+		    exit(EXIT_FAILURE);
+		}
+		printf("%2d %4d ", frm.s, frm.r);
+		for (int b = 0; b < nb; b++) {
+		    printf(fmt, dat[b]);
+		}
+		printf("\n");
+		break;
+	    }
+	    case SigmetRawSubSwpDone:
+		printf("# sweep %d complete\n", frm.s);
+		break;
+	    case SigmetRawSubVolDone:
+		printf("# volume complete\n");
+		break;
+	    case SigmetRawSubLost:
+		fprintf(stderr, "%s: fell behind daemon at socket %s. Rays were dropped.\n",
+			cmd, path);
+		break;
+	}
+	fflush(stdout);
+    }
+    free(dat);
+}
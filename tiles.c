@@ -0,0 +1,208 @@
+/*
+ *	tiles.c --
+ *		Write a sweep from a volume as XYZ map tiles. See sigmet_raw (1).
+ *	--
+ *
+ *	Usage: tiles [-z zoom0:zoom1] [-r range] [-l start:step:count] [-t threads] [-m megabytes]
+ *		data_type sweep_index raw_product_file directory
+ *
+ *	Writes 256 by 256 pixel palette PNG tiles for zoom levels zoom0 to zoom1, default 6 to 10,
+ *	to directory/zoom/x/y.png, and removes tiles that no longer have data. Tiles extend range
+ *	meters from the radar, default the end of the last bin. Colors come from the color scale
+ *	definition in the product configuration unless -l gives count levels of width step from
+ *	start. -m limits memory for projection tables, default 256 megabytes.
+ *
+ *	Copyright (c) 2022, Gordon D. Carrie. All rights reserved.
+ *	Licensed under the Academic Free License version 3.0
+ *	See file AFL-3.0 or https://opensource.org/licenses/AFL-3.0.
+ *	Send feedback to dev1960@polarismail.net
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <libgen.h>
+#include "sigmet.h"
+#include "sigmet_raw.h"
+
+#define DFLT_Z0 6
+#define DFLT_Z1 10
+#define DFLT_LUT_MB 256
+
+int main(int argc, char *argv[])
+{
+    /* If set, use $APP_NAME in error messages instead of argv[0]. */
+    char *cmd = getenv("APP_NAME") ? getenv("APP_NAME") : basename(argv[0]);
+    struct Sigmet_ErrMsg err_msg = { .str = (char[SIGMET_ERR_LEN]){ '\0' }, .sz = SIGMET_ERR_LEN};
+    unsigned z0 = DFLT_Z0, z1 = DFLT_Z1;
+    float rng_max = NAN;
+    unsigned num_threads = 0;
+    size_t lut_mb = DFLT_LUT_MB;
+    struct SigmetRaw_PpiLevels lvls;
+    _Bool have_lvls = 0;
+    int a = 1;
+    while (a + 1 < argc && argv[a][0] == '-') {
+	char * opt = argv[a], * val = argv[a + 1];
+	float start, step;
+	unsigned count;
+	if (strcmp(opt, "-z") == 0) {
+	    if (sscanf(val, "%u:%u", &z0, &z1) != 2 || z0 > z1 || z1 > SIGMETRAW_TILES_MAX_ZOOM) {
+		fprintf(stderr, "%s: expected zoom0:zoom1 with 0 <= zoom0 <= zoom1 <= %d, "
+			"got %s\n", cmd, SIGMETRAW_TILES_MAX_ZOOM, val);
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(opt, "-r") == 0) {
+	    if (sscanf(val, "%f", &rng_max) != 1 || !(rng_max > 0.0f)) {
+		fprintf(stderr, "%s: expected positive number for range, got %s\n", cmd, val);
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(opt, "-l") == 0) {
+	    if (sscanf(val, "%f:%f:%u", &start, &step, &count) != 3
+		    || !(step > 0.0f) || count == 0 || count > SIGMETRAW_PPI_MAX_COLORS) {
+		fprintf(stderr, "%s: expected start:step:count for levels, with positive step "
+			"and 1 to %d levels, got %s\n", cmd, SIGMETRAW_PPI_MAX_COLORS, val);
+		exit(EXIT_FAILURE);
+	    }
+	    SigmetRaw_PpiLevelsFixed(start, step, count, &lvls);
+	    have_lvls = 1;
+	} else if (strcmp(opt, "-t") == 0) {
+	    if (sscanf(val, "%u", &num_threads) != 1) {
+		fprintf(stderr, "%s: expected integer for thread count, got %s\n", cmd, val);
+		exit(EXIT_FAILURE);
+	    }
+	} else if (strcmp(opt, "-m") == 0) {
+	    if (sscanf(val, "%zu", &lut_mb) != 1) {
+		fprintf(stderr, "%s: expected integer for megabytes, got %s\n", cmd, val);
+		exit(EXIT_FAILURE);
+	    }
+	} else {
+	    break;
+	}
+	a += 2;
+    }
+    if (argc - a != 4) {
+	fprintf(stderr, "Usage: %s [-z zoom0:zoom1] [-r range] [-l start:step:count] [-t threads] "
+		"[-m megabytes] data_type sweep_index raw_product_file directory\n", cmd);
+	exit(EXIT_FAILURE);
+    }
+    char * abbrv = argv[a];
+    char * s_s = argv[a + 1];
+    char * path = argv[a + 2];
+    char * dir = argv[a + 3];
+    const struct Sigmet_DataType * type = Sigmet_DataTypeGet(abbrv);
+    if (type == NULL) {
+	fprintf(stderr, "%s: %s is not a Sigmet data type.\n", cmd, abbrv);
+	exit(EXIT_FAILURE);
+    }
+    int s;
+    if (sscanf(s_s, "%d", &s) != 1) {
+	fprintf(stderr, "%s: expected integer for sweep index, got %s\n", cmd, s_s);
+	exit(EXIT_FAILURE);
+    }
+
+    /* Read volume */
+    FILE * vol_fl = fopen(path, "r");
+    if (vol_fl == NULL) {
+	fprintf(stderr, "%s: could not open file. %s\n", cmd, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    struct Sigmet_VolHdr vol_hdr;
+    memset(&vol_hdr, 0, sizeof vol_hdr);
+    if ( !Sigmet_VolReadVHdr(vol_fl, &vol_hdr, &err_msg) ) {
+	fclose(vol_fl);
+	fprintf(stderr, "%s: could not read volume headers from %s. %s\n", cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    int num_swps = Sigmet_VolNumSwps(&vol_hdr);
+    if (s < 0 || s >= num_swps) {
+	fprintf(stderr, "%s: sweep index %d out of range. Volume has %d sweeps.\n",
+		cmd, s, num_swps);
+	exit(EXIT_FAILURE);
+    }
+    int num_rays = Sigmet_VolNumRays(&vol_hdr);
+    int num_types = Sigmet_VolNumTypes(&vol_hdr);
+    int y = Sigmet_VolTypeIdx(type, &vol_hdr);
+    if (y == -1) {
+	fprintf(stderr, "%s: %s data type is not in volume at %s.\n", cmd, abbrv, path);
+	exit(EXIT_FAILURE);
+    }
+    struct Sigmet_Ray (*rays)[num_rays][num_types] = calloc(num_swps, sizeof *rays);
+    if (rays == NULL) {
+	fprintf(stderr, "%s could not allocate memory for array of  %d by %d ray structures "
+		"from raw product file %s\n", cmd, num_swps, num_rays, path);
+	exit(EXIT_FAILURE);
+    }
+    size_t dat_buf_sz = Sigmet_VolIDatSz(&vol_hdr, &err_msg);
+    if (dat_buf_sz == 0) {
+	fprintf(stderr, "%s: could not determine size of input data buffer. %s\n", cmd, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    void * dat_buf = malloc(dat_buf_sz);
+    if (dat_buf == NULL) {
+	fprintf(stderr, "%s: could not allocate memory for %zu bytes of data.\n", cmd, dat_buf_sz);
+	exit(EXIT_FAILURE);
+    }
+    int rd = Sigmet_VolReadDat(vol_fl, &vol_hdr, num_swps, num_rays, num_types, NULL,
+	    rays, dat_buf_sz, dat_buf, &err_msg);
+    fclose(vol_fl);
+    if (rd == 0) {
+	fprintf(stderr, "%s: volume at %s has no data. %s\n", cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+
+    /* Radar location, binary angles from 0 to 2 pi, and range geometry in centimeters */
+    double lat = Sigmet_Bin4Rad(vol_hdr.ingst_hdr.ingst_cfg.lat);
+    double lon = Sigmet_Bin4Rad(vol_hdr.ingst_hdr.ingst_cfg.lon);
+    lat -= (lat > M_PI) ? 2.0 * M_PI : 0.0;
+    lon -= (lon > M_PI) ? 2.0 * M_PI : 0.0;
+    const struct Sigmet_TaskRngInfo * rng_info = &vol_hdr.ingst_hdr.task_cfg.task_rng_info;
+    float rng0 = rng_info->rng_1st_bin * 0.01f;
+    float drng = rng_info->step_out * 0.01f;
+    int num_bins = Sigmet_VolNumBins(&vol_hdr);
+    if (isnan(rng_max)) {
+	rng_max = rng0 + num_bins * drng;
+    }
+    if ( !have_lvls && !SigmetRaw_PpiLevelsFmCsd(&vol_hdr.prod_hdr.prod_cfg.color_scale_def,
+		&lvls, &err_msg) ) {
+	fprintf(stderr, "%s: could not get color levels from %s, use -l. %s\n",
+		cmd, path, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+
+    struct Sigmet_RayHdr * ray_hdrs = calloc(num_rays, sizeof *ray_hdrs);
+    const float ** dat = calloc(num_rays, sizeof *dat);
+    float * vals = calloc((size_t)num_rays * num_bins, sizeof *vals);
+    if (ray_hdrs == NULL || dat == NULL || vals == NULL) {
+	fprintf(stderr, "%s: could not allocate memory for %d rays.\n", cmd, num_rays);
+	exit(EXIT_FAILURE);
+    }
+    float * v = vals;
+    for (int r = 0; r < num_rays; r++) {
+	struct Sigmet_Ray * ray = &rays[s][r][y];
+	int nb = ray->ray_hdr.num_bins;
+	ray_hdrs[r] = ray->ray_hdr;
+	dat[r] = NULL;
+	if (ray->dat == NULL || nb <= 0 || nb > num_bins) {
+	    continue;
+	}
+	Sigmet_DataTypeStorToVal(vol_hdr.types[y], nb, v, ray->dat, &vol_hdr);
+	dat[r] = v;
+	v += nb;
+    }
+    struct SigmetRaw_Tiles * tiles = SigmetRaw_TilesInit(lat, lon, rng0, drng, rng_max,
+	    num_threads, lut_mb << 20, &err_msg);
+    if (tiles == NULL) {
+	fprintf(stderr, "%s: could not create tile generator. %s\n", cmd, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    size_t num_written;
+    if ( !SigmetRaw_TilesWrite(tiles, &lvls, num_rays, ray_hdrs, dat, z0, z1, dir,
+		&num_written, &err_msg) ) {
+	fprintf(stderr, "%s: could not write tiles for sweep %d. %s\n", cmd, s, err_msg.str);
+	exit(EXIT_FAILURE);
+    }
+    SigmetRaw_TilesFree(tiles);
+    exit(EXIT_SUCCESS);
+}